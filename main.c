@@ -1,3 +1,41 @@
 //
 // Created by stve on 12/10/25.
-//
\ No newline at end of file
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_matrix.h"
+#include "mp_pool.h"
+
+
+/**
+ * Smoke run: fill a matrix spanning several chunks and read it back.
+ */
+int
+main(void) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix matx;
+    mp_matrix_init(&matx, &pool);
+
+    const uint64_t side = 3 * CHUNK_W + 7;
+    int32_t ret = mp_matrix_set_size(&matx, (mp_msize){side, side});
+
+    for (uint64_t y = 0; ret == 0 && y < side; y++)
+        for (uint64_t x = 0; x < side; x++)
+            if (mp_matrix_put(&matx, x, y, (int64_t) (x * side + y)) < 0) ret = -1;
+
+    uint64_t wrong = 0;
+    for (uint64_t y = 0; ret == 0 && y < side; y++)
+        for (uint64_t x = 0; x < side; x++)
+            wrong += mp_matrix_get(&matx, x, y) != (int64_t) (x * side + y);
+
+    printf("MatrixP: %lu x %lu, %lu chunks, %lu pages, %s\n", side, side,
+           matx.tree.count, (uint64_t) pool.size, ret < 0 || wrong ? "FAILED" : "ok");
+
+    mp_matrix_free(&matx);
+    mp_pool_free(&pool);
+    return ret < 0 || wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
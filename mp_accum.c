@@ -0,0 +1,151 @@
+#include "mp_accum.h"
+
+#include <stdlib.h>
+
+
+/* ============================================================================
+ *  Hot table
+ * ============================================================================
+ */
+
+/**
+ * Index slot of a chunk offset.
+ */
+static __inline__ uint32_t
+mp_accum_hash(const mp_copos opos, const uint32_t cap) {
+    return (uint32_t) ((opos.pos * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+/**
+ * Hot matrix chunk at opos, or NULL.
+ */
+static __inline__ mp_chunk *
+mp_accum_find(const mp_accum *acc, const mp_copos opos) {
+    if (!acc->nhot) return NULL;
+
+    uint32_t h = mp_accum_hash(opos, acc->chot);
+    for (; acc->hot[h]; h = (h + 1) & (acc->chot - 1))
+        if (acc->hot[h]->opos.pos == opos.pos) return acc->hot[h];
+    return NULL;
+}
+
+/**
+ * Double the hot table.
+ */
+static int32_t
+mp_accum_rehash(mp_accum *acc) {
+    const uint32_t cap = acc->chot << 1;
+    mp_chunk **hot = calloc(cap, sizeof(mp_chunk *));
+    if (!hot) return -1;
+
+    for (uint32_t i = 0; i < acc->chot; i++) {
+        mp_chunk *chunk = acc->hot[i];
+        if (!chunk) continue;
+
+        uint32_t h = mp_accum_hash(chunk->opos, cap);
+        while (hot[h]) h = (h + 1) & (cap - 1);
+        hot[h] = chunk;
+    }
+
+    free(acc->hot);
+    acc->hot = hot;
+    acc->chot = cap;
+    return 0;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Prepare accumulation into matx by the workers of sched.
+ */
+int32_t
+mp_accum_init(mp_accum *acc, mp_matrix *matx, mp_sched *sched) {
+    if (!acc || !matx || !sched) return -1;
+
+    acc->sched = sched;
+    acc->hot = calloc(ACCUM_HOT, sizeof(mp_chunk *));
+    acc->nhot = 0;
+    acc->chot = ACCUM_HOT;
+    if (!acc->hot) return -1;
+
+    if (mp_stage_init(&acc->stage, matx, sched->workers, MP_STAGE_ADD) < 0) {
+        free(acc->hot);
+        acc->hot = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Drop the pending deltas and release the context.
+ */
+void
+mp_accum_free(mp_accum *acc) {
+    if (!acc || !acc->hot) return;
+
+    mp_stage_free(&acc->stage);
+    free(acc->hot);
+    acc->hot = NULL;
+}
+
+/**
+ * Declare the chunk at opos hot for this round.
+ */
+int32_t
+mp_accum_hot(mp_accum *acc, const mp_copos opos) {
+    if (mp_accum_find(acc, opos)) return 0;
+
+    if ((acc->nhot + 1) * 2 > acc->chot && mp_accum_rehash(acc) < 0) return -1;
+
+    mp_chunk *chunk = mp_matrix_chunk_write(acc->stage.matx, opos);
+    if (!chunk) return -1;
+
+    uint32_t h = mp_accum_hash(opos, acc->chot);
+    while (acc->hot[h]) h = (h + 1) & (acc->chot - 1);
+    acc->hot[h] = chunk;
+    acc->nhot += 1;
+    return 0;
+}
+
+/**
+ * Add value to element (x, y) from worker.
+ */
+int32_t
+mp_accum_add(mp_accum *acc, const uint32_t worker, const uint64_t x, const uint64_t y,
+             const int64_t value) {
+    const mp_matrix *matx = acc->stage.matx;
+    if (x >= matx->size.x || y >= matx->size.y) return -1;
+
+    mp_copos opos;
+    opos.dim.x = (uint32_t) (x >> CHUNK_POW);
+    opos.dim.y = (uint32_t) (y >> CHUNK_POW);
+
+    const uint32_t idx = CHUNK_POS(x & (CHUNK_W - 1), y & (CHUNK_H - 1));
+
+    mp_chunk *chunk = mp_accum_find(acc, opos);
+    if (chunk) {
+        __atomic_fetch_add(&chunk->data[idx], value, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    chunk = mp_stage_take(&acc->stage, worker, opos);
+    if (!chunk) return -1;
+
+    chunk->data[idx] += value;
+    return 0;
+}
+
+/**
+ * Fold every delta into the matrix and clear the hot set.
+ */
+int32_t
+mp_accum_merge(mp_accum *acc) {
+    __builtin_memset(acc->hot, 0, acc->chot * sizeof(mp_chunk *));
+    acc->nhot = 0;
+
+    return mp_stage_merge_par(&acc->stage, acc->sched);
+}
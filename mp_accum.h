@@ -0,0 +1,132 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_accum.h
+ *  Description:  Parallel accumulation into a matrix.
+ *
+ *  Histogram-style assembly (many threads adding into the same entries
+ *  of Q) without a lock on the matrix. Each worker adds into private
+ *  delta chunks taken from the pool; the owner then folds the deltas
+ *  into the matrix with a parallel reduction tree:
+ *
+ *      worker w:  mp_accum_add(w, x, y, v) → delta chunk of w (mp_stage,
+ *                 MP_STAGE_ADD), or an atomic add into a hot chunk
+ *
+ *      owner:     mp_accum_merge() → deltas at the same offset summed
+ *                 pairwise over the workers, then into the matrix
+ *
+ *  A delta chunk per worker and offset costs memory and a merge step. A
+ *  few offsets everybody writes to (the diagonal, a dense band) can be
+ *  declared hot instead: the owner materializes them in the matrix up
+ *  front and workers add into them directly with __atomic_fetch_add.
+ *
+ *  Design goals:
+ *   - Nothing shared on the cold path but the batched pool refills
+ *   - Hot lookups read a table that does not change while workers run
+ *
+ *  Notes:
+ *   - The rules of mp_stage.h apply between mp_accum_init() and
+ *     mp_accum_merge(): worker ids are exclusive, nobody else touches
+ *     the matrix, its pool or its tree
+ *   - The hot set lasts for one round: mp_accum_merge() clears it
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_ACCUM_H
+#define QDEEP_MATRIXP_ACCUM_H
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+#include "mp_sched.h"
+#include "mp_stage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Initial capacity of the hot table (power of two) */
+#define ACCUM_HOT 16
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Accumulation context of a matrix.
+ */
+typedef struct mp_accum {
+    mp_stage stage;     /**< Per-worker delta chunks */
+    mp_sched *sched;    /**< Workers of the merge */
+
+    mp_chunk **hot;     /**< Hot matrix chunks (open addressing) */
+    uint32_t nhot;      /**< Used slots */
+    uint32_t chot;      /**< Slots (power of two) */
+} mp_accum;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Prepare accumulation into matx by the workers of sched.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+int32_t
+mp_accum_init(mp_accum *acc, mp_matrix *matx, mp_sched *sched);
+
+/**
+ * Drop the pending deltas and release the context.
+ */
+void
+mp_accum_free(mp_accum *acc);
+
+/**
+ * Declare the chunk at opos hot for this round (owner thread, before
+ * the workers start). It is created in the matrix if absent.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure or out of range offset
+ */
+int32_t
+mp_accum_hot(mp_accum *acc, mp_copos opos);
+
+/**
+ * Add value to element (x, y) from worker.
+ *
+ * @return  0 on success
+ * @return -1 on out of range position or allocation failure
+ */
+int32_t
+mp_accum_add(mp_accum *acc, uint32_t worker, uint64_t x, uint64_t y, int64_t value);
+
+/**
+ * Fold every delta into the matrix (owner thread, after the workers are
+ * done) and clear the hot set. The context can be used again.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure (the pending deltas are dropped)
+ */
+int32_t
+mp_accum_merge(mp_accum *acc);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_ACCUM_H */
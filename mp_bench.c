@@ -0,0 +1,610 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_bench.c
+ *  Description:  Microbenchmarks of the MatrixP layers.
+ *
+ *  Usage:
+ *      mp_bench [-f csv|json] [-n max_pow] [-d dir] [-m mib] [bench ...]
+ *
+ *  Benchmarks (all of them, or the ones named):
+ *      pool     mp_pool_get() / mp_pool_ret() of BENCH_POOL chunks
+ *      tree     chunk insert / lookup / drop at 10^3 .. 10^max_pow chunks
+ *      pipe     mp_chunk_send() → mp_chunk_recv() through a pipe
+ *      unix     the same through a Unix stream socket pair
+ *      splice   mp_matrix_send() of a flat matrix file to a socket
+ *               (payload moved by mp_splice_copy())
+ *
+ *  One row per measured operation goes to stdout, as CSV (default) or
+ *  as a JSON array, with the columns
+ *
+ *      bench, param, ops, ns, ns_op, ops_s, mb_s, p50_ns, p99_ns
+ *
+ *  ns_op and ops_s come from an untimed loop; p50 / p99 from a second
+ *  pass timing every operation, less the clock overhead (row "clock").
+ *  Operations that move data report mb_s; others report 0.
+ *
+ *  Notes:
+ *   - Tree benchmarks link payload-less descriptors, as a mapped file
+ *     does, so 10^7 chunks fit in memory
+ *   - The splice file is created in dir (default /tmp) and removed
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+#include "mp_pool.h"
+#include "mp_splice.h"
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Chunks taken per pool round */
+#define BENCH_POOL 4096
+
+/** Pool rounds (the first one, which maps the pages, is not counted) */
+#define BENCH_POOL_ROUNDS 64
+
+/** Chunks moved per stream benchmark */
+#define BENCH_STREAM 1024
+
+/** Clock calls of the overhead calibration */
+#define BENCH_CLOCK 100000
+
+
+/* ============================================================================
+ *  Timing
+ * ============================================================================
+ */
+
+/**
+ * One result row.
+ */
+typedef struct mp_bench_row {
+    const char *bench;
+    uint64_t param;     /**< Problem size (chunks, bytes, ...) */
+    uint64_t ops;
+    uint64_t ns;        /**< Total time of the untimed loop */
+    uint64_t bytes;     /**< Payload moved, 0 if none */
+    uint64_t p50;       /**< Per-operation latency percentiles */
+    uint64_t p99;
+} mp_bench_row;
+
+static uint64_t clock_ns;   /**< Cost of one mp_bench_now() */
+static uint8_t json;
+
+static uint64_t *samples;   /**< Per-operation latencies of one pass */
+static uint64_t nsamples;
+
+static __inline__ uint64_t
+mp_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Record the latency of an operation that started at t0.
+ */
+static __inline__ void
+mp_bench_sample(const uint64_t t0) {
+    const uint64_t ns = mp_bench_now() - t0;
+    samples[nsamples++] = ns > clock_ns ? ns - clock_ns : 0;
+}
+
+static int
+mp_bench_cmp(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Fill the percentiles of row from the recorded samples and reset them.
+ */
+static void
+mp_bench_percentiles(mp_bench_row *row) {
+    if (nsamples) {
+        qsort(samples, nsamples, sizeof(uint64_t), mp_bench_cmp);
+        row->p50 = samples[nsamples / 2];
+        row->p99 = samples[nsamples * 99 / 100];
+    }
+    nsamples = 0;
+}
+
+
+/* ============================================================================
+ *  Output
+ * ============================================================================
+ */
+
+static uint64_t nrows;
+
+static void
+mp_bench_emit(const mp_bench_row *row) {
+    const double ns_op = row->ops ? (double) row->ns / (double) row->ops : 0.0;
+    const double ops_s = row->ns ? (double) row->ops * 1e9 / (double) row->ns : 0.0;
+    const double mb_s = row->ns ? (double) row->bytes * 1e9 / (double) row->ns / 1048576.0 : 0.0;
+
+    if (json) {
+        printf("%s\n  {\"bench\": \"%s\", \"param\": %lu, \"ops\": %lu, \"ns\": %lu, "
+               "\"ns_op\": %.2f, \"ops_s\": %.0f, \"mb_s\": %.1f, \"p50_ns\": %lu, \"p99_ns\": %lu}",
+               nrows ? "," : "[", row->bench, row->param, row->ops, row->ns,
+               ns_op, ops_s, mb_s, row->p50, row->p99);
+    } else {
+        if (!nrows) printf("bench,param,ops,ns,ns_op,ops_s,mb_s,p50_ns,p99_ns\n");
+        printf("%s,%lu,%lu,%lu,%.2f,%.0f,%.1f,%lu,%lu\n", row->bench, row->param, row->ops,
+               row->ns, ns_op, ops_s, mb_s, row->p50, row->p99);
+    }
+    nrows += 1;
+    fflush(stdout);
+}
+
+/**
+ * Measure the clock overhead subtracted from every sample.
+ */
+static void
+mp_bench_clock(void) {
+    uint64_t min = UINT64_MAX;
+    const uint64_t t0 = mp_bench_now();
+
+    for (uint32_t i = 0; i < BENCH_CLOCK; i++) {
+        const uint64_t a = mp_bench_now();
+        const uint64_t b = mp_bench_now();
+        if (b - a < min) min = b - a;
+    }
+
+    const uint64_t ns = mp_bench_now() - t0;
+    clock_ns = min;
+    mp_bench_emit(&(mp_bench_row){"clock", 0, 2 * BENCH_CLOCK, ns, 0, min, min});
+}
+
+
+/* ============================================================================
+ *  Pool
+ * ============================================================================
+ */
+
+static int32_t
+mp_bench_pool(void) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_chunk **chunks = malloc(BENCH_POOL * sizeof(mp_chunk *));
+    if (!chunks) return -1;
+
+    mp_bench_row get = {.bench = "pool_get", .param = BENCH_POOL};
+    mp_bench_row ret = {.bench = "pool_ret", .param = BENCH_POOL};
+
+    for (uint32_t round = 0; round <= BENCH_POOL_ROUNDS; round++) {
+        uint64_t t0 = mp_bench_now();
+        for (uint32_t i = 0; i < BENCH_POOL; i++) chunks[i] = mp_pool_get(&pool);
+        uint64_t t1 = mp_bench_now();
+        for (uint32_t i = 0; i < BENCH_POOL; i++) mp_pool_ret(&pool, chunks[i]);
+        uint64_t t2 = mp_bench_now();
+
+        if (round == 0) continue;
+        get.ns += t1 - t0;
+        ret.ns += t2 - t1;
+        get.ops += BENCH_POOL;
+        ret.ops += BENCH_POOL;
+    }
+
+    for (uint32_t i = 0; i < BENCH_POOL; i++) {
+        const uint64_t t0 = mp_bench_now();
+        chunks[i] = mp_pool_get(&pool);
+        mp_bench_sample(t0);
+    }
+    mp_bench_percentiles(&get);
+
+    for (uint32_t i = 0; i < BENCH_POOL; i++) {
+        const uint64_t t0 = mp_bench_now();
+        mp_pool_ret(&pool, chunks[i]);
+        mp_bench_sample(t0);
+    }
+    mp_bench_percentiles(&ret);
+
+    mp_bench_emit(&get);
+    mp_bench_emit(&ret);
+
+    free(chunks);
+    mp_pool_free(&pool);
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Tree
+ * ============================================================================
+ */
+
+/**
+ * Offset of the i-th key: a 4096-wide grid, walked in a random order.
+ */
+static __inline__ mp_copos
+mp_bench_key(const uint64_t *order, const uint64_t i) {
+    mp_copos opos;
+    opos.dim.x = (uint32_t) (order[i] & 4095);
+    opos.dim.y = (uint32_t) (order[i] >> 12);
+    return opos;
+}
+
+/**
+ * Insert, look up and drop n descriptors; timed == 1 samples every
+ * operation instead of accumulating the totals.
+ */
+static void
+mp_bench_tree_pass(mp_matrix *matx, const uint64_t *order, const uint64_t n, const uint8_t timed,
+                   mp_bench_row rows[3]) {
+    mp_cursor cur;
+    mp_cursor_init(&cur);
+    uint64_t miss = 0;
+
+    uint64_t t0 = mp_bench_now();
+    for (uint64_t i = 0; i < n; i++) {
+        mp_chunk *chunk = &matx->maps[i];
+        chunk->opos = mp_bench_key(order, i);
+
+        const uint64_t t = timed ? mp_bench_now() : 0;
+        mp_matrix_chunk_insert(matx, chunk);
+        if (timed) mp_bench_sample(t);
+    }
+    uint64_t t1 = mp_bench_now();
+    if (timed) mp_bench_percentiles(&rows[0]);
+    else rows[0].ns = t1 - t0;
+
+    /* look up in a different order than inserted */
+    t0 = mp_bench_now();
+    for (uint64_t i = 0; i < n; i++) {
+        const mp_copos opos = mp_bench_key(order, n - 1 - i);
+
+        const uint64_t t = timed ? mp_bench_now() : 0;
+        miss += mp_matrix_chunk_lookup(matx, &cur, opos) == NULL;
+        if (timed) mp_bench_sample(t);
+    }
+    t1 = mp_bench_now();
+    if (timed) mp_bench_percentiles(&rows[1]);
+    else rows[1].ns = t1 - t0;
+
+    t0 = mp_bench_now();
+    for (uint64_t i = 0; i < n; i++) {
+        const mp_copos opos = mp_bench_key(order, (i * 7 + 3) % n);
+
+        const uint64_t t = timed ? mp_bench_now() : 0;
+        mp_matrix_chunk_drop(matx, opos);
+        if (timed) mp_bench_sample(t);
+    }
+    t1 = mp_bench_now();
+    if (timed) mp_bench_percentiles(&rows[2]);
+    else rows[2].ns = t1 - t0;
+
+    if (miss || matx->tree.count) fprintf(stderr, "mp_bench: tree lost %lu chunks\n", miss);
+}
+
+static int32_t
+mp_bench_tree(const uint32_t max_pow) {
+    uint64_t n_max = 1;
+    for (uint32_t p = 0; p < max_pow; p++) n_max *= 10;
+
+    uint64_t *order = malloc(n_max * sizeof(uint64_t));
+    uint64_t *keep = samples;
+    samples = malloc(n_max * sizeof(uint64_t));
+    if (!order || !samples) {
+        free(order);
+        free(samples);
+        samples = keep;
+        return -1;
+    }
+
+    for (uint64_t n = 1000; n <= n_max; n *= 10) {
+        /* distinct keys in a random order (xorshift-driven shuffle) */
+        uint64_t r = 0x9E3779B97F4A7C15ull ^ n;
+        for (uint64_t i = 0; i < n; i++) order[i] = i;
+        for (uint64_t i = n - 1; i > 0; i--) {
+            r ^= r << 13;
+            r ^= r >> 7;
+            r ^= r << 17;
+            const uint64_t j = r % (i + 1);
+            const uint64_t t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+
+        mp_matrix matx;
+        mp_matrix_init(&matx, NULL);
+        matx.maps = calloc(n, sizeof(mp_chunk));
+        if (!matx.maps) break;
+        matx.nmaps = n;
+        matx.flags |= MP_MATRIX_MAPPED;
+
+        mp_bench_row rows[3] = {
+            {.bench = "tree_insert", .param = n, .ops = n},
+            {.bench = "tree_lookup", .param = n, .ops = n},
+            {.bench = "tree_drop", .param = n, .ops = n},
+        };
+        mp_bench_tree_pass(&matx, order, n, 0, rows);
+        mp_bench_tree_pass(&matx, order, n, 1, rows);
+        for (uint32_t i = 0; i < 3; i++) mp_bench_emit(&rows[i]);
+
+        mp_matrix_free(&matx);
+    }
+
+    free(order);
+    free(samples);
+    samples = keep;
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Streams
+ * ============================================================================
+ */
+
+typedef struct mp_bench_writer {
+    int32_t fd;
+    const mp_chunk *chunk;
+    uint64_t count;
+} mp_bench_writer;
+
+static void *
+mp_bench_send(void *arg) {
+    const mp_bench_writer *w = arg;
+    for (uint64_t i = 0; i < w->count; i++)
+        if (mp_chunk_send(w->chunk, w->fd) < 0) break;
+    return NULL;
+}
+
+/**
+ * Chunk send → recv through a connected descriptor pair.
+ */
+static int32_t
+mp_bench_stream(const char *bench, const int32_t fds[2]) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_chunk *src = mp_pool_get(&pool);
+    mp_chunk *dst = mp_pool_get(&pool);
+    if (!src || !dst) return -1;
+
+    const mp_csize full = {.dim = {CHUNK_W - 1, CHUNK_H - 1}};
+    mp_chunk_set_size(src, full);
+    mp_chunk_set_size(dst, full);
+    for (uint32_t i = 0; i < CHUNK_SIZE; i++) src->data[i] = i;
+
+    mp_bench_row row = {.bench = bench, .param = CHUNK_BYTES};
+    mp_bench_writer w = {fds[1], src, 2 * BENCH_STREAM};
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, mp_bench_send, &w) != 0) return -1;
+
+    const uint64_t t0 = mp_bench_now();
+    for (uint64_t i = 0; i < BENCH_STREAM; i++) {
+        if (mp_chunk_recv(dst, fds[0]) < 0) break;
+        row.ops += 1;
+    }
+    row.ns = mp_bench_now() - t0;
+    row.bytes = row.ops * CHUNK_BYTES;
+
+    for (uint64_t i = 0; i < BENCH_STREAM; i++) {
+        const uint64_t t = mp_bench_now();
+        if (mp_chunk_recv(dst, fds[0]) < 0) break;
+        mp_bench_sample(t);
+    }
+    mp_bench_percentiles(&row);
+
+    pthread_join(thread, NULL);
+    mp_bench_emit(&row);
+
+    if (dst->data[CHUNK_SIZE - 1] != CHUNK_SIZE - 1) fprintf(stderr, "mp_bench: %s corrupted\n", bench);
+
+    mp_pool_free(&pool);
+    return 0;
+}
+
+static int32_t
+mp_bench_pipe(void) {
+    int32_t fds[2];
+    if (pipe(fds) < 0) return -1;
+
+    const int32_t ret = mp_bench_stream("chunk_pipe", fds);
+    close(fds[0]);
+    close(fds[1]);
+    return ret;
+}
+
+static int32_t
+mp_bench_unix(void) {
+    int32_t fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) return -1;
+
+    const int32_t ret = mp_bench_stream("chunk_unix", fds);
+    close(fds[0]);
+    close(fds[1]);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Splice
+ * ============================================================================
+ */
+
+typedef struct mp_bench_drain {
+    int32_t fd;
+    uint64_t bytes;
+} mp_bench_drain;
+
+static void *
+mp_bench_read(void *arg) {
+    mp_bench_drain *d = arg;
+    uint8_t *buf = malloc(1u << 20);
+    if (!buf) return NULL;
+
+    for (int64_t ret; (ret = read(d->fd, buf, 1u << 20)) > 0;) d->bytes += (uint64_t) ret;
+    free(buf);
+    return NULL;
+}
+
+/**
+ * mp_matrix_send() of an mib MiB flat file into a Unix socket.
+ */
+static int32_t
+mp_bench_splice(const char *dir, const uint32_t mib) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/mp_bench.%d.mp", dir, getpid());
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix matx;
+    mp_matrix_init(&matx, &pool);
+    if (mp_matrix_set_file(&matx, path) < 0) return -1;
+    unlink(path);
+
+    /* square int64 matrix of about mib MiB, written so it is not a hole */
+    uint64_t side = 1;
+    while ((side + 1) * (side + 1) * sizeof(int64_t) <= (uint64_t) mib << 20) side++;
+    const uint64_t bytes = side * side * sizeof(int64_t);
+
+    int32_t ret = mp_matrix_set_size(&matx, (mp_msize){side, side});
+    uint8_t *buf = ret < 0 ? NULL : calloc(1, 1u << 20);
+    for (uint64_t off = 0; buf && off < bytes; off += 1u << 20) {
+        const uint64_t len = bytes - off < (1u << 20) ? bytes - off : 1u << 20;
+        if (pwrite(matx.fd, buf, len, (off_t) (sizeof(mp_msize) + off)) != (int64_t) len) ret = -1;
+    }
+    free(buf);
+
+    mp_bench_row row = {.bench = "splice_send", .param = bytes};
+    for (uint32_t rep = 0; ret == 0 && rep < 2; rep++) {
+        int32_t fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            ret = -1;
+            break;
+        }
+
+        mp_bench_drain drain = {fds[0], 0};
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, mp_bench_read, &drain) != 0) {
+            close(fds[0]);
+            close(fds[1]);
+            ret = -1;
+            break;
+        }
+
+        /* rep 0 warms the page cache */
+        const uint64_t t0 = mp_bench_now();
+        ret = mp_matrix_send(&matx, fds[1]);
+        const uint64_t ns = mp_bench_now() - t0;
+
+        shutdown(fds[1], SHUT_WR);
+        pthread_join(thread, NULL);
+        close(fds[0]);
+        close(fds[1]);
+
+        if (rep == 1) {
+            row.ops = 1;
+            row.ns = ns;
+            row.bytes = drain.bytes;
+            row.p50 = row.p99 = ns;
+        }
+    }
+
+    close(matx.fd);
+    matx.fd = -1;
+    mp_matrix_free(&matx);
+    mp_pool_free(&pool);
+
+    if (ret == 0) mp_bench_emit(&row);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Main
+ * ============================================================================
+ */
+
+static const char *const benches[] = {"pool", "tree", "pipe", "unix", "splice"};
+
+/**
+ * Whether bench was selected on the command line (all if none was).
+ */
+static int32_t
+mp_bench_selected(const char *bench, char **names, const int32_t nnames) {
+    if (!nnames) return 1;
+    for (int32_t i = 0; i < nnames; i++)
+        if (strcmp(names[i], bench) == 0) return 1;
+    return 0;
+}
+
+int
+main(const int argc, char **argv) {
+    uint32_t max_pow = 6;
+    uint32_t mib = 64;
+    const char *dir = "/tmp";
+    int32_t first = argc;
+
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) json = strcmp(argv[++i], "json") == 0;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) max_pow = (uint32_t) atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) dir = argv[++i];
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) mib = (uint32_t) atoi(argv[++i]);
+        else if (argv[i][0] != '-') {
+            first = i;
+            break;
+        } else {
+            fprintf(stderr, "usage: %s [-f csv|json] [-n max_pow] [-d dir] [-m mib] "
+                            "[pool|tree|pipe|unix|splice ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (max_pow < 3) max_pow = 3;
+    if (max_pow > 8) max_pow = 8;
+    if (!mib) mib = 1;
+
+    char **names = argv + first;
+    const int32_t nnames = argc - first;
+    for (int32_t i = 0; i < nnames; i++) {
+        uint32_t known = 0;
+        for (uint32_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) known |= strcmp(names[i], benches[b]) == 0;
+        if (!known) {
+            fprintf(stderr, "mp_bench: unknown benchmark %s\n", names[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    samples = malloc((BENCH_POOL > BENCH_STREAM ? BENCH_POOL : BENCH_STREAM) * sizeof(uint64_t));
+    if (!samples) return EXIT_FAILURE;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int32_t failed = 0;
+    mp_bench_clock();
+
+    if (mp_bench_selected("pool", names, nnames) && mp_bench_pool() < 0) failed |= 1;
+    if (mp_bench_selected("tree", names, nnames) && mp_bench_tree(max_pow) < 0) failed |= 2;
+    if (mp_bench_selected("pipe", names, nnames) && mp_bench_pipe() < 0) failed |= 4;
+    if (mp_bench_selected("unix", names, nnames) && mp_bench_unix() < 0) failed |= 8;
+    if (mp_bench_selected("splice", names, nnames) && mp_bench_splice(dir, mib) < 0) failed |= 16;
+
+    if (json) printf("\n]\n");
+    if (failed) fprintf(stderr, "mp_bench: some benchmarks failed (mask %d)\n", failed);
+
+    free(samples);
+    mp_splice_cleanup();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
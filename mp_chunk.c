@@ -1,4 +1,7 @@
 #include "mp_chunk.h"
+#include "mp_perf.h"
+#include "mp_hist.h"
+#include "mp_stats.h"
 
 
 /**
@@ -12,12 +15,16 @@
 int32_t
 mp_chunk_recv(const mp_chunk *chunk, const int32_t fd) {
     uint8_t *ptr = (uint8_t *) chunk->data;
+    int32_t status = 0;
+
+    MP_PERF_BEGIN(MP_PERF_XFER);
+    MP_HIST_BEGIN(start);
 
     const uint16_t size_x = chunk->size.dim.x + 1;
     const uint16_t size_y = chunk->size.dim.y + 1;
     constexpr uint64_t size_d = sizeof(int64_t);
 
-    for (uint16_t _y = 0; _y <= size_y; _y++) {
+    for (uint16_t _y = 0; _y < size_y; _y++) {
         uint64_t rem = size_x * size_d;
 
         while (rem > 0) {
@@ -26,9 +33,11 @@ mp_chunk_recv(const mp_chunk *chunk, const int32_t fd) {
             /* Expected: positive bytes read. ret <= 0 is unlikely. */
             if (__builtin_expect(ret <= 0, 0)) {
                 if (errno == EINTR) continue; /* retry on interrupt */
-                return -1; /* EOF or real error */
+                status = -1; /* EOF or real error */
+                goto end;
             }
 
+            mp_stats_io(MP_STATS_RECV, (uint64_t) ret);
             ptr += ret;
             rem -= (uint64_t) ret;
         }
@@ -37,7 +46,10 @@ mp_chunk_recv(const mp_chunk *chunk, const int32_t fd) {
         ptr += (CHUNK_W - size_x) * size_d;
     }
 
-    return 0;
+end:
+    MP_HIST_END(start, MP_HIST_CHUNK_RECV);
+    MP_PERF_END(MP_PERF_XFER);
+    return status;
 }
 
 
@@ -52,12 +64,16 @@ mp_chunk_recv(const mp_chunk *chunk, const int32_t fd) {
 int32_t
 mp_chunk_send(const mp_chunk *chunk, const int32_t fd) {
     const uint8_t *ptr = (const uint8_t *) chunk->data;
+    int32_t status = 0;
+
+    MP_PERF_BEGIN(MP_PERF_XFER);
+    MP_HIST_BEGIN(start);
 
     const uint16_t size_x = chunk->size.dim.x + 1;
     const uint16_t size_y = chunk->size.dim.y + 1;
     constexpr uint64_t size_d = sizeof(int64_t);
 
-    for (uint16_t _y = 0; _y <= size_y; _y++) {
+    for (uint16_t _y = 0; _y < size_y; _y++) {
         uint64_t rem = size_x * size_d;
 
         while (rem > 0) {
@@ -66,9 +82,11 @@ mp_chunk_send(const mp_chunk *chunk, const int32_t fd) {
             /* Expected: positive bytes read. ret <= 0 is unlikely. */
             if (__builtin_expect(ret <= 0, 0)) {
                 if (errno == EINTR) continue; /* retry on interrupt */
-                return -1; /* EOF or real error */
+                status = -1; /* EOF or real error */
+                goto end;
             }
 
+            mp_stats_io(MP_STATS_SENT, (uint64_t) ret);
             ptr += ret;
             rem -= (uint64_t) ret;
         }
@@ -77,5 +95,8 @@ mp_chunk_send(const mp_chunk *chunk, const int32_t fd) {
         ptr += (CHUNK_W - size_x) * size_d;
     }
 
-    return 0;
+end:
+    MP_HIST_END(start, MP_HIST_CHUNK_SEND);
+    MP_PERF_END(MP_PERF_XFER);
+    return status;
 }
\ No newline at end of file
@@ -224,13 +224,16 @@ typedef struct mp_chunk {
 
     struct mp_chunk *sides[2]; /**< sides[0] = left, sides[1] = right */
     uint8_t color; /**< RB-tree node color */
+    uint8_t heat;  /**< Access counter, aged by mp_cold_sweep() */
 
     /* --------------------------------------------------------------------
      * Chunk payload
      * ------------------------------------------------------------------ */
 
+    uint32_t gen;  /**< Write generation of the last modification */
     mp_cdata data; /**< Pointer to chunk data buffer */
     mp_csize size; /**< Effective chunk dimensions */
+    uint32_t epoch; /**< Last snapshot epoch this chunk was saved for */
     mp_copos opos; /**< Global chunk offset */
 } mp_chunk;
 
@@ -244,6 +247,9 @@ mp_chunk_init(mp_chunk *chunk) {
     chunk->data = NULL; /* no attached memory yet */
     chunk->size.size = 0; /* chunk data size (bytes/elements) */
     chunk->opos.pos = 0; /* logical offset of this chunk */
+    chunk->epoch = 0; /* never part of a snapshot */
+    chunk->gen = 0; /* clean */
+    chunk->heat = 0; /* never accessed */
 }
 
 /**
@@ -254,6 +260,28 @@ mp_chunk_set_size(mp_chunk *chunk, const mp_csize size) {
     chunk->size = size;
 }
 
+/**
+ * Change chunk size from `from` to `to`, clearing the rows / columns
+ * the new size exposes.
+ *
+ * The buffer keeps whatever was there before (pool reuse, an earlier
+ * larger size): without clearing, a grown chunk would read it back.
+ */
+static __inline__ void
+mp_chunk_regrow(mp_chunk *chunk, const mp_csize from, const mp_csize to) {
+    const uint32_t fx = from.dim.x + 1u, fy = from.dim.y + 1u;
+    const uint32_t tx = to.dim.x + 1u, ty = to.dim.y + 1u;
+
+    if (tx > fx)
+        for (uint32_t y = 0; y < (fy < ty ? fy : ty); y++)
+            __builtin_memset(chunk->data + CHUNK_POS(fx, y), 0, (tx - fx) * sizeof(int64_t));
+
+    for (uint32_t y = fy; y < ty; y++)
+        __builtin_memset(chunk->data + CHUNK_POS(0, y), 0, tx * sizeof(int64_t));
+
+    mp_chunk_set_size(chunk, to);
+}
+
 /**
  * Read an entire chunk from file descriptor into chunk->data.
  * Chunks size must be set before this function
@@ -262,7 +290,7 @@ mp_chunk_set_size(mp_chunk *chunk, const mp_csize size) {
  *   0  on success
  *  -1  on EOF or unrecoverable error
  */
-static __inline__ int32_t
+int32_t
 mp_chunk_recv(const mp_chunk *chunk, int32_t fd);
 
 
@@ -274,7 +302,7 @@ mp_chunk_recv(const mp_chunk *chunk, int32_t fd);
  *   0  on success
  *  -1  on error
  */
-static __inline__ int32_t
+int32_t
 mp_chunk_send(const mp_chunk *chunk, int32_t fd);
 
 
@@ -0,0 +1,217 @@
+#include "mp_codec.h"
+
+
+/* ============================================================================
+ *  Bit packing
+ * ============================================================================
+ */
+
+/**
+ * Bits needed for an unsigned value (0 for 0).
+ */
+static __inline__ uint32_t
+mp_codec_width(const uint64_t v) {
+    return v ? 64u - (uint32_t) __builtin_clzll(v) : 0;
+}
+
+/**
+ * Zigzag: small magnitudes of either sign become small unsigned values.
+ */
+static __inline__ uint64_t
+mp_codec_zigzag(const int64_t v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static __inline__ int64_t
+mp_codec_unzigzag(const uint64_t v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/**
+ * Pack n values of w bits (1..64) into out.
+ *
+ * Returns:
+ *   Bytes written
+ */
+static uint64_t
+mp_codec_pack(uint8_t *out, const uint64_t *val, const uint32_t n, const uint32_t w) {
+    uint8_t *const start = out;
+    uint64_t acc = 0;
+    uint32_t bits = 0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const uint64_t v = val[i];
+        acc |= v << bits;
+        bits += w;
+
+        if (bits >= 64) {
+            __builtin_memcpy(out, &acc, 8);
+            out += 8;
+            bits -= 64;
+            acc = bits ? v >> (w - bits) : 0;
+        }
+    }
+
+    for (; bits > 0; bits = bits > 8 ? bits - 8 : 0, acc >>= 8) *out++ = (uint8_t) acc;
+    return (uint64_t) (out - start);
+}
+
+/**
+ * Load up to 8 bytes little-endian, bounded by end.
+ */
+static __inline__ uint64_t
+mp_codec_load(const uint8_t *p, const uint8_t *end) {
+    uint64_t v = 0;
+    if (__builtin_expect(p + 8 <= end, 1)) __builtin_memcpy(&v, p, 8);
+    else if (p < end) __builtin_memcpy(&v, p, (uint64_t) (end - p));
+    return v;
+}
+
+/**
+ * Unpack n values of w bits (1..64) from in; in + bytes must not pass end.
+ */
+static void
+mp_codec_unpack(uint64_t *val, const uint8_t *in, const uint8_t *end,
+                const uint32_t n, const uint32_t w) {
+    const uint64_t mask = w == 64 ? ~0ull : (1ull << w) - 1;
+    uint64_t pos = 0;
+    uint32_t i = 0;
+
+    if (w <= 56) {
+        /* fast path: every value is inside one 8-byte window */
+        for (; i < n && in + (pos >> 3) + 8 <= end; i++, pos += w) {
+            uint64_t v;
+            __builtin_memcpy(&v, in + (pos >> 3), 8);
+            val[i] = (v >> (pos & 7)) & mask;
+        }
+    }
+
+    for (; i < n; i++, pos += w) {
+        const uint8_t *p = in + (pos >> 3);
+        const uint32_t sh = pos & 7;
+        uint64_t v = mp_codec_load(p, end) >> sh;
+        if (sh + w > 64) v |= mp_codec_load(p + 8, end) << (64 - sh);
+        val[i] = v & mask;
+    }
+}
+
+
+/* ============================================================================
+ *  Rows
+ * ============================================================================
+ */
+
+/**
+ * Encode one row of n values.
+ */
+static uint64_t
+mp_codec_encode_row(uint8_t *out, const int64_t *row, const uint32_t n) {
+    uint64_t tmp[CHUNK_W];
+
+    int64_t lo = row[0], hi = row[0];
+    uint64_t zz = 0;
+    for (uint32_t i = 1; i < n; i++) {
+        lo = row[i] < lo ? row[i] : lo;
+        hi = row[i] > hi ? row[i] : hi;
+        zz |= mp_codec_zigzag((int64_t) ((uint64_t) row[i] - (uint64_t) row[i - 1]));
+    }
+
+    const uint32_t wf = mp_codec_width((uint64_t) hi - (uint64_t) lo);
+    const uint32_t wd = mp_codec_width(zz);
+    const uint8_t delta = wd < wf;
+    const uint32_t w = delta ? wd : wf;
+
+    out[0] = (uint8_t) (w | (delta ? CODEC_DELTA : 0));
+    __builtin_memcpy(out + 1, delta ? &row[0] : &lo, 8);
+    if (w == 0) return CODEC_HEAD;
+
+    if (delta) {
+        for (uint32_t i = 1; i < n; i++)
+            tmp[i - 1] = mp_codec_zigzag((int64_t) ((uint64_t) row[i] - (uint64_t) row[i - 1]));
+        return CODEC_HEAD + mp_codec_pack(out + CODEC_HEAD, tmp, n - 1, w);
+    }
+
+    for (uint32_t i = 0; i < n; i++) tmp[i] = (uint64_t) row[i] - (uint64_t) lo;
+    return CODEC_HEAD + mp_codec_pack(out + CODEC_HEAD, tmp, n, w);
+}
+
+/**
+ * Decode one row of n values.
+ *
+ * Returns:
+ *   Bytes consumed, or 0 on malformed / truncated input
+ */
+static uint64_t
+mp_codec_decode_row(int64_t *row, const uint8_t *in, const uint8_t *end, const uint32_t n) {
+    if (end - in < CODEC_HEAD) return 0;
+
+    const uint8_t delta = in[0] & CODEC_DELTA;
+    const uint32_t w = in[0] & ~CODEC_DELTA;
+    if (w > 64) return 0;
+
+    int64_t ref;
+    __builtin_memcpy(&ref, in + 1, 8);
+
+    const uint32_t count = delta ? n - 1 : n;
+    const uint64_t bytes = ((uint64_t) count * w + 7) >> 3;
+    if ((uint64_t) (end - in) - CODEC_HEAD < bytes) return 0;
+
+    if (w == 0) {
+        for (uint32_t i = 0; i < n; i++) row[i] = ref;
+        return CODEC_HEAD;
+    }
+
+    uint64_t *val = (uint64_t *) row + (delta ? 1 : 0);
+    const uint8_t *data = in + CODEC_HEAD;
+    mp_codec_unpack(val, data, data + bytes, count, w);
+
+    if (delta) {
+        uint64_t acc = (uint64_t) ref;
+        row[0] = ref;
+        for (uint32_t i = 1; i < n; i++) {
+            acc += (uint64_t) mp_codec_unzigzag(val[i - 1]);
+            row[i] = (int64_t) acc;
+        }
+    } else {
+        for (uint32_t i = 0; i < n; i++) row[i] = (int64_t) (val[i] + (uint64_t) ref);
+    }
+
+    return CODEC_HEAD + bytes;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Encode the effective rows of chunk into out.
+ */
+uint64_t
+mp_codec_encode(const mp_chunk *chunk, uint8_t *out) {
+    const uint32_t w = chunk->size.dim.x + 1u;
+    const uint32_t h = chunk->size.dim.y + 1u;
+    uint64_t len = 0;
+
+    for (uint32_t y = 0; y < h; y++)
+        len += mp_codec_encode_row(out + len, chunk->data + CHUNK_POS(0, y), w);
+    return len;
+}
+
+/**
+ * Decode len bytes into the effective rows of chunk.
+ */
+int32_t
+mp_codec_decode(const mp_chunk *chunk, const uint8_t *in, const uint64_t len) {
+    const uint32_t w = chunk->size.dim.x + 1u;
+    const uint32_t h = chunk->size.dim.y + 1u;
+    const uint8_t *const end = in + len;
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint64_t used = mp_codec_decode_row(chunk->data + CHUNK_POS(0, y), in, end, w);
+        if (!used) return -1;
+        in += used;
+    }
+    return in == end ? 0 : -1;
+}
@@ -0,0 +1,324 @@
+#include "mp_cold.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "mp_codec.h"
+
+
+/* ============================================================================
+ *  Compressor thread
+ * ============================================================================
+ */
+
+/**
+ * Encode one candidate.
+ *
+ * Returns:
+ *   Placeholder with the encoded payload, or NULL if the chunk does not
+ *   shrink by COLD_GAIN (or on allocation failure)
+ */
+static mp_cold_chunk *
+mp_cold_encode(const mp_cold *cold, const uint32_t i) {
+    mp_chunk view;
+    view.data = cold->data[i];
+    view.size = cold->size[i];
+
+    const uint64_t len = mp_codec_encode(&view, cold->buf);
+    if (len * COLD_GAIN > mp_csize_real(view.size) * sizeof(int64_t)) return NULL;
+
+    mp_cold_chunk *blob = malloc(sizeof(mp_cold_chunk) + len);
+    if (!blob) return NULL;
+
+    blob->csize = view.size;
+    blob->len = (uint32_t) len;
+    __builtin_memcpy(blob->blob, cold->buf, len);
+    return blob;
+}
+
+/**
+ * Encode every batch handed over by mp_cold_sweep().
+ */
+static void *
+mp_cold_compressor(void *arg) {
+    mp_cold *cold = arg;
+
+    pthread_mutex_lock(&cold->lock);
+    while (1) {
+        while (cold->state != COLD_ENCODING && !cold->stop) pthread_cond_wait(&cold->cond, &cold->lock);
+        if (cold->state != COLD_ENCODING) break;
+        pthread_mutex_unlock(&cold->lock);
+
+        for (uint32_t i = 0; i < cold->n; i++) cold->blob[i] = mp_cold_encode(cold, i);
+
+        pthread_mutex_lock(&cold->lock);
+        cold->state = COLD_READY;
+        pthread_cond_broadcast(&cold->cond);
+    }
+    pthread_mutex_unlock(&cold->lock);
+    return NULL;
+}
+
+/**
+ * Wait until the compressor does not own the batch.
+ *
+ * Returns:
+ *   COLD_IDLE or COLD_READY
+ */
+static uint8_t
+mp_cold_settle(mp_cold *cold) {
+    pthread_mutex_lock(&cold->lock);
+    while (cold->state == COLD_ENCODING) pthread_cond_wait(&cold->cond, &cold->lock);
+    const uint8_t state = cold->state;
+    pthread_mutex_unlock(&cold->lock);
+    return state;
+}
+
+
+/* ============================================================================
+ *  Owner side
+ * ============================================================================
+ */
+
+/**
+ * Swap the encoded candidates of a ready batch into the tree.
+ *
+ * A candidate is frozen only if it is still the chunk at its offset,
+ * with the same size, and was not accessed since it was picked (every
+ * lookup and touch bumps heat).
+ */
+static uint64_t
+mp_cold_collect(mp_cold *cold) {
+    mp_matrix *matx = cold->matx;
+    uint64_t frozen = 0;
+
+    for (uint32_t i = 0; i < cold->n; i++) {
+        mp_chunk *chunk = cold->cand[i];
+        mp_cold_chunk *blob = cold->blob[i];
+
+        const uint8_t same = chunk->heat == 0 && chunk->opos.pos == cold->opos[i].pos &&
+                             chunk->size.size == cold->size[i].size;
+
+        if (!blob) {
+            /* incompressible: leave it alone for a while */
+            if (same) chunk->heat = COLD_PARK;
+            continue;
+        }
+
+        mp_chunk *ph = &blob->chunk;
+        ph->data = NULL;
+        ph->opos = chunk->opos;
+        ph->size = chunk->size;
+        ph->gen = chunk->gen;
+        ph->epoch = chunk->epoch;
+        ph->heat = 0;
+
+        if (!same || mp_matrix_chunk_swap(matx, chunk, ph) < 0) {
+            free(blob);
+            continue;
+        }
+
+        /* give the slot back to the kernel, not only to the pool */
+        madvise(chunk->data, CHUNK_BYTES, MADV_DONTNEED);
+        mp_pool_ret(matx->pool, chunk);
+
+        cold->count += 1;
+        cold->bytes += blob->len;
+        frozen++;
+    }
+
+    cold->n = 0;
+    cold->frozen += frozen;
+    return frozen;
+}
+
+/**
+ * Drop the blobs of a ready batch.
+ */
+static void
+mp_cold_discard(mp_cold *cold) {
+    for (uint32_t i = 0; i < cold->n; i++) free(cold->blob[i]);
+    cold->n = 0;
+}
+
+/**
+ * Age every counter and pick the chunks that stayed at 0.
+ */
+static void
+mp_cold_select(mp_cold *cold) {
+    mp_matrix *matx = cold->matx;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (chunk->heat) {
+            chunk->heat >>= 1;
+            continue;
+        }
+        if (cold->n == COLD_BATCH || !chunk->data || mp_matrix_chunk_mapped(matx, chunk)) continue;
+
+        const uint32_t i = cold->n++;
+        cold->cand[i] = chunk;
+        cold->opos[i] = chunk->opos;
+        cold->size[i] = chunk->size;
+        cold->data[i] = chunk->data;
+        cold->blob[i] = NULL;
+    }
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Attach a cold tier to matx and start its compressor.
+ */
+int32_t
+mp_cold_attach(mp_cold *cold, mp_matrix *matx) {
+    if (!cold || !matx || matx->cold || matx->rcu) return -1;
+
+    __builtin_memset(cold, 0, sizeof(*cold));
+    cold->matx = matx;
+    cold->state = COLD_IDLE;
+
+    cold->buf = malloc(CODEC_MAX);
+    if (!cold->buf) return -1;
+
+    pthread_mutex_init(&cold->lock, NULL);
+    pthread_cond_init(&cold->cond, NULL);
+
+    if (pthread_create(&cold->thread, NULL, mp_cold_compressor, cold) != 0) {
+        pthread_cond_destroy(&cold->cond);
+        pthread_mutex_destroy(&cold->lock);
+        free(cold->buf);
+        cold->buf = NULL;
+        return -1;
+    }
+
+    matx->cold = cold;
+    return 0;
+}
+
+/**
+ * Freeze the last batch, age the counters and start the next batch.
+ *
+ * Returns without doing anything while the compressor is busy or a
+ * snapshot is running (it holds pointers to the live descriptors).
+ */
+uint64_t
+mp_cold_sweep(mp_cold *cold) {
+    if (!cold || cold->matx->snap) return 0;
+
+    pthread_mutex_lock(&cold->lock);
+    const uint8_t state = cold->state;
+    pthread_mutex_unlock(&cold->lock);
+
+    if (state == COLD_ENCODING) return 0;
+
+    const uint64_t frozen = state == COLD_READY ? mp_cold_collect(cold) : 0;
+
+    mp_cold_select(cold);
+
+    pthread_mutex_lock(&cold->lock);
+    cold->state = cold->n ? COLD_ENCODING : COLD_IDLE;
+    pthread_cond_broadcast(&cold->cond);
+    pthread_mutex_unlock(&cold->lock);
+
+    return frozen;
+}
+
+/**
+ * Decode a placeholder back into a pool chunk.
+ */
+mp_chunk *
+mp_cold_thaw_chunk(mp_matrix *matx, mp_chunk *chunk) {
+    mp_cold_chunk *blob = (mp_cold_chunk *) chunk;
+
+    mp_chunk *warm = mp_pool_get(matx->pool);
+    if (!warm) return NULL;
+
+    warm->opos = chunk->opos;
+    warm->gen = chunk->gen;
+    warm->epoch = chunk->epoch;
+    warm->heat = chunk->heat;
+    mp_chunk_set_size(warm, blob->csize);
+
+    if (mp_codec_decode(warm, blob->blob, blob->len) < 0 ||
+        mp_matrix_chunk_swap(matx, chunk, warm) < 0) {
+        mp_pool_ret(matx->pool, warm);
+        return NULL;
+    }
+
+    /* the matrix was resized while the chunk was frozen: clear what the
+     * blob does not cover, as mp_matrix_set_size() does for pool chunks */
+    if (blob->csize.size != chunk->size.size) mp_chunk_regrow(warm, blob->csize, chunk->size);
+
+    mp_cold_release(matx, chunk);
+    matx->cold->thawed += 1;
+    return warm;
+}
+
+/**
+ * Free a placeholder unlinked from the tree.
+ */
+void
+mp_cold_release(mp_matrix *matx, mp_chunk *chunk) {
+    mp_cold_chunk *blob = (mp_cold_chunk *) chunk;
+    mp_cold *cold = matx->cold;
+
+    cold->count -= 1;
+    cold->bytes -= blob->len;
+    free(blob);
+}
+
+/**
+ * Thaw every placeholder and discard the batch in flight.
+ *
+ * Thawing replaces the node being visited in place, which the iterator
+ * tolerates: it has already read the right subtree.
+ */
+int32_t
+mp_cold_thaw(mp_cold *cold) {
+    if (!cold) return -1;
+
+    if (mp_cold_settle(cold) == COLD_READY) {
+        mp_cold_discard(cold);
+
+        pthread_mutex_lock(&cold->lock);
+        cold->state = COLD_IDLE;
+        pthread_mutex_unlock(&cold->lock);
+    }
+
+    mp_iter iter;
+    mp_iter_init(&iter, &cold->matx->tree);
+
+    int32_t ret = 0;
+    for (mp_chunk *chunk; cold->count && (chunk = mp_iter_next(&iter));)
+        if (!mp_cold_warm(cold->matx, chunk)) ret = -1;
+    return ret;
+}
+
+/**
+ * Thaw everything, stop the compressor and detach the tier.
+ */
+int32_t
+mp_cold_free(mp_cold *cold) {
+    if (!cold || mp_cold_thaw(cold) < 0) return -1;
+
+    pthread_mutex_lock(&cold->lock);
+    cold->stop = 1;
+    pthread_cond_broadcast(&cold->cond);
+    pthread_mutex_unlock(&cold->lock);
+    pthread_join(cold->thread, NULL);
+
+    pthread_cond_destroy(&cold->cond);
+    pthread_mutex_destroy(&cold->lock);
+    free(cold->buf);
+    cold->buf = NULL;
+
+    cold->matx->cold = NULL;
+    return 0;
+}
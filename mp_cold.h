@@ -0,0 +1,218 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_cold.h
+ *  Description:  Compressed in-memory tier for rarely used chunks.
+ *
+ *  Every lookup through the matrix bumps a saturating per-chunk access
+ *  counter (mp_chunk::heat). mp_cold_sweep() halves all counters; chunks
+ *  that stayed at 0 since the previous sweep are handed to a compressor
+ *  thread, which encodes them with mp_codec.h. At the next sweep the
+ *  encoded chunks replace their pool chunks in the tree:
+ *
+ *      owner thread                         compressor thread
+ *      ────────────                         ─────────────────
+ *      sweep: age, pick heat == 0    ->     encode each candidate
+ *      ... keeps using the matrix           into a compact blob
+ *      sweep: untouched candidates   <-
+ *        tree node → placeholder
+ *        pool slot → released
+ *      lookup of a placeholder:
+ *        decode into a pool chunk, swap it back in
+ *
+ *  A placeholder is an mp_chunk with data == NULL followed by the
+ *  encoded payload, in one allocation. It keeps opos, size, gen and
+ *  epoch, so sync and drop bookkeeping do not change. The released
+ *  slot is returned to the kernel (MADV_DONTNEED), so the resident set
+ *  shrinks by 512 KB per frozen chunk minus the encoded size.
+ *
+ *  Design goals:
+ *   - No locking on the lookup path: the owner alone touches the tree,
+ *     the compressor only reads payloads of chunks it was handed
+ *   - A candidate touched while it was being encoded is kept as is
+ *     (its counter is no longer 0), so no write is ever lost
+ *   - Incompressible chunks are parked hot for a while instead of
+ *     being retried on every sweep
+ *
+ *  Notes:
+ *   - Lookups (mp_matrix_chunk_find / take / write, mp_matrix_get /
+ *     put), sync, mp_file_store(), Merkle trees, chunk streams, gemm
+ *     (local, parallel and distributed) and the server kernels thaw
+ *     placeholders transparently, through mp_cold_warm(). Passes over a
+ *     bare tree (mp_scan, mp_sched_for_chunks()) need a warm matrix:
+ *     call mp_cold_thaw() first
+ *   - Starting a snapshot thaws the matrix; nothing is frozen while a
+ *     snapshot is running
+ *   - Mapped tiles are never frozen (their memory is the page cache)
+ *   - Owner-thread API, like the rest of mp_matrix
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_COLD_H
+#define QDEEP_MATRIXP_COLD_H
+
+#include <pthread.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Chunks encoded per sweep */
+#define COLD_BATCH 64
+
+/** Minimum compression ratio for a chunk to be frozen */
+#define COLD_GAIN 2
+
+/** Counter given to incompressible chunks (cold again after 8 sweeps) */
+#define COLD_PARK UINT8_MAX
+
+/** Compressor states */
+#define COLD_IDLE     0 /**< Nothing handed out */
+#define COLD_ENCODING 1 /**< Batch owned by the compressor */
+#define COLD_READY    2 /**< Batch encoded, waiting for the next sweep */
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Placeholder of a frozen chunk (chunk.data == NULL).
+ */
+typedef struct mp_cold_chunk {
+    mp_chunk chunk;  /**< Tree node, metadata of the original chunk */
+    mp_csize csize;  /**< Size the payload was encoded with */
+    uint32_t len;    /**< Encoded bytes */
+    uint8_t blob[];  /**< mp_codec_encode() output */
+} mp_cold_chunk;
+
+/**
+ * Cold tier of one matrix.
+ */
+typedef struct mp_cold {
+    mp_matrix *matx;       /**< Owning matrix */
+
+    pthread_t thread;      /**< Compressor */
+    pthread_mutex_t lock;  /**< Guards state / stop */
+    pthread_cond_t cond;   /**< Signalled on every state change */
+    uint8_t state;         /**< COLD_* */
+    uint8_t stop;          /**< Compressor must exit */
+
+    /* --------------------------------------------------------------------
+     * Batch (written by the owner while idle, by the compressor while
+     * encoding)
+     * ------------------------------------------------------------------ */
+
+    uint32_t n;                      /**< Candidates in the batch */
+    mp_chunk *cand[COLD_BATCH];      /**< Candidate descriptors */
+    mp_copos opos[COLD_BATCH];       /**< Offsets at selection */
+    mp_csize size[COLD_BATCH];       /**< Sizes at selection */
+    mp_cdata data[COLD_BATCH];       /**< Payloads at selection */
+    mp_cold_chunk *blob[COLD_BATCH]; /**< Encoded chunks (NULL if not worth it) */
+    uint8_t *buf;                    /**< Compressor scratch (CODEC_MAX) */
+
+    /* --------------------------------------------------------------------
+     * Statistics
+     * ------------------------------------------------------------------ */
+
+    uint64_t count;   /**< Placeholders in the tree */
+    uint64_t bytes;   /**< Encoded bytes held by them */
+    uint64_t frozen;  /**< Chunks frozen so far */
+    uint64_t thawed;  /**< Chunks thawed so far */
+} mp_cold;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Attach a cold tier to matx and start its compressor.
+ *
+ * @return  0 on success
+ * @return -1 on allocation / thread failure, if matx already has one
+ *            or has concurrent readers (mp_rcu.h)
+ */
+int32_t
+mp_cold_attach(mp_cold *cold, mp_matrix *matx);
+
+/**
+ * Freeze the chunks encoded since the last sweep, age all access
+ * counters and hand the next cold chunks to the compressor.
+ *
+ * Call it periodically from the owner thread; the interval sets how
+ * long a chunk has to stay unused before it is frozen (about 8 sweeps
+ * for a chunk that was busy before).
+ *
+ * Returns:
+ *   Chunks frozen by this call
+ */
+uint64_t
+mp_cold_sweep(mp_cold *cold);
+
+/**
+ * Decode the placeholder chunk of matx back into a pool chunk.
+ *
+ * The pool chunk takes its place in the tree and the placeholder is
+ * freed.
+ *
+ * Returns:
+ *   The pool chunk, or NULL on allocation failure
+ */
+mp_chunk *
+mp_cold_thaw_chunk(mp_matrix *matx, mp_chunk *chunk);
+
+/**
+ * Return chunk itself, or its thawed copy if it is a placeholder.
+ */
+static __inline__ mp_chunk *
+mp_cold_warm(mp_matrix *matx, mp_chunk *chunk) {
+    return __builtin_expect(chunk->data != NULL, 1) ? chunk : mp_cold_thaw_chunk(matx, chunk);
+}
+
+/**
+ * Free a placeholder unlinked from the tree of matx.
+ */
+void
+mp_cold_release(mp_matrix *matx, mp_chunk *chunk);
+
+/**
+ * Thaw every placeholder and discard the batch in flight.
+ *
+ * The tier stays attached.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure (some chunks stay frozen)
+ */
+int32_t
+mp_cold_thaw(mp_cold *cold);
+
+/**
+ * Thaw everything, stop the compressor and detach the tier.
+ *
+ * @return  0 on success
+ * @return -1 if the matrix could not be thawed (the tier stays attached)
+ */
+int32_t
+mp_cold_free(mp_cold *cold);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_COLD_H */
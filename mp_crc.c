@@ -0,0 +1,604 @@
+#include "mp_crc.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "mp_stream.h"
+
+
+/* ============================================================================
+ *  Internal state
+ * ============================================================================
+ */
+
+/** Reflected Castagnoli polynomial */
+#define CRC_POLY 0x82F63B78u
+
+/** Slice-by-8 tables (software path) */
+static uint32_t crc_table[8][256];
+
+/** Multiply-by-x^(8·CRC_LANE) and x^(16·CRC_LANE) tables, per state byte */
+static uint32_t crc_shift1[4][256];
+static uint32_t crc_shift2[4][256];
+
+static uint8_t crc_hw;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+
+/* ============================================================================
+ *  Tables
+ * ============================================================================
+ */
+
+/**
+ * a · b modulo the polynomial (reflected bit order, x^0 is bit 31).
+ */
+static uint32_t
+mp_crc_multmodp(const uint32_t a, uint32_t b) {
+    uint32_t p = 0;
+
+    for (uint32_t m = 1u << 31; m; m >>= 1) {
+        if (a & m) p ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC_POLY : b >> 1;
+    }
+    return p;
+}
+
+/**
+ * x^(8·n) modulo the polynomial.
+ */
+static uint32_t
+mp_crc_x8n(uint64_t n) {
+    uint32_t p = 1u << 31;  /* x^0 */
+    uint32_t sq = 1u << 23; /* x^8 */
+
+    for (; n; n >>= 1) {
+        if (n & 1) p = mp_crc_multmodp(sq, p);
+        sq = mp_crc_multmodp(sq, sq);
+    }
+    return p;
+}
+
+/**
+ * Build the tables and probe the CPU once.
+ */
+static void
+mp_crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (uint32_t k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (uint32_t t = 1; t < 8; t++)
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xFF];
+
+    /* shifting a state is linear: split it into bytes */
+    const uint32_t k1 = mp_crc_x8n(CRC_LANE);
+    const uint32_t k2 = mp_crc_x8n(2 * CRC_LANE);
+    for (uint32_t j = 0; j < 4; j++)
+        for (uint32_t i = 0; i < 256; i++) {
+            crc_shift1[j][i] = mp_crc_multmodp(k1, i << (8 * j));
+            crc_shift2[j][i] = mp_crc_multmodp(k2, i << (8 * j));
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    crc_hw = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+/**
+ * Multiply a raw state by a table-encoded constant.
+ */
+static __inline__ uint32_t
+mp_crc_shift(const uint32_t (*tab)[256], const uint32_t s) {
+    return tab[0][s & 0xFF] ^ tab[1][(s >> 8) & 0xFF] ^
+           tab[2][(s >> 16) & 0xFF] ^ tab[3][s >> 24];
+}
+
+
+/* ============================================================================
+ *  Raw update (no pre / post inversion)
+ * ============================================================================
+ */
+
+/**
+ * Slice-by-8 software update.
+ */
+static uint32_t
+mp_crc_sw(uint32_t s, const uint8_t *p, uint64_t len) {
+    for (; len && ((uintptr_t) p & 7); len--) s = (s >> 8) ^ crc_table[0][(s ^ *p++) & 0xFF];
+
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        __builtin_memcpy(&v, p, 8);
+        v ^= s;
+        s = crc_table[7][v & 0xFF] ^ crc_table[6][(v >> 8) & 0xFF] ^
+            crc_table[5][(v >> 16) & 0xFF] ^ crc_table[4][(v >> 24) & 0xFF] ^
+            crc_table[3][(v >> 32) & 0xFF] ^ crc_table[2][(v >> 40) & 0xFF] ^
+            crc_table[1][(v >> 48) & 0xFF] ^ crc_table[0][v >> 56];
+    }
+
+    for (; len; len--) s = (s >> 8) ^ crc_table[0][(s ^ *p++) & 0xFF];
+    return s;
+}
+
+#if defined(__x86_64__)
+/**
+ * SSE4.2 update, three independent lanes per CRC_LANE·3 block.
+ *
+ *   R(s, A|B|C) = R(s, A)·x^(16L) ^ R(0, B)·x^(8L) ^ R(0, C)
+ */
+__attribute__((target("sse4.2")))
+static uint32_t
+mp_crc_hw(uint32_t s, const uint8_t *p, uint64_t len) {
+    for (; len && ((uintptr_t) p & 7); len--) s = __builtin_ia32_crc32qi(s, *p++);
+
+    for (; len >= 3 * CRC_LANE; len -= 3 * CRC_LANE, p += 3 * CRC_LANE) {
+        uint64_t s0 = s, s1 = 0, s2 = 0;
+
+        for (uint32_t i = 0; i < CRC_LANE; i += 8) {
+            uint64_t v0, v1, v2;
+            __builtin_memcpy(&v0, p + i, 8);
+            __builtin_memcpy(&v1, p + CRC_LANE + i, 8);
+            __builtin_memcpy(&v2, p + 2 * CRC_LANE + i, 8);
+
+            s0 = __builtin_ia32_crc32di(s0, v0);
+            s1 = __builtin_ia32_crc32di(s1, v1);
+            s2 = __builtin_ia32_crc32di(s2, v2);
+        }
+
+        s = mp_crc_shift(crc_shift2, (uint32_t) s0) ^
+            mp_crc_shift(crc_shift1, (uint32_t) s1) ^ (uint32_t) s2;
+    }
+
+    uint64_t s64 = s;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        __builtin_memcpy(&v, p, 8);
+        s64 = __builtin_ia32_crc32di(s64, v);
+    }
+    s = (uint32_t) s64;
+
+    for (; len; len--) s = __builtin_ia32_crc32qi(s, *p++);
+    return s;
+}
+#endif
+
+
+/* ============================================================================
+ *  CRC32C
+ * ============================================================================
+ */
+
+/**
+ * Extend a CRC32C over len bytes.
+ */
+uint32_t
+mp_crc32c(const uint32_t crc, const void *buf, const uint64_t len) {
+    pthread_once(&crc_once, mp_crc_init);
+
+#if defined(__x86_64__)
+    if (crc_hw) return ~mp_crc_hw(~crc, buf, len);
+#endif
+    return ~mp_crc_sw(~crc, buf, len);
+}
+
+/**
+ * Check whether mp_crc32c() uses the hardware instruction.
+ */
+int32_t
+mp_crc32c_hw(void) {
+    pthread_once(&crc_once, mp_crc_init);
+    return crc_hw;
+}
+
+
+/* ============================================================================
+ *  Checked transfer
+ * ============================================================================
+ */
+
+/**
+ * Byte range of the dense payload.
+ */
+typedef struct mp_crc_range {
+    uint64_t off;
+    uint64_t len;
+} mp_crc_range;
+
+/**
+ * Positional read / write of exactly len bytes.
+ */
+static int32_t
+mp_crc_io(const int32_t fd, uint8_t *buf, uint64_t len, uint64_t off, const uint8_t write_) {
+    while (len > 0) {
+        const int64_t ret = write_ ? pwrite(fd, buf, len, (off_t) off)
+                                   : pread(fd, buf, len, (off_t) off);
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (ret < 0 && errno == EINTR) continue;
+            return -1;
+        }
+
+        buf += ret;
+        off += (uint64_t) ret;
+        len -= (uint64_t) ret;
+    }
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Checksum lane
+ * ============================================================================
+ */
+
+/**
+ * One frame buffer, owned by the socket thread until it is submitted
+ * and by the checksum thread until it is finished.
+ */
+typedef struct mp_crc_slot {
+    uint8_t *buf;
+    uint64_t off;  /**< Payload offset of the frame */
+    uint64_t len;
+    uint64_t tag;  /**< recv: offset in the received frame header */
+    uint64_t crc;  /**< send: computed, recv: received checksum field */
+} mp_crc_slot;
+
+/**
+ * Checksum thread of one transfer.
+ *
+ * The socket thread submits frames in order and the checksum thread
+ * finishes them in the same order, so frame i always lives in slot
+ * i % CRC_DEPTH. Sending, it loads and sums the frames ahead of the
+ * socket; receiving, it verifies and stores them behind the socket.
+ */
+typedef struct mp_crc_lane {
+    const mp_matrix *matx;
+    uint8_t recv;          /**< Verify and store instead of load and sum */
+    uint8_t serial;        /**< No thread: frames are finished on submit */
+
+    pthread_t thread;
+    pthread_mutex_t lock;  /**< Guards everything below */
+    pthread_cond_t cond;   /**< Signalled on every submit / finish */
+    uint64_t submitted;    /**< Frames handed over (written by the socket thread only) */
+    uint64_t done;         /**< Frames finished */
+    uint8_t stop;
+    uint8_t failed;        /**< File I/O or allocation failure */
+
+    /* recv: ranges that failed the check (read by the socket thread when idle) */
+    mp_crc_range *bad;
+    uint64_t nbad;
+    uint64_t cbad;
+
+    mp_crc_slot slot[CRC_DEPTH];
+} mp_crc_lane;
+
+/**
+ * Append [off, off + len) to a bad list, merging with its last entry.
+ */
+static int32_t
+mp_crc_note(mp_crc_range **bad, uint64_t *n, uint64_t *cap, const uint64_t off, const uint64_t len) {
+    if (*n && (*bad)[*n - 1].off + (*bad)[*n - 1].len == off) {
+        (*bad)[*n - 1].len += len;
+        return 0;
+    }
+
+    if (*n == *cap) {
+        const uint64_t c = *cap ? *cap << 1 : 16;
+        mp_crc_range *next = realloc(*bad, c * sizeof(mp_crc_range));
+        if (!next) return -1;
+        *bad = next;
+        *cap = c;
+    }
+
+    (*bad)[(*n)++] = (mp_crc_range){off, len};
+    return 0;
+}
+
+/**
+ * Finish one frame on the checksum thread.
+ */
+static int32_t
+mp_crc_finish(mp_crc_lane *lane, mp_crc_slot *slot) {
+    const uint64_t pos = sizeof(mp_msize) + slot->off;
+
+    if (!lane->recv) {
+        if (mp_crc_io(lane->matx->fd, slot->buf, slot->len, pos, 0) < 0) return -1;
+        slot->crc = mp_crc32c(0, slot->buf, slot->len);
+        return 0;
+    }
+
+    if (slot->tag == slot->off && slot->crc == mp_crc32c(0, slot->buf, slot->len))
+        return mp_crc_io(lane->matx->fd, slot->buf, slot->len, pos, 1);
+    return mp_crc_note(&lane->bad, &lane->nbad, &lane->cbad, slot->off, slot->len);
+}
+
+/**
+ * Checksum thread: finish submitted frames in order until stopped.
+ */
+static void *
+mp_crc_lane_run(void *arg) {
+    mp_crc_lane *lane = arg;
+
+    pthread_mutex_lock(&lane->lock);
+    while (1) {
+        while (lane->done == lane->submitted && !lane->stop) pthread_cond_wait(&lane->cond, &lane->lock);
+        if (lane->done == lane->submitted) break;
+
+        /* after a failure frames are only counted, so waiters wake up */
+        mp_crc_slot *slot = &lane->slot[lane->done % CRC_DEPTH];
+        const uint8_t skip = lane->failed;
+        pthread_mutex_unlock(&lane->lock);
+
+        const int32_t ret = skip ? 0 : mp_crc_finish(lane, slot);
+
+        pthread_mutex_lock(&lane->lock);
+        if (ret < 0) lane->failed = 1;
+        lane->done++;
+        pthread_cond_broadcast(&lane->cond);
+    }
+    pthread_mutex_unlock(&lane->lock);
+    return NULL;
+}
+
+/**
+ * Allocate the frame buffers and start the checksum thread.
+ */
+static int32_t
+mp_crc_lane_init(mp_crc_lane *lane, const mp_matrix *matx, const uint8_t recv) {
+    __builtin_memset(lane, 0, sizeof(*lane));
+    lane->matx = matx;
+    lane->recv = recv;
+
+    uint8_t *buf = malloc((uint64_t) CRC_DEPTH * CRC_FRAME);
+    if (!buf) return -1;
+    for (uint32_t i = 0; i < CRC_DEPTH; i++) lane->slot[i].buf = buf + (uint64_t) i * CRC_FRAME;
+
+    pthread_mutex_init(&lane->lock, NULL);
+    pthread_cond_init(&lane->cond, NULL);
+
+    /* on too few CPUs a second thread only adds context switches */
+    lane->serial = sysconf(_SC_NPROCESSORS_ONLN) < CRC_LANE_CPUS;
+    if (!lane->serial && pthread_create(&lane->thread, NULL, mp_crc_lane_run, lane) != 0) {
+        pthread_cond_destroy(&lane->cond);
+        pthread_mutex_destroy(&lane->lock);
+        free(buf);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Finish the submitted frames, stop the thread and free the buffers.
+ */
+static void
+mp_crc_lane_free(mp_crc_lane *lane) {
+    pthread_mutex_lock(&lane->lock);
+    lane->stop = 1;
+    pthread_cond_broadcast(&lane->cond);
+    pthread_mutex_unlock(&lane->lock);
+
+    if (!lane->serial) pthread_join(lane->thread, NULL);
+    pthread_cond_destroy(&lane->cond);
+    pthread_mutex_destroy(&lane->lock);
+
+    free(lane->slot[0].buf);
+    free(lane->bad);
+}
+
+/**
+ * Hand the frame in slot submitted % CRC_DEPTH to the checksum thread.
+ */
+static void
+mp_crc_lane_submit(mp_crc_lane *lane) {
+    if (lane->serial) {
+        if (!lane->failed && mp_crc_finish(lane, &lane->slot[lane->submitted % CRC_DEPTH]) < 0) lane->failed = 1;
+        lane->submitted++;
+        lane->done++;
+        return;
+    }
+
+    pthread_mutex_lock(&lane->lock);
+    lane->submitted++;
+    pthread_cond_broadcast(&lane->cond);
+    pthread_mutex_unlock(&lane->lock);
+}
+
+/**
+ * Wait until the first n frames are finished.
+ *
+ * @return  0 on success
+ * @return -1 if the checksum thread failed
+ */
+static int32_t
+mp_crc_lane_wait(mp_crc_lane *lane, const uint64_t n) {
+    pthread_mutex_lock(&lane->lock);
+    while (lane->done < n && !lane->failed) pthread_cond_wait(&lane->cond, &lane->lock);
+    const int32_t ret = lane->failed ? -1 : 0;
+    pthread_mutex_unlock(&lane->lock);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Sender and receiver
+ * ============================================================================
+ */
+
+/**
+ * Send the frames of n ranges, loaded and summed CRC_DEPTH frames ahead.
+ */
+static int32_t
+mp_crc_send_ranges(mp_crc_lane *lane, const int32_t fd, const mp_crc_range *ranges, const uint64_t n) {
+    uint8_t frame[STREAM_FRAME];
+    uint64_t r = 0, off = n ? ranges[0].off : 0;  /* next frame to submit */
+    uint64_t sent = lane->submitted;
+
+    while (1) {
+        while (r < n && lane->submitted - sent < CRC_DEPTH) {
+            mp_crc_slot *slot = &lane->slot[lane->submitted % CRC_DEPTH];
+            const uint64_t left = ranges[r].off + ranges[r].len - off;
+
+            slot->off = off;
+            slot->len = left < CRC_FRAME ? left : CRC_FRAME;
+            mp_crc_lane_submit(lane);
+
+            off += slot->len;
+            if (off == ranges[r].off + ranges[r].len && ++r < n) off = ranges[r].off;
+        }
+        if (sent == lane->submitted) return 0;
+
+        if (mp_crc_lane_wait(lane, sent + 1) < 0) return -1;
+        const mp_crc_slot *slot = &lane->slot[sent % CRC_DEPTH];
+
+        mp_stream_pack(frame, slot->off, slot->crc);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+        if (mp_stream_write(fd, slot->buf, slot->len) < 0) return -1;
+        sent++;
+    }
+}
+
+/**
+ * Send the dense payload of matx with per-frame CRC32C.
+ */
+int64_t
+mp_matrix_send_checked(const mp_matrix *matx, const int32_t fd) {
+    if (!matx || matx->fd == -1 || (matx->flags & MP_MATRIX_TILED)) return -1;
+
+    const uint64_t total = matx->size.x * matx->size.y * sizeof(int64_t);
+    uint8_t head[2 * STREAM_FRAME];
+    uint8_t frame[STREAM_FRAME];
+
+    mp_stream_pack(head, matx->size.x, matx->size.y);
+    mp_stream_pack(head + STREAM_FRAME, mp_crc32c(0, head, STREAM_FRAME), 0);
+    if (mp_stream_write(fd, head, sizeof(head)) < 0) return -1;
+
+    mp_crc_lane lane;
+    if (mp_crc_lane_init(&lane, matx, 0) < 0) return -1;
+
+    mp_crc_range *bad = NULL;
+    int64_t ret = -1, resent = 0;
+
+    const mp_crc_range all = {0, total};
+    if (mp_crc_send_ranges(&lane, fd, &all, total ? 1 : 0) < 0) goto end;
+
+    for (uint32_t round = 0;; round++) {
+        uint64_t n, r;
+        if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto end;
+        mp_stream_unpack(frame, &n, &r);
+
+        if (r != round) goto end;
+        if (n == 0) break;
+        if (round + 1 == CRC_ROUNDS || n > total / CRC_FRAME + 1) goto end;
+
+        /* read the whole list before sending: the receiver writes it in one go */
+        free(bad);
+        bad = malloc(n * sizeof(mp_crc_range));
+        if (!bad) goto end;
+
+        for (uint64_t i = 0; i < n; i++) {
+            if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto end;
+            mp_stream_unpack(frame, &bad[i].off, &bad[i].len);
+            if (!bad[i].len || bad[i].off > total || bad[i].len > total - bad[i].off) goto end;
+            resent += (int64_t) bad[i].len;
+        }
+
+        if (mp_crc_send_ranges(&lane, fd, bad, n) < 0) goto end;
+    }
+    ret = resent;
+
+end:
+    mp_crc_lane_free(&lane);
+    free(bad);
+    return ret;
+}
+
+/**
+ * Receive a dense payload sent by mp_matrix_send_checked().
+ */
+int64_t
+mp_matrix_recv_checked(mp_matrix *matx, const int32_t fd) {
+    if (!matx || matx->fd == -1 || (matx->flags & MP_MATRIX_TILED)) return -1;
+
+    uint8_t head[2 * STREAM_FRAME];
+    uint8_t frame[STREAM_FRAME];
+    uint64_t a, b;
+
+    /* without a trusted size there is no frame layout to retransmit against */
+    if (mp_stream_read(fd, head, sizeof(head)) < 0) return -1;
+    mp_stream_unpack(head + STREAM_FRAME, &a, &b);
+    if (a != mp_crc32c(0, head, STREAM_FRAME) || b != 0) return -1;
+
+    mp_stream_unpack(head, &a, &b);
+    if (mp_matrix_set_size(matx, (mp_msize){a, b}) < 0) return -1;
+
+    const uint64_t total = matx->size.x * matx->size.y * sizeof(int64_t);
+
+    mp_crc_lane lane;
+    if (mp_crc_lane_init(&lane, matx, 1) < 0) return -1;
+
+    mp_crc_range *want = malloc(sizeof(mp_crc_range));
+    uint64_t nwant = total ? 1 : 0, cwant = 1;
+    int64_t ret = -1, asked = 0;
+    if (!want) goto end;
+
+    want[0] = (mp_crc_range){0, total};
+
+    for (uint32_t round = 0;; round++) {
+        for (uint64_t i = 0; i < nwant; i++) {
+            const mp_crc_range range = want[i];
+
+            for (uint64_t off = range.off; off < range.off + range.len; off += CRC_FRAME) {
+                const uint64_t left = range.off + range.len - off;
+
+                /* the frame that used this slot must be stored */
+                if (lane.submitted >= CRC_DEPTH &&
+                    mp_crc_lane_wait(&lane, lane.submitted - CRC_DEPTH + 1) < 0)
+                    goto end;
+
+                mp_crc_slot *slot = &lane.slot[lane.submitted % CRC_DEPTH];
+                slot->off = off;
+                slot->len = left < CRC_FRAME ? left : CRC_FRAME;
+
+                if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto end;
+                if (mp_stream_read(fd, slot->buf, slot->len) < 0) goto end;
+
+                mp_stream_unpack(frame, &slot->tag, &slot->crc);
+                mp_crc_lane_submit(&lane);
+            }
+        }
+
+        /* ---- report ---- */
+        if (mp_crc_lane_wait(&lane, lane.submitted) < 0) goto end;
+
+        mp_stream_pack(frame, lane.nbad, round);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) goto end;
+
+        for (uint64_t i = 0; i < lane.nbad; i++) {
+            mp_stream_pack(frame, lane.bad[i].off, lane.bad[i].len);
+            if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) goto end;
+            asked += (int64_t) lane.bad[i].len;
+        }
+
+        if (lane.nbad == 0) break;
+        if (round + 1 == CRC_ROUNDS) goto end;
+
+        /* the bad list of this round is the want list of the next */
+        mp_crc_range *tmp = want;
+        const uint64_t ctmp = cwant;
+        want = lane.bad;
+        nwant = lane.nbad;
+        cwant = lane.cbad;
+        lane.bad = tmp;
+        lane.nbad = 0;
+        lane.cbad = ctmp;
+    }
+    ret = asked;
+
+end:
+    mp_crc_lane_free(&lane);
+    free(want);
+    return ret;
+}
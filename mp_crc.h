@@ -0,0 +1,141 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_crc.h
+ *  Description:  CRC32C and integrity-checked dense matrix transfer.
+ *
+ *  mp_crc32c() uses the SSE4.2 crc32 instruction on three interleaved
+ *  lanes (one instruction per cycle instead of one per latency) when
+ *  the CPU has it, slice-by-8 tables otherwise. Lanes are merged with
+ *  precomputed "shift by lane length" tables.
+ *
+ *  Checked transfer (socket, both directions used):
+ *
+ *      sender                                   receiver
+ *      [ size.x | size.y ][ crc | 0 ]  ->       header, checked on its own
+ *      [ offset | crc ] payload        ->       per CRC_FRAME bytes
+ *      ...                                      good frames go to the file
+ *                                      <-       [ n | round ]
+ *                                      <-       n × [ offset | length ]
+ *      frames of the bad ranges only   ->
+ *      ...                                      until n = 0
+ *
+ *  Frame boundaries are derived from the ranges on both sides, so a
+ *  corrupted frame header only fails its own frame and never
+ *  desynchronizes the stream. A corrupted size header fails the
+ *  transfer before the matrix is resized: without a trusted size there
+ *  is no frame layout to retransmit against.
+ *
+ *  On machines with CRC_LANE_CPUS CPUs or more, each side runs a
+ *  checksum thread next to the socket thread, with CRC_DEPTH frame
+ *  buffers between them:
+ *
+ *      send:  file -> pread + crc (checksum thread) -> write (socket)
+ *      recv:  read (socket) -> crc + pwrite (checksum thread) -> file
+ *
+ *  Design goals:
+ *   - A flipped bit costs one CRC_FRAME retransmission, not the matrix
+ *   - Checksums and file I/O overlap with the socket instead of
+ *     stalling it; each frame is summed right after it was loaded /
+ *     received, while it is still in L2
+ *
+ *  Notes:
+ *   - Payloads are host byte order, headers big-endian (mp_stream.h)
+ *   - Only dense backing files, like mp_matrix_send() / mp_matrix_recv()
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_CRC_H
+#define QDEEP_MATRIXP_CRC_H
+
+#include <stdint.h>
+
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Checked frame payload size (fits L2 with room to spare) */
+#define CRC_FRAME (256u << 10)
+
+/** Bytes per lane of the interleaved hardware loop */
+#define CRC_LANE 2048
+
+/** Frame buffers in flight between the socket and the checksum thread */
+#define CRC_DEPTH 4
+
+/** Online CPUs needed for a checksum thread (below, frames are summed inline) */
+#ifndef CRC_LANE_CPUS
+#define CRC_LANE_CPUS 2
+#endif
+
+/** Retransmission rounds before a transfer is given up */
+#define CRC_ROUNDS 8
+
+
+/* ============================================================================
+ *  CRC32C
+ * ============================================================================
+ */
+
+/**
+ * Extend a CRC32C (Castagnoli) over len bytes.
+ *
+ * Start with crc = 0; the result of one call can be passed to the
+ * next to continue over split buffers.
+ *
+ * Returns:
+ *   Updated CRC
+ */
+uint32_t
+mp_crc32c(uint32_t crc, const void *buf, uint64_t len);
+
+/**
+ * Check whether mp_crc32c() uses the hardware instruction.
+ */
+int32_t
+mp_crc32c_hw(void);
+
+
+/* ============================================================================
+ *  Checked transfer
+ * ============================================================================
+ */
+
+/**
+ * Send the dense payload of matx with per-frame CRC32C.
+ *
+ * Returns:
+ *   Bytes retransmitted, or -1 on I/O failure, protocol error or when
+ *   the receiver still reports bad frames after CRC_ROUNDS rounds
+ */
+int64_t
+mp_matrix_send_checked(const mp_matrix *matx, int32_t fd);
+
+/**
+ * Receive a dense payload sent by mp_matrix_send_checked().
+ *
+ * The matrix is resized to the received header.
+ *
+ * Returns:
+ *   Bytes requested again, or -1 on I/O failure or protocol error
+ */
+int64_t
+mp_matrix_recv_checked(mp_matrix *matx, int32_t fd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_CRC_H */
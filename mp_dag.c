@@ -0,0 +1,261 @@
+#include "mp_dag.h"
+
+#include <stdlib.h>
+
+
+/* ============================================================================
+ *  Submission
+ * ============================================================================
+ */
+
+/**
+ * Grow an array of elements of size `size` to hold at least need.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+static int32_t
+mp_dag_grow(void **ptr, uint32_t *cap, const uint32_t need, const uint64_t size) {
+    if (need <= *cap) return 0;
+
+    uint32_t n = *cap ? *cap : 64;
+    while (n < need) n <<= 1;
+
+    void *p = realloc(*ptr, n * size);
+    if (!p) return -1;
+
+    *ptr = p;
+    *cap = n;
+    return 0;
+}
+
+/**
+ * Map slot of a chunk.
+ */
+static __inline__ uint32_t
+mp_dag_hash(const mp_copos key, const uint32_t cap) {
+    return (uint32_t) ((key.pos * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+/**
+ * Double the chunk map.
+ */
+static int32_t
+mp_dag_rehash(mp_dag *dag) {
+    const uint32_t cap = dag->cmap << 1;
+    mp_dag_slot *map = malloc(cap * sizeof(mp_dag_slot));
+    if (!map) return -1;
+
+    for (uint32_t i = 0; i < cap; i++) map[i].key.pos = UINT64_MAX;
+
+    for (uint32_t i = 0; i < dag->cmap; i++) {
+        if (dag->map[i].key.pos == UINT64_MAX) continue;
+
+        uint32_t h = mp_dag_hash(dag->map[i].key, cap);
+        while (map[h].key.pos != UINT64_MAX) h = (h + 1) & (cap - 1);
+        map[h] = dag->map[i];
+    }
+
+    free(dag->map);
+    dag->map = map;
+    dag->cmap = cap;
+    return 0;
+}
+
+/**
+ * Find or create the access state of a chunk.
+ */
+static mp_dag_slot *
+mp_dag_slot_get(mp_dag *dag, const mp_copos key) {
+    if ((dag->nmap + 1) * 2 > dag->cmap && mp_dag_rehash(dag) < 0) return NULL;
+
+    uint32_t h = mp_dag_hash(key, dag->cmap);
+    while (dag->map[h].key.pos != UINT64_MAX) {
+        if (dag->map[h].key.pos == key.pos) return &dag->map[h];
+        h = (h + 1) & (dag->cmap - 1);
+    }
+
+    mp_dag_slot *slot = &dag->map[h];
+    slot->key = key;
+    slot->writer = DAG_NONE;
+    slot->readers = DAG_NONE;
+    dag->nmap += 1;
+    return slot;
+}
+
+/**
+ * Prepend a node to a link list.
+ */
+static int32_t
+mp_dag_link_push(mp_dag *dag, uint32_t *head, const uint32_t task) {
+    if (mp_dag_grow((void **) &dag->links, &dag->clinks, dag->nlinks + 1, sizeof(mp_dag_link)) < 0)
+        return -1;
+
+    dag->links[dag->nlinks] = (mp_dag_link){task, *head};
+    *head = dag->nlinks++;
+    return 0;
+}
+
+/**
+ * Add the edge pred → task (self edges of read-modify-write are skipped).
+ */
+static int32_t
+mp_dag_edge(mp_dag *dag, const uint32_t pred, const uint32_t task) {
+    if (pred == DAG_NONE || pred == task) return 0;
+    if (mp_dag_link_push(dag, &dag->tasks[pred].succ, task) < 0) return -1;
+
+    dag->tasks[task].pending += 1;
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Execution
+ * ============================================================================
+ */
+
+/**
+ * Append released tasks to the ready list and spawn them.
+ */
+static void
+mp_dag_release(mp_dag *dag, const uint32_t *ids, const uint32_t n, const uint32_t worker) {
+    const uint64_t at = __atomic_fetch_add(&dag->nready, n, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < n; i++) dag->ready[at + i] = ids[i];
+
+    mp_sched_spawn(dag->sched, worker, at, at + n);
+}
+
+/**
+ * Loop kernel: run ready-list entries [lo, hi) and release successors.
+ */
+static void
+mp_dag_exec(void *arg, uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    mp_dag *dag = arg;
+    uint32_t batch[DAG_BATCH];
+    uint32_t n = 0;
+
+    for (; lo < hi; lo++) {
+        const mp_dag_task *task = &dag->tasks[dag->ready[lo]];
+        task->fn(task->arg, task->key, worker);
+
+        for (uint32_t e = task->succ; e != DAG_NONE; e = dag->links[e].next) {
+            const uint32_t succ = dag->links[e].task;
+            if (__atomic_sub_fetch(&dag->tasks[succ].pending, 1, __ATOMIC_ACQ_REL)) continue;
+
+            batch[n++] = succ;
+            if (n == DAG_BATCH) {
+                mp_dag_release(dag, batch, n, worker);
+                n = 0;
+            }
+        }
+    }
+
+    if (n) mp_dag_release(dag, batch, n, worker);
+}
+
+/**
+ * Forget all tasks and chunk states.
+ */
+static void
+mp_dag_reset(mp_dag *dag) {
+    dag->ntasks = 0;
+    dag->nlinks = 0;
+    dag->nmap = 0;
+    for (uint32_t i = 0; i < dag->cmap; i++) dag->map[i].key.pos = UINT64_MAX;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Initialize an empty graph.
+ */
+int32_t
+mp_dag_init(mp_dag *dag) {
+    __builtin_memset(dag, 0, sizeof(*dag));
+
+    dag->map = malloc(DAG_MAP * sizeof(mp_dag_slot));
+    if (!dag->map) return -1;
+
+    dag->cmap = DAG_MAP;
+    mp_dag_reset(dag);
+    return 0;
+}
+
+/**
+ * Release a graph.
+ */
+void
+mp_dag_free(mp_dag *dag) {
+    free(dag->tasks);
+    free(dag->links);
+    free(dag->map);
+    free(dag->ready);
+    __builtin_memset(dag, 0, sizeof(*dag));
+}
+
+/**
+ * Submit a task.
+ *
+ * Reads are processed before writes, so a read-modify-write chunk
+ * waits for its last writer and the readers before it.
+ */
+int64_t
+mp_dag_submit(mp_dag *dag, const mp_dag_fn fn, void *arg, const mp_copos key,
+              const mp_copos *reads, const uint32_t nreads,
+              const mp_copos *writes, const uint32_t nwrites) {
+    if (dag->ntasks == DAG_NONE) return -1;
+    if (mp_dag_grow((void **) &dag->tasks, &dag->ctasks, dag->ntasks + 1, sizeof(mp_dag_task)) < 0)
+        return -1;
+
+    const uint32_t id = dag->ntasks;
+    dag->tasks[id] = (mp_dag_task){fn, arg, key, 0, DAG_NONE};
+
+    for (uint32_t i = 0; i < nreads; i++) {
+        mp_dag_slot *slot = mp_dag_slot_get(dag, reads[i]);
+        if (!slot || mp_dag_edge(dag, slot->writer, id) < 0) return -1;
+        if (mp_dag_link_push(dag, &slot->readers, id) < 0) return -1;
+    }
+
+    for (uint32_t i = 0; i < nwrites; i++) {
+        mp_dag_slot *slot = mp_dag_slot_get(dag, writes[i]);
+        if (!slot || mp_dag_edge(dag, slot->writer, id) < 0) return -1;
+
+        /* links may move inside mp_dag_edge(): walk by index */
+        for (uint32_t r = slot->readers; r != DAG_NONE; r = dag->links[r].next)
+            if (mp_dag_edge(dag, dag->links[r].task, id) < 0) return -1;
+
+        slot->writer = id;
+        slot->readers = DAG_NONE;
+    }
+
+    dag->ntasks += 1;
+    return id;
+}
+
+/**
+ * Run every submitted task and empty the graph.
+ */
+int32_t
+mp_dag_run(mp_dag *dag, mp_sched *sched) {
+    const uint32_t n = dag->ntasks;
+    if (n == 0) return 0;
+
+    uint32_t *ready = realloc(dag->ready, n * sizeof(uint32_t));
+    if (!ready) return -1;
+    dag->ready = ready;
+
+    uint64_t first = 0;
+    for (uint32_t i = 0; i < n; i++)
+        if (dag->tasks[i].pending == 0) ready[first++] = i;
+
+    dag->nready = first;
+    dag->sched = sched;
+    mp_sched_loop(sched, n, first, 1, mp_dag_exec, dag);
+
+    mp_dag_reset(dag);
+    return 0;
+}
@@ -0,0 +1,178 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_dag.h
+ *  Description:  Task graphs over chunks, run on the work-stealing pool.
+ *
+ *  Blocked algorithms (LU / elimination mod p, triangular solves) are
+ *  submitted as a sequence of tasks, each keyed by a chunk and declaring
+ *  the chunks it reads and writes. Dependencies follow from submission
+ *  order, per chunk:
+ *
+ *      read  after write   →  waits for the last writer
+ *      write after read    →  waits for every reader since that write
+ *      write after write   →  waits for the last writer
+ *
+ *  so the parallel run computes exactly what running the tasks one by
+ *  one in submission order would. mp_dag_run() starts with the tasks
+ *  that depend on nothing; whenever a task finishes, the successors it
+ *  releases are appended to the ready list and spawned on the deque of
+ *  the worker that released them (see mp_sched_loop()). No phase
+ *  barriers: e.g. the trailing update of LU step k overlaps with the
+ *  panel of step k + 1.
+ *
+ *  Design goals:
+ *   - O(1) amortized dependency tracking per declared access
+ *     (open-addressing map from mp_copos to its access state)
+ *   - Tasks, edges and ready list in flat growable arrays, reused by
+ *     the next graph
+ *   - Released successors stay on the releasing worker, whose caches
+ *     hold the chunks they were just written to
+ *
+ *  Notes:
+ *   - Build, then run: tasks are submitted by one thread, before
+ *     mp_dag_run(), which empties the graph when it is done
+ *   - Task functions run concurrently and follow the rules of
+ *     mp_sched.h kernels (no pool or tree access; find chunks first)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_DAG_H
+#define QDEEP_MATRIXP_DAG_H
+
+#include "mp_chunk.h"
+#include "mp_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Initial capacity of the chunk map (power of two) */
+#define DAG_MAP 256
+
+/** No task */
+#define DAG_NONE UINT32_MAX
+
+/** Released successors buffered before they are spawned */
+#define DAG_BATCH 32
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Task body: key is the chunk the task was submitted for.
+ */
+typedef void (*mp_dag_fn)(void *arg, mp_copos key, uint32_t worker);
+
+/**
+ * Submitted task.
+ */
+typedef struct mp_dag_task {
+    mp_dag_fn fn;      /**< Body */
+    void *arg;         /**< Body argument */
+    mp_copos key;      /**< Chunk the task belongs to */
+    uint32_t pending;  /**< Unfinished predecessors */
+    uint32_t succ;     /**< First outgoing edge, DAG_NONE if none */
+} mp_dag_task;
+
+/**
+ * Edge or reader list node: a task id and the next node.
+ */
+typedef struct mp_dag_link {
+    uint32_t task;
+    uint32_t next;
+} mp_dag_link;
+
+/**
+ * Access state of one chunk during submission.
+ */
+typedef struct mp_dag_slot {
+    mp_copos key;      /**< Chunk, UINT64_MAX if the slot is empty */
+    uint32_t writer;   /**< Last writer, DAG_NONE if none */
+    uint32_t readers;  /**< Readers since that write (link list) */
+} mp_dag_slot;
+
+/**
+ * Task graph.
+ */
+typedef struct mp_dag {
+    mp_dag_task *tasks;  /**< Submitted tasks */
+    uint32_t ntasks;
+    uint32_t ctasks;
+
+    mp_dag_link *links;  /**< Edges and reader lists */
+    uint32_t nlinks;
+    uint32_t clinks;
+
+    mp_dag_slot *map;    /**< Chunk access states (open addressing) */
+    uint32_t nmap;       /**< Used slots */
+    uint32_t cmap;       /**< Slots (power of two) */
+
+    uint32_t *ready;     /**< Ready list, grows while running */
+    uint64_t nready;     /**< Entries appended so far */
+    mp_sched *sched;     /**< Scheduler of the running graph */
+} mp_dag;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Initialize an empty graph.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+int32_t
+mp_dag_init(mp_dag *dag);
+
+/**
+ * Release a graph.
+ */
+void
+mp_dag_free(mp_dag *dag);
+
+/**
+ * Submit a task reading `reads` and writing `writes`.
+ *
+ * A chunk may appear in both lists (read-modify-write). The task runs
+ * after every earlier task it conflicts with on any of these chunks.
+ *
+ * Returns:
+ *   Task id, or -1 on allocation failure (the graph can then only be
+ *   freed)
+ */
+int64_t
+mp_dag_submit(mp_dag *dag, mp_dag_fn fn, void *arg, mp_copos key,
+              const mp_copos *reads, uint32_t nreads,
+              const mp_copos *writes, uint32_t nwrites);
+
+/**
+ * Run every submitted task on sched and empty the graph.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure (nothing was run, the graph is kept)
+ */
+int32_t
+mp_dag_run(mp_dag *dag, mp_sched *sched);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_DAG_H */
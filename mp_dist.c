@@ -0,0 +1,620 @@
+#include "mp_dist.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "mp_stream.h"
+
+
+/* ============================================================================
+ *  Header helpers
+ * ============================================================================
+ */
+
+/**
+ * Encode a 32-byte command header.
+ */
+static void
+mp_dist_pack(uint8_t *out, const uint64_t op, const uint64_t opos,
+             const uint64_t csize, const uint64_t arg) {
+    mp_stream_pack(out, op, opos);
+    mp_stream_pack(out + 16, csize, arg);
+}
+
+/**
+ * Send a command header without payload.
+ */
+static int32_t
+mp_dist_cmd(const int32_t fd, const uint64_t op, const uint64_t opos,
+            const uint64_t csize, const uint64_t arg) {
+    uint8_t hdr[DIST_HDR];
+    mp_dist_pack(hdr, op, opos, csize, arg);
+    return mp_stream_write(fd, hdr, DIST_HDR);
+}
+
+
+/* ============================================================================
+ *  Worker cache mirror
+ * ============================================================================
+ */
+
+/** Hash slots of a cache mirror (power of two, 50% max load) */
+#define DIST_SLOT_BITS 13
+#define DIST_SLOTS (1 << DIST_SLOT_BITS)
+
+_Static_assert(DIST_SLOTS >= 2 * DIST_CACHE, "cache mirror load factor above 50%");
+_Static_assert(DIST_PART >= 1, "cache too small for one (A, B) pair");
+
+/** Empty hash slot */
+#define DIST_NONE UINT64_MAX
+
+/**
+ * Coordinator-side copy of a worker's cache contents.
+ *
+ * Keys are opos with the matrix selector folded into the top bit.
+ * Eviction order is FIFO through a ring of keys. A key whose mark
+ * equals epoch belongs to the task part being assembled and is not
+ * evicted.
+ */
+typedef struct mp_dist_cache {
+    uint64_t slot[DIST_SLOTS]; /**< Open-addressing key set */
+    uint32_t mark[DIST_SLOTS]; /**< Epoch of the last use of each slot */
+    uint64_t ring[DIST_CACHE]; /**< Keys in insertion order */
+    uint32_t head;             /**< Oldest ring entry */
+    uint32_t size;             /**< Number of cached chunks */
+    uint32_t epoch;            /**< Current task part (numbered from 1) */
+} mp_dist_cache;
+
+/**
+ * Home slot of a key (Fibonacci hashing).
+ */
+static __inline__ uint32_t
+mp_dist_home(const uint64_t key) {
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> (64 - DIST_SLOT_BITS));
+}
+
+/**
+ * Find the slot holding key, or the empty slot where it would go.
+ */
+static uint32_t
+mp_dist_probe(const mp_dist_cache *cache, const uint64_t key) {
+    uint32_t i = mp_dist_home(key);
+    while (cache->slot[i] != DIST_NONE && cache->slot[i] != key)
+        i = (i + 1) & (DIST_SLOTS - 1);
+    return i;
+}
+
+/**
+ * Remove a key, shifting back the following cluster.
+ */
+static void
+mp_dist_erase(mp_dist_cache *cache, const uint64_t key) {
+    uint32_t i = mp_dist_probe(cache, key);
+    if (cache->slot[i] == DIST_NONE) return;
+
+    for (uint32_t j = (i + 1) & (DIST_SLOTS - 1);
+         cache->slot[j] != DIST_NONE;
+         j = (j + 1) & (DIST_SLOTS - 1)) {
+        const uint32_t home = mp_dist_home(cache->slot[j]);
+
+        /* Move j into the hole at i if home is not cyclically in (i, j] */
+        if (((j - home) & (DIST_SLOTS - 1)) >= ((j - i) & (DIST_SLOTS - 1))) {
+            cache->slot[i] = cache->slot[j];
+            cache->mark[i] = cache->mark[j];
+            i = j;
+        }
+    }
+    cache->slot[i] = DIST_NONE;
+}
+
+/**
+ * Make sure a worker holds a chunk, shipping it if needed, and pin it
+ * for the current task part.
+ */
+static int32_t
+mp_dist_ensure(mp_dist_cache *cache, const int32_t fd,
+               const uint64_t which, const mp_chunk *chunk) {
+    const uint64_t key = chunk->opos.pos ^ (which << 63);
+
+    const uint32_t i = mp_dist_probe(cache, key);
+    if (cache->slot[i] == key) {
+        cache->mark[i] = cache->epoch;
+        return 0;
+    }
+
+    /* Evict the oldest entry that is not pinned */
+    if (cache->size == DIST_CACHE) {
+        uint32_t turns = 0;
+        while (cache->mark[mp_dist_probe(cache, cache->ring[cache->head])] == cache->epoch) {
+            /* the ring is full: the pinned oldest entry becomes the newest */
+            cache->head = (cache->head + 1) % DIST_CACHE;
+            if (++turns == DIST_CACHE) return -1;
+        }
+
+        const uint64_t old = cache->ring[cache->head];
+        const mp_copos opos = {.pos = old & ~(1ull << 63)};
+
+        if (mp_dist_cmd(fd, DIST_EVICT, opos.pos, 0, old >> 63) < 0) return -1;
+
+        mp_dist_erase(cache, old);
+        cache->head = (cache->head + 1) % DIST_CACHE;
+        cache->size -= 1;
+    }
+
+    const uint32_t slot = mp_dist_probe(cache, key);
+    cache->slot[slot] = key;
+    cache->mark[slot] = cache->epoch;
+    cache->ring[(cache->head + cache->size) % DIST_CACHE] = key;
+    cache->size += 1;
+
+    if (mp_dist_cmd(fd, DIST_LOAD, chunk->opos.pos, chunk->size.size, which) < 0) return -1;
+    return mp_chunk_send(chunk, fd);
+}
+
+
+/* ============================================================================
+ *  Coordinator: result collection
+ * ============================================================================
+ */
+
+/**
+ * Arguments of the result collector thread.
+ */
+typedef struct mp_dist_sink {
+    mp_matrix *c;
+    const int32_t *fds;
+    uint32_t n;
+    int32_t ret;
+} mp_dist_sink;
+
+/**
+ * Collect result chunks from all workers into C.
+ *
+ * Runs on its own thread so that workers never block on a full
+ * socket while the coordinator is still sending them commands.
+ */
+static void *
+mp_dist_collect(void *arg) {
+    mp_dist_sink *sink = arg;
+    struct pollfd *pfd = malloc(sink->n * sizeof(struct pollfd));
+    uint32_t open = sink->n;
+
+    sink->ret = pfd ? 0 : -1;
+    if (!pfd) return NULL;
+
+    for (uint32_t i = 0; i < sink->n; i++) {
+        pfd[i].fd = sink->fds[i];
+        pfd[i].events = POLLIN;
+    }
+
+    while (open > 0) {
+        if (poll(pfd, sink->n, -1) == -1) {
+            if (errno == EINTR) continue;
+            goto fail;
+        }
+
+        for (uint32_t i = 0; i < sink->n; i++) {
+            if (!pfd[i].revents) continue;
+
+            uint8_t frame[STREAM_FRAME];
+            uint64_t a, b;
+            if (mp_stream_read(pfd[i].fd, frame, STREAM_FRAME) < 0) goto fail;
+            mp_stream_unpack(frame, &a, &b);
+
+            if (a == MP_STREAM_END) {
+                pfd[i].fd = -1; /* poll ignores negative descriptors */
+                open -= 1;
+                continue;
+            }
+
+            const mp_copos opos = {.pos = a};
+            const mp_csize size = {.size = (uint16_t) b};
+            if (b > UINT16_MAX || !mp_stream_valid(sink->c, opos, size)) goto fail;
+
+            const mp_chunk *chunk = mp_matrix_chunk_write(sink->c, opos);
+            if (!chunk || mp_chunk_recv(chunk, pfd[i].fd) < 0) goto fail;
+        }
+    }
+
+    free(pfd);
+    return NULL;
+
+fail:
+    /* fail the sends of the coordinator too, instead of leaving it
+     * blocked on workers that wait for their results to be read */
+    for (uint32_t i = 0; i < sink->n; i++) shutdown(sink->fds[i], SHUT_RDWR);
+
+    sink->ret = -1;
+    free(pfd);
+    return NULL;
+}
+
+
+/* ============================================================================
+ *  Coordinator: scheduling
+ * ============================================================================
+ */
+
+/**
+ * Pick a pr × pc worker grid with pr the largest divisor ≤ √n.
+ */
+static uint32_t
+mp_dist_grid(const uint32_t n) {
+    uint32_t pr = 1;
+    for (uint32_t d = 1; d * d <= n; d++)
+        if (n % d == 0) pr = d;
+    return pr;
+}
+
+/**
+ * (A chunk, B chunk) pair contributing to an output block.
+ */
+typedef struct mp_dist_pair {
+    const mp_chunk *a;
+    const mp_chunk *b;
+} mp_dist_pair;
+
+/**
+ * Schedule all output blocks of block row i.
+ *
+ * Contributions are bucketed by output block column j (counting sort),
+ * then every non-empty C(i, j) becomes one or more TASK parts on its
+ * grid owner.
+ */
+static int32_t
+mp_dist_row(const mp_gemm_index *ai, const mp_gemm_index *bi, const uint64_t i,
+            const int32_t *fds, mp_dist_cache *cache, const uint32_t pr, const uint32_t pc,
+            uint64_t *cnt, const uint64_t cols, mp_dist_pair **pairs, uint64_t *cap,
+            uint8_t **msg, uint64_t *mcap) {
+    uint64_t total = 0;
+    __builtin_memset(cnt, 0, (cols + 1) * sizeof(uint64_t));
+
+    /* count contributions per output column */
+    for (uint64_t p = ai->row[i]; p < ai->row[i + 1]; p++) {
+        const uint64_t k = ai->chunks[p]->opos.dim.x;
+        for (uint64_t q = bi->row[k]; q < bi->row[k + 1]; q++) {
+            cnt[bi->chunks[q]->opos.dim.x + 1] += 1;
+            total += 1;
+        }
+    }
+    if (total == 0) return 0;
+
+    if (total > *cap) {
+        free(*pairs);
+        *pairs = malloc(total * sizeof(mp_dist_pair));
+        *cap = *pairs ? total : 0;
+        if (!*pairs) return -1;
+    }
+
+    for (uint64_t j = 0; j < cols; j++) cnt[j + 1] += cnt[j];
+
+    /* bucket pairs, cnt[j] becomes the end of bucket j */
+    for (uint64_t p = ai->row[i]; p < ai->row[i + 1]; p++) {
+        const mp_chunk *ac = ai->chunks[p];
+        const uint64_t k = ac->opos.dim.x;
+        for (uint64_t q = bi->row[k]; q < bi->row[k + 1]; q++) {
+            const mp_chunk *bc = bi->chunks[q];
+            (*pairs)[cnt[bc->opos.dim.x]++] = (mp_dist_pair){ac, bc};
+        }
+    }
+
+    uint64_t start = 0;
+    for (uint64_t j = 0; j < cols; j++) {
+        const uint64_t end = cnt[j];
+        if (end == start) continue;
+
+        const uint32_t w = (uint32_t) ((i % pr) * pc + j % pc);
+        const mp_copos opos = {.dim = {(uint32_t) j, (uint32_t) i}};
+
+        /* parts of at most DIST_PART k blocks, so their chunks fit the cache */
+        for (uint64_t lo = start; lo < end; lo += DIST_PART) {
+            const uint64_t hi = end - lo > DIST_PART ? lo + DIST_PART : end;
+            const uint64_t ks = hi - lo;
+
+            cache[w].epoch += 1;
+            for (uint64_t p = lo; p < hi; p++) {
+                if (mp_dist_ensure(&cache[w], fds[w], DIST_A, (*pairs)[p].a) < 0) return -1;
+                if (mp_dist_ensure(&cache[w], fds[w], DIST_B, (*pairs)[p].b) < 0) return -1;
+            }
+
+            const uint64_t bytes = DIST_HDR + ks * sizeof(uint64_t);
+            if (bytes > *mcap) {
+                free(*msg);
+                *msg = malloc(bytes);
+                *mcap = *msg ? bytes : 0;
+                if (!*msg) return -1;
+            }
+
+            mp_dist_pack(*msg, DIST_TASK, opos.pos, hi < end, ks);
+
+            uint64_t *kv = (uint64_t *) (*msg + DIST_HDR);
+            for (uint64_t p = lo; p < hi; p++)
+                kv[p - lo] = htobe64((*pairs)[p].a->opos.dim.x);
+
+            if (mp_stream_write(fds[w], *msg, bytes) < 0) return -1;
+        }
+        start = end;
+    }
+
+    return 0;
+}
+
+/**
+ * Coordinator: compute C = A · B on n workers connected through fds.
+ */
+int32_t
+mp_dist_gemm(mp_matrix *c, mp_matrix *a, mp_matrix *b,
+             const int32_t *fds, const uint32_t n) {
+    if (a->size.x != b->size.y || n == 0 || n > DIST_WORKERS) return -1;
+
+    mp_matrix_free(c);
+    if (mp_matrix_set_size(c, (mp_msize){b->size.x, a->size.y}) < 0) return -1;
+
+    const uint32_t pr = mp_dist_grid(n);
+    const uint32_t pc = n / pr;
+    const uint64_t cols = (b->size.x + CHUNK_W - 1) >> CHUNK_POW;
+
+    mp_gemm_index ai, bi;
+    if (mp_gemm_index_init(&ai, a) < 0) return -1;
+    if (mp_gemm_index_init(&bi, b) < 0) {
+        mp_gemm_index_free(&ai);
+        return -1;
+    }
+
+    int32_t ret = -1;
+    mp_dist_pair *pairs = NULL;
+    uint8_t *msg = NULL;
+    uint64_t cap = 0, mcap = 0;
+
+    mp_dist_cache *cache = malloc(n * sizeof(mp_dist_cache));
+    uint64_t *cnt = malloc((cols + 1) * sizeof(uint64_t));
+    if (!cache || !cnt) goto end;
+
+    for (uint32_t w = 0; w < n; w++) {
+        __builtin_memset(cache[w].slot, 0xFF, sizeof(cache[w].slot));
+        __builtin_memset(cache[w].mark, 0, sizeof(cache[w].mark));
+        cache[w].head = 0;
+        cache[w].size = 0;
+        cache[w].epoch = 0;
+    }
+
+    /* Announce the job */
+    uint8_t job[DIST_HDR * 2];
+    mp_dist_pack(job, DIST_JOB, 0, 0, 0);
+    mp_dist_pack(job + DIST_HDR, a->size.x, a->size.y, b->size.x, b->size.y);
+
+    for (uint32_t w = 0; w < n; w++)
+        if (mp_stream_write(fds[w], job, sizeof(job)) < 0) goto end;
+
+    /* Results are collected concurrently */
+    mp_dist_sink sink = {c, fds, n, 0};
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, mp_dist_collect, &sink) != 0) goto end;
+
+    int32_t sent = 0;
+    for (uint64_t i = 0; i < ai.rows && sent == 0; i++)
+        sent = mp_dist_row(&ai, &bi, i, fds, cache, pr, pc, cnt, cols,
+                           &pairs, &cap, &msg, &mcap);
+
+    for (uint32_t w = 0; w < n; w++)
+        if (mp_dist_cmd(fds[w], DIST_END, 0, 0, 0) < 0) sent = -1;
+
+    /* On send failure the peers are broken; unblock the collector */
+    if (sent < 0)
+        for (uint32_t w = 0; w < n; w++) shutdown(fds[w], SHUT_RD);
+
+    pthread_join(tid, NULL);
+    ret = sent < 0 || sink.ret < 0 ? -1 : 0;
+
+end:
+    free(msg);
+    free(pairs);
+    free(cnt);
+    free(cache);
+    mp_gemm_index_free(&bi);
+    mp_gemm_index_free(&ai);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Worker
+ * ============================================================================
+ */
+
+/**
+ * Accumulate one TASK part of an output block, and send the block after
+ * its last part.
+ *
+ * *acc holds the block between parts; it is NULL when no block is open.
+ */
+static int32_t
+mp_dist_task(const int32_t fd, mp_matrix *ma, mp_matrix *mb, const mp_matrix *mc,
+             mp_chunk **acc, const mp_copos opos, const uint64_t more, const uint64_t ks) {
+    uint64_t kv[64];
+
+    /* parts of one block arrive back to back */
+    if (*acc && (*acc)->opos.pos != opos.pos) return -1;
+
+    if (!*acc) {
+        *acc = mp_pool_get(ma->pool);
+        if (!*acc) return -1;
+
+        (*acc)->opos = opos;
+        mp_chunk_set_size(*acc, mp_matrix_csize(mc, opos));
+
+        const uint64_t row = ((*acc)->size.dim.x + 1) * sizeof(int64_t);
+        for (uint32_t y = 0; y <= (*acc)->size.dim.y; y++)
+            __builtin_memset((*acc)->data + CHUNK_POS(0, y), 0, row);
+    }
+
+    mp_chunk *cc = *acc;
+    int32_t ret = 0;
+    for (uint64_t done = 0; done < ks && ret == 0;) {
+        const uint64_t m = ks - done > 64 ? 64 : ks - done;
+        if (mp_stream_read(fd, (uint8_t *) kv, m * sizeof(uint64_t)) < 0) {
+            ret = -1;
+            break;
+        }
+
+        for (uint64_t t = 0; t < m; t++) {
+            const uint32_t k = (uint32_t) be64toh(kv[t]);
+            const mp_chunk *ac = mp_matrix_chunk_find(ma, (mp_copos){.dim = {k, opos.dim.y}});
+            const mp_chunk *bc = mp_matrix_chunk_find(mb, (mp_copos){.dim = {opos.dim.x, k}});
+
+            /* coordinator ships every chunk before the task referencing it */
+            if (!ac || !bc) {
+                ret = -1;
+                break;
+            }
+            mp_gemm_chunk(cc, ac, bc);
+        }
+        done += m;
+    }
+
+    if (ret == 0 && more) return 0;
+
+    if (ret == 0) {
+        uint8_t frame[STREAM_FRAME];
+        mp_stream_pack(frame, cc->opos.pos, cc->size.size);
+        ret = mp_stream_write(fd, frame, STREAM_FRAME) < 0 || mp_chunk_send(cc, fd) < 0 ? -1 : 0;
+    }
+
+    mp_pool_ret(ma->pool, cc);
+    *acc = NULL;
+    return ret;
+}
+
+/**
+ * Worker: serve jobs from the coordinator on fd until it disconnects.
+ */
+int32_t
+mp_dist_worker(const int32_t fd, mp_pool *pool) {
+    mp_matrix m[3]; /* A, B and an empty C used for chunk sizes */
+    for (uint32_t i = 0; i < 3; i++) mp_matrix_init(&m[i], pool);
+
+    mp_chunk *acc = NULL; /* output block between TASK parts */
+
+    uint8_t hdr[DIST_HDR * 2];
+    uint64_t op, opos, csize, arg;
+    int32_t ret = -1;
+
+    while (1) {
+        const int64_t got = recv(fd, hdr, DIST_HDR, MSG_WAITALL);
+        if (got == 0) {
+            ret = 0; /* coordinator closed the connection */
+            break;
+        }
+        if (got != DIST_HDR) break;
+
+        mp_stream_unpack(hdr, &op, &opos);
+        mp_stream_unpack(hdr + 16, &csize, &arg);
+
+        const mp_copos pos = {.pos = opos};
+        const mp_csize size = {.size = (uint16_t) csize};
+
+        /* only further parts may follow an unfinished block */
+        if (acc && op != DIST_LOAD && op != DIST_EVICT && op != DIST_TASK) break;
+
+        if (op == DIST_JOB) {
+            uint64_t ax, ay, bx, by;
+            if (mp_stream_read(fd, hdr, DIST_HDR) < 0) break;
+            mp_stream_unpack(hdr, &ax, &ay);
+            mp_stream_unpack(hdr + 16, &bx, &by);
+
+            for (uint32_t i = 0; i < 3; i++) mp_matrix_free(&m[i]);
+            if (mp_matrix_set_size(&m[DIST_A], (mp_msize){ax, ay}) < 0 ||
+                mp_matrix_set_size(&m[DIST_B], (mp_msize){bx, by}) < 0 ||
+                mp_matrix_set_size(&m[2], (mp_msize){bx, ay}) < 0)
+                break;
+        } else if (op == DIST_LOAD) {
+            if (arg > DIST_B || csize > UINT16_MAX || !mp_stream_valid(&m[arg], pos, size)) break;
+
+            const mp_chunk *chunk = mp_matrix_chunk_write(&m[arg], pos);
+            if (!chunk || mp_chunk_recv(chunk, fd) < 0) break;
+        } else if (op == DIST_EVICT) {
+            if (arg > DIST_B) break;
+            mp_matrix_chunk_drop(&m[arg], pos);
+        } else if (op == DIST_TASK) {
+            if (!mp_matrix_contains(&m[2], pos)) break;
+            if (mp_dist_task(fd, &m[DIST_A], &m[DIST_B], &m[2], &acc, pos, csize, arg) < 0) break;
+        } else if (op == DIST_END) {
+            uint8_t frame[STREAM_FRAME];
+            mp_stream_pack(frame, MP_STREAM_END, 0);
+            if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) break;
+        } else {
+            break;
+        }
+    }
+
+    if (acc) mp_pool_ret(pool, acc);
+    for (uint32_t i = 0; i < 3; i++) mp_matrix_free(&m[i]);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Local processes
+ * ============================================================================
+ */
+
+/**
+ * Run a job on n freshly forked local worker processes.
+ */
+int32_t
+mp_dist_local(mp_matrix *c, mp_matrix *a, mp_matrix *b, const uint32_t n) {
+    if (n == 0 || n > DIST_WORKERS) return -1;
+
+    int32_t *fds = malloc(n * sizeof(int32_t));
+    pid_t *pid = malloc(n * sizeof(pid_t));
+    uint32_t started = 0;
+    int32_t ret = -1;
+
+    if (!fds || !pid) goto end;
+
+    for (; started < n; started++) {
+        int32_t sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) goto join;
+
+        pid[started] = fork();
+        if (pid[started] == -1) {
+            close(sv[0]);
+            close(sv[1]);
+            goto join;
+        }
+
+        if (pid[started] == 0) {
+            /* child: drop coordinator ends, serve one connection */
+            for (uint32_t i = 0; i < started; i++) close(fds[i]);
+            close(sv[0]);
+
+            mp_pool pool;
+            mp_pool_init(&pool);
+            const int32_t res = mp_dist_worker(sv[1], &pool);
+            mp_pool_free(&pool);
+            _exit(res == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        close(sv[1]);
+        fds[started] = sv[0];
+    }
+
+    ret = mp_dist_gemm(c, a, b, fds, n);
+
+join:
+    for (uint32_t i = 0; i < started; i++) close(fds[i]);
+    for (uint32_t i = 0; i < started; i++) {
+        int32_t status;
+        if (waitpid(pid[i], &status, 0) == -1 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != EXIT_SUCCESS)
+            ret = -1;
+    }
+
+end:
+    free(pid);
+    free(fds);
+    return ret;
+}
@@ -0,0 +1,136 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_dist.h
+ *  Description:  Distributed block-sparse GEMM over worker processes.
+ *
+ *  Roles:
+ *    - Coordinator: owns A, B and C; splits C = A · B into output chunk
+ *      tasks, ships the A / B chunks each worker lacks, collects results
+ *    - Worker: keeps a chunk cache of A and B, computes C(i, j) blocks
+ *      with mp_gemm_chunk() and streams them back
+ *
+ *  Placement (2D / SUMMA-style):
+ *
+ *      workers form a pr × pc grid, C(i, j) -> worker (i mod pr, j mod pc)
+ *
+ *  so every A chunk of block row i is needed by at most pc workers and
+ *  every B chunk of block column j by at most pr workers. The
+ *  coordinator mirrors each worker's cache and only sends chunks that
+ *  are not already resident; the oldest entry is evicted when a cache
+ *  holds DIST_CACHE chunks. Chunks of the task being assembled are
+ *  pinned: eviction passes over them until its TASK is written.
+ *
+ *  An output block with more than DIST_PART k blocks is sent as several
+ *  TASK parts; the worker accumulates the parts of a block in one chunk
+ *  and sends it back after the last one (more = 0).
+ *
+ *  Wire format (coordinator -> worker), 32-byte big-endian headers:
+ *
+ *      [ JOB   | 0    | 0     | 0     ] [ A.x | A.y | B.x | B.y ]
+ *      [ LOAD  | opos | csize | which ] payload
+ *      [ EVICT | opos | 0     | which ]
+ *      [ TASK  | opos | more  | n     ] n × k (u64)
+ *      [ END   | 0    | 0     | 0     ]
+ *
+ *  Results (worker -> coordinator) are chunk-stream frames
+ *  ([ opos | csize ] payload), closed by an MP_STREAM_END frame.
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_DIST_H
+#define QDEEP_MATRIXP_DIST_H
+
+#include "mp_gemm.h"
+#include "mp_matrix.h"
+#include "mp_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/**
+ * Chunks cached per worker (A and B together).
+ *
+ * 4096 × 512 KB = 2 GB per worker. Tests build with a small cache.
+ */
+#ifndef DIST_CACHE
+#define DIST_CACHE 4096
+#endif
+
+/**
+ * k blocks per TASK part: the A and B chunks of a part fit the cache.
+ */
+#define DIST_PART (DIST_CACHE / 2)
+
+/** Maximum number of workers */
+#define DIST_WORKERS 1024
+
+/** Command header size */
+#define DIST_HDR 32
+
+#define DIST_JOB   1
+#define DIST_LOAD  2
+#define DIST_EVICT 3
+#define DIST_TASK  4
+#define DIST_END   5
+
+/** Matrix selector of LOAD / EVICT */
+#define DIST_A 0
+#define DIST_B 1
+
+
+/* ============================================================================
+ *  Roles
+ * ============================================================================
+ */
+
+/**
+ * Coordinator: compute C = A · B on n workers connected through fds.
+ *
+ * C is cleared and resized to (B.x, A.y). The worker connections stay
+ * open and can be reused for further jobs.
+ *
+ * @return  0 on success
+ * @return -1 on size mismatch, I/O failure or allocation failure
+ */
+int32_t
+mp_dist_gemm(mp_matrix *c, mp_matrix *a, mp_matrix *b,
+             const int32_t *fds, uint32_t n);
+
+/**
+ * Worker: serve jobs from the coordinator on fd until it disconnects.
+ *
+ * @return  0 when the coordinator closed the connection
+ * @return -1 on I/O failure or malformed command
+ */
+int32_t
+mp_dist_worker(int32_t fd, mp_pool *pool);
+
+/**
+ * Run a job on n freshly forked local worker processes.
+ *
+ * Convenience / testing entry point: workers are connected with
+ * socketpair() and exit after the job.
+ *
+ * @return  0 on success
+ * @return -1 on failure
+ */
+int32_t
+mp_dist_local(mp_matrix *c, mp_matrix *a, mp_matrix *b, uint32_t n);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_DIST_H */
@@ -0,0 +1,272 @@
+#include "mp_file.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mp_cold.h"
+
+
+/* ============================================================================
+ *  Internal helpers
+ * ============================================================================
+ */
+
+/**
+ * Positional read / write of exactly len bytes.
+ *
+ * A short read past EOF fills the rest with zeros (tile beyond the
+ * last written one).
+ */
+static int32_t
+mp_file_io(const int32_t fd, uint8_t *buf, const uint64_t len, uint64_t off,
+           const uint8_t write_) {
+    uint64_t done = 0;
+
+    while (done < len) {
+        const int64_t ret = write_ ? pwrite(fd, buf + done, len - done, (off_t) off)
+                                   : pread(fd, buf + done, len - done, (off_t) off);
+
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (ret == 0 && !write_) {
+                __builtin_memset(buf + done, 0, len - done);
+                return 0;
+            }
+            if (ret < 0 && errno == EINTR) continue;
+            return -1;
+        }
+
+        done += (uint64_t) ret;
+        off += (uint64_t) ret;
+    }
+    return 0;
+}
+
+/**
+ * Check that chunk I/O is possible for this matrix and offset.
+ */
+static int32_t
+mp_file_check(const mp_matrix *matx, const mp_copos opos) {
+    return matx->fd != -1 && (matx->flags & MP_MATRIX_TILED) && mp_matrix_contains(matx, opos);
+}
+
+
+/* ============================================================================
+ *  Header
+ * ============================================================================
+ */
+
+/**
+ * Read the header page of a tiled file.
+ */
+int32_t
+mp_file_header_read(const int32_t fd, mp_msize *size) {
+    _Alignas(FILE_HEAD) uint8_t page[FILE_HEAD];
+
+    const int64_t ret = pread(fd, page, FILE_HEAD, 0);
+    if (ret == 0) {
+        *size = (mp_msize){0, 0};
+        return 0;
+    }
+
+    if (ret != FILE_HEAD || memcmp(page, FILE_MAGIC, 8) != 0) return -1;
+
+    __builtin_memcpy(size, page + 8, sizeof(mp_msize));
+    return 0;
+}
+
+/**
+ * Resize a tiled file and rewrite its header page.
+ */
+int32_t
+mp_file_resize(const int32_t fd, const mp_msize size) {
+    _Alignas(FILE_HEAD) uint8_t page[FILE_HEAD] = {0};
+
+    __builtin_memcpy(page, FILE_MAGIC, 8);
+    __builtin_memcpy(page + 8, &size, sizeof(mp_msize));
+
+    if (ftruncate(fd, (off_t) mp_file_length(size)) == -1) return -1;
+    return mp_file_io(fd, page, FILE_HEAD, 0, 1);
+}
+
+
+/* ============================================================================
+ *  Chunk I/O
+ * ============================================================================
+ */
+
+/**
+ * Read the tile of chunk->opos into chunk->data.
+ */
+int32_t
+mp_file_chunk_load(const mp_matrix *matx, mp_chunk *chunk) {
+    if (!mp_file_check(matx, chunk->opos)) return -1;
+
+    mp_chunk_set_size(chunk, mp_matrix_csize(matx, chunk->opos));
+    return mp_file_io(matx->fd, (uint8_t *) chunk->data, CHUNK_BYTES,
+                      mp_file_offset(mp_file_tile(matx->size, chunk->opos)), 0);
+}
+
+/**
+ * Write chunk->data to its tile.
+ */
+int32_t
+mp_file_chunk_store(const mp_matrix *matx, const mp_chunk *chunk) {
+    if (!mp_file_check(matx, chunk->opos)) return -1;
+    return mp_file_tile_write(matx->fd, matx->size, chunk->opos, chunk->data);
+}
+
+/**
+ * Write a chunk buffer to the tile of opos.
+ */
+int32_t
+mp_file_tile_write(const int32_t fd, const mp_msize size, const mp_copos opos,
+                   const int64_t *data) {
+    return mp_file_io(fd, (uint8_t *) data, CHUNK_BYTES,
+                      mp_file_offset(mp_file_tile(size, opos)), 1);
+}
+
+/**
+ * Turn count tiles starting at tile into holes.
+ */
+int32_t
+mp_file_tile_clear(const int32_t fd, const uint64_t tile, const uint64_t count) {
+    if (count == 0) return 0;
+
+    const uint64_t off = mp_file_offset(tile);
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t) off, (off_t) (count * CHUNK_BYTES)) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS) return -1;
+
+    /* page aligned for O_DIRECT descriptors */
+    static _Alignas(FILE_HEAD) const uint8_t zero[CHUNK_BYTES];
+
+    for (uint64_t i = 0; i < count; i++)
+        if (mp_file_io(fd, (uint8_t *) zero, CHUNK_BYTES, off + i * CHUNK_BYTES, 1) < 0) return -1;
+    return 0;
+}
+
+/**
+ * Find the first tile at or after tile that contains data.
+ */
+int64_t
+mp_file_next_tile(const mp_matrix *matx, const uint64_t tile) {
+    const uint64_t tiles = mp_file_ncx(matx->size) * mp_file_ncy(matx->size);
+    if (tile >= tiles) return -1;
+
+    const off_t pos = lseek(matx->fd, (off_t) mp_file_offset(tile), SEEK_DATA);
+    if (pos == -1) return errno == ENXIO ? -1 : (int64_t) tile;
+
+    const uint64_t next = ((uint64_t) pos - FILE_HEAD) / CHUNK_BYTES;
+    return next < tiles ? (int64_t) next : -1;
+}
+
+/**
+ * Load every non-hole tile into matx as pool chunks.
+ *
+ * Buffered sequential loads keep the next matx->ahead tiles under
+ * POSIX_FADV_WILLNEED, refilling the window when half of it is consumed.
+ * O_DIRECT loads bypass the page cache, so there is nothing to prefetch.
+ */
+int32_t
+mp_file_load(mp_matrix *matx) {
+    if (matx->fd == -1 || !(matx->flags & MP_MATRIX_TILED)) return -1;
+
+    const uint64_t ncx = mp_file_ncx(matx->size);
+    const uint64_t tiles = ncx * mp_file_ncy(matx->size);
+    const uint8_t prefetch = matx->ahead && matx->access != MP_ACCESS_RANDOM &&
+                             !(matx->flags & MP_MATRIX_DIRECT);
+    uint64_t hinted = 0; /* tiles [0, hinted) already advised */
+
+    for (int64_t tile = mp_file_next_tile(matx, 0); tile != -1;
+         tile = mp_file_next_tile(matx, (uint64_t) tile + 1)) {
+        if (prefetch && (uint64_t) tile + matx->ahead / 2 >= hinted) {
+            const uint64_t from = (uint64_t) tile > hinted ? (uint64_t) tile : hinted;
+            const uint64_t to = (uint64_t) tile + matx->ahead < tiles ? (uint64_t) tile + matx->ahead : tiles;
+
+            if (to > from)
+                posix_fadvise(matx->fd, (off_t) mp_file_offset(from),
+                              (off_t) ((to - from) * CHUNK_BYTES), POSIX_FADV_WILLNEED);
+            hinted = to;
+        }
+
+        mp_chunk *chunk = mp_pool_get(matx->pool);
+        if (!chunk) return -1;
+
+        chunk->opos.dim.x = (uint32_t) ((uint64_t) tile % ncx);
+        chunk->opos.dim.y = (uint32_t) ((uint64_t) tile / ncx);
+
+        if (mp_file_chunk_load(matx, chunk) < 0) {
+            mp_pool_ret(matx->pool, chunk);
+            return -1;
+        }
+
+        mp_matrix_chunk_insert(matx, chunk);
+        chunk->gen = 0; /* identical to the file */
+    }
+    return 0;
+}
+
+/**
+ * Write every chunk of matx to its tile.
+ */
+int32_t
+mp_file_store(mp_matrix *matx) {
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));)
+        if (!(chunk = mp_cold_warm(matx, chunk)) || mp_file_chunk_store(matx, chunk) < 0) return -1;
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Prefetching scan
+ * ============================================================================
+ */
+
+/**
+ * Advise the tile of a mapped chunk; other chunks are already resident.
+ */
+static void
+mp_scan_hint(const mp_matrix *matx, const mp_chunk *chunk) {
+    const uint8_t *data = (const uint8_t *) chunk->data;
+    if (!matx->map || data < matx->map || data >= matx->map + matx->map_len) return;
+
+    /* tile offsets are FILE_HEAD aligned, hence page aligned */
+    madvise((void *) data, CHUNK_BYTES, MADV_WILLNEED);
+}
+
+/**
+ * Start a prefetching scan over matx.
+ */
+void
+mp_scan_init(mp_scan *scan, const mp_matrix *matx) {
+    scan->matx = matx;
+    mp_iter_init(&scan->iter, &matx->tree);
+    mp_iter_init(&scan->ahead, &matx->tree);
+
+    if (matx->access == MP_ACCESS_RANDOM) return;
+
+    /* prime the window */
+    for (uint32_t i = 0; i < matx->ahead; i++) {
+        const mp_chunk *chunk = mp_iter_next(&scan->ahead);
+        if (!chunk) break;
+        mp_scan_hint(matx, chunk);
+    }
+}
+
+/**
+ * Return the next chunk in opos order, or NULL when done.
+ */
+mp_chunk *
+mp_scan_next(mp_scan *scan) {
+    if (scan->matx->access != MP_ACCESS_RANDOM && scan->matx->ahead) {
+        const mp_chunk *chunk = mp_iter_next(&scan->ahead);
+        if (chunk) mp_scan_hint(scan->matx, chunk);
+    }
+    return mp_iter_next(&scan->iter);
+}
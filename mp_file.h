@@ -0,0 +1,255 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_file.h
+ *  Description:  Tiled on-disk matrix format and chunk-granular file I/O.
+ *
+ *  The dense backing file of mp_matrix_set_file() stores the matrix
+ *  row-major after a 16-byte header, so a chunk is scattered over 256
+ *  unaligned rows. The tiled format stores every chunk as one aligned
+ *  block instead:
+ *
+ *      offset 0          [ header page  (FILE_HEAD bytes)              ]
+ *      FILE_HEAD + k*T   [ tile k = chunk (k % ncx, k / ncx), T bytes  ]
+ *
+ *      T   = CHUNK_BYTES (full 256 × 256 buffer, border padding included)
+ *      ncx = ceil(size.x / CHUNK_W)
+ *
+ *  Design goals:
+ *   - One pread()/pwrite() per chunk, straight into / out of mp_cdata
+ *   - Every tile offset and length is a multiple of FILE_HEAD, and pool
+ *     chunk buffers are page aligned, so O_DIRECT works without bounce
+ *     buffers and without polluting the page cache
+ *   - Tiles never written stay file holes; loading skips them, so
+ *     sparse matrices stay sparse on disk and in memory
+ *   - Sequential scans prefetch matx->ahead tiles with WILLNEED
+ *     (see mp_matrix_set_access())
+ *
+ *  Notes:
+ *   - Header fields are host byte order, like the dense header
+ *   - Resizing changes ncx and therefore the tile layout; existing
+ *     tiles are not moved
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_FILE_H
+#define QDEEP_MATRIXP_FILE_H
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/**
+ * Header page size and alignment unit of the format.
+ *
+ * 4096 covers the logical block size of all common devices (O_DIRECT).
+ */
+#define FILE_HEAD 4096
+
+/** Magic at the start of the header page */
+#define FILE_MAGIC "MPTILE01"
+
+
+/* ============================================================================
+ *  Layout helpers
+ * ============================================================================
+ */
+
+/**
+ * Number of chunk columns of a matrix.
+ */
+static __inline__ uint64_t
+mp_file_ncx(const mp_msize size) {
+    return (size.x + CHUNK_W - 1) >> CHUNK_POW;
+}
+
+/**
+ * Number of chunk rows of a matrix.
+ */
+static __inline__ uint64_t
+mp_file_ncy(const mp_msize size) {
+    return (size.y + CHUNK_H - 1) >> CHUNK_POW;
+}
+
+/**
+ * Linear tile index of a chunk offset.
+ */
+static __inline__ uint64_t
+mp_file_tile(const mp_msize size, const mp_copos opos) {
+    return (uint64_t) opos.dim.y * mp_file_ncx(size) + opos.dim.x;
+}
+
+/**
+ * File offset of a tile.
+ */
+static __inline__ uint64_t
+mp_file_offset(const uint64_t tile) {
+    return FILE_HEAD + tile * CHUNK_BYTES;
+}
+
+/**
+ * Total file length for a matrix of the given size.
+ */
+static __inline__ uint64_t
+mp_file_length(const mp_msize size) {
+    return mp_file_offset(mp_file_ncx(size) * mp_file_ncy(size));
+}
+
+
+/* ============================================================================
+ *  Header
+ * ============================================================================
+ */
+
+/**
+ * Read the header page of a tiled file.
+ *
+ * An empty file reads as size {0, 0}.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure or if the file is not in tiled format
+ */
+int32_t
+mp_file_header_read(int32_t fd, mp_msize *size);
+
+/**
+ * Resize a tiled file and rewrite its header page.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure
+ */
+int32_t
+mp_file_resize(int32_t fd, mp_msize size);
+
+
+/* ============================================================================
+ *  Chunk I/O
+ * ============================================================================
+ */
+
+/**
+ * Read the tile of chunk->opos into chunk->data.
+ *
+ * Sets chunk->size to the effective size at that offset.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure or out of range offset
+ */
+int32_t
+mp_file_chunk_load(const mp_matrix *matx, mp_chunk *chunk);
+
+/**
+ * Write chunk->data to its tile.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure or out of range offset
+ */
+int32_t
+mp_file_chunk_store(const mp_matrix *matx, const mp_chunk *chunk);
+
+/**
+ * Write a chunk buffer to the tile of opos in a tiled file of the given size.
+ *
+ * Descriptor level variant of mp_file_chunk_store(), usable without a
+ * matrix (e.g. by snapshot writers).
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure
+ */
+int32_t
+mp_file_tile_write(int32_t fd, mp_msize size, mp_copos opos, const int64_t *data);
+
+/**
+ * Turn count tiles starting at tile into holes.
+ *
+ * Filesystems that cannot punch holes get zero tiles instead.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure
+ */
+int32_t
+mp_file_tile_clear(int32_t fd, uint64_t tile, uint64_t count);
+
+/**
+ * Find the first tile at or after tile that contains data.
+ *
+ * Uses SEEK_DATA; on filesystems without hole reporting every tile
+ * counts as data.
+ *
+ * Returns:
+ *   Tile index, or -1 if there is no further data
+ */
+int64_t
+mp_file_next_tile(const mp_matrix *matx, uint64_t tile);
+
+/**
+ * Load every non-hole tile into matx as pool chunks.
+ *
+ * Chunks already in the tree are replaced.
+ *
+ * @return  0 on success
+ * @return -1 on I/O or allocation failure
+ */
+int32_t
+mp_file_load(mp_matrix *matx);
+
+/**
+ * Write every chunk of matx to its tile.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure
+ */
+int32_t
+mp_file_store(mp_matrix *matx);
+
+
+/* ============================================================================
+ *  Prefetching scan
+ * ============================================================================
+ */
+
+/**
+ * In-order chunk iterator that prefetches the tiles of upcoming chunks.
+ *
+ * A second iterator runs matx->ahead chunks in front of the returned
+ * one; every chunk it passes that lives in a file mapping is advised
+ * MADV_WILLNEED, so page faults of the scan hit memory that is already
+ * being read. Pool chunks are in memory anyway and get no hint.
+ * With MP_ACCESS_RANDOM nothing is prefetched.
+ */
+typedef struct mp_scan {
+    const mp_matrix *matx;
+    mp_iter iter;  /**< Returned chunks */
+    mp_iter ahead; /**< Prefetch cursor */
+} mp_scan;
+
+/**
+ * Start a prefetching scan over matx.
+ */
+void
+mp_scan_init(mp_scan *scan, const mp_matrix *matx);
+
+/**
+ * Return the next chunk in opos order, or NULL when done.
+ */
+mp_chunk *
+mp_scan_next(mp_scan *scan);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_FILE_H */
@@ -0,0 +1,200 @@
+#include "mp_gemm.h"
+#include "mp_cold.h"
+#include "mp_perf.h"
+
+
+/* ============================================================================
+ *  Row index
+ * ============================================================================
+ */
+
+/**
+ * Build the row index of a matrix.
+ */
+int32_t
+mp_gemm_index_init(mp_gemm_index *index, mp_matrix *matx) {
+    const uint64_t count = matx->tree.count;
+
+    index->rows = (matx->size.y + CHUNK_H - 1) >> CHUNK_POW;
+    index->chunks = malloc((count ? count : 1) * sizeof(mp_chunk *));
+    index->row = malloc((index->rows + 1) * sizeof(uint64_t));
+
+    if (!index->chunks || !index->row) {
+        mp_gemm_index_free(index);
+        return -1;
+    }
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    /* Tree order is row-major over blocks, so rows come out contiguous */
+    uint64_t r = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        mp_chunk *chunk = mp_cold_warm(matx, mp_iter_next(&iter));
+        if (!chunk) {
+            mp_gemm_index_free(index);
+            return -1;
+        }
+
+        while (r <= chunk->opos.dim.y) index->row[r++] = i;
+        index->chunks[i] = chunk;
+    }
+    while (r <= index->rows) index->row[r++] = count;
+
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Kernels
+ * ============================================================================
+ */
+
+/**
+ * c += a · b for single chunks.
+ */
+void
+mp_gemm_chunk(mp_chunk *c, const mp_chunk *a, const mp_chunk *b) {
+    const uint32_t m = c->size.dim.y + 1; /* rows of c / a */
+    const uint32_t n = c->size.dim.x + 1; /* cols of c / b */
+    const uint32_t l = b->size.dim.y + 1; /* cols of a / rows of b */
+
+    MP_PERF_BEGIN(MP_PERF_KERNEL);
+
+    for (uint32_t i = 0; i < m; i++) {
+        int64_t *__restrict crow = c->data + CHUNK_POS(0, i);
+        const int64_t *__restrict arow = a->data + CHUNK_POS(0, i);
+
+        for (uint32_t k = 0; k < l; k++) {
+            const int64_t aik = arow[k];
+            if (aik == 0) continue;
+
+            const int64_t *__restrict brow = b->data + CHUNK_POS(0, k);
+            for (uint32_t j = 0; j < n; j++) crow[j] += aik * brow[j];
+        }
+    }
+    MP_PERF_END(MP_PERF_KERNEL);
+}
+
+/**
+ * C = A · B in the calling process.
+ */
+int32_t
+mp_gemm(mp_matrix *c, mp_matrix *a, mp_matrix *b) {
+    if (a->size.x != b->size.y) return -1;
+
+    mp_matrix_free(c);
+    if (mp_matrix_set_size(c, (mp_msize){b->size.x, a->size.y}) < 0) return -1;
+
+    mp_gemm_index bi;
+    if (mp_gemm_index_init(&bi, b) < 0) return -1;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &a->tree);
+
+    int32_t ret = 0;
+    for (mp_chunk *ac; (ac = mp_iter_next(&iter));) {
+        if (!(ac = mp_cold_warm(a, ac))) {
+            ret = -1;
+            goto end;
+        }
+
+        const uint64_t k = ac->opos.dim.x;
+
+        for (uint64_t p = bi.row[k]; p < bi.row[k + 1]; p++) {
+            const mp_chunk *bc = bi.chunks[p];
+            const mp_copos opos = {.dim = {bc->opos.dim.x, ac->opos.dim.y}};
+
+            mp_chunk *cc = mp_matrix_chunk_write(c, opos);
+            if (!cc) {
+                ret = -1;
+                goto end;
+            }
+
+            mp_gemm_chunk(cc, ac, bc);
+        }
+    }
+
+end:
+    mp_gemm_index_free(&bi);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Parallel GEMM
+ * ============================================================================
+ */
+
+/**
+ * Shared state of the tasks of mp_gemm_par().
+ */
+typedef struct mp_gemm_par_ctx {
+    mp_gemm_index ai;
+    mp_gemm_index bi;
+    mp_stage stage;   /**< C chunks, staged per worker */
+    uint8_t failed;   /**< A chunk of C could not be allocated */
+} mp_gemm_par_ctx;
+
+/**
+ * C(i, ·) = Σ_k A(i, k) · B(k, ·) for block rows [lo, hi).
+ *
+ * A block row of C is computed by one task, so every C chunk is staged
+ * by exactly one worker.
+ */
+static void
+mp_gemm_par_rows(void *arg, uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    mp_gemm_par_ctx *ctx = arg;
+
+    for (; lo < hi; lo++) {
+        for (uint64_t p = ctx->ai.row[lo]; p < ctx->ai.row[lo + 1]; p++) {
+            const mp_chunk *ac = ctx->ai.chunks[p];
+            const uint64_t k = ac->opos.dim.x;
+            if (k >= ctx->bi.rows) continue;
+
+            for (uint64_t q = ctx->bi.row[k]; q < ctx->bi.row[k + 1]; q++) {
+                const mp_chunk *bc = ctx->bi.chunks[q];
+                const mp_copos opos = {.dim = {bc->opos.dim.x, (uint32_t) lo}};
+
+                mp_chunk *cc = mp_stage_take(&ctx->stage, worker, opos);
+                if (!cc) {
+                    __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+                mp_gemm_chunk(cc, ac, bc);
+            }
+        }
+    }
+}
+
+/**
+ * C = A · B over the workers of sched.
+ */
+int32_t
+mp_gemm_par(mp_matrix *c, mp_matrix *a, mp_matrix *b, mp_sched *sched) {
+    if (a->size.x != b->size.y) return -1;
+
+    mp_matrix_free(c);
+    if (mp_matrix_set_size(c, (mp_msize){b->size.x, a->size.y}) < 0) return -1;
+
+    mp_gemm_par_ctx ctx;
+    ctx.failed = 0;
+    if (mp_gemm_index_init(&ctx.ai, a) < 0) return -1;
+    if (mp_gemm_index_init(&ctx.bi, b) < 0) {
+        mp_gemm_index_free(&ctx.ai);
+        return -1;
+    }
+
+    int32_t ret = mp_stage_init(&ctx.stage, c, sched->workers, MP_STAGE_REPLACE);
+    if (ret == 0) {
+        mp_sched_for(sched, ctx.ai.rows, 1, mp_gemm_par_rows, &ctx);
+
+        /* C is empty: the staged chunks become its tree in one pass */
+        if (ctx.failed || mp_stage_merge(&ctx.stage) < 0) ret = -1;
+        mp_stage_free(&ctx.stage);
+    }
+
+    mp_gemm_index_free(&ctx.ai);
+    mp_gemm_index_free(&ctx.bi);
+    return ret;
+}
@@ -0,0 +1,126 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_gemm.h
+ *  Description:  Block-sparse integer matrix multiplication.
+ *
+ *  C = A · B is computed chunk by chunk:
+ *
+ *      C(i, j) = Σ_k  A(i, k) · B(k, j)
+ *
+ *  where (x, y) = (column block, row block) of mp_copos and only
+ *  materialized chunks take part. Absent chunks are zero blocks.
+ *
+ *  Responsibilities:
+ *    - Single chunk multiply-accumulate kernel
+ *    - Row index of a matrix (chunks grouped by block row)
+ *    - Local (in-process) block-sparse GEMM, serial or over the
+ *      workers of an mp_sched
+ *
+ *  Notes:
+ *    - Arithmetic is int64_t with wrap-around
+ *    - The chunk kernel is written in i-k-j order so the inner loop is
+ *      a contiguous axpy the compiler vectorizes
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_GEMM_H
+#define QDEEP_MATRIXP_GEMM_H
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+#include "mp_sched.h"
+#include "mp_stage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Row index
+ * ============================================================================
+ */
+
+/**
+ * Chunks of a matrix grouped by block row.
+ *
+ * Chunks of block row r are chunks[row[r]] .. chunks[row[r + 1] - 1],
+ * ordered by block column (tree order).
+ */
+typedef struct mp_gemm_index {
+    mp_chunk **chunks; /**< All chunks in opos order */
+    uint64_t *row;     /**< Start of each block row, rows + 1 entries */
+    uint64_t rows;     /**< Number of block rows */
+} mp_gemm_index;
+
+/**
+ * Build the row index of a matrix.
+ *
+ * Frozen chunks of matx are thawed, so the index only holds chunks
+ * with a payload.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+int32_t
+mp_gemm_index_init(mp_gemm_index *index, mp_matrix *matx);
+
+/**
+ * Release a row index.
+ */
+static __inline__ void
+mp_gemm_index_free(mp_gemm_index *index) {
+    free(index->chunks);
+    free(index->row);
+}
+
+
+/* ============================================================================
+ *  Kernels
+ * ============================================================================
+ */
+
+/**
+ * c += a · b for single chunks.
+ *
+ * Preconditions:
+ *   - a is (c rows) × (b rows), b is (b rows) × (c cols)
+ */
+void
+mp_gemm_chunk(mp_chunk *c, const mp_chunk *a, const mp_chunk *b);
+
+/**
+ * C = A · B in the calling process.
+ *
+ * C is cleared and resized to (B.x, A.y) first.
+ *
+ * @return  0 on success
+ * @return -1 on size mismatch or allocation failure
+ */
+int32_t
+mp_gemm(mp_matrix *c, mp_matrix *a, mp_matrix *b);
+
+/**
+ * C = A · B with the block rows of C spread over the workers of sched.
+ *
+ * Each task computes whole block rows of C from the row indexes of A
+ * and B, creating the C chunks it needs in its own staging area (see
+ * mp_stage.h); the staged chunks are linked into C in one pass at the
+ * end. No tree is touched in the parallel part.
+ *
+ * @return  0 on success
+ * @return -1 on size mismatch or allocation failure
+ */
+int32_t
+mp_gemm_par(mp_matrix *c, mp_matrix *a, mp_matrix *b, mp_sched *sched);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_GEMM_H */
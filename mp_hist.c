@@ -0,0 +1,196 @@
+#include "mp_hist.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+
+/* ============================================================================
+ *  Internal state
+ * ============================================================================
+ */
+
+static const char *const hist_ops[MP_HIST_OPS] = {
+    "pool_get", "pool_ret", "find_hit", "find_miss",
+    "page_init", "chunk_send", "chunk_recv", "splice",
+};
+
+/**
+ * Histograms of one thread. Written only by the thread holding it, read
+ * by anybody with relaxed loads.
+ */
+typedef struct mp_hist_shard {
+    uint64_t bucket[MP_HIST_OPS][HIST_BUCKETS];
+    uint64_t sum[MP_HIST_OPS];
+    uint64_t max[MP_HIST_OPS];
+
+    struct mp_hist_shard *next;     /**< Next shard, shards are never freed */
+    uint8_t used;                   /**< Held by a live thread */
+} mp_hist_shard;
+
+/** All shards; new ones are pushed under the lock and read without it */
+static struct {
+    pthread_mutex_t lock;
+    mp_hist_shard *head;
+} hist_shards = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread mp_hist_shard *hist_self;
+
+static pthread_key_t hist_key;
+static pthread_once_t hist_once = PTHREAD_ONCE_INIT;
+
+
+/* ============================================================================
+ *  Shards
+ * ============================================================================
+ */
+
+/**
+ * Hand the shard of an exiting thread back.
+ */
+static void
+mp_hist_detach(void *arg) {
+    mp_hist_shard *shard = arg;
+    pthread_mutex_lock(&hist_shards.lock);
+    shard->used = 0;
+    pthread_mutex_unlock(&hist_shards.lock);
+}
+
+static void
+mp_hist_key_init(void) {
+    pthread_key_create(&hist_key, mp_hist_detach);
+}
+
+/**
+ * Give the calling thread a shard: a released one, or a new one.
+ *
+ * Returns:
+ *   Shard, or NULL on allocation failure
+ */
+static mp_hist_shard *
+mp_hist_attach(void) {
+    pthread_once(&hist_once, mp_hist_key_init);
+    pthread_mutex_lock(&hist_shards.lock);
+
+    mp_hist_shard *shard = hist_shards.head;
+    while (shard && shard->used) shard = shard->next;
+
+    if (!shard && (shard = calloc(1, sizeof(mp_hist_shard)))) {
+        shard->next = hist_shards.head;
+        __atomic_store_n(&hist_shards.head, shard, __ATOMIC_RELEASE);
+    }
+    if (shard) shard->used = 1;
+
+    pthread_mutex_unlock(&hist_shards.lock);
+    if (!shard) return NULL;
+
+    pthread_setspecific(hist_key, shard);
+    return hist_self = shard;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Record one sample in the calling thread's shard.
+ */
+void
+mp_hist_record(const uint32_t op, const uint64_t nsec) {
+    mp_hist_shard *shard = hist_self;
+    if (__builtin_expect(!shard, 0) && !(shard = mp_hist_attach())) return;
+
+    /* Single writer: plain increments, published with relaxed stores */
+    uint64_t *bucket = &shard->bucket[op][mp_hist_bucket(nsec)];
+    __atomic_store_n(bucket, __atomic_load_n(bucket, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&shard->sum[op], __atomic_load_n(&shard->sum[op], __ATOMIC_RELAXED) + nsec,
+                     __ATOMIC_RELAXED);
+    if (nsec > __atomic_load_n(&shard->max[op], __ATOMIC_RELAXED))
+        __atomic_store_n(&shard->max[op], nsec, __ATOMIC_RELAXED);
+}
+
+/**
+ * Merge the shards of an operation type.
+ */
+void
+mp_hist_stats(const uint32_t op, mp_hist_stat *stat) {
+    __builtin_memset(stat, 0, sizeof(*stat));
+
+    for (const mp_hist_shard *shard = __atomic_load_n(&hist_shards.head, __ATOMIC_ACQUIRE);
+         shard; shard = shard->next) {
+        for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+            const uint64_t n = __atomic_load_n(&shard->bucket[op][b], __ATOMIC_RELAXED);
+            stat->bucket[b] += n;
+            stat->count += n;
+        }
+
+        stat->sum += __atomic_load_n(&shard->sum[op], __ATOMIC_RELAXED);
+        const uint64_t max = __atomic_load_n(&shard->max[op], __ATOMIC_RELAXED);
+        if (max > stat->max) stat->max = max;
+    }
+}
+
+/**
+ * Top of the bucket holding quantile q.
+ */
+uint64_t
+mp_hist_quantile(const mp_hist_stat *stat, const double q) {
+    if (!stat->count) return 0;
+
+    /* Rank of the sample, 1-based: ceil(q * count), at least the first */
+    uint64_t rank = (uint64_t) (q * (double) stat->count);
+    if ((double) rank < q * (double) stat->count) rank++;
+    if (rank < 1) rank = 1;
+    if (rank > stat->count) rank = stat->count;
+
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+        seen += stat->bucket[b];
+        if (seen < rank) continue;
+
+        const uint64_t top = mp_hist_top(b);
+        return top < stat->max ? top : stat->max;
+    }
+    return stat->max;
+}
+
+/**
+ * Clear every shard.
+ */
+void
+mp_hist_reset(void) {
+    for (mp_hist_shard *shard = __atomic_load_n(&hist_shards.head, __ATOMIC_ACQUIRE);
+         shard; shard = shard->next) {
+        for (uint32_t op = 0; op < MP_HIST_OPS; op++) {
+            for (uint32_t b = 0; b < HIST_BUCKETS; b++)
+                __atomic_store_n(&shard->bucket[op][b], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&shard->sum[op], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&shard->max[op], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Write one line per operation type with samples.
+ */
+void
+mp_hist_dump(FILE *out) {
+    fprintf(out, "hist: %-10s %12s %10s %10s %10s %10s %10s %10s\n",
+            "op", "count", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+
+    mp_hist_stat *s = malloc(sizeof(mp_hist_stat));
+    if (!s) return;
+
+    for (uint32_t op = 0; op < MP_HIST_OPS; op++) {
+        mp_hist_stats(op, s);
+        if (s->count)
+            fprintf(out, "hist: %-10s %12lu %10.0f %10lu %10lu %10lu %10lu %10lu\n",
+                    hist_ops[op], s->count, (double) s->sum / (double) s->count,
+                    mp_hist_quantile(s, 0.50), mp_hist_quantile(s, 0.90),
+                    mp_hist_quantile(s, 0.99), mp_hist_quantile(s, 0.999), s->max);
+    }
+
+    free(s);
+    fflush(out);
+}
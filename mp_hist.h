@@ -0,0 +1,183 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_hist.h
+ *  Description:  Per-operation latency histograms.
+ *
+ *  Service objectives are set on tail latencies, which an average does
+ *  not show. Each operation type gets a log-linear histogram of its
+ *  latencies in nanoseconds (HDR style): every power of two is split
+ *  into HIST_SUB equal sub-buckets,
+ *
+ *      v < HIST_SUB                 bucket v (exact)
+ *      2^e <= v < 2^(e+1)           bucket (e - HIST_SUB_BITS + 1) * HIST_SUB
+ *                                          + the next HIST_SUB_BITS bits of v
+ *
+ *  so any value is known to within 1 / HIST_SUB of itself, from one
+ *  nanosecond to hours, in a fixed array.
+ *
+ *  Every thread records into its own shard; readers merge the shards.
+ *  Instrumented operations look like:
+ *
+ *      MP_HIST_BEGIN(start);
+ *      ... operation ...
+ *      MP_HIST_END(start, MP_HIST_POOL_GET);
+ *
+ *  Design goals:
+ *   - Compiled out unless built with MP_HIST
+ *   - Recording touches only the thread's own shard: no lock, no shared
+ *     cache line, no read-modify-write instruction
+ *   - Quantiles reported as the top of their bucket, never below the
+ *     true value
+ *
+ *  Notes:
+ *   - Shards of exited threads are handed to new threads, their counts
+ *     are kept
+ *   - mp_hist_reset() while threads record may keep a sample or two
+ *     that was being recorded meanwhile
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_HIST_H
+#define QDEEP_MATRIXP_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Sub-buckets per power of two (log2) */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1u << HIST_SUB_BITS)
+
+/** Buckets covering every uint64_t value */
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/** Operation types */
+#define MP_HIST_POOL_GET   0 /**< mp_pool_get() */
+#define MP_HIST_POOL_RET   1 /**< mp_pool_ret() */
+#define MP_HIST_FIND_HIT   2 /**< Tree lookups that found the chunk */
+#define MP_HIST_FIND_MISS  3 /**< Tree lookups that did not */
+#define MP_HIST_PAGE_INIT  4 /**< mp_page_init() (mmap of a page) */
+#define MP_HIST_CHUNK_SEND 5 /**< mp_chunk_send() */
+#define MP_HIST_CHUNK_RECV 6 /**< mp_chunk_recv() */
+#define MP_HIST_SPLICE     7 /**< mp_splice_copy() */
+#define MP_HIST_OPS        8
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Merged histogram of one operation type.
+ */
+typedef struct mp_hist_stat {
+    uint64_t count;                  /**< Samples */
+    uint64_t sum;                    /**< Sum of the samples (ns) */
+    uint64_t max;                    /**< Largest sample (ns) */
+    uint64_t bucket[HIST_BUCKETS];   /**< Samples per bucket */
+} mp_hist_stat;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static __inline__ uint64_t
+mp_hist_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Bucket of a value.
+ */
+static __inline__ uint32_t
+mp_hist_bucket(const uint64_t value) {
+    if (value < HIST_SUB) return (uint32_t) value;
+
+    const uint32_t e = 63 - (uint32_t) __builtin_clzll(value);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+           (uint32_t) ((value >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/**
+ * Largest value of a bucket.
+ */
+static __inline__ uint64_t
+mp_hist_top(const uint32_t bucket) {
+    if (bucket < HIST_SUB) return bucket;
+
+    const uint32_t shift = bucket / HIST_SUB - 1;
+    const uint64_t low = (uint64_t) (HIST_SUB + bucket % HIST_SUB) << shift;
+    return low + ((1ull << shift) - 1);
+}
+
+/**
+ * Record one sample of op, in nanoseconds, in the calling thread's shard.
+ */
+void
+mp_hist_record(uint32_t op, uint64_t nsec);
+
+/**
+ * Merge the shards of an operation type into stat.
+ */
+void
+mp_hist_stats(uint32_t op, mp_hist_stat *stat);
+
+/**
+ * Value below or at which a fraction q (0..1) of the samples lie.
+ *
+ * Returns:
+ *   Top of the bucket holding the quantile, at most the largest sample;
+ *   0 without samples
+ */
+uint64_t
+mp_hist_quantile(const mp_hist_stat *stat, double q);
+
+/**
+ * Clear every shard.
+ */
+void
+mp_hist_reset(void);
+
+/**
+ * Write count, mean and p50 / p90 / p99 / p99.9 / max of every operation
+ * type with samples to out.
+ */
+void
+mp_hist_dump(FILE *out);
+
+#ifdef MP_HIST
+#define MP_HIST_BEGIN(t)   const uint64_t t = mp_hist_now()
+#define MP_HIST_END(t, op) mp_hist_record(op, mp_hist_now() - (t))
+#else
+#define MP_HIST_BEGIN(t)   ((void) 0)
+#define MP_HIST_END(t, op) ((void) 0)
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_HIST_H */
@@ -1,10 +1,24 @@
 #include "mp_matrix.h"
 
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "mp_cold.h"
+#include "mp_file.h"
+#include "mp_merkle.h"
+#include "mp_perf.h"
+#include "mp_hist.h"
+#include "mp_rcu.h"
+#include "mp_snap.h"
+#include "mp_stats.h"
+#include "mp_splice.h"
 
 
 /* ============================================================================
@@ -18,8 +32,9 @@
 static void
 mp_tree_init(mp_tree *tree) {
     tree->root = NULL;
-    tree->find = NULL;
-    tree->offset.pos = UINT64_MAX;
+    tree->count = 0;
+    tree->seq = 0;
+    mp_cursor_init(&tree->cur);
 }
 
 /**
@@ -30,10 +45,10 @@ mp_tree_free(mp_tree *tree, mp_pool *pool) {
     mp_chunk *node = tree->root;
     int32_t pos = -1;
     while (1) {
-        while (node) node = (tree->stack[++pos] = node)->sides[0];
+        while (node) node = (tree->cur.stack[++pos] = node)->sides[0];
         if (pos == -1) break;
 
-        node = tree->stack[pos--];
+        node = tree->cur.stack[pos--];
 
         mp_chunk *next = node->sides[1];
         mp_pool_ret(pool, node);
@@ -48,18 +63,38 @@ mp_tree_free(mp_tree *tree, mp_pool *pool) {
  *
  * These functions rebalance the RB-tree after insertion or removal,
  * maintaining standard RB-tree invariants.
+ *
+ * Links are published with release stores: a concurrent reader (see
+ * mp_rcu.h) that follows a link also sees the node it points to, and
+ * the tree->seq bump that came before the change.
+ */
+
+#define RB_LINK(slot, node) __atomic_store_n(&(slot), (node), __ATOMIC_RELEASE)
+
+/**
+ * Open / close a link change (odd seq while it runs).
  */
+static __inline__ void
+rb_tree_write_begin(mp_tree *tree) {
+    __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELAXED);
+}
+
+static __inline__ void
+rb_tree_write_end(mp_tree *tree) {
+    __atomic_store_n(&tree->seq, tree->seq + 1, __ATOMIC_RELEASE);
+}
 
 /**
  * Rebalance tree after insertion.
  */
 static void
 rb_tree_insert_optimize(mp_tree *tree) {
-    while (--tree->pos >= 0) {
-        const uint8_t side = tree->sides[tree->pos];
-        mp_chunk *g_ = tree->stack[tree->pos];       // Grandparent
+    mp_cursor *cur = &tree->cur;
+    while (--cur->pos >= 0) {
+        const uint8_t side = cur->sides[cur->pos];
+        mp_chunk *g_ = cur->stack[cur->pos];       // Grandparent
         mp_chunk *y_ = g_->sides[side ^ 1];          // Uncle
-        mp_chunk *x_ = tree->stack[tree->pos + 1];  // Parent
+        mp_chunk *x_ = cur->stack[cur->pos + 1];  // Parent
 
         if (x_->color == MP_BLACK) break;
 
@@ -67,24 +102,25 @@ rb_tree_insert_optimize(mp_tree *tree) {
             x_->color = MP_BLACK;
             y_->color = MP_BLACK;
             g_->color = MP_RED;
-            --tree->pos;
+            --cur->pos;
             continue;
         }
 
-        if (side == 1 - tree->sides[tree->pos + 1]) {
+        if (side == 1 - cur->sides[cur->pos + 1]) {
             y_ = x_->sides[side ^ 1];
-            x_->sides[side ^ 1] = y_->sides[side];
-            y_->sides[side] = x_;
-            x_ = g_->sides[side] = y_;
+            RB_LINK(x_->sides[side ^ 1], y_->sides[side]);
+            RB_LINK(y_->sides[side], x_);
+            RB_LINK(g_->sides[side], y_);
+            x_ = y_;
         }
 
         g_->color = MP_RED;
         x_->color = MP_BLACK;
-        g_->sides[side] = x_->sides[side ^ 1];
-        x_->sides[side ^ 1] = g_;
+        RB_LINK(g_->sides[side], x_->sides[side ^ 1]);
+        RB_LINK(x_->sides[side ^ 1], g_);
 
-        if (tree->pos == 0) tree->root = x_;
-        else tree->stack[tree->pos - 1]->sides[tree->sides[tree->pos - 1]] = x_;
+        if (cur->pos == 0) RB_LINK(tree->root, x_);
+        else RB_LINK(cur->stack[cur->pos - 1]->sides[cur->sides[cur->pos - 1]], x_);
         break;
     }
 
@@ -96,9 +132,10 @@ rb_tree_insert_optimize(mp_tree *tree) {
  */
 static void
 rb_tree_remove_optimize(mp_tree *tree) {
-    while (tree->pos >= 0) {
-        const uint8_t side = tree->sides[tree->pos];
-        mp_chunk *p = tree->stack[tree->pos];       // Parent
+    mp_cursor *cur = &tree->cur;
+    while (cur->pos >= 0) {
+        const uint8_t side = cur->sides[cur->pos];
+        mp_chunk *p = cur->stack[cur->pos];       // Parent
         mp_chunk *s = p->sides[side ^ 1];           // Sibling
 
         if (p->sides[side] && p->sides[side]->color == MP_RED) {
@@ -110,15 +147,15 @@ rb_tree_remove_optimize(mp_tree *tree) {
             s->color = MP_BLACK;
             p->color = MP_RED;
 
-            if (tree->pos == 0) tree->root = s;
-            else tree->stack[tree->pos - 1]->sides[tree->sides[tree->pos - 1]] = s;
+            if (cur->pos == 0) RB_LINK(tree->root, s);
+            else RB_LINK(cur->stack[cur->pos - 1]->sides[cur->sides[cur->pos - 1]], s);
 
-            p->sides[side ^ 1] = s->sides[side];
-            s->sides[side] = p;
+            RB_LINK(p->sides[side ^ 1], s->sides[side]);
+            RB_LINK(s->sides[side], p);
 
-            tree->stack[tree->pos] = s;
-            tree->sides[++tree->pos] = side;
-            tree->stack[tree->pos] = p;
+            cur->stack[cur->pos] = s;
+            cur->sides[++cur->pos] = side;
+            cur->stack[cur->pos] = p;
 
             s = p->sides[side ^ 1];
         }
@@ -128,7 +165,7 @@ rb_tree_remove_optimize(mp_tree *tree) {
         if ((s->sides[0] == NULL || s->sides[0]->color == MP_BLACK) &&
             (s->sides[1] == NULL || s->sides[1]->color == MP_BLACK)) {
             s->color = MP_RED;
-            --tree->pos;
+            --cur->pos;
             continue;
         }
 
@@ -137,10 +174,11 @@ rb_tree_remove_optimize(mp_tree *tree) {
             y->color = MP_BLACK;
             s->color = MP_RED;
 
-            s->sides[side] = y->sides[side ^ 1];
-            y->sides[side ^ 1] = s;
+            RB_LINK(s->sides[side], y->sides[side ^ 1]);
+            RB_LINK(y->sides[side ^ 1], s);
 
-            s = p->sides[side ^ 1] = y;
+            RB_LINK(p->sides[side ^ 1], y);
+            s = y;
         }
 
         s->color = p->color;
@@ -148,11 +186,11 @@ rb_tree_remove_optimize(mp_tree *tree) {
 
         if (s->sides[side ^ 1]) s->sides[side ^ 1]->color = MP_BLACK;
 
-        if (tree->pos == 0) tree->root = s;
-        else tree->stack[tree->pos - 1]->sides[tree->sides[tree->pos - 1]] = s;
+        if (cur->pos == 0) RB_LINK(tree->root, s);
+        else RB_LINK(cur->stack[cur->pos - 1]->sides[cur->sides[cur->pos - 1]], s);
 
-        p->sides[side ^ 1] = s->sides[side];
-        s->sides[side] = p;
+        RB_LINK(p->sides[side ^ 1], s->sides[side]);
+        RB_LINK(s->sides[side], p);
         break;
     }
 }
@@ -166,23 +204,60 @@ rb_tree_remove_optimize(mp_tree *tree) {
 /**
  * Find chunk in tree by offset.
  *
- * Uses cache in tree->find to speed repeated lookups.
+ * Uses cache in cur->find to speed repeated lookups. The path is left
+ * in cur, so only the writer passes the tree's own cursor.
  */
 static mp_chunk *
-rb_tree_find(mp_tree *tree, const mp_copos offset) {
-    if (tree->find && mp_coffs_cmp(tree->offset, offset) == 0) return tree->find;
+rb_tree_search(const mp_tree *tree, mp_cursor *cur, const mp_copos offset) {
+    cur->finds += 1;
+    if (cur->find && mp_coffs_cmp(cur->offset, offset) == 0) {
+        cur->hits += 1;
+        return cur->find;
+    }
 
     mp_chunk *node = tree->root;
-    tree->pos = -1;
-    tree->offset = offset;
+    cur->pos = -1;
+    cur->offset = offset;
 
     while (node) {
-        if (mp_coffs_cmp(node->opos, offset) == 0) return tree->find = node;
-        tree->stack[++tree->pos] = node;
-        node = node->sides[tree->sides[tree->pos] = mp_coffs_cmp(node->opos, offset) < 0];
+        if (mp_coffs_cmp(node->opos, offset) == 0) return cur->find = node;
+        cur->stack[++cur->pos] = node;
+        node = node->sides[cur->sides[cur->pos] = mp_coffs_cmp(node->opos, offset) < 0];
     }
 
-    return tree->find = NULL;
+    return cur->find = NULL;
+}
+
+/**
+ * rb_tree_search(), timed as a hit or a miss.
+ */
+static mp_chunk *
+rb_tree_find(const mp_tree *tree, mp_cursor *cur, const mp_copos offset) {
+    MP_HIST_BEGIN(start);
+    mp_chunk *chunk = rb_tree_search(tree, cur, offset);
+    MP_HIST_END(start, chunk ? MP_HIST_FIND_HIT : MP_HIST_FIND_MISS);
+    return chunk;
+}
+
+/**
+ * Link sorted chunks [lo, hi) as a balanced subtree.
+ *
+ * Halving keeps every null link at depth red or red + 1, so colouring
+ * the nodes at depth red (the incomplete last level) red gives every
+ * path the same number of black nodes.
+ */
+static mp_chunk *
+rb_tree_build(mp_chunk **chunks, const uint64_t lo, const uint64_t hi,
+              const uint32_t depth, const uint32_t red) {
+    if (lo >= hi) return NULL;
+
+    const uint64_t mid = lo + (hi - lo) / 2;
+    mp_chunk *node = chunks[mid];
+
+    node->sides[0] = rb_tree_build(chunks, lo, mid, depth + 1, red);
+    node->sides[1] = rb_tree_build(chunks, mid + 1, hi, depth + 1, red);
+    node->color = depth == red ? MP_RED : MP_BLACK;
+    return node;
 }
 
 /**
@@ -190,23 +265,27 @@ rb_tree_find(mp_tree *tree, const mp_copos offset) {
  */
 static void
 rb_tree_insert(mp_tree *tree, mp_chunk *chunk) {
-    mp_chunk *node = tree->find;
+    mp_cursor *cur = &tree->cur;
+    mp_chunk *node = cur->find;
 
     if (!node || mp_coffs_cmp(node->opos, chunk->opos) != 0)
-        node = rb_tree_find(tree, chunk->opos);
+        node = rb_tree_find(tree, cur, chunk->opos);
 
     if (node) return;
 
     /* Insert As Red Colored Node */
-    tree->offset.pos = UINT64_MAX;
+    cur->offset.pos = UINT64_MAX;
     chunk->color = MP_RED;
     chunk->sides[0] = NULL;
     chunk->sides[1] = NULL;
 
-    if (tree->pos == -1) tree->root = chunk;
-    else tree->stack[tree->pos]->sides[tree->sides[tree->pos]] = chunk;
+    rb_tree_write_begin(tree);
+    if (cur->pos == -1) RB_LINK(tree->root, chunk);
+    else RB_LINK(cur->stack[cur->pos]->sides[cur->sides[cur->pos]], chunk);
 
+    tree->count += 1;
     rb_tree_insert_optimize(tree);
+    rb_tree_write_end(tree);
 }
 
 /**
@@ -216,53 +295,63 @@ static void
 rb_tree_remove(mp_tree *tree, const mp_chunk *chunk) {
     if (!chunk) return;
 
-    mp_chunk *node = tree->find;
+    mp_cursor *cur = &tree->cur;
+    mp_chunk *node = cur->find;
     if (!node || mp_coffs_cmp(node->opos, chunk->opos) != 0)
-        node = rb_tree_find(tree, chunk->opos);
+        node = rb_tree_find(tree, cur, chunk->opos);
 
     if (!node) return;
 
-    tree->offset.pos = UINT64_MAX;
-
-    const uint32_t side = tree->sides[tree->pos];
+    cur->offset.pos = UINT64_MAX;
+    cur->find = NULL;
+    tree->count -= 1;
+    rb_tree_write_begin(tree);
 
-    /* Node with two children */
+    /* Node with two children: swap with in-order predecessor */
     if (node->sides[0] && node->sides[1]) {
         mp_chunk *target = node->sides[0];
-        const int32_t pos = tree->pos;
+        const int32_t pos = cur->pos;
 
-        tree->stack[++tree->pos] = node;
-        tree->sides[tree->pos] = 0;
+        cur->stack[++cur->pos] = node;
+        cur->sides[cur->pos] = 0;
 
         while (target->sides[1]) {
-            tree->stack[++tree->pos] = target;
-            tree->sides[tree->pos] = 1;
+            cur->stack[++cur->pos] = target;
+            cur->sides[cur->pos] = 1;
             target = target->sides[1];
         }
 
-        if (pos == -1) tree->root = target;
-        else tree->stack[pos]->sides[tree->sides[pos]] = target;
+        if (pos == -1) RB_LINK(tree->root, target);
+        else RB_LINK(cur->stack[pos]->sides[cur->sides[pos]], target);
 
-        tree->stack[pos + 1] = target;
+        cur->stack[pos + 1] = target;
 
         const uint8_t color = target->color;
         target->color = node->color;
         node->color = color;
 
-        target->sides[1] = node->sides[1];
-        node->sides[1] = NULL;
+        mp_chunk *left = target->sides[0];
+        RB_LINK(target->sides[1], node->sides[1]);
 
-        mp_chunk *tmp = node->sides[0];
-        node->sides[0] = target->sides[0];
-        target->sides[0] = tmp;
+        if (cur->pos == pos + 1) {
+            /* predecessor was the left child: node moves below it */
+            RB_LINK(target->sides[0], node);
+        } else {
+            RB_LINK(target->sides[0], node->sides[0]);
+            RB_LINK(cur->stack[cur->pos]->sides[1], node);
+        }
+
+        RB_LINK(node->sides[0], left);
+        RB_LINK(node->sides[1], NULL);
     }
 
     mp_chunk *child = node->sides[0] ? node->sides[0] : node->sides[1];
-    if (tree->pos == -1) tree->root = child;
-    else tree->stack[tree->pos]->sides[side] = child;
+    if (cur->pos == -1) RB_LINK(tree->root, child);
+    else RB_LINK(cur->stack[cur->pos]->sides[cur->sides[cur->pos]], child);
 
     if (node->color == MP_BLACK)
         rb_tree_remove_optimize(tree);
+    rb_tree_write_end(tree);
 }
 
 
@@ -279,7 +368,43 @@ void
 mp_matrix_init(mp_matrix *matx, mp_pool *pool) {
     mp_tree_init(&matx->tree);
     matx->pool = pool;
+    matx->size = (mp_msize){0, 0};
     matx->fd = -1;
+    matx->flags = 0;
+
+    matx->access = MP_ACCESS_NORMAL;
+    matx->ahead = MATRIX_AHEAD;
+
+    matx->map = NULL;
+    matx->map_len = 0;
+    matx->maps = NULL;
+    matx->nmaps = 0;
+
+    matx->snap = NULL;
+    matx->merkle = NULL;
+    matx->cold = NULL;
+    matx->rcu = NULL;
+
+    matx->gen = 1;
+    matx->synced = 0;
+    matx->drops = NULL;
+    matx->ndrops = 0;
+    matx->cdrops = 0;
+    matx->resync = 0;
+}
+
+/**
+ * Return a chunk to its owner: the pool, the cold tier for
+ * placeholders, or nobody for mapped tiles.
+ */
+static void
+mp_matrix_release(mp_matrix *matx, mp_chunk *chunk) {
+    if (mp_matrix_chunk_mapped(matx, chunk)) return;
+    if (__builtin_expect(chunk->data == NULL, 0)) {
+        mp_cold_release(matx, chunk);
+        return;
+    }
+    mp_pool_ret(matx->pool, chunk);
 }
 
 
@@ -288,7 +413,74 @@ mp_matrix_init(mp_matrix *matx, mp_pool *pool) {
  */
 void
 mp_matrix_free(mp_matrix *matx) {
-    mp_tree_free(&matx->tree, matx->pool);
+    free(matx->drops);
+    matx->drops = NULL;
+    matx->ndrops = 0;
+    matx->cdrops = 0;
+
+    if (!(matx->flags & MP_MATRIX_MAPPED) && !matx->cold) {
+        mp_tree_free(&matx->tree, matx->pool);
+        mp_tree_init(&matx->tree);
+        return;
+    }
+
+    /* mixed tree: mapped descriptors or placeholders, and pool chunks */
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) mp_matrix_release(matx, chunk);
+    mp_tree_init(&matx->tree);
+
+    if (matx->map) munmap(matx->map, matx->map_len);
+    free(matx->maps);
+
+    matx->map = NULL;
+    matx->map_len = 0;
+    matx->maps = NULL;
+    matx->nmaps = 0;
+    matx->flags &= ~MP_MATRIX_MAPPED;
+}
+
+/**
+ * Commit a new matrix size.
+ *
+ * Chunks now outside the matrix are dropped. Border chunks get their
+ * new effective size; a grown pool chunk has the exposed area cleared
+ * (a frozen one is cleared when thawed, see mp_cold_warm()). Since the
+ * tile layout changes the next sync rewrites everything.
+ */
+static void
+mp_matrix_resized(mp_matrix *matx, const mp_msize size) {
+    if (size.x == matx->size.x && size.y == matx->size.y) return;
+
+    matx->size = size;
+    matx->resync = 1;
+
+    /* drop outside chunks in batches: dropping invalidates the iterator */
+    mp_copos batch[MATRIX_DROP_BATCH];
+    uint32_t n;
+
+    do {
+        n = 0;
+
+        mp_iter iter;
+        mp_iter_init(&iter, &matx->tree);
+
+        for (mp_chunk *chunk; n < MATRIX_DROP_BATCH && (chunk = mp_iter_next(&iter));)
+            if (!mp_matrix_contains(matx, chunk->opos)) batch[n++] = chunk->opos;
+
+        for (uint32_t i = 0; i < n; i++) mp_matrix_chunk_drop(matx, batch[i]);
+    } while (n == MATRIX_DROP_BATCH);
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        const mp_csize csize = mp_matrix_csize(matx, chunk->opos);
+        if (chunk->data && !mp_matrix_chunk_mapped(matx, chunk))
+            mp_chunk_regrow(chunk, chunk->size, csize);
+        else
+            mp_chunk_set_size(chunk, csize);
+    }
 }
 
 /**
@@ -298,8 +490,10 @@ mp_matrix_free(mp_matrix *matx) {
  *   [ mp_msize header | matrix data (int64_t) ]
  *
  * The header is written at offset 0 and stores matrix dimensions.
+ * Tiled files are resized to the tile layout of mp_file.h instead.
+ * Without a backing file only matx->size is updated.
  *
- * @param matx  Matrix descriptor with a valid file descriptor.
+ * @param matx  Matrix descriptor.
  * @param size  Matrix dimensions (x = columns, y = rows).
  *
  * @return  0 on success
@@ -307,10 +501,32 @@ mp_matrix_free(mp_matrix *matx) {
  */
 int32_t
 mp_matrix_set_size(mp_matrix *matx, const mp_msize size) {
-    if (!matx || matx->fd == -1) return -1;
+    if (!matx || !mp_msize_valid(size)) return -1;
+
+    /* Memory-only matrix: nothing to resize */
+    if (matx->fd == -1) {
+        mp_matrix_resized(matx, size);
+        return 0;
+    }
+
+    if (matx->flags & MP_MATRIX_TILED) {
+        uint64_t tiles;
+        if (__builtin_mul_overflow(mp_file_ncx(size), mp_file_ncy(size), &tiles) ||
+            tiles > (INT64_MAX - FILE_HEAD) / CHUNK_BYTES)
+            return -1;
+
+        if (mp_file_resize(matx->fd, size) < 0) return -1;
+        mp_matrix_resized(matx, size);
+        return 0;
+    }
 
     constexpr uint64_t header_size = sizeof(mp_msize);
-    const uint64_t data_size   = (uint64_t)size.x * size.y * sizeof(int64_t);
+    uint64_t data_size;
+    if (__builtin_mul_overflow(size.x, size.y, &data_size) ||
+        __builtin_mul_overflow(data_size, sizeof(int64_t), &data_size) ||
+        data_size > INT64_MAX - header_size)
+        return -1;
+
     const uint64_t total_size  = header_size + data_size;
 
     /* Resize file */
@@ -318,13 +534,291 @@ mp_matrix_set_size(mp_matrix *matx, const mp_msize size) {
         return -1;
 
     /* Write header (matrix size) */
-    if (pwrite(matx->fd, &size, header_size, 0) != header_size)
+    if (pwrite(matx->fd, &size, header_size, 0) != (int64_t) header_size)
         return -1;
 
-    matx->size = size;
+    mp_matrix_resized(matx, size);
+    return 0;
+}
+
+/* ============================================================================
+ *  Chunk access
+ * ============================================================================
+ */
+
+/**
+ * Count an access to a chunk found in the tree, thawing it if frozen.
+ */
+static __inline__ mp_chunk *
+mp_matrix_hit(mp_matrix *matx, mp_chunk *chunk) {
+    chunk = mp_cold_warm(matx, chunk);
+    if (chunk) chunk->heat += chunk->heat != UINT8_MAX;
+    return chunk;
+}
+
+/**
+ * Find the chunk at offset opos.
+ */
+mp_chunk *
+mp_matrix_chunk_find(mp_matrix *matx, const mp_copos opos) {
+    MP_PERF_BEGIN(MP_PERF_TREE);
+    mp_chunk *chunk = rb_tree_find(&matx->tree, &matx->tree.cur, opos);
+    if (chunk) chunk = mp_matrix_hit(matx, chunk);
+    MP_PERF_END(MP_PERF_TREE);
+    return chunk;
+}
+
+/**
+ * Find the chunk at offset opos through a caller-owned cursor.
+ */
+mp_chunk *
+mp_matrix_chunk_lookup(const mp_matrix *matx, mp_cursor *cur, const mp_copos opos) {
+    MP_PERF_BEGIN(MP_PERF_TREE);
+    mp_chunk *chunk = rb_tree_find(&matx->tree, cur, opos);
+    MP_PERF_END(MP_PERF_TREE);
+    return chunk;
+}
+
+/**
+ * Find the chunk at offset opos, allocating a zeroed one if absent.
+ *
+ * Only the effective (clipped) area of a new chunk is cleared.
+ */
+mp_chunk *
+mp_matrix_chunk_take(mp_matrix *matx, const mp_copos opos) {
+    mp_chunk *chunk = rb_tree_find(&matx->tree, &matx->tree.cur, opos);
+    if (chunk) return mp_matrix_hit(matx, chunk);
+
+    if (!mp_matrix_contains(matx, opos)) return NULL;
+
+    chunk = mp_pool_get(matx->pool);
+    if (!chunk) return NULL;
+
+    chunk->opos = opos;
+    mp_chunk_set_size(chunk, mp_matrix_csize(matx, opos));
+
+    const uint64_t row = (chunk->size.dim.x + 1) * sizeof(int64_t);
+    for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+        __builtin_memset(chunk->data + CHUNK_POS(0, y), 0, row);
+
+    /* a new chunk is dirty until the next sync */
+    chunk->gen = matx->gen;
+    chunk->heat = 1;
+    if (__builtin_expect(matx->merkle != NULL, 0)) mp_merkle_mark(matx->merkle, opos);
+
+    /* rb_tree_find above left the insert path in tree->cur */
+    rb_tree_insert(&matx->tree, chunk);
+    return chunk;
+}
+
+/**
+ * Declare that chunk is about to be modified.
+ */
+void
+mp_matrix_chunk_touch(mp_matrix *matx, mp_chunk *chunk) {
+    if (__builtin_expect(matx->snap != NULL, 0)) mp_snap_preserve(matx->snap, chunk);
+    if (__builtin_expect(matx->merkle != NULL, 0)) mp_merkle_mark(matx->merkle, chunk->opos);
+    chunk->gen = matx->gen;
+    chunk->heat += chunk->heat != UINT8_MAX;
+}
+
+/**
+ * Remember a dropped offset for the next sync.
+ *
+ * A failed allocation is remembered as a full resync.
+ */
+static void
+mp_matrix_note_drop(mp_matrix *matx, const mp_copos opos) {
+    if (matx->fd == -1 && matx->synced == 0) return; /* nothing to delete from */
+
+    if (matx->ndrops == matx->cdrops) {
+        const uint64_t cap = matx->cdrops ? matx->cdrops << 1 : 64;
+        mp_copos *drops = realloc(matx->drops, cap * sizeof(mp_copos));
+        if (!drops) {
+            matx->resync = 1;
+            return;
+        }
+        matx->drops = drops;
+        matx->cdrops = cap;
+    }
+    matx->drops[matx->ndrops++] = opos;
+}
+
+/**
+ * Find or allocate the chunk at opos for writing.
+ */
+mp_chunk *
+mp_matrix_chunk_write(mp_matrix *matx, const mp_copos opos) {
+    mp_chunk *chunk = mp_matrix_chunk_take(matx, opos);
+    if (chunk) mp_matrix_chunk_touch(matx, chunk);
+    return chunk;
+}
+
+/**
+ * Unlink a chunk found by the last rb_tree_find() and release it.
+ *
+ * A running snapshot saves the chunk before its buffer is released.
+ * With concurrent readers the release waits for a grace period.
+ */
+static void
+mp_matrix_unlink(mp_matrix *matx, mp_chunk *chunk) {
+    if (__builtin_expect(matx->snap != NULL, 0)) mp_snap_preserve(matx->snap, chunk);
+    if (__builtin_expect(matx->merkle != NULL, 0)) mp_merkle_mark(matx->merkle, chunk->opos);
+
+    rb_tree_remove(&matx->tree, chunk);
+
+    if (__builtin_expect(matx->rcu != NULL, 0) && !mp_matrix_chunk_mapped(matx, chunk))
+        mp_rcu_retire(matx->rcu, chunk);
+    else
+        mp_matrix_release(matx, chunk);
+}
+
+/**
+ * Remove the chunk at offset opos and return it to the pool.
+ *
+ * Mapped tiles are only unlinked from the tree. A running snapshot
+ * saves the chunk before its buffer is released.
+ */
+void
+mp_matrix_chunk_drop(mp_matrix *matx, const mp_copos opos) {
+    mp_chunk *chunk = rb_tree_find(&matx->tree, &matx->tree.cur, opos);
+    if (!chunk) return;
+
+    mp_matrix_note_drop(matx, opos);
+    mp_matrix_unlink(matx, chunk);
+}
+
+/**
+ * Insert a filled chunk, replacing any chunk at the same offset.
+ */
+void
+mp_matrix_chunk_insert(mp_matrix *matx, mp_chunk *chunk) {
+    mp_chunk *old = rb_tree_find(&matx->tree, &matx->tree.cur, chunk->opos);
+    if (old) mp_matrix_unlink(matx, old);
+
+    chunk->gen = matx->gen;
+    chunk->heat = 1;
+    if (__builtin_expect(matx->merkle != NULL, 0)) mp_merkle_mark(matx->merkle, chunk->opos);
+
+    rb_tree_insert(&matx->tree, chunk);
+}
+
+/**
+ * Link n sorted chunks into an empty matrix.
+ */
+int32_t
+mp_matrix_chunk_build(mp_matrix *matx, mp_chunk **chunks, const uint64_t n) {
+    mp_tree *tree = &matx->tree;
+    if (tree->root) return -1;
+
+    for (uint64_t i = 0; i < n; i++) {
+        chunks[i]->gen = matx->gen;
+        chunks[i]->heat = 1;
+        if (__builtin_expect(matx->merkle != NULL, 0)) mp_merkle_mark(matx->merkle, chunks[i]->opos);
+    }
+
+    /* levels 0 .. red - 1 are full */
+    uint32_t red = 0;
+    while ((2ull << red) - 1 <= n) red++;
+
+    mp_chunk *root = rb_tree_build(chunks, 0, n, 0, red);
+    if (root) root->color = MP_BLACK;
+
+    rb_tree_write_begin(tree);
+    RB_LINK(tree->root, root);
+    tree->count = n;
+    rb_tree_write_end(tree);
+
+    tree->cur.offset.pos = UINT64_MAX;
+    tree->cur.find = NULL;
+    return 0;
+}
+
+/**
+ * Put chunk in the tree node of old.
+ *
+ * The lookup cache is bypassed so rb_tree_find() leaves the parent of
+ * old in the cursor.
+ */
+int32_t
+mp_matrix_chunk_swap(mp_matrix *matx, mp_chunk *old, mp_chunk *chunk) {
+    mp_tree *tree = &matx->tree;
+    mp_cursor *cur = &tree->cur;
+
+    cur->find = NULL;
+    if (rb_tree_find(tree, cur, old->opos) != old) return -1;
+
+    chunk->sides[0] = old->sides[0];
+    chunk->sides[1] = old->sides[1];
+    chunk->color = old->color;
+
+    rb_tree_write_begin(tree);
+    if (cur->pos == -1) RB_LINK(tree->root, chunk);
+    else RB_LINK(cur->stack[cur->pos]->sides[cur->sides[cur->pos]], chunk);
+    rb_tree_write_end(tree);
+
+    cur->find = chunk;
     return 0;
 }
 
+
+/* ============================================================================
+ *  Element access
+ * ============================================================================
+ */
+
+/**
+ * Split a global element position into chunk offset and local index.
+ */
+static __inline__ mp_copos
+mp_matrix_locate(const uint64_t x, const uint64_t y, uint32_t *idx) {
+    mp_copos opos;
+    opos.dim.x = (uint32_t) (x >> CHUNK_POW);
+    opos.dim.y = (uint32_t) (y >> CHUNK_POW);
+
+    *idx = CHUNK_POS(x & (CHUNK_W - 1), y & (CHUNK_H - 1));
+    return opos;
+}
+
+/**
+ * Read element (x, y).
+ */
+int64_t
+mp_matrix_get(mp_matrix *matx, const uint64_t x, const uint64_t y) {
+    uint32_t idx;
+    const mp_copos opos = mp_matrix_locate(x, y, &idx);
+
+    const mp_chunk *chunk = mp_matrix_chunk_find(matx, opos);
+    return chunk ? chunk->data[idx] : 0;
+}
+
+/**
+ * Write element (x, y), materializing its chunk if needed.
+ */
+int32_t
+mp_matrix_put(mp_matrix *matx, const uint64_t x, const uint64_t y, const int64_t value) {
+    if (x >= matx->size.x || y >= matx->size.y) return -1;
+
+    uint32_t idx;
+    const mp_copos opos = mp_matrix_locate(x, y, &idx);
+
+    mp_chunk *chunk = mp_matrix_chunk_write(matx, opos);
+    if (!chunk) return -1;
+
+    chunk->data[idx] = value;
+    return 0;
+}
+
+
+/**
+ * Close the backing file of matx, if any.
+ */
+static void
+mp_matrix_close_file(mp_matrix *matx) {
+    if (matx->fd != -1) close(matx->fd);
+    matx->fd = -1;
+}
+
 /**
  * Open or attach a file as a matrix backing store.
  *
@@ -345,87 +839,165 @@ mp_matrix_set_file(mp_matrix *matx, const char *filename) {
     if (!matx || !filename) return -1;
     constexpr uint64_t header_size = sizeof(mp_msize);
 
+    mp_matrix_close_file(matx);
     matx->fd = open(filename, O_RDWR | O_CREAT, 0644);
     if (matx->fd == -1) return -1;
+    matx->flags &= MP_MATRIX_MAPPED; /* mapped chunks stay until mp_matrix_free() */
 
     /* Try to read header */
     mp_msize size;
-    matx->size = pread(matx->fd, &size, header_size, 0) == header_size ?
+    matx->size = pread(matx->fd, &size, header_size, 0) == (int64_t) header_size ?
         size : (mp_msize){0, 0};
 
     return 0;
 }
 
 /**
- * Zero-copy transfer of matrix payload between file descriptors.
- *
- * Transfers exactly:
- *     size.x * size.y * sizeof(int64_t)
- *
- * Data is moved kernel-to-kernel using splice():
- *   fd_f -> pipe -> fd_t
- *
- * This avoids user-space buffers and supports very large matrices
- * (multi-TB) without RAM pressure.
- *
- * @param fd_f   Source file descriptor (must be readable).
- * @param fd_t   Destination file descriptor (must be writable).
- * @param size   Matrix dimensions defining transfer length.
+ * Open a matrix file in the given mode.
  *
- * @return  0 on success
- * @return -1 on failure
+ * O_DIRECT requires aligned offsets, lengths and buffers, which only
+ * the tiled format provides, so MP_MATRIX_DIRECT implies MP_MATRIX_TILED.
  */
-static int32_t
-mp_matrix_splice(const int32_t fd_f, const int32_t fd_t, const mp_msize size) {
-    uint64_t remain = size.x * size.y * sizeof(int64_t);
-    constexpr uint64_t chunk = CHUNK_BYTES;
+int32_t
+mp_matrix_set_file_mode(mp_matrix *matx, const char *filename, uint32_t flags) {
+    if (!matx || !filename) return -1;
+    if (!(flags & (MP_MATRIX_TILED | MP_MATRIX_DIRECT))) return mp_matrix_set_file(matx, filename);
 
+    flags |= MP_MATRIX_TILED;
+    mp_matrix_close_file(matx);
 
-    int32_t pipefd[2] = {-1, -1};
-    if (pipe(pipefd) == -1) return -1;
+    if (flags & MP_MATRIX_DIRECT) {
+        matx->fd = open(filename, O_RDWR | O_CREAT | O_DIRECT, 0644);
+        if (matx->fd == -1 && errno != EINVAL) return -1;
+        if (matx->fd == -1) flags &= ~MP_MATRIX_DIRECT; /* not supported here */
+    }
+
+    if (matx->fd == -1) matx->fd = open(filename, O_RDWR | O_CREAT, 0644);
+    if (matx->fd == -1) return -1;
+
+    mp_msize size;
+    if (mp_file_header_read(matx->fd, &size) < 0) {
+        mp_matrix_close_file(matx);
+        return -1;
+    }
 
-    while (remain) {
-        const uint64_t bytes = remain > chunk ? chunk : remain;
+    matx->size = size;
+    matx->flags = flags | (matx->flags & MP_MATRIX_MAPPED);
+    return 0;
+}
 
-        /* ---- fd_f -> pipe ---- */
-        int64_t n;
-        do {
-            n = splice(fd_f, NULL,
-                       pipefd[1], NULL,
-                       bytes, SPLICE_F_MORE | SPLICE_F_MOVE);
-        } while (n == -1 && (errno == EINTR || errno == EAGAIN));
+/**
+ * Map a tiled matrix file without copying it into the pool.
+ *
+ * Two passes over the tile holes: count, then build the descriptor
+ * array in one allocation.
+ */
+int32_t
+mp_matrix_map_file(mp_matrix *matx, const char *filename) {
+    if (!matx || !filename) return -1;
 
-        if (n == 0) break; /* EOF */
-        if (n < 0) goto error;
+    /* drop the old mapping and file, a remap must not leak either */
+    mp_matrix_free(matx);
+    mp_matrix_close_file(matx);
 
+    matx->fd = open(filename, O_RDONLY);
+    if (matx->fd == -1) return -1;
 
+    mp_msize size;
+    struct stat st;
+    if (mp_file_header_read(matx->fd, &size) < 0 || fstat(matx->fd, &st) == -1)
+        goto error;
 
-        /* ---- pipe -> fd_t ---- */
-        while (n > 0) {
-            int64_t m;
-            do {
-                m = splice(pipefd[0], NULL,
-                           fd_t, NULL,
-                           n, SPLICE_F_MORE | SPLICE_F_MOVE);
-            } while (m == -1 && (errno == EINTR || errno == EAGAIN));
+    const uint64_t len = mp_file_length(size);
+    if ((uint64_t) st.st_size < len) goto error; /* truncated file */
 
-            if (m < 0) goto error;
+    matx->size = size;
+    matx->flags = MP_MATRIX_TILED | MP_MATRIX_MAPPED;
 
-            n -= m;
-            remain -= m;
-        }
+    /* copy-on-write private mapping: reads share the page cache */
+    matx->map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, matx->fd, 0);
+    if (matx->map == MAP_FAILED) {
+        matx->map = NULL;
+        goto error;
     }
+    matx->map_len = len;
+
+    uint64_t n = 0;
+    for (int64_t t = mp_file_next_tile(matx, 0); t != -1; t = mp_file_next_tile(matx, (uint64_t) t + 1))
+        n += 1;
 
-    close(pipefd[0]);
-    close(pipefd[1]);
+    matx->maps = n ? malloc(n * sizeof(mp_chunk)) : NULL;
+    if (n && !matx->maps) goto error;
+
+    const uint64_t ncx = mp_file_ncx(size);
+    for (int64_t t = mp_file_next_tile(matx, 0); t != -1 && matx->nmaps < n;
+         t = mp_file_next_tile(matx, (uint64_t) t + 1)) {
+        mp_chunk *chunk = &matx->maps[matx->nmaps++];
+
+        chunk->opos.dim.x = (uint32_t) ((uint64_t) t % ncx);
+        chunk->opos.dim.y = (uint32_t) ((uint64_t) t / ncx);
+        chunk->data = (mp_cdata) (matx->map + mp_file_offset((uint64_t) t));
+        chunk->epoch = 0;
+        mp_chunk_set_size(chunk, mp_matrix_csize(matx, chunk->opos));
+
+        mp_matrix_chunk_insert(matx, chunk);
+        chunk->gen = 0; /* identical to the file */
+    }
     return 0;
 
 error:
-    close(pipefd[0]);
-    close(pipefd[1]);
+    mp_matrix_free(matx);
+    mp_matrix_close_file(matx);
+    matx->flags = 0;
     return -1;
 }
 
+/**
+ * Declare how the backing file will be accessed.
+ */
+int32_t
+mp_matrix_set_access(mp_matrix *matx, const uint8_t access, const uint32_t ahead) {
+    static const int32_t fadv[] = {POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM};
+    static const int32_t madv[] = {MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM};
+
+    if (!matx || access > MP_ACCESS_RANDOM) return -1;
+
+    matx->access = access;
+    matx->ahead = ahead;
+
+    if (matx->fd != -1 && posix_fadvise(matx->fd, 0, 0, fadv[access]) != 0) return -1;
+    if (matx->map && madvise(matx->map, matx->map_len, madv[access]) == -1) return -1;
+    return 0;
+}
+
+/**
+ * Zero-copy transfer of matrix payload between file descriptors.
+ *
+ * Transfers exactly:
+ *     size.x * size.y * sizeof(int64_t)
+ *
+ * Data is moved kernel-to-kernel by the splice engine, which picks
+ * copy_file_range(), sendfile() or splice() through a pooled pipe
+ * depending on the descriptor types (see mp_splice.h).
+ *
+ * This avoids user-space buffers and supports very large matrices
+ * (multi-TB) without RAM pressure.
+ *
+ * @param fd_f   Source file descriptor (must be readable).
+ * @param pos_f  Source offset, or -1 for a stream.
+ * @param fd_t   Destination file descriptor (must be writable).
+ * @param pos_t  Destination offset, or -1 for a stream.
+ * @param size   Matrix dimensions defining transfer length.
+ *
+ * @return  0 on success
+ * @return -1 on failure
+ */
+static int32_t
+mp_matrix_splice(const int32_t fd_f, const loff_t pos_f,
+                 const int32_t fd_t, const loff_t pos_t, const mp_msize size) {
+    return mp_splice_copy(fd_f, pos_f, fd_t, pos_t, size.x * size.y * sizeof(int64_t));
+}
+
 /**
  * Receive matrix size header from a stream/socket.
  *
@@ -447,7 +1019,7 @@ mp_matrix_recv_msize(mp_matrix *matx, const int32_t fd) {
     uint64_t x, y;
 
     /* receive header */
-    uint64_t rem = sizeof(uint64_t);
+    uint64_t rem = sizeof(hdr);
     uint64_t ptr = 0;
 
     while (rem > 0) {
@@ -475,7 +1047,7 @@ mp_matrix_recv_msize(mp_matrix *matx, const int32_t fd) {
 /**
  * Receive full matrix (header + payload).
  *
- * Payload transfer is performed via zero-copy splice().
+ * Payload transfer is performed by the zero-copy splice engine.
  *
  * @param matx  Destination matrix.
  * @param fd    Source file descriptor.
@@ -483,10 +1055,17 @@ mp_matrix_recv_msize(mp_matrix *matx, const int32_t fd) {
  * @return  0 on success
  * @return -1 on failure
  */
-static __inline__ int32_t
+int32_t
 mp_matrix_recv(mp_matrix *matx, const int32_t fd) {
-    if (mp_matrix_recv_msize(matx, fd) < 0) return -1;
-    return mp_matrix_splice(fd, matx->fd, matx->size);
+    if (matx->flags & MP_MATRIX_TILED) return -1;
+
+    MP_PERF_BEGIN(MP_PERF_XFER);
+    int32_t ret = mp_matrix_recv_msize(matx, fd);
+    if (ret == 0) ret = mp_matrix_splice(fd, -1, matx->fd, sizeof(mp_msize), matx->size);
+    if (ret == 0)
+        mp_stats_io(MP_STATS_RECV, sizeof(mp_msize) + matx->size.x * matx->size.y * sizeof(int64_t));
+    MP_PERF_END(MP_PERF_XFER);
+    return ret;
 }
 
 /**
@@ -512,7 +1091,7 @@ mp_matrix_send_msize(const mp_matrix *matx, const int32_t fd) {
     __builtin_memcpy(hdr + 8, &y, 8);
 
     /* send header atomically */
-    uint64_t rem = sizeof(uint64_t);
+    uint64_t rem = sizeof(hdr);
     uint64_t ptr = 0;
 
     while (rem > 0) {
@@ -531,7 +1110,7 @@ mp_matrix_send_msize(const mp_matrix *matx, const int32_t fd) {
 /**
  * Send full matrix (header + payload).
  *
- * Payload is transferred using kernel zero-copy splice().
+ * Payload is transferred by the kernel zero-copy splice engine.
  *
  * @param matx  Source matrix.
  * @param fd    Destination file descriptor.
@@ -539,8 +1118,15 @@ mp_matrix_send_msize(const mp_matrix *matx, const int32_t fd) {
  * @return  0 on success
  * @return -1 on failure
  */
-static __inline__ int32_t
+int32_t
 mp_matrix_send(const mp_matrix *matx, const int32_t fd) {
-    if (mp_matrix_send_msize(matx, fd) < 0) return -1;
-    return mp_matrix_splice(matx->fd, fd, matx->size);
+    if (matx->flags & MP_MATRIX_TILED) return -1;
+
+    MP_PERF_BEGIN(MP_PERF_XFER);
+    int32_t ret = mp_matrix_send_msize(matx, fd);
+    if (ret == 0) ret = mp_matrix_splice(matx->fd, sizeof(mp_msize), fd, -1, matx->size);
+    if (ret == 0)
+        mp_stats_io(MP_STATS_SENT, sizeof(mp_msize) + matx->size.x * matx->size.y * sizeof(int64_t));
+    MP_PERF_END(MP_PERF_XFER);
+    return ret;
 }
\ No newline at end of file
@@ -42,17 +42,36 @@ extern "C" {
  */
 
 /**
- * RB-tree state for chunk management.
+ * Lookup state of a tree walk.
+ *
+ * rb_tree_find() leaves the path to the node (or to the place a missing
+ * node would be inserted) here, and caches the last result. The tree's
+ * own cursor belongs to the writer; other threads bring their own (see
+ * mp_matrix_chunk_lookup() and mp_rcu.h).
  */
-typedef struct mp_tree {
-    mp_chunk *root;      /**< Root of RB-tree */
+typedef struct mp_cursor {
     mp_chunk *find;      /**< Cache for last found node */
-
     mp_copos offset;     /**< Last accessed offset */
     int32_t pos;          /**< Depth index for stack during insert/remove */
+    uint64_t finds;      /**< Lookups through this cursor */
+    uint64_t hits;       /**< Lookups answered by the cache */
 
     mp_chunk *stack[32]; /**< Ancestor nodes during traversal */
     uint8_t   sides[32]; /**< Side taken at each level (0=left, 1=right) */
+} mp_cursor;
+
+/**
+ * RB-tree state for chunk management.
+ *
+ * seq is a sequence lock over the links: odd while the writer is
+ * inserting, removing or rotating nodes.
+ */
+typedef struct mp_tree {
+    mp_chunk *root;      /**< Root of RB-tree */
+    uint64_t count;      /**< Number of chunks in the tree */
+    uint64_t seq;        /**< Link changes * 2 (+1 while one is running) */
+
+    mp_cursor cur;       /**< Lookup state of the writer */
 } mp_tree;
 
 /**
@@ -63,13 +82,30 @@ typedef struct {
     uint64_t y; /**< Number of rows */
 } mp_msize;
 
+/** Backing file modes (mp_matrix::flags) */
+#define MP_MATRIX_TILED  0x1 /**< Tiled file format, see mp_file.h */
+#define MP_MATRIX_DIRECT 0x2 /**< O_DIRECT chunk I/O (implies TILED) */
+#define MP_MATRIX_MAPPED 0x4 /**< Chunks point into a file mapping */
+
+/** Declared access patterns (mp_matrix::access) */
+#define MP_ACCESS_NORMAL     0 /**< No hint, kernel defaults */
+#define MP_ACCESS_SEQUENTIAL 1 /**< Tree / tile order scans, read ahead */
+#define MP_ACCESS_RANDOM     2 /**< Point lookups, no readahead */
+
+/** Default readahead window of sequential scans (chunks) */
+#define MATRIX_AHEAD 8
+
+/** Chunks dropped per pass when a matrix shrinks */
+#define MATRIX_DROP_BATCH 256
+
 /**
  * Matrix structure.
  *
  * Contains:
  *   - RB-tree of chunks
- *   - Optional file descriptor (fd)
+ *   - Optional file descriptor (fd) and its mode flags
  *   - Matrix size
+ *   - File mapping and its chunk descriptors (MP_MATRIX_MAPPED)
  */
 typedef struct mp_matrix {
     mp_pool *pool;
@@ -77,6 +113,27 @@ typedef struct mp_matrix {
 
     mp_msize size;
     int32_t fd;
+    uint32_t flags;
+
+    uint8_t access;   /**< MP_ACCESS_* pattern */
+    uint32_t ahead;   /**< Chunks to prefetch ahead of a sequential scan */
+
+    uint8_t *map;     /**< Mapping of the whole tiled file */
+    uint64_t map_len; /**< Mapping length (bytes) */
+    mp_chunk *maps;   /**< Descriptors of mapped tiles (not from the pool) */
+    uint64_t nmaps;   /**< Number of descriptors */
+
+    struct mp_snap *snap;     /**< Running snapshot (see mp_snap.h) or NULL */
+    struct mp_merkle *merkle; /**< Attached hash tree (see mp_merkle.h) or NULL */
+    struct mp_cold *cold;     /**< Attached cold tier (see mp_cold.h) or NULL */
+    struct mp_rcu *rcu;       /**< Concurrent readers (see mp_rcu.h) or NULL */
+
+    uint32_t gen;     /**< Current write generation, stamped on touch */
+    uint32_t synced;  /**< Generation covered by the last sync (mp_sync.h) */
+    mp_copos *drops;  /**< Chunks dropped since the last sync */
+    uint64_t ndrops;  /**< Entries in drops */
+    uint64_t cdrops;  /**< Capacity of drops */
+    uint8_t resync;   /**< Drop list lost, the next sync rewrites everything */
 } mp_matrix;
 
 /* ============================================================================
@@ -87,29 +144,42 @@ typedef struct mp_matrix {
 /**
  * Initialize an empty matrix.
  */
-static __inline__ void
+void
 mp_matrix_init(mp_matrix *matx, mp_pool *pool);
 
 
 /**
  * Free the data taken y thi s matrix
+ *
+ * Pool chunks go back to the pool; a file mapping is unmapped.
  */
-static __inline__ void
+void
 mp_matrix_free(mp_matrix *matx);
 
+/**
+ * Check that a matrix size is addressable: the chunk coordinates of
+ * both dimensions must fit the 32-bit fields of mp_copos.
+ */
+static __inline__ int32_t
+mp_msize_valid(const mp_msize size) {
+    return size.x >> CHUNK_POW < UINT32_MAX && size.y >> CHUNK_POW < UINT32_MAX;
+}
+
 /**
  * @brief Set the matrix size and resize the underlying file.
  *
  * Stores the matrix dimensions in the file header and resizes the file
- * to accommodate the matrix data.
+ * to accommodate the matrix data. Matrices without a backing file only
+ * record the new size.
  *
  * @param matx Pointer to the matrix object.
  * @param size Matrix dimensions (width × height).
  *
  * @return 0  On success.
- * @return -1 On error (invalid file descriptor or system call failure).
+ * @return -1 On error (system call failure), on a size that fails
+ *            mp_msize_valid() or whose file length overflows.
  */
-static __inline__ int32_t
+int32_t
 mp_matrix_set_size(mp_matrix *matx, mp_msize size);
 
 /**
@@ -117,7 +187,7 @@ mp_matrix_set_size(mp_matrix *matx, mp_msize size);
  *
  * Opens the specified file in read/write mode, creating it if necessary.
  * If the file already contains a matrix header, reads the matrix size
- * into the matrix structure.
+ * into the matrix structure. A file attached before is closed.
  *
  * @param matx    Pointer to the matrix object.
  * @param filename Path to the file to open.
@@ -125,17 +195,302 @@ mp_matrix_set_size(mp_matrix *matx, mp_msize size);
  * @return 0  On success.
  * @return -1 On error (invalid parameters or file open failure).
  */
-static __inline__ int32_t
+int32_t
 mp_matrix_set_file(mp_matrix *matx, const char *filename);
 
+/**
+ * @brief Open a matrix file in the given mode.
+ *
+ * With flags == 0 this is mp_matrix_set_file(). MP_MATRIX_TILED uses
+ * the tiled format of mp_file.h; MP_MATRIX_DIRECT additionally opens the
+ * file with O_DIRECT so chunk loads and stores bypass the page cache.
+ *
+ * If the filesystem refuses O_DIRECT (e.g. tmpfs) the file is opened
+ * buffered and MP_MATRIX_DIRECT is cleared from matx->flags.
+ *
+ * @param matx     Pointer to the matrix object.
+ * @param filename Path to the file to open.
+ * @param flags    MP_MATRIX_* mode flags.
+ *
+ * @return 0  On success.
+ * @return -1 On error (open failure or foreign file format).
+ */
+int32_t
+mp_matrix_set_file_mode(mp_matrix *matx, const char *filename, uint32_t flags);
 
-static __inline__ int32_t
+/**
+ * @brief Map a tiled matrix file without copying it into the pool.
+ *
+ * The file is mmap'd once and every non-hole tile gets a descriptor
+ * whose data points into the mapping, so opening is O(tiles) metadata
+ * work and chunk payloads are paged in lazily on first access. Clean
+ * pages are shared with the page cache and with other processes mapping
+ * the same file.
+ *
+ * The mapping is private: chunks may be modified, but modifications
+ * never reach the file. Chunks materialized later (e.g. by
+ * mp_matrix_put() on a hole) come from the pool as usual.
+ * Any previous content of matx is released and a file attached
+ * before is closed first.
+ *
+ * @param matx     Pointer to the matrix object.
+ * @param filename Path to a file in the tiled format of mp_file.h.
+ *
+ * @return 0  On success.
+ * @return -1 On open / mmap / allocation failure or foreign file format.
+ */
+int32_t
+mp_matrix_map_file(mp_matrix *matx, const char *filename);
+
+/**
+ * @brief Declare how the backing file will be accessed.
+ *
+ * Forwards the pattern to the kernel for the current backing file
+ * (posix_fadvise) and mapping (madvise). Sequential scans via
+ * mp_file_load() and mp_scan_next() additionally prefetch the next
+ * `ahead` tiles with WILLNEED, so cold files are read with more than
+ * one request in flight. Call after opening the file.
+ *
+ * @param matx    Pointer to the matrix object.
+ * @param access  MP_ACCESS_* pattern.
+ * @param ahead   Readahead window in chunks (0 disables prefetching).
+ *
+ * @return 0  On success.
+ * @return -1 On invalid pattern or advice failure.
+ */
+int32_t
+mp_matrix_set_access(mp_matrix *matx, uint8_t access, uint32_t ahead);
+
+
+/**
+ * Receive / send the dense payload of a matrix (header + row-major data).
+ *
+ * Only dense backing files are supported; tiled matrices use the
+ * chunk-stream format of mp_stream.h instead.
+ */
+int32_t
 mp_matrix_recv(mp_matrix *matx, int32_t fd);
 
-static __inline__ int32_t
+int32_t
 mp_matrix_send(const mp_matrix *matx, int32_t fd);
 
 
+/* ============================================================================
+ *  Chunk access
+ * ============================================================================
+ */
+
+/**
+ * Compute the effective size of the chunk at opos for this matrix.
+ *
+ * Chunks on the right / bottom border are clipped to the matrix size.
+ */
+static __inline__ mp_csize
+mp_matrix_csize(const mp_matrix *matx, const mp_copos opos) {
+    const uint64_t x = matx->size.x - ((uint64_t) opos.dim.x << CHUNK_POW);
+    const uint64_t y = matx->size.y - ((uint64_t) opos.dim.y << CHUNK_POW);
+
+    mp_csize size;
+    size.dim.x = (uint8_t) ((x > CHUNK_W ? CHUNK_W : x) - 1);
+    size.dim.y = (uint8_t) ((y > CHUNK_H ? CHUNK_H : y) - 1);
+    return size;
+}
+
+/**
+ * Check that a chunk offset lies inside the matrix.
+ */
+static __inline__ int32_t
+mp_matrix_contains(const mp_matrix *matx, const mp_copos opos) {
+    return ((uint64_t) opos.dim.x << CHUNK_POW) < matx->size.x &&
+           ((uint64_t) opos.dim.y << CHUNK_POW) < matx->size.y;
+}
+
+/**
+ * Check whether chunk is a descriptor of the file mapping of matx.
+ */
+static __inline__ int32_t
+mp_matrix_chunk_mapped(const mp_matrix *matx, const mp_chunk *chunk) {
+    return chunk >= matx->maps && chunk < matx->maps + matx->nmaps;
+}
+
+/**
+ * Find the chunk at offset opos.
+ *
+ * A frozen chunk (see mp_cold.h) is thawed first.
+ *
+ * Returns:
+ *   Chunk pointer or NULL if the chunk is not materialized (or could
+ *   not be thawed)
+ */
+mp_chunk *
+mp_matrix_chunk_find(mp_matrix *matx, mp_copos opos);
+
+/**
+ * Reset a cursor (empty lookup cache).
+ */
+static __inline__ void
+mp_cursor_init(mp_cursor *cur) {
+    cur->find = NULL;
+    cur->offset.pos = UINT64_MAX;
+    cur->finds = 0;
+    cur->hits = 0;
+}
+
+/**
+ * Find the chunk at offset opos through a caller-owned cursor.
+ *
+ * Nothing shared is written (no cache, no access counting, no thawing),
+ * so any number of threads may look up chunks of a matrix nobody
+ * modifies, each with its own cursor. Frozen chunks come back as
+ * placeholders with data == NULL. Lookups racing with a writer go
+ * through mp_reader_find() instead.
+ *
+ * Returns:
+ *   Chunk pointer or NULL if the chunk is not materialized
+ */
+mp_chunk *
+mp_matrix_chunk_lookup(const mp_matrix *matx, mp_cursor *cur, mp_copos opos);
+
+/**
+ * Find the chunk at offset opos, allocating a zeroed one if absent.
+ *
+ * Returns:
+ *   Chunk pointer or NULL on allocation failure / out of range offset
+ */
+mp_chunk *
+mp_matrix_chunk_take(mp_matrix *matx, mp_copos opos);
+
+/**
+ * Declare that chunk (of matx) is about to be modified.
+ *
+ * This is the write-path hook of the matrix: the chunk is stamped with
+ * the current write generation (dirty until the next sync), queued for
+ * rehashing in an attached Merkle tree, and a running snapshot saves it
+ * before it changes. Code that modifies chunk data
+ * obtained from mp_matrix_chunk_find() or an iterator must call it first.
+ */
+void
+mp_matrix_chunk_touch(mp_matrix *matx, mp_chunk *chunk);
+
+/**
+ * mp_matrix_chunk_take() followed by mp_matrix_chunk_touch().
+ *
+ * Use this instead of take whenever the chunk will be written.
+ *
+ * Returns:
+ *   Chunk pointer or NULL on allocation failure / out of range offset
+ */
+mp_chunk *
+mp_matrix_chunk_write(mp_matrix *matx, mp_copos opos);
+
+/**
+ * Remove the chunk at offset opos and return it to the pool.
+ *
+ * Matrices with a backing file, or synced at least once, remember the
+ * offset so the next sync can delete the chunk there too.
+ */
+void
+mp_matrix_chunk_drop(mp_matrix *matx, mp_copos opos);
+
+/**
+ * Insert a filled chunk (opos and size set) obtained from matx->pool.
+ *
+ * A chunk already present at the same offset is replaced and
+ * returned to the pool.
+ */
+void
+mp_matrix_chunk_insert(mp_matrix *matx, mp_chunk *chunk);
+
+/**
+ * Link n chunks sorted by opos (distinct offsets, from matx->pool)
+ * into an empty matrix, in O(n).
+ *
+ * Each chunk is stamped and hooked as by mp_matrix_chunk_insert().
+ *
+ * @return  0 on success
+ * @return -1 if the matrix is not empty
+ */
+int32_t
+mp_matrix_chunk_build(mp_matrix *matx, mp_chunk **chunks, uint64_t n);
+
+/**
+ * Put chunk in the tree node of old (same opos), leaving everything
+ * else alone: no generation stamp, no hooks, old is not released.
+ *
+ * This is how the cold tier swaps placeholders and pool chunks.
+ *
+ * @return  0 on success
+ * @return -1 if old is not in the tree
+ */
+int32_t
+mp_matrix_chunk_swap(mp_matrix *matx, mp_chunk *old, mp_chunk *chunk);
+
+
+/* ============================================================================
+ *  Element access
+ * ============================================================================
+ */
+
+/**
+ * Read element (x, y).
+ *
+ * Elements of chunks that are not materialized read as 0.
+ */
+int64_t
+mp_matrix_get(mp_matrix *matx, uint64_t x, uint64_t y);
+
+/**
+ * Write element (x, y), materializing its chunk if needed.
+ *
+ * @return  0 on success
+ * @return -1 on out of range position or allocation failure
+ */
+int32_t
+mp_matrix_put(mp_matrix *matx, uint64_t x, uint64_t y, int64_t value);
+
+
+/* ============================================================================
+ *  In-order chunk iteration
+ * ============================================================================
+ */
+
+/**
+ * In-order (opos ascending) iterator over the chunks of a tree.
+ *
+ * The iterator keeps its own stack, so it does not disturb the
+ * lookup cache of the tree. The tree must not be modified while
+ * iterating.
+ */
+typedef struct mp_iter {
+    mp_chunk *node;      /**< Next subtree to descend into */
+    int32_t pos;          /**< Top of stack */
+    mp_chunk *stack[64]; /**< Ancestors still to be visited */
+} mp_iter;
+
+/**
+ * Start iterating over the chunks of a tree.
+ */
+static __inline__ void
+mp_iter_init(mp_iter *iter, const mp_tree *tree) {
+    iter->node = tree->root;
+    iter->pos = -1;
+}
+
+/**
+ * Return the next chunk in opos order, or NULL when done.
+ */
+static __inline__ mp_chunk *
+mp_iter_next(mp_iter *iter) {
+    mp_chunk *node = iter->node;
+    while (node) node = (iter->stack[++iter->pos] = node)->sides[0];
+    if (iter->pos == -1) return NULL;
+
+    node = iter->stack[iter->pos--];
+    iter->node = node->sides[1];
+    return node;
+}
+
+
 #ifdef __cplusplus
 }
 #endif
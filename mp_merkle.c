@@ -0,0 +1,475 @@
+#include "mp_merkle.h"
+
+#include <endian.h>
+
+#include "mp_cold.h"
+#include "mp_file.h"
+#include "mp_stream.h"
+
+
+/** u64 values converted per write / read of a hash or index list */
+#define MERKLE_BATCH 512
+
+
+/* ============================================================================
+ *  Hashing
+ * ============================================================================
+ */
+
+/**
+ * Hash the effective rows of a chunk.
+ *
+ * Four independent lanes keep the multipliers busy; a row tail that is
+ * not a multiple of four goes to lane 0.
+ */
+uint64_t
+mp_merkle_chunk_hash(const mp_chunk *chunk) {
+    const uint32_t w = chunk->size.dim.x + 1u;
+    const uint32_t h = chunk->size.dim.y + 1u;
+    uint64_t acc[4] = {MERKLE_P1 + MERKLE_P2, MERKLE_P2, 0, -MERKLE_P1};
+
+    for (uint32_t y = 0; y < h; y++) {
+        const uint64_t *row = (const uint64_t *) chunk->data + CHUNK_POS(0, y);
+        uint32_t x = 0;
+
+        for (; x + 4 <= w; x += 4) {
+            acc[0] = mp_merkle_round(acc[0], row[x + 0]);
+            acc[1] = mp_merkle_round(acc[1], row[x + 1]);
+            acc[2] = mp_merkle_round(acc[2], row[x + 2]);
+            acc[3] = mp_merkle_round(acc[3], row[x + 3]);
+        }
+        for (; x < w; x++) acc[0] = mp_merkle_round(acc[0], row[x]);
+    }
+
+    uint64_t hash = ((acc[0] << 1) | (acc[0] >> 63)) + ((acc[1] << 7) | (acc[1] >> 57)) +
+                    ((acc[2] << 12) | (acc[2] >> 52)) + ((acc[3] << 18) | (acc[3] >> 46));
+    hash = mp_merkle_mix(hash ^ ((uint64_t) w << 32 | h));
+    return hash ? hash : 1;
+}
+
+/**
+ * Hash n child hashes into their parent.
+ */
+uint64_t
+mp_merkle_node_hash(const uint64_t *child, const uint64_t n) {
+    uint64_t any = 0;
+    uint64_t acc = MERKLE_P3 + n;
+
+    for (uint64_t i = 0; i < n; i++) {
+        any |= child[i];
+        acc = mp_merkle_round(acc, child[i]);
+    }
+    if (!any) return 0;
+
+    acc = mp_merkle_mix(acc);
+    return acc ? acc : 1;
+}
+
+
+/* ============================================================================
+ *  Tree
+ * ============================================================================
+ */
+
+/**
+ * Release the level arrays.
+ */
+static void
+mp_merkle_release(mp_merkle *merkle) {
+    for (uint32_t l = 0; l < MERKLE_DEPTH; l++) {
+        free(merkle->node[l]);
+        free(merkle->mark[l]);
+        merkle->node[l] = NULL;
+        merkle->mark[l] = NULL;
+        merkle->count[l] = 0;
+    }
+    merkle->depth = 0;
+}
+
+/**
+ * Rehash node i of level l (l > 0) from its children.
+ */
+static void
+mp_merkle_rehash(mp_merkle *merkle, const uint32_t l, const uint64_t i) {
+    const uint64_t first = i * MERKLE_FAN;
+    const uint64_t left = merkle->count[l - 1] - first;
+
+    merkle->node[l][i] = mp_merkle_node_hash(merkle->node[l - 1] + first,
+                                             left < MERKLE_FAN ? left : MERKLE_FAN);
+}
+
+/**
+ * Allocate the levels for the current matrix size and hash everything.
+ */
+static int32_t
+mp_merkle_build(mp_merkle *merkle) {
+    mp_matrix *matx = merkle->matx;
+    mp_merkle_release(merkle);
+
+    uint64_t count = mp_file_ncx(matx->size) * mp_file_ncy(matx->size);
+    if (count == 0) count = 1;
+
+    for (uint32_t l = 0; l < MERKLE_DEPTH; l++) {
+        merkle->count[l] = count;
+        merkle->node[l] = calloc(count, sizeof(uint64_t));
+        merkle->mark[l] = calloc(count, sizeof(uint8_t));
+        merkle->depth = l + 1;
+        if (!merkle->node[l] || !merkle->mark[l]) goto error;
+
+        if (count == 1) break;
+        count = (count + MERKLE_FAN - 1) / MERKLE_FAN;
+    }
+    if (merkle->count[merkle->depth - 1] != 1) goto error;
+
+    /* ---- leaves ---- */
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (!mp_matrix_contains(matx, chunk->opos)) continue;
+        if (!(chunk = mp_cold_warm(matx, chunk))) goto error;
+        merkle->node[0][mp_file_tile(matx->size, chunk->opos)] = mp_merkle_chunk_hash(chunk);
+    }
+
+    /* ---- inner levels ---- */
+    for (uint32_t l = 1; l < merkle->depth; l++)
+        for (uint64_t i = 0; i < merkle->count[l]; i++) mp_merkle_rehash(merkle, l, i);
+
+    merkle->size = matx->size;
+    merkle->npend = 0;
+    merkle->stale = 0;
+    return 0;
+
+error:
+    mp_merkle_release(merkle);
+    merkle->stale = 1;
+    return -1;
+}
+
+/**
+ * Build the tree of matx and attach it.
+ */
+int32_t
+mp_merkle_attach(mp_merkle *merkle, mp_matrix *matx) {
+    if (!merkle || !matx || matx->merkle) return -1;
+
+    __builtin_memset(merkle, 0, sizeof(*merkle));
+    merkle->matx = matx;
+
+    if (mp_merkle_build(merkle) < 0) return -1;
+
+    matx->merkle = merkle;
+    return 0;
+}
+
+/**
+ * Detach the tree from its matrix and free it.
+ */
+void
+mp_merkle_free(mp_merkle *merkle) {
+    if (merkle->matx && merkle->matx->merkle == merkle) merkle->matx->merkle = NULL;
+
+    mp_merkle_release(merkle);
+    free(merkle->pend);
+    merkle->pend = NULL;
+    merkle->npend = 0;
+    merkle->cpend = 0;
+}
+
+/**
+ * Queue the leaf of opos for rehashing.
+ */
+void
+mp_merkle_mark(mp_merkle *merkle, const mp_copos opos) {
+    if (merkle->stale) return;
+
+    const mp_matrix *matx = merkle->matx;
+    if (matx->size.x != merkle->size.x || matx->size.y != merkle->size.y ||
+        !mp_matrix_contains(matx, opos)) {
+        merkle->stale = 1;
+        return;
+    }
+
+    const uint64_t tile = mp_file_tile(matx->size, opos);
+    if (merkle->mark[0][tile]) return;
+
+    if (merkle->npend == merkle->cpend) {
+        const uint64_t cap = merkle->cpend ? merkle->cpend << 1 : 64;
+        uint64_t *pend = realloc(merkle->pend, cap * sizeof(uint64_t));
+        if (!pend) {
+            merkle->stale = 1;
+            return;
+        }
+        merkle->pend = pend;
+        merkle->cpend = cap;
+    }
+
+    merkle->mark[0][tile] = 1;
+    merkle->pend[merkle->npend++] = tile;
+}
+
+/**
+ * Rehash queued leaves and their ancestors.
+ *
+ * The queue is turned into the parent queue in place, level by level:
+ * every entry produces at most one new entry, so writes never overtake
+ * reads.
+ */
+int32_t
+mp_merkle_update(mp_merkle *merkle) {
+    const mp_matrix *matx = merkle->matx;
+
+    if (merkle->stale || !merkle->depth ||
+        matx->size.x != merkle->size.x || matx->size.y != merkle->size.y)
+        return mp_merkle_build(merkle);
+
+    uint64_t *pend = merkle->pend;
+    uint64_t n = merkle->npend;
+
+    /* ---- leaves ---- */
+    for (uint64_t i = 0; i < n; i++) {
+        const uint64_t tile = pend[i];
+        const uint64_t ncx = mp_file_ncx(matx->size);
+        const mp_copos opos = {.dim = {(uint32_t) (tile % ncx), (uint32_t) (tile / ncx)}};
+        const mp_chunk *chunk = mp_matrix_chunk_find((mp_matrix *) matx, opos);
+
+        merkle->node[0][tile] = chunk ? mp_merkle_chunk_hash(chunk) : 0;
+        merkle->mark[0][tile] = 0;
+    }
+
+    /* ---- ancestors ---- */
+    for (uint32_t l = 1; l < merkle->depth; l++) {
+        uint64_t m = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            const uint64_t parent = pend[i] / MERKLE_FAN;
+            if (merkle->mark[l][parent]) continue;
+            merkle->mark[l][parent] = 1;
+            pend[m++] = parent;
+        }
+        n = m;
+
+        for (uint64_t i = 0; i < n; i++) {
+            mp_merkle_rehash(merkle, l, pend[i]);
+            merkle->mark[l][pend[i]] = 0;
+        }
+    }
+
+    merkle->npend = 0;
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Wire helpers
+ * ============================================================================
+ */
+
+/**
+ * Write n values as big-endian u64.
+ */
+static int32_t
+mp_merkle_write(const int32_t fd, const uint64_t *val, uint64_t n) {
+    uint64_t buf[MERKLE_BATCH];
+
+    while (n > 0) {
+        const uint64_t k = n < MERKLE_BATCH ? n : MERKLE_BATCH;
+        for (uint64_t i = 0; i < k; i++) buf[i] = htobe64(val[i]);
+        if (mp_stream_write(fd, (const uint8_t *) buf, k * sizeof(uint64_t)) < 0) return -1;
+
+        val += k;
+        n -= k;
+    }
+    return 0;
+}
+
+/**
+ * Read n big-endian u64 values.
+ */
+static int32_t
+mp_merkle_read(const int32_t fd, uint64_t *val, const uint64_t n) {
+    if (mp_stream_read(fd, (uint8_t *) val, n * sizeof(uint64_t)) < 0) return -1;
+    for (uint64_t i = 0; i < n; i++) val[i] = be64toh(val[i]);
+    return 0;
+}
+
+/**
+ * Replace a list of level l + 1 nodes by the list of their children.
+ *
+ * Returns:
+ *   New list length
+ */
+static uint64_t
+mp_merkle_children(const mp_merkle *merkle, const uint32_t l,
+                   const uint64_t *list, const uint64_t n, uint64_t *out) {
+    uint64_t m = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        const uint64_t first = list[i] * MERKLE_FAN;
+        for (uint64_t c = first; c < first + MERKLE_FAN && c < merkle->count[l]; c++)
+            out[m++] = c;
+    }
+    return m;
+}
+
+
+/* ============================================================================
+ *  Replication
+ * ============================================================================
+ */
+
+/**
+ * Send the requested tiles, closed by an END frame.
+ */
+static int64_t
+mp_merkle_send_tiles(const mp_matrix *matx, const int32_t fd,
+                     const uint64_t *tile, const uint64_t n) {
+    const uint64_t ncx = mp_file_ncx(matx->size);
+    uint8_t frame[STREAM_FRAME];
+
+    for (uint64_t i = 0; i < n; i++) {
+        const mp_copos opos = {.dim = {(uint32_t) (tile[i] % ncx), (uint32_t) (tile[i] / ncx)}};
+        const mp_chunk *chunk = mp_matrix_chunk_find((mp_matrix *) matx, opos);
+
+        mp_stream_pack(frame, opos.pos, chunk ? chunk->size.size : MERKLE_ABSENT);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+        if (chunk && mp_chunk_send(chunk, fd) < 0) return -1;
+    }
+
+    mp_stream_pack(frame, MP_STREAM_END, n);
+    if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+    return (int64_t) n;
+}
+
+/**
+ * Replicate the matrix of merkle to the peer on fd (source side).
+ */
+int64_t
+mp_merkle_send(mp_merkle *merkle, const int32_t fd) {
+    const mp_matrix *matx = merkle->matx;
+    if (mp_merkle_update(merkle) < 0) return -1;
+
+    uint8_t frame[STREAM_FRAME];
+    mp_stream_pack(frame, matx->size.x, matx->size.y);
+    if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+
+    uint64_t *list = malloc(merkle->count[0] * sizeof(uint64_t));
+    uint64_t *hash = malloc(merkle->count[0] * sizeof(uint64_t));
+    int64_t ret = -1;
+    if (!list || !hash) goto end;
+
+    /* level being compared by the sink, and its node list */
+    uint32_t l = merkle->depth - 1;
+    uint64_t n = 1;
+    list[0] = 0;
+
+    while (1) {
+        for (uint64_t i = 0; i < n; i++) hash[i] = merkle->node[l][list[i]];
+        if (mp_merkle_write(fd, hash, n) < 0) goto end;
+
+        /* ---- differing nodes of level l ---- */
+        uint64_t a, b;
+        if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto end;
+        mp_stream_unpack(frame, &a, &b);
+        if (a > n || b != l || mp_merkle_read(fd, hash, a) < 0) goto end;
+
+        for (uint64_t i = 0; i < a; i++)
+            if (hash[i] >= merkle->count[l]) goto end;
+
+        if (a == 0 || l == 0) {
+            ret = mp_merkle_send_tiles(matx, fd, hash, a);
+            goto end;
+        }
+
+        l--;
+        n = mp_merkle_children(merkle, l, hash, a, list);
+    }
+
+end:
+    free(list);
+    free(hash);
+    return ret;
+}
+
+/**
+ * Apply tile frames up to the END frame.
+ */
+static int64_t
+mp_merkle_recv_tiles(mp_matrix *matx, const int32_t fd) {
+    uint8_t frame[STREAM_FRAME];
+    int64_t count = 0;
+
+    while (1) {
+        uint64_t a, b;
+        if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) return -1;
+        mp_stream_unpack(frame, &a, &b);
+
+        if (a == MP_STREAM_END) return count;
+
+        const mp_copos opos = {.pos = a};
+        count++;
+
+        if (b == MERKLE_ABSENT) {
+            mp_matrix_chunk_drop(matx, opos);
+            continue;
+        }
+
+        const mp_csize size = {.size = (uint16_t) b};
+        if (b > UINT16_MAX || !mp_stream_valid(matx, opos, size)) return -1;
+
+        const mp_chunk *chunk = mp_matrix_chunk_write(matx, opos);
+        if (!chunk || mp_chunk_recv(chunk, fd) < 0) return -1;
+    }
+}
+
+/**
+ * Make the matrix of merkle equal to the source on fd (sink side).
+ */
+int64_t
+mp_merkle_recv(mp_merkle *merkle, const int32_t fd) {
+    mp_matrix *matx = merkle->matx;
+
+    uint8_t frame[STREAM_FRAME];
+    uint64_t a, b;
+    if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) return -1;
+    mp_stream_unpack(frame, &a, &b);
+
+    if (a != matx->size.x || b != matx->size.y)
+        if (mp_matrix_set_size(matx, (mp_msize){a, b}) < 0) return -1;
+    if (mp_merkle_update(merkle) < 0) return -1;
+
+    uint64_t *list = malloc(merkle->count[0] * sizeof(uint64_t));
+    uint64_t *hash = malloc(merkle->count[0] * sizeof(uint64_t));
+    int64_t ret = -1;
+    if (!list || !hash) goto end;
+
+    uint32_t l = merkle->depth - 1;
+    uint64_t n = 1;
+    list[0] = 0;
+
+    while (1) {
+        if (mp_merkle_read(fd, hash, n) < 0) goto end;
+
+        /* ---- keep the differing nodes (in place) ---- */
+        uint64_t d = 0;
+        for (uint64_t i = 0; i < n; i++)
+            if (hash[i] != merkle->node[l][list[i]]) list[d++] = list[i];
+
+        mp_stream_pack(frame, d, l);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) goto end;
+        if (mp_merkle_write(fd, list, d) < 0) goto end;
+
+        if (d == 0 || l == 0) break;
+
+        l--;
+        __builtin_memcpy(hash, list, d * sizeof(uint64_t));
+        n = mp_merkle_children(merkle, l, hash, d, list);
+    }
+
+    ret = mp_merkle_recv_tiles(matx, fd);
+    if (ret >= 0 && mp_merkle_update(merkle) < 0) ret = -1;
+
+end:
+    free(list);
+    free(hash);
+    return ret;
+}
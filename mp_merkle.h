@@ -0,0 +1,227 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_merkle.h
+ *  Description:  Merkle tree over the chunk grid and O(changed) replication.
+ *
+ *  Leaves are the tiles of the matrix in opos order (the grid of
+ *  mp_file.h, absent chunks hash to 0); every inner node hashes
+ *  MERKLE_FAN children:
+ *
+ *      level 2            [ root ]
+ *      level 1      [ n0 ]  ...  [ n15 ]
+ *      level 0   [ t0 .. t15 ] ... [ t240 .. t255 ]   (tiles)
+ *
+ *  Write paths mark the leaf of every modified chunk (see
+ *  mp_matrix_chunk_touch()); mp_merkle_update() rehashes the marked
+ *  leaves and only their ancestors.
+ *
+ *  Replication (blocking, source -> sink, 16-byte big-endian frames of
+ *  mp_stream.h, hash and index lists as big-endian u64 arrays):
+ *
+ *      source                              sink
+ *      [ size.x | size.y ]         ->
+ *      root hash                   ->
+ *                                  <-      [ n | level ] n differing nodes
+ *      hashes of their children    ->
+ *                                  <-      ...
+ *                                  <-      [ n | 0 ] n differing tiles
+ *      [ opos | csize ] payload    ->      per differing tile, or
+ *      [ opos | MERKLE_ABSENT ]    ->      if the source has no chunk
+ *      [ MP_STREAM_END | n ]       ->
+ *
+ *  One round trip per level, then only the differing chunks are sent
+ *  with mp_chunk_send().
+ *
+ *  Design goals:
+ *   - Nearly identical matrices cost O(changed · depth) hashes on the wire
+ *   - Unmodified chunks are never rehashed
+ *   - Empty subtrees hash to 0, so sparse matrices are cheap
+ *
+ *  Notes:
+ *   - The hash is a 4-lane multiply-rotate mix (not cryptographic), over
+ *     the effective rows of a chunk only
+ *   - Both endpoints must use the same byte order for payloads (see
+ *     mp_proto.h)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_MERKLE_H
+#define QDEEP_MATRIXP_MERKLE_H
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Children per inner node */
+#define MERKLE_FAN 16
+
+/** Maximum number of levels (16^12 tiles is far beyond any matrix) */
+#define MERKLE_DEPTH 12
+
+/** csize value of a tile the source does not have (no payload) */
+#define MERKLE_ABSENT ((uint64_t) UINT16_MAX + 1)
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Merkle tree of one matrix.
+ */
+typedef struct mp_merkle {
+    mp_matrix *matx;                 /**< Hashed matrix */
+    mp_msize size;                   /**< Size the levels were built for */
+
+    uint32_t depth;                  /**< Number of levels (root is depth - 1) */
+    uint64_t count[MERKLE_DEPTH];    /**< Nodes per level */
+    uint64_t *node[MERKLE_DEPTH];    /**< Node hashes per level */
+    uint8_t *mark[MERKLE_DEPTH];     /**< Node queued for rehash */
+
+    uint64_t *pend;                  /**< Queued leaves (tile indices) */
+    uint64_t npend;                  /**< Entries in pend */
+    uint64_t cpend;                  /**< Capacity of pend */
+    uint8_t stale;                   /**< Rebuild everything on next update */
+} mp_merkle;
+
+
+/* ============================================================================
+ *  Hashing
+ * ============================================================================
+ */
+
+#define MERKLE_P1 0x9E3779B185EBCA87ull
+#define MERKLE_P2 0xC2B2AE3D27D4EB4Full
+#define MERKLE_P3 0x165667B19E3779F9ull
+
+/**
+ * One lane step: acc = rotl(acc + v * P2, 31) * P1.
+ */
+static __inline__ uint64_t
+mp_merkle_round(const uint64_t acc, const uint64_t v) {
+    const uint64_t x = acc + v * MERKLE_P2;
+    return ((x << 31) | (x >> 33)) * MERKLE_P1;
+}
+
+/**
+ * Final avalanche of a 64-bit hash.
+ */
+static __inline__ uint64_t
+mp_merkle_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= MERKLE_P2;
+    h ^= h >> 29;
+    h *= MERKLE_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Hash the effective rows of a chunk.
+ *
+ * Returns:
+ *   Non-zero 64-bit hash (0 is reserved for absent chunks)
+ */
+uint64_t
+mp_merkle_chunk_hash(const mp_chunk *chunk);
+
+/**
+ * Hash n child hashes into their parent.
+ *
+ * Returns:
+ *   Parent hash, 0 if all children are 0
+ */
+uint64_t
+mp_merkle_node_hash(const uint64_t *child, uint64_t n);
+
+
+/* ============================================================================
+ *  Tree
+ * ============================================================================
+ */
+
+/**
+ * Build the tree of matx and attach it, so its write paths mark leaves.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure or if matx already has a tree
+ */
+int32_t
+mp_merkle_attach(mp_merkle *merkle, mp_matrix *matx);
+
+/**
+ * Detach the tree from its matrix and free it.
+ */
+void
+mp_merkle_free(mp_merkle *merkle);
+
+/**
+ * Queue the leaf of opos for rehashing (called from the matrix write paths).
+ */
+void
+mp_merkle_mark(mp_merkle *merkle, mp_copos opos);
+
+/**
+ * Rehash queued leaves and their ancestors.
+ *
+ * A resized matrix (or a lost queue) is rehashed completely.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+int32_t
+mp_merkle_update(mp_merkle *merkle);
+
+/**
+ * Root hash (0 for an empty matrix). Valid after mp_merkle_update().
+ */
+static __inline__ uint64_t
+mp_merkle_root(const mp_merkle *merkle) {
+    return merkle->node[merkle->depth - 1][0];
+}
+
+
+/* ============================================================================
+ *  Replication
+ * ============================================================================
+ */
+
+/**
+ * Replicate the matrix of merkle to the peer on fd (source side).
+ *
+ * Returns:
+ *   Number of tiles sent, or -1 on I/O failure or protocol error
+ */
+int64_t
+mp_merkle_send(mp_merkle *merkle, int32_t fd);
+
+/**
+ * Make the matrix of merkle equal to the source on fd (sink side).
+ *
+ * Returns:
+ *   Number of tiles received, or -1 on I/O failure, protocol error or
+ *   allocation failure
+ */
+int64_t
+mp_merkle_recv(mp_merkle *merkle, int32_t fd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_MERKLE_H */
@@ -1,4 +1,5 @@
 #include "mp_page.h"
+#include "mp_hist.h"
 
 /**
  * Required logical size for chunk storage (bytes).
@@ -16,8 +17,10 @@ static uint64_t __PAGE_SIZE = 0;
  */
 static uint64_t __MMAP_SIZE = 0;
 
-__inline__ int32_t
+int32_t
 mp_page_init(mp_page *page) {
+    MP_HIST_BEGIN(start);
+
     /* Caching the sizes for mmap usage */
     if (!__PAGE_SIZE) __PAGE_SIZE = sysconf(_SC_PAGESIZE);
     if (!__MMAP_SIZE) __MMAP_SIZE = (__NEED_SIZE + __PAGE_SIZE - 1) & ~(__PAGE_SIZE - 1);
@@ -51,6 +54,7 @@ mp_page_init(mp_page *page) {
     page->free = UINT16_MAX;
     page->fill = 0;
 
+    MP_HIST_END(start, MP_HIST_PAGE_INIT);
     return EXIT_SUCCESS;
 }
 
@@ -62,7 +66,7 @@ mp_page_init(mp_page *page) {
  *   - Does NOT destroy page object itself
  *   - Caller must ensure no chunks are in use
  */
-__inline__ void
+void
 mp_page_free(const mp_page *page) {
     munmap(page->data, __MMAP_SIZE);
 }
@@ -149,7 +149,7 @@ typedef struct mp_page {
  *   EXIT_SUCCESS on success
  *   EXIT_FAILURE on mmap failure
  */
-static __inline__ int32_t
+int32_t
 mp_page_init(mp_page *page);
 
 
@@ -160,7 +160,7 @@ mp_page_init(mp_page *page);
  *   - Does NOT destroy page object itself
  *   - Caller must ensure no chunks are in use
  */
-static __inline__ void
+void
 mp_page_free(const mp_page *page);
 
 
@@ -197,7 +197,7 @@ mp_page_full(const mp_page *page) {
  * Returns:
  *   Pointer to chunk or NULL if page exhausted
  */
-static __inline__ mp_chunk *
+mp_chunk *
 mp_page_get_new(mp_page *page);
 
 
@@ -206,14 +206,14 @@ mp_page_get_new(mp_page *page);
  *
  * Used when the position is known externally.
  */
-static __inline__ void
+void
 mp_page_get(mp_page *page, const mp_chunk *chunk);
 
 
 /**
  * Return a chunk back to the page.
  */
-static __inline__ void
+void
 mp_page_ret(mp_page *page, const mp_chunk *chunk);
 
 
@@ -0,0 +1,366 @@
+#include "mp_perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* ============================================================================
+ *  Internal state
+ * ============================================================================
+ */
+
+/** Counter definitions, in MP_PERF_* order */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} perf_def[MP_PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static const char *const perf_ops[MP_PERF_OPS] = {"tree", "pool", "xfer", "kernel"};
+
+/** Counting enabled */
+static uint8_t perf_on;
+
+/** Counters opened by some thread */
+static uint32_t perf_mask;
+
+/** Totals per operation type, updated with relaxed atomics */
+static mp_perf_stat perf_stat[MP_PERF_OPS];
+
+/** Periodic dump */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    FILE *out;
+    uint32_t ms;
+    uint8_t running;
+    uint8_t stop;
+} perf_dump = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+/** Thread state */
+#define PERF_CLOSED 0
+#define PERF_OPEN   1
+#define PERF_FAILED 2
+
+/**
+ * Counter group of one thread and its stack of entry readings.
+ */
+typedef struct mp_perf_thread {
+    int32_t fd[MP_PERF_EVENTS];     /**< Counter descriptors, -1 if refused */
+    uint8_t slot[MP_PERF_EVENTS];   /**< Position of each in a group read */
+    int32_t leader;                 /**< Group leader descriptor */
+    uint32_t n;                     /**< Counters in the group */
+    uint8_t state;                  /**< PERF_* */
+
+    uint32_t depth;                 /**< Open operations (may exceed PERF_DEPTH) */
+    struct {
+        uint64_t nsec;
+        uint64_t value[MP_PERF_EVENTS];
+    } stack[PERF_DEPTH];
+} mp_perf_thread;
+
+static __thread mp_perf_thread perf_self;
+
+static pthread_key_t perf_key;
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+
+
+/* ============================================================================
+ *  Counters
+ * ============================================================================
+ */
+
+static uint64_t
+mp_perf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Close the counters of an exiting thread.
+ */
+static void
+mp_perf_close(void *arg) {
+    mp_perf_thread *self = arg;
+    for (uint32_t e = 0; e < MP_PERF_EVENTS; e++)
+        if (self->fd[e] >= 0) close(self->fd[e]);
+    self->state = PERF_FAILED;
+}
+
+static void
+mp_perf_key_init(void) {
+    pthread_key_create(&perf_key, mp_perf_close);
+}
+
+/**
+ * Open the counter group of the calling thread.
+ *
+ * Returns:
+ *   Mask of the counters opened
+ */
+static uint32_t
+mp_perf_open(mp_perf_thread *self) {
+    uint32_t mask = 0;
+    self->leader = -1;
+    self->n = 0;
+
+    for (uint32_t e = 0; e < MP_PERF_EVENTS; e++) {
+        struct perf_event_attr attr;
+        __builtin_memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_def[e].type;
+        attr.config = perf_def[e].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        self->fd[e] = (int32_t) syscall(__NR_perf_event_open, &attr, 0, -1, self->leader,
+                                        PERF_FLAG_FD_CLOEXEC);
+        if (self->fd[e] < 0) continue;
+
+        if (self->leader < 0) self->leader = self->fd[e];
+        self->slot[e] = (uint8_t) self->n++;
+        mask |= 1u << e;
+    }
+
+    self->state = self->leader >= 0 ? PERF_OPEN : PERF_FAILED;
+    if (self->state == PERF_OPEN) {
+        pthread_once(&perf_once, mp_perf_key_init);
+        pthread_setspecific(perf_key, self);
+    }
+
+    __atomic_fetch_or(&perf_mask, mask, __ATOMIC_RELAXED);
+    return mask;
+}
+
+/**
+ * Read the group of the calling thread into value[MP_PERF_*].
+ */
+static void
+mp_perf_read(const mp_perf_thread *self, uint64_t *value) {
+    uint64_t buf[1 + MP_PERF_EVENTS] = {0};
+    if (self->state == PERF_OPEN && read(self->leader, buf, sizeof(buf)) <= 0) buf[0] = 0;
+
+    for (uint32_t e = 0; e < MP_PERF_EVENTS; e++)
+        value[e] = self->state == PERF_OPEN && self->fd[e] >= 0 && self->slot[e] < buf[0] ?
+            buf[1 + self->slot[e]] : 0;
+}
+
+
+/* ============================================================================
+ *  Probes
+ * ============================================================================
+ */
+
+/**
+ * Entry of an instrumented operation.
+ */
+void
+mp_perf_begin(void) {
+    if (__builtin_expect(!__atomic_load_n(&perf_on, __ATOMIC_RELAXED), 1)) return;
+
+    mp_perf_thread *self = &perf_self;
+    if (self->state == PERF_CLOSED) mp_perf_open(self);
+    if (self->depth++ >= PERF_DEPTH) return;
+
+    mp_perf_read(self, self->stack[self->depth - 1].value);
+    self->stack[self->depth - 1].nsec = mp_perf_now();
+}
+
+/**
+ * Exit of an instrumented operation: add the deltas to op.
+ *
+ * An exit without entry (counting started in between) is ignored; an
+ * operation that began before mp_perf_stop() still completes.
+ */
+void
+mp_perf_end(const uint32_t op) {
+    mp_perf_thread *self = &perf_self;
+    if (__builtin_expect(self->depth == 0, 1)) return;
+    if (--self->depth >= PERF_DEPTH) return;
+
+    const uint64_t nsec = mp_perf_now();
+    uint64_t value[MP_PERF_EVENTS];
+    mp_perf_read(self, value);
+
+    mp_perf_stat *stat = &perf_stat[op];
+    __atomic_fetch_add(&stat->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->nsec, nsec - self->stack[self->depth].nsec, __ATOMIC_RELAXED);
+    for (uint32_t e = 0; e < MP_PERF_EVENTS; e++)
+        if (value[e]) __atomic_fetch_add(&stat->value[e], value[e] - self->stack[self->depth].value[e], __ATOMIC_RELAXED);
+}
+
+
+/* ============================================================================
+ *  Dump
+ * ============================================================================
+ */
+
+/**
+ * Average per operation, or "-" for a counter nobody could open.
+ */
+static void
+mp_perf_field(FILE *out, const uint32_t e, const double value, const char *fmt) {
+    if (__atomic_load_n(&perf_mask, __ATOMIC_RELAXED) & (1u << e)) fprintf(out, fmt, value);
+    else fprintf(out, " %10s", "-");
+}
+
+/**
+ * Write one line per operation type.
+ */
+void
+mp_perf_dump(FILE *out) {
+    fprintf(out, "perf: %-7s %12s %10s %10s %10s %10s %10s %10s\n",
+            "op", "count", "ns/op", "cycles/op", "ipc", "llc/ki", "dtlb/ki", "faults/op");
+
+    for (uint32_t op = 0; op < MP_PERF_OPS; op++) {
+        mp_perf_stat s;
+        mp_perf_stats(op, &s);
+        if (!s.count) continue;
+
+        const double n = (double) s.count;
+        const double ki = (double) s.value[MP_PERF_INSTR] / 1000.0;
+
+        fprintf(out, "perf: %-7s %12lu %10.0f", perf_ops[op], s.count, (double) s.nsec / n);
+        mp_perf_field(out, MP_PERF_CYCLES, (double) s.value[MP_PERF_CYCLES] / n, " %10.0f");
+        mp_perf_field(out, MP_PERF_INSTR, s.value[MP_PERF_CYCLES] ?
+                      (double) s.value[MP_PERF_INSTR] / (double) s.value[MP_PERF_CYCLES] : 0.0, " %10.2f");
+        mp_perf_field(out, MP_PERF_LLC, ki > 0 ? (double) s.value[MP_PERF_LLC] / ki : 0.0, " %10.2f");
+        mp_perf_field(out, MP_PERF_DTLB, ki > 0 ? (double) s.value[MP_PERF_DTLB] / ki : 0.0, " %10.2f");
+        mp_perf_field(out, MP_PERF_FAULTS, (double) s.value[MP_PERF_FAULTS] / n, " %10.3f");
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
+
+static void *
+mp_perf_dumper(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&perf_dump.lock);
+
+    while (!perf_dump.stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += perf_dump.ms / 1000;
+        ts.tv_nsec += (long) (perf_dump.ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        if (pthread_cond_timedwait(&perf_dump.cond, &perf_dump.lock, &ts) != ETIMEDOUT) continue;
+
+        pthread_mutex_unlock(&perf_dump.lock);
+        mp_perf_dump(perf_dump.out);
+        pthread_mutex_lock(&perf_dump.lock);
+    }
+
+    pthread_mutex_unlock(&perf_dump.lock);
+    return NULL;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Start counting.
+ */
+uint32_t
+mp_perf_start(void) {
+    __atomic_store_n(&perf_on, 1, __ATOMIC_RELAXED);
+
+    mp_perf_thread *self = &perf_self;
+    if (self->state == PERF_CLOSED) return mp_perf_open(self);
+
+    uint32_t mask = 0;
+    for (uint32_t e = 0; self->state == PERF_OPEN && e < MP_PERF_EVENTS; e++)
+        if (self->fd[e] >= 0) mask |= 1u << e;
+    return mask;
+}
+
+/**
+ * Stop counting and the periodic dump.
+ */
+void
+mp_perf_stop(void) {
+    __atomic_store_n(&perf_on, 0, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&perf_dump.lock);
+    const uint8_t running = perf_dump.running;
+    perf_dump.stop = 1;
+    pthread_cond_signal(&perf_dump.cond);
+    pthread_mutex_unlock(&perf_dump.lock);
+
+    if (!running) return;
+    pthread_join(perf_dump.thread, NULL);
+    perf_dump.running = 0;
+}
+
+/**
+ * Clear the totals.
+ */
+void
+mp_perf_reset(void) {
+    for (uint32_t op = 0; op < MP_PERF_OPS; op++) {
+        mp_perf_stat *stat = &perf_stat[op];
+        __atomic_store_n(&stat->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->nsec, 0, __ATOMIC_RELAXED);
+        for (uint32_t e = 0; e < MP_PERF_EVENTS; e++) __atomic_store_n(&stat->value[e], 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Mask of the counters opened by at least one thread.
+ */
+uint32_t
+mp_perf_events(void) {
+    return __atomic_load_n(&perf_mask, __ATOMIC_RELAXED);
+}
+
+/**
+ * Snapshot the totals of an operation type.
+ */
+void
+mp_perf_stats(const uint32_t op, mp_perf_stat *stat) {
+    const mp_perf_stat *s = &perf_stat[op];
+    stat->count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+    stat->nsec = __atomic_load_n(&s->nsec, __ATOMIC_RELAXED);
+    for (uint32_t e = 0; e < MP_PERF_EVENTS; e++) stat->value[e] = __atomic_load_n(&s->value[e], __ATOMIC_RELAXED);
+}
+
+/**
+ * Dump every ms milliseconds until mp_perf_stop().
+ */
+int32_t
+mp_perf_dump_every(FILE *out, const uint32_t ms) {
+    if (!out || !ms) return -1;
+
+    pthread_mutex_lock(&perf_dump.lock);
+    if (perf_dump.running) {
+        pthread_mutex_unlock(&perf_dump.lock);
+        return -1;
+    }
+
+    perf_dump.out = out;
+    perf_dump.ms = ms;
+    perf_dump.stop = 0;
+    perf_dump.running = pthread_create(&perf_dump.thread, NULL, mp_perf_dumper, NULL) == 0;
+    pthread_mutex_unlock(&perf_dump.lock);
+
+    return perf_dump.running ? 0 : -1;
+}
@@ -0,0 +1,168 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_perf.h
+ *  Description:  Hardware performance counters per operation type.
+ *
+ *  Tells whether a slow job is index-bound (tree), allocation-bound,
+ *  TLB-bound or bandwidth-bound without running perf by hand. Each
+ *  thread opens one perf_event_open() group on itself:
+ *
+ *      cycles, instructions, LLC misses, dTLB read misses, page faults
+ *
+ *  and instrumented operations read the group on entry and on exit:
+ *
+ *      MP_PERF_BEGIN(MP_PERF_TREE);
+ *      ... lookup ...
+ *      MP_PERF_END(MP_PERF_TREE);
+ *
+ *  The deltas (and the wall time) are added to the totals of the
+ *  operation type. Nested operations count in both: a matrix receive
+ *  includes the pool gets it makes.
+ *
+ *  Design goals:
+ *   - Compiled out unless built with MP_PERF; compiled in, one
+ *     predictable branch per operation while stopped
+ *   - One read() of the whole group per probe, not one per counter
+ *   - Counters the machine or the sandbox does not have (VMs,
+ *     perf_event_paranoid) are left out, the others still count
+ *
+ *  Notes:
+ *   - Counting is per thread and user space only (exclude_kernel),
+ *     so it works at perf_event_paranoid <= 2
+ *   - Each probe costs a system call: instrument operations, not
+ *     elements
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_PERF_H
+#define QDEEP_MATRIXP_PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Nesting depth of instrumented operations per thread */
+#define PERF_DEPTH 8
+
+/** Operation types */
+#define MP_PERF_TREE   0 /**< Chunk lookups in a matrix tree */
+#define MP_PERF_POOL   1 /**< Pool gets and returns */
+#define MP_PERF_XFER   2 /**< Chunk and matrix transfers over descriptors */
+#define MP_PERF_KERNEL 3 /**< Compute kernels (chunk GEMM) */
+#define MP_PERF_OPS    4
+
+/** Counters */
+#define MP_PERF_CYCLES 0
+#define MP_PERF_INSTR  1
+#define MP_PERF_LLC    2 /**< Last level cache misses */
+#define MP_PERF_DTLB   3 /**< Data TLB read misses */
+#define MP_PERF_FAULTS 4 /**< Page faults */
+#define MP_PERF_EVENTS 5
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Totals of one operation type.
+ */
+typedef struct mp_perf_stat {
+    uint64_t count;                 /**< Completed operations */
+    uint64_t nsec;                  /**< Wall time inside them */
+    uint64_t value[MP_PERF_EVENTS]; /**< Counter deltas, MP_PERF_* */
+} mp_perf_stat;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Start counting (threads open their counters on their next probe).
+ *
+ * Returns:
+ *   Mask of the counters this thread could open (1 << MP_PERF_*)
+ */
+uint32_t
+mp_perf_start(void);
+
+/**
+ * Stop counting and the periodic dump, if any. Totals are kept.
+ */
+void
+mp_perf_stop(void);
+
+/**
+ * Clear the totals.
+ */
+void
+mp_perf_reset(void);
+
+/**
+ * Mask of the counters opened by at least one thread so far.
+ */
+uint32_t
+mp_perf_events(void);
+
+/**
+ * Snapshot the totals of an operation type.
+ */
+void
+mp_perf_stats(uint32_t op, mp_perf_stat *stat);
+
+/**
+ * Write one line per operation type (per-operation averages, IPC,
+ * misses per thousand instructions) to out.
+ */
+void
+mp_perf_dump(FILE *out);
+
+/**
+ * Dump to out every ms milliseconds from a background thread, until
+ * mp_perf_stop().
+ *
+ * @return  0 on success
+ * @return -1 if the thread cannot be started or one is running
+ */
+int32_t
+mp_perf_dump_every(FILE *out, uint32_t ms);
+
+/**
+ * Probes behind MP_PERF_BEGIN() / MP_PERF_END(); call them in pairs.
+ */
+void
+mp_perf_begin(void);
+
+void
+mp_perf_end(uint32_t op);
+
+#ifdef MP_PERF
+#define MP_PERF_BEGIN(op) mp_perf_begin()
+#define MP_PERF_END(op)   mp_perf_end(op)
+#else
+#define MP_PERF_BEGIN(op) ((void) 0)
+#define MP_PERF_END(op)   ((void) 0)
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_PERF_H */
@@ -0,0 +1,140 @@
+#include "mp_pipeline.h"
+
+#include "mp_codec.h"
+#include "mp_stream.h"
+
+
+/* ============================================================================
+ *  Stages
+ * ============================================================================
+ */
+
+/**
+ * Compute worker: ready -> fn -> done.
+ */
+static void *
+mp_pipeline_worker(void *arg) {
+    mp_pipeline *pl = arg;
+
+    for (mp_chunk *chunk; (chunk = mp_queue_pop(&pl->ready));) {
+        /* keep draining after a failure so the reader gets its buffers back */
+        if (!pl->error && pl->fn(pl->ctx, chunk) != 0) pl->error = 1;
+        mp_queue_push(&pl->done, chunk);
+    }
+    return NULL;
+}
+
+/**
+ * Reader side handling of n computed chunks, popped to free_[*nfree..].
+ *
+ * Keeps the buffers on the free stack, or inserts them into the matrix.
+ */
+static void
+mp_pipeline_retire(const mp_pipeline *pl, mp_matrix *matx,
+                   mp_chunk **free_, uint32_t *nfree, const uint32_t n) {
+    if (!pl->keep || pl->error) {
+        *nfree += n;
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) mp_matrix_chunk_insert(matx, free_[*nfree + i]);
+}
+
+/**
+ * Receive a chunk stream from fd, computing on chunks while receiving.
+ */
+int32_t
+mp_pipeline_recv(mp_pipeline *pl, mp_matrix *matx, const int32_t fd) {
+    if (pl->workers == 0 || pl->depth == 0) return -1;
+
+    pthread_t *tid = malloc(pl->workers * sizeof(pthread_t));
+    mp_chunk **free_ = malloc(pl->depth * sizeof(mp_chunk *));
+    uint8_t *buf = NULL; /* packed payloads, allocated on first use */
+    uint32_t started = 0, nfree = 0, inflight = 0;
+    int32_t ret = -1;
+
+    pl->error = 0;
+    if (!tid || !free_) goto out;
+    if (mp_queue_init(&pl->ready, pl->depth) < 0) goto out;
+    if (mp_queue_init(&pl->done, pl->depth) < 0) {
+        mp_queue_free(&pl->ready);
+        goto out;
+    }
+
+    for (; started < pl->workers; started++)
+        if (pthread_create(&tid[started], NULL, mp_pipeline_worker, pl) != 0) goto drain;
+
+    /* ---- stream header ---- */
+    uint8_t frame[STREAM_FRAME];
+    uint64_t a, b;
+
+    if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto drain;
+    mp_stream_unpack(frame, &a, &b);
+    if (mp_matrix_set_size(matx, (mp_msize){a, b}) < 0) goto drain;
+
+    /* ---- chunk frames ---- */
+    while (!pl->error) {
+        if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto drain;
+        mp_stream_unpack(frame, &a, &b);
+
+        if (a == MP_STREAM_END) {
+            ret = 0;
+            break;
+        }
+
+        const mp_copos opos = {.pos = a};
+        const mp_csize size = {.size = (uint16_t) b};
+        const uint8_t packed = (b & STREAM_PACKED) != 0;
+        const uint64_t elen = b >> 32;
+
+        if ((packed ? b & 0xFFFE0000ull : b > UINT16_MAX) ||
+            !mp_stream_valid(matx, opos, size) || elen > mp_codec_bound(size))
+            goto drain;
+
+        if (packed && !buf && !(buf = malloc(CODEC_MAX))) goto drain;
+
+        /* collect finished buffers, blocking while all are in flight */
+        const uint32_t n = inflight == pl->depth ?
+            mp_queue_pop_wait(&pl->done, free_ + nfree, inflight) :
+            mp_queue_pop_n(&pl->done, free_ + nfree, inflight);
+
+        mp_pipeline_retire(pl, matx, free_, &nfree, n);
+        inflight -= n;
+
+        mp_chunk *chunk = nfree ? free_[--nfree] : mp_pool_get(matx->pool);
+        if (!chunk) goto drain;
+
+        chunk->opos = opos;
+        mp_chunk_set_size(chunk, size);
+
+        if (packed ? mp_stream_read(fd, buf, elen) < 0 || mp_codec_decode(chunk, buf, elen) < 0
+                   : mp_chunk_recv(chunk, fd) < 0) {
+            free_[nfree++] = chunk;
+            goto drain;
+        }
+
+        inflight += 1;
+        mp_queue_push(&pl->ready, chunk);
+    }
+
+drain:
+    /* ---- wait for outstanding compute, then stop workers ---- */
+    while (inflight > 0) {
+        const uint32_t n = mp_queue_pop_wait(&pl->done, free_ + nfree, inflight);
+        mp_pipeline_retire(pl, matx, free_, &nfree, n);
+        inflight -= n;
+    }
+
+    mp_queue_close(&pl->ready);
+    for (uint32_t i = 0; i < started; i++) pthread_join(tid[i], NULL);
+
+    while (nfree > 0) mp_pool_ret(matx->pool, free_[--nfree]);
+
+    mp_queue_free(&pl->done);
+    mp_queue_free(&pl->ready);
+
+out:
+    free(buf);
+    free(free_);
+    free(tid);
+    return pl->error ? -1 : ret;
+}
@@ -0,0 +1,136 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_pipeline.h
+ *  Description:  Pipelined receive-and-compute over a chunk stream.
+ *
+ *  Instead of receiving a whole matrix and then running a kernel, the
+ *  pipeline hands every chunk to compute workers as soon as its payload
+ *  has arrived:
+ *
+ *      fd ──► reader ──► [ ready ] ──► workers (fn) ──► [ done ] ──┐
+ *               ▲                                                  │
+ *               └──────────── recycled / inserted ◄────────────────┘
+ *
+ *  Design goals:
+ *   - End-to-end latency ≈ max(transfer, compute) instead of the sum
+ *   - Bounded memory: at most `depth` chunk buffers are in flight;
+ *     when all are busy the reader stops reading the socket, which
+ *     propagates backpressure to the sender through TCP flow control
+ *   - The pool and the matrix tree are only touched by the reader
+ *     thread, so neither needs locking
+ *
+ *  Notes:
+ *   - Input is the chunk-stream format of mp_stream.h; packed frames
+ *     are decoded by the reader into the chunk buffer before hand-off
+ *   - depth = 2 × workers gives double buffering, 3 × workers triple
+ *   - Both hand-offs go through lock-free queues (mp_queue.h); the
+ *     reader collects finished buffers in batches
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_PIPELINE_H
+#define QDEEP_MATRIXP_PIPELINE_H
+
+#include <pthread.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+#include "mp_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Default number of compute workers */
+#define PIPELINE_WORKERS 2
+
+/** Default buffers per worker (triple buffering) */
+#define PIPELINE_BUFFERING 3
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Compute callback, called on a worker thread for every received chunk.
+ *
+ * The callback may modify chunk->data but must not touch the pool or
+ * the matrix tree.
+ *
+ * @return 0 on success, anything else aborts the pipeline
+ */
+typedef int32_t (*mp_pipeline_fn)(void *ctx, mp_chunk *chunk);
+
+/**
+ * Pipeline configuration and state.
+ */
+typedef struct mp_pipeline {
+    /* --------------------------------------------------------------------
+     * Configuration (set before mp_pipeline_recv)
+     * ------------------------------------------------------------------ */
+
+    mp_pipeline_fn fn; /**< Compute callback */
+    void *ctx;         /**< Callback context */
+    uint32_t workers;  /**< Compute threads */
+    uint32_t depth;    /**< Chunk buffers in flight */
+    uint8_t keep;      /**< Insert processed chunks into the matrix */
+
+    /* --------------------------------------------------------------------
+     * Runtime state
+     * ------------------------------------------------------------------ */
+
+    mp_queue ready;          /**< Received, waiting for compute */
+    mp_queue done;           /**< Computed, waiting for the reader */
+    volatile int32_t error;  /**< First callback failure */
+} mp_pipeline;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Initialize a pipeline with default worker count and triple buffering.
+ */
+static __inline__ void
+mp_pipeline_init(mp_pipeline *pl, const mp_pipeline_fn fn, void *ctx) {
+    pl->fn = fn;
+    pl->ctx = ctx;
+    pl->workers = PIPELINE_WORKERS;
+    pl->depth = PIPELINE_WORKERS * PIPELINE_BUFFERING;
+    pl->keep = 0;
+    pl->error = 0;
+}
+
+/**
+ * Receive a chunk stream from fd, computing on chunks while receiving.
+ *
+ * The matrix is resized to the stream header. With pl->keep set the
+ * processed chunks end up in matx, otherwise their buffers are recycled
+ * and matx stays empty.
+ *
+ * @return  0 on success
+ * @return -1 on I/O failure, malformed stream, allocation or callback failure
+ */
+int32_t
+mp_pipeline_recv(mp_pipeline *pl, mp_matrix *matx, int32_t fd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_PIPELINE_H */
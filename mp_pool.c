@@ -1,4 +1,6 @@
 #include "mp_pool.h"
+#include "mp_perf.h"
+#include "mp_hist.h"
 
 
 
@@ -123,7 +125,7 @@ mp_pool_tree_insert(mp_pool *pool, mp_page *page) {
  */
 static mp_page *
 mp_pool_tree_find(const mp_pool *pool, const mp_chunk *chunk) {
-    mp_page *node = pool->head;
+    mp_page *node = pool->root;
 
     while (node != NULL) {
         if (chunk >= node->chunk && chunk < node->chunk + PAGE_SIZE) break;
@@ -151,6 +153,9 @@ mp_pool_get(mp_pool *pool) {
     mp_page *page = pool->head;
     mp_chunk *chunk = NULL;
 
+    MP_PERF_BEGIN(MP_PERF_POOL);
+    MP_HIST_BEGIN(start);
+
     if (!page || mp_page_full(page)) {
         page = (mp_page *) malloc(sizeof(mp_page));
         if (!page) goto end;
@@ -161,10 +166,13 @@ mp_pool_get(mp_pool *pool) {
     }
 
     chunk = mp_page_get_new(page);
+    pool->used += 1;
     if (mp_page_full(page)) mp_pool_list_rotate(pool);
 
 end:
     if (!chunk && page) free(page);
+    MP_HIST_END(start, MP_HIST_POOL_GET);
+    MP_PERF_END(MP_PERF_POOL);
     return chunk;
 }
 
@@ -177,10 +185,15 @@ end:
  */
 void
 mp_pool_ret(mp_pool *pool, const mp_chunk *chunk) {
+    MP_PERF_BEGIN(MP_PERF_POOL);
+    MP_HIST_BEGIN(start);
     mp_page *page = mp_pool_tree_find(pool, chunk);
 
     mp_page_ret(page, chunk);
+    pool->used -= 1;
 
     mp_pool_list_remove(pool, page);
     mp_pool_list_insert(pool, page);
+    MP_HIST_END(start, MP_HIST_POOL_RET);
+    MP_PERF_END(MP_PERF_POOL);
 }
\ No newline at end of file
@@ -48,6 +48,7 @@ typedef struct mp_pool {
     mp_page *head; /**< Head of page list */
     mp_page *root; /**< Root of RB-tree (indexed by data ptr) */
     uint32_t size; /**< Total number of pages */
+    uint64_t used; /**< Chunks handed out */
 
     /* ------------------------------------------------------------------------
      * Temporary stack for RB-tree insertion balancing
@@ -70,21 +71,26 @@ mp_pool_init(mp_pool *pool) {
     pool->head = NULL;
     pool->root = NULL;
     pool->size = 0;
+    pool->used = 0;
 }
 
 /**
  * Free all pages in the pool and their memory.
  *
  * Notes:
- *   - Iterates page list
+ *   - Iterates the circular page list once
  *   - Calls mp_page_free for each
  */
 static __inline__ void
 mp_pool_free(const mp_pool *pool) {
-    for (mp_page *page = pool->head, *next; page != NULL; page = next) {
-        next = page->nextp;
+    mp_page *page = pool->head;
+
+    /* The page list is circular: visit exactly pool->size pages */
+    for (uint32_t i = 0; i < pool->size; i++) {
+        mp_page *next = page->nextp;
         mp_page_free(page);
         free(page);
+        page = next;
     }
 }
 
@@ -101,7 +107,7 @@ mp_pool_free(const mp_pool *pool) {
  *  - Create new page if necessary
  *  - Rotate list if head page is full
  */
-static __inline__ mp_chunk *
+mp_chunk *
 mp_pool_get(mp_pool *pool);
 
 /**
@@ -111,7 +117,7 @@ mp_pool_get(mp_pool *pool);
  *  - Free-list in page
  *  - Rotates page to back of list
  */
-static __inline__ void
+void
 mp_pool_ret(mp_pool *pool, const mp_chunk *chunk);
 
 
@@ -0,0 +1,202 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_proto.h
+ *  Description:  Matrix Manipulation Protocol (MMP) wire format.
+ *
+ *  Every request is:
+ *
+ *      [ request header ][ name ][ body ]
+ *        32 bytes          nlen    len
+ *
+ *  and is answered, in request order, by:
+ *
+ *      [ response header ][ body ]
+ *        24 bytes           len
+ *
+ *  Clients may pipeline any number of requests without waiting for
+ *  responses; the id field is echoed so replies can be matched.
+ *
+ *  Header fields are big-endian. Element values and chunk payloads are
+ *  host-order int64_t, exactly as produced by mp_chunk_send().
+ *
+ *  Operations:
+ *
+ *    op              a          b          body (request)     body (response)
+ *    --------------  ---------  ---------  -----------------  -----------------
+ *    CREATE          cols       rows       -                  -
+ *    DROP            -          -          -                  -
+ *    GET_CHUNK       opos       -          -                  payload (a=csize)
+ *    PUT_CHUNK       opos       csize      payload            -
+ *    GET_ELEMS       -          -          n × [x|y]          n × value
+ *    PUT_ELEMS       -          -          n × [x|y|value]    -
+ *    SEND_MATRIX     -          -          -                  chunk stream
+ *    RECV_MATRIX     -          -          chunk stream       -
+ *    KERNEL          -          argument   "kern\0src\0..."   -
+ *
+ *  CREATE replaces a matrix of the same name with an empty one. CREATE
+ *  and the stream header of RECV_MATRIX fail with -EINVAL when a
+ *  dimension has 2^32 chunks or more (see mp_msize_valid()).
+ *
+ *  Codec negotiation: a SEND_MATRIX request with MP_FLAG_PACKED may be
+ *  answered with packed frames (see mp_stream.h); the server then sets
+ *  a = MP_CODEC_FOR and len = 0 (the body ends with the END frame).
+ *  RECV_MATRIX bodies may always contain packed frames.
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_PROTO_H
+#define QDEEP_MATRIXP_PROTO_H
+
+#include <endian.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Constants
+ * ============================================================================
+ */
+
+#define PROTO_REQ   32 /**< Request header size  */
+#define PROTO_RESP  24 /**< Response header size */
+
+/** Largest buffered request body (element batches, kernel arguments) */
+#define PROTO_BODY_MAX (64u << 20)
+
+/** Default TCP port of the daemon */
+#define PROTO_PORT 7433
+
+#define MP_OP_CREATE       1
+#define MP_OP_DROP         2
+#define MP_OP_GET_CHUNK    3
+#define MP_OP_PUT_CHUNK    4
+#define MP_OP_GET_ELEMS    5
+#define MP_OP_PUT_ELEMS    6
+#define MP_OP_SEND_MATRIX  7
+#define MP_OP_RECV_MATRIX  8
+#define MP_OP_KERNEL       9
+
+/** Request flags */
+#define MP_FLAG_PACKED 1 /**< SEND_MATRIX: packed frames welcome (mp_codec.h) */
+
+
+/* ============================================================================
+ *  Headers
+ * ============================================================================
+ */
+
+/**
+ * Decoded request header.
+ */
+typedef struct mp_req {
+    uint32_t id;    /**< Client chosen request id, echoed in the response */
+    uint8_t op;     /**< MP_OP_* */
+    uint8_t nlen;   /**< Length of the matrix name that follows */
+    uint16_t flags; /**< MP_FLAG_* */
+    uint64_t a;     /**< First operand (see table) */
+    uint64_t b;     /**< Second operand (see table) */
+    uint64_t len;   /**< Body length in bytes */
+} mp_req;
+
+/**
+ * Decoded response header.
+ */
+typedef struct mp_resp {
+    uint32_t id;    /**< Id of the request */
+    int32_t status; /**< 0 or negative errno */
+    uint64_t a;     /**< Operation specific result */
+    uint64_t len;   /**< Body length in bytes */
+} mp_resp;
+
+/**
+ * Encode a request header.
+ */
+static __inline__ void
+mp_req_pack(uint8_t *out, const mp_req *req) {
+    const uint32_t id = htobe32(req->id);
+    const uint16_t flags = htobe16(req->flags);
+    const uint64_t a = htobe64(req->a);
+    const uint64_t b = htobe64(req->b);
+    const uint64_t len = htobe64(req->len);
+
+    __builtin_memcpy(out + 0, &id, 4);
+    out[4] = req->op;
+    out[5] = req->nlen;
+    __builtin_memcpy(out + 6, &flags, 2);
+    __builtin_memcpy(out + 8, &a, 8);
+    __builtin_memcpy(out + 16, &b, 8);
+    __builtin_memcpy(out + 24, &len, 8);
+}
+
+/**
+ * Decode a request header.
+ */
+static __inline__ void
+mp_req_unpack(const uint8_t *in, mp_req *req) {
+    uint32_t id;
+    uint16_t flags;
+    uint64_t a, b, len;
+
+    __builtin_memcpy(&id, in + 0, 4);
+    __builtin_memcpy(&flags, in + 6, 2);
+    __builtin_memcpy(&a, in + 8, 8);
+    __builtin_memcpy(&b, in + 16, 8);
+    __builtin_memcpy(&len, in + 24, 8);
+
+    req->id = be32toh(id);
+    req->op = in[4];
+    req->nlen = in[5];
+    req->flags = be16toh(flags);
+    req->a = be64toh(a);
+    req->b = be64toh(b);
+    req->len = be64toh(len);
+}
+
+/**
+ * Encode a response header.
+ */
+static __inline__ void
+mp_resp_pack(uint8_t *out, const mp_resp *resp) {
+    const uint32_t id = htobe32(resp->id);
+    const uint32_t status = htobe32((uint32_t) resp->status);
+    const uint64_t a = htobe64(resp->a);
+    const uint64_t len = htobe64(resp->len);
+
+    __builtin_memcpy(out + 0, &id, 4);
+    __builtin_memcpy(out + 4, &status, 4);
+    __builtin_memcpy(out + 8, &a, 8);
+    __builtin_memcpy(out + 16, &len, 8);
+}
+
+/**
+ * Decode a response header.
+ */
+static __inline__ void
+mp_resp_unpack(const uint8_t *in, mp_resp *resp) {
+    uint32_t id, status;
+    uint64_t a, len;
+
+    __builtin_memcpy(&id, in + 0, 4);
+    __builtin_memcpy(&status, in + 4, 4);
+    __builtin_memcpy(&a, in + 8, 8);
+    __builtin_memcpy(&len, in + 16, 8);
+
+    resp->id = be32toh(id);
+    resp->status = (int32_t) be32toh(status);
+    resp->a = be64toh(a);
+    resp->len = be64toh(len);
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_PROTO_H */
@@ -0,0 +1,219 @@
+#include "mp_queue.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+
+/* ============================================================================
+ *  Ring
+ * ============================================================================
+ */
+
+/**
+ * Claim up to n consecutive positions of index whose cells are ready
+ * (seq == position + lap: lap 0 for producers, 1 for consumers).
+ *
+ * Returns:
+ *   Number of positions claimed, starting at *start (0: full / empty)
+ */
+static uint32_t
+mp_queue_claim(mp_queue *q, uint64_t *index, const uint64_t lap, const uint32_t n,
+               uint64_t *start) {
+    uint64_t pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+
+    while (1) {
+        uint32_t k = 0;
+        uint64_t seq = 0;
+
+        for (; k < n; k++) {
+            seq = __atomic_load_n(&q->ring[(pos + k) & q->mask].seq, __ATOMIC_ACQUIRE);
+            if (seq != pos + k + lap) break;
+        }
+
+        if (k == 0) {
+            /* cell still holds the previous lap: full / empty */
+            if ((int64_t) (seq - (pos + lap)) < 0) return 0;
+
+            /* somebody else took pos */
+            pos = __atomic_load_n(index, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(index, &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            *start = pos;
+            return k;
+        }
+    }
+}
+
+/**
+ * Wake the sleepers on word, if any.
+ *
+ * The fence orders the cells published before it against the sleeper
+ * count, which a sleeper raises before its last look at the ring.
+ */
+static void
+mp_queue_wake(uint32_t *word, const uint32_t *sleepers) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(sleepers, __ATOMIC_RELAXED)) return;
+
+    __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Register as a sleeper on word: returns the word value to sleep on.
+ */
+static uint32_t
+mp_queue_prepare(uint32_t *word, uint32_t *sleepers) {
+    const uint32_t value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(sleepers, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return value;
+}
+
+/**
+ * Sleep until word moves away from value (or a spurious wake-up).
+ */
+static void
+mp_queue_sleep(uint32_t *word, const uint32_t value) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Initialize a queue for at least cap handles.
+ */
+int32_t
+mp_queue_init(mp_queue *q, const uint64_t cap) {
+    uint64_t n = 2;
+    while (n < cap) n <<= 1;
+
+    __builtin_memset(q, 0, sizeof(*q));
+    q->ring = malloc(n * sizeof(mp_queue_cell));
+    if (!q->ring) return -1;
+
+    for (uint64_t i = 0; i < n; i++) q->ring[i].seq = i;
+    q->mask = n - 1;
+    return 0;
+}
+
+/**
+ * Release a queue.
+ */
+void
+mp_queue_free(mp_queue *q) {
+    free(q->ring);
+    q->ring = NULL;
+}
+
+/**
+ * Push up to n handles without blocking.
+ */
+uint32_t
+mp_queue_push_n(mp_queue *q, mp_chunk *const *chunks, const uint32_t n) {
+    if (__atomic_load_n(&q->closed, __ATOMIC_RELAXED)) return 0;
+
+    uint64_t pos;
+    const uint32_t k = n ? mp_queue_claim(q, &q->tail, 0, n, &pos) : 0;
+    if (!k) return 0;
+
+    for (uint32_t i = 0; i < k; i++) {
+        mp_queue_cell *cell = &q->ring[(pos + i) & q->mask];
+        cell->chunk = chunks[i];
+        __atomic_store_n(&cell->seq, pos + i + 1, __ATOMIC_RELEASE);
+    }
+
+    mp_queue_wake(&q->items, &q->sleep_items);
+    return k;
+}
+
+/**
+ * Pop up to n handles without blocking.
+ */
+uint32_t
+mp_queue_pop_n(mp_queue *q, mp_chunk **chunks, const uint32_t n) {
+    uint64_t pos;
+    const uint32_t k = n ? mp_queue_claim(q, &q->head, 1, n, &pos) : 0;
+    if (!k) return 0;
+
+    for (uint32_t i = 0; i < k; i++) {
+        mp_queue_cell *cell = &q->ring[(pos + i) & q->mask];
+        chunks[i] = cell->chunk;
+        __atomic_store_n(&cell->seq, pos + i + q->mask + 1, __ATOMIC_RELEASE);
+    }
+
+    mp_queue_wake(&q->space, &q->sleep_space);
+    return k;
+}
+
+/**
+ * Push all n handles, sleeping while the queue is full.
+ */
+uint32_t
+mp_queue_push_wait(mp_queue *q, mp_chunk *const *chunks, const uint32_t n) {
+    uint32_t done = 0;
+
+    for (uint32_t spin = 0; done < n; spin++) {
+        if (__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) break;
+
+        const uint32_t k = mp_queue_push_n(q, chunks + done, n - done);
+        if (k) {
+            done += k;
+            spin = 0;
+            continue;
+        }
+        if (spin < QUEUE_SPIN) continue;
+
+        const uint32_t value = mp_queue_prepare(&q->space, &q->sleep_space);
+
+        const uint32_t again = mp_queue_push_n(q, chunks + done, n - done);
+        if (!again && !__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) mp_queue_sleep(&q->space, value);
+
+        __atomic_sub_fetch(&q->sleep_space, 1, __ATOMIC_RELAXED);
+        done += again;
+    }
+    return done;
+}
+
+/**
+ * Pop between 1 and n handles, sleeping while the queue is empty.
+ */
+uint32_t
+mp_queue_pop_wait(mp_queue *q, mp_chunk **chunks, const uint32_t n) {
+    for (uint32_t spin = 0;; spin++) {
+        const uint32_t k = mp_queue_pop_n(q, chunks, n);
+        if (k) return k;
+
+        /* closed: whatever was pushed before closing is visible now */
+        if (__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) return mp_queue_pop_n(q, chunks, n);
+        if (spin < QUEUE_SPIN) continue;
+
+        const uint32_t value = mp_queue_prepare(&q->items, &q->sleep_items);
+
+        const uint32_t again = mp_queue_pop_n(q, chunks, n);
+        if (!again && !__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) mp_queue_sleep(&q->items, value);
+
+        __atomic_sub_fetch(&q->sleep_items, 1, __ATOMIC_RELAXED);
+        if (again) return again;
+    }
+}
+
+/**
+ * Close the queue and wake every sleeper.
+ */
+void
+mp_queue_close(mp_queue *q) {
+    __atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+
+    __atomic_add_fetch(&q->items, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&q->space, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &q->items, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    syscall(SYS_futex, &q->space, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
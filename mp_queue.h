@@ -0,0 +1,182 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_queue.h
+ *  Description:  Bounded lock-free MPMC queue of chunk handles.
+ *
+ *  Pipeline stages (receiver → decoder → compute → sender) hand chunks
+ *  to each other by pointer. The queue is a ring of cells, each with a
+ *  sequence number telling which lap of the ring it is ready for
+ *  (D. Vyukov's bounded MPMC queue):
+ *
+ *      cell.seq == pos          free for the producer of position pos
+ *      cell.seq == pos + 1      holds the item of position pos
+ *      cell.seq == pos + cap    free again, for the next lap
+ *
+ *  A producer claims positions with one CAS on tail, fills the cells
+ *  and publishes them by advancing their seq; consumers do the same on
+ *  head. Batch operations claim a run of consecutive ready cells with a
+ *  single CAS.
+ *
+ *  Blocking is layered on top with two futex words (items / space):
+ *  a thread that finds the queue empty (full) registers as a sleeper,
+ *  re-checks and sleeps on the word; the other side bumps the word and
+ *  wakes only when a sleeper is registered, so the uncontended path
+ *  makes no system call.
+ *
+ *  Design goals:
+ *   - No lock: producers and consumers only contend on their own index
+ *   - head, tail and the futex words on separate cache lines
+ *   - One CAS and one wake-up check per batch, not per chunk
+ *
+ *  Notes:
+ *   - Capacity is rounded up to a power of two
+ *   - Closing wakes everybody: pushes fail, pops drain what is left.
+ *     Close after the last push has returned, or that push may be lost
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_QUEUE_H
+#define QDEEP_MATRIXP_QUEUE_H
+
+#include "mp_chunk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Failed attempts before a blocking call sleeps on the futex */
+#define QUEUE_SPIN 64
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Ring cell.
+ */
+typedef struct mp_queue_cell {
+    uint64_t seq;     /**< Position this cell is ready for (see above) */
+    mp_chunk *chunk;  /**< Handle */
+} mp_queue_cell;
+
+/**
+ * Bounded MPMC queue.
+ */
+typedef struct mp_queue {
+    uint64_t head __attribute__((aligned(64)));  /**< Next position to pop */
+    uint64_t tail __attribute__((aligned(64)));  /**< Next position to push */
+
+    uint32_t items __attribute__((aligned(64))); /**< Futex: bumped after pushes */
+    uint32_t space;                              /**< Futex: bumped after pops */
+    uint32_t sleep_items;                        /**< Consumers waiting for items */
+    uint32_t sleep_space;                        /**< Producers waiting for space */
+    uint8_t closed;                              /**< No more pushes */
+
+    mp_queue_cell *ring __attribute__((aligned(64)));
+    uint64_t mask;                               /**< Capacity - 1 */
+} mp_queue;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Initialize a queue for at least cap handles.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+int32_t
+mp_queue_init(mp_queue *q, uint64_t cap);
+
+/**
+ * Release a queue (no thread may still use it).
+ */
+void
+mp_queue_free(mp_queue *q);
+
+/**
+ * Push up to n handles without blocking.
+ *
+ * Returns:
+ *   Number of handles pushed (0 if full or closed)
+ */
+uint32_t
+mp_queue_push_n(mp_queue *q, mp_chunk *const *chunks, uint32_t n);
+
+/**
+ * Pop up to n handles without blocking.
+ *
+ * Returns:
+ *   Number of handles popped (0 if empty)
+ */
+uint32_t
+mp_queue_pop_n(mp_queue *q, mp_chunk **chunks, uint32_t n);
+
+/**
+ * Push all n handles, sleeping while the queue is full.
+ *
+ * Returns:
+ *   n, or fewer if the queue was closed meanwhile
+ */
+uint32_t
+mp_queue_push_wait(mp_queue *q, mp_chunk *const *chunks, uint32_t n);
+
+/**
+ * Pop between 1 and n handles, sleeping while the queue is empty.
+ *
+ * Returns:
+ *   Number of handles popped, 0 once the queue is closed and drained
+ */
+uint32_t
+mp_queue_pop_wait(mp_queue *q, mp_chunk **chunks, uint32_t n);
+
+/**
+ * Push one handle, sleeping while the queue is full.
+ *
+ * @return  0 on success
+ * @return -1 if the queue is closed
+ */
+static __inline__ int32_t
+mp_queue_push(mp_queue *q, mp_chunk *chunk) {
+    return mp_queue_push_wait(q, &chunk, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * Pop one handle, sleeping while the queue is empty.
+ *
+ * Returns:
+ *   Chunk handle, or NULL once the queue is closed and drained
+ */
+static __inline__ mp_chunk *
+mp_queue_pop(mp_queue *q) {
+    mp_chunk *chunk;
+    return mp_queue_pop_wait(q, &chunk, 1) ? chunk : NULL;
+}
+
+/**
+ * Close the queue and wake every sleeper.
+ */
+void
+mp_queue_close(mp_queue *q);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_QUEUE_H */
@@ -0,0 +1,268 @@
+#include "mp_rcu.h"
+
+#include <sched.h>
+#include <stdlib.h>
+
+
+/* ============================================================================
+ *  Grace periods
+ * ============================================================================
+ */
+
+/**
+ * Oldest epoch a reader is in a section for, or `epoch` if none is.
+ *
+ * Pairs with the sequentially consistent announcement in
+ * mp_reader_lock(): a reader either shows up here or entered after the
+ * epoch was advanced, i.e. after the chunks were unlinked.
+ */
+static uint64_t
+mp_rcu_oldest(const mp_rcu *rcu, const uint64_t epoch) {
+    uint64_t min = epoch;
+    for (uint32_t i = 0; i < rcu->nslots; i++) {
+        const uint64_t e = __atomic_load_n(&rcu->slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (e && e < min) min = e;
+    }
+    return min;
+}
+
+/**
+ * Return the retired chunks older than min to the pool.
+ */
+static uint64_t
+mp_rcu_release(mp_rcu *rcu, const uint64_t min) {
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < rcu->nretired; i++) {
+        if (rcu->retired[i].epoch < min) mp_pool_ret(rcu->matx->pool, rcu->retired[i].chunk);
+        else rcu->retired[n++] = rcu->retired[i];
+    }
+
+    const uint64_t done = rcu->nretired - n;
+    rcu->nretired = n;
+    rcu->reclaimed += done;
+    return done;
+}
+
+/**
+ * Wait until no reader can reach anything unlinked so far.
+ */
+static void
+mp_rcu_synchronize(mp_rcu *rcu) {
+    const uint64_t epoch = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (uint32_t spin = 0; mp_rcu_oldest(rcu, epoch) < epoch;)
+        if (++spin % RCU_SPIN == 0) sched_yield();
+}
+
+
+/* ============================================================================
+ *  Writer side
+ * ============================================================================
+ */
+
+/**
+ * Enable concurrent readers on matx.
+ */
+int32_t
+mp_rcu_attach(mp_rcu *rcu, mp_matrix *matx, uint32_t readers) {
+    if (!rcu || !matx || matx->rcu || matx->cold) return -1;
+    if (!readers) readers = RCU_READERS;
+
+    __builtin_memset(rcu, 0, sizeof(*rcu));
+    rcu->matx = matx;
+    rcu->epoch = 1;
+
+    rcu->slots = aligned_alloc(64, readers * sizeof(mp_rcu_slot));
+    if (!rcu->slots) return -1;
+
+    __builtin_memset(rcu->slots, 0, readers * sizeof(mp_rcu_slot));
+    rcu->nslots = readers;
+
+    matx->rcu = rcu;
+    return 0;
+}
+
+/**
+ * Return every retired chunk and detach.
+ */
+void
+mp_rcu_free(mp_rcu *rcu) {
+    if (!rcu || !rcu->slots) return;
+
+    mp_rcu_release(rcu, UINT64_MAX);
+    free(rcu->retired);
+    free(rcu->slots);
+
+    rcu->matx->rcu = NULL;
+    rcu->retired = NULL;
+    rcu->slots = NULL;
+}
+
+/**
+ * Queue an unlinked chunk.
+ *
+ * If the retire list cannot grow, the writer waits for a grace period
+ * and returns the chunk directly.
+ */
+void
+mp_rcu_retire(mp_rcu *rcu, mp_chunk *chunk) {
+    if (rcu->nretired == rcu->cretired) {
+        const uint64_t cap = rcu->cretired ? rcu->cretired << 1 : RCU_BATCH;
+        mp_rcu_retired *retired = realloc(rcu->retired, cap * sizeof(mp_rcu_retired));
+
+        if (!retired) {
+            mp_rcu_synchronize(rcu);
+            mp_rcu_release(rcu, UINT64_MAX);
+            mp_pool_ret(rcu->matx->pool, chunk);
+            rcu->reclaimed += 1;
+            return;
+        }
+
+        rcu->retired = retired;
+        rcu->cretired = cap;
+    }
+
+    rcu->retired[rcu->nretired++] = (mp_rcu_retired){chunk, rcu->epoch};
+    if (rcu->nretired % RCU_BATCH == 0) mp_rcu_reclaim(rcu);
+}
+
+/**
+ * Advance the epoch and return what no reader can reach.
+ */
+uint64_t
+mp_rcu_reclaim(mp_rcu *rcu) {
+    if (!rcu->nretired) return 0;
+
+    const uint64_t epoch = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+    return mp_rcu_release(rcu, mp_rcu_oldest(rcu, epoch));
+}
+
+
+/* ============================================================================
+ *  Reader side
+ * ============================================================================
+ */
+
+/**
+ * Register a reader of matx.
+ */
+int32_t
+mp_reader_init(mp_reader *reader, mp_matrix *matx) {
+    if (!reader || !matx || !matx->rcu) return -1;
+
+    mp_rcu *rcu = matx->rcu;
+    for (uint32_t i = 0; i < rcu->nslots; i++) {
+        uint8_t free = 0;
+        if (!__atomic_compare_exchange_n(&rcu->slots[i].used, &free, 1, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        reader->rcu = rcu;
+        reader->slot = &rcu->slots[i];
+        reader->seq = 1; /* odd: matches no stable tree */
+        reader->offset.pos = UINT64_MAX;
+        reader->find = NULL;
+        reader->retries = 0;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Give the slot back.
+ */
+void
+mp_reader_free(mp_reader *reader) {
+    __atomic_store_n(&reader->slot->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&reader->slot->used, 0, __ATOMIC_RELEASE);
+    reader->slot = NULL;
+    reader->rcu = NULL;
+}
+
+/**
+ * Enter a read-side section.
+ *
+ * The announcement is re-checked against the global epoch, so the
+ * writer cannot advance past it unseen between the load and the store.
+ */
+void
+mp_reader_lock(mp_reader *reader) {
+    const mp_rcu *rcu = reader->rcu;
+    uint64_t epoch = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST);
+
+    while (1) {
+        __atomic_store_n(&reader->slot->epoch, epoch, __ATOMIC_SEQ_CST);
+
+        const uint64_t now = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST);
+        if (now == epoch) break;
+        epoch = now;
+    }
+}
+
+/**
+ * Leave the read-side section.
+ */
+void
+mp_reader_unlock(mp_reader *reader) {
+    __atomic_store_n(&reader->slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Find the chunk at offset opos.
+ *
+ * A walk that lands on opos is a hit whatever the writer did meanwhile
+ * (the node cannot be reclaimed while we are in the section). A miss
+ * may be a node the writer was rotating out of our path, so it counts
+ * only if seq was stable. The depth bound cuts walks through a
+ * half-rotated subtree short.
+ */
+mp_chunk *
+mp_reader_find(mp_reader *reader, const mp_copos opos) {
+    const mp_tree *tree = &reader->rcu->matx->tree;
+
+    uint64_t seq = __atomic_load_n(&tree->seq, __ATOMIC_ACQUIRE);
+    if (seq == reader->seq && opos.pos == reader->offset.pos) return reader->find;
+
+    for (uint32_t spin = 0;; spin++) {
+        mp_chunk *node = __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+
+        for (uint32_t depth = 0; node && depth < 64; depth++) {
+            if (node->opos.pos == opos.pos) break;
+            node = __atomic_load_n(&node->sides[node->opos.pos < opos.pos], __ATOMIC_ACQUIRE);
+        }
+        if (node && node->opos.pos != opos.pos) node = NULL;
+
+        const uint64_t now = __atomic_load_n(&tree->seq, __ATOMIC_ACQUIRE);
+        const uint8_t stable = now == seq && !(seq & 1);
+
+        if (node || stable) {
+            /* cacheable only if no link changed during the walk */
+            reader->seq = stable ? seq : 1;
+            reader->offset = opos;
+            reader->find = node;
+            return node;
+        }
+
+        reader->retries += 1;
+        if (spin % RCU_SPIN == RCU_SPIN - 1) sched_yield();
+        seq = now;
+    }
+}
+
+/**
+ * Read element (x, y) in a section of its own.
+ */
+int64_t
+mp_reader_get(mp_reader *reader, const uint64_t x, const uint64_t y) {
+    mp_copos opos;
+    opos.dim.x = (uint32_t) (x >> CHUNK_POW);
+    opos.dim.y = (uint32_t) (y >> CHUNK_POW);
+
+    mp_reader_lock(reader);
+
+    const mp_chunk *chunk = mp_reader_find(reader, opos);
+    const int64_t value = chunk ? chunk->data[CHUNK_POS(x & (CHUNK_W - 1), y & (CHUNK_H - 1))] : 0;
+
+    mp_reader_unlock(reader);
+    return value;
+}
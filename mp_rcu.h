@@ -0,0 +1,223 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_rcu.h
+ *  Description:  Concurrent chunk lookups against a single writer.
+ *
+ *  Evaluators that share one matrix look chunks up from their own
+ *  threads while the owner keeps modifying it. Two mechanisms make that
+ *  safe without a lock on the read side:
+ *
+ *    - Sequence lock over the tree links. The writer makes tree->seq
+ *      odd around every insert / remove / rotation and publishes links
+ *      with release stores. A reader walks the tree with acquire loads;
+ *      a hit is always a real chunk, a miss is only trusted if seq was
+ *      even and did not move during the walk (else the walk repeats).
+ *
+ *    - Epoch-based reclamation (RCU style). Readers announce the epoch
+ *      they entered at; chunks the writer unlinks are retired, not
+ *      returned to the pool, until every reader that could still hold
+ *      them has left its read-side section:
+ *
+ *        retire(chunk)  →  (chunk, epoch)          on the retire list
+ *        reclaim()      →  epoch++, min = oldest announced reader epoch
+ *                          chunks retired before min go back to the pool
+ *
+ *  Design goals:
+ *   - Readers write nothing shared: each one has its own cursor state
+ *     and an announcement slot on its own cache line
+ *   - Read-side cost of an uncontended lookup: two loads of seq plus
+ *     the tree walk; repeated lookups of one chunk hit the reader cache
+ *     as long as the tree shape did not change
+ *   - Writer cost: two stores per link change, reclamation amortized
+ *     over RCU_BATCH retired chunks
+ *
+ *  Notes:
+ *   - One writer: every mp_matrix_* call that modifies the matrix stays
+ *     on the owning thread
+ *   - Chunk data is not versioned: elements the writer changes in place
+ *     are seen either old or new, element by element. Use a snapshot
+ *     (mp_snap.h) for a consistent picture of many chunks
+ *   - Readers see warm chunks only, so a cold tier cannot be attached
+ *     together with concurrent readers
+ *   - Detach (mp_rcu_free()) before mp_matrix_free(): retired chunks
+ *     are returned to the pool there
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_RCU_H
+#define QDEEP_MATRIXP_RCU_H
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Default number of reader slots */
+#define RCU_READERS 64
+
+/** Retired chunks that trigger a reclamation */
+#define RCU_BATCH 64
+
+/** Failed attempts before a waiting thread yields the CPU */
+#define RCU_SPIN 64
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Announcement slot of one reader (cache line aligned).
+ */
+typedef struct mp_rcu_slot {
+    uint64_t epoch __attribute__((aligned(64))); /**< Epoch entered at, 0 outside */
+    uint8_t used;                                /**< Claimed by a reader */
+} mp_rcu_slot;
+
+/**
+ * Chunk unlinked by the writer, waiting for its grace period.
+ */
+typedef struct mp_rcu_retired {
+    mp_chunk *chunk;
+    uint64_t epoch;  /**< Epoch at the time it was unlinked */
+} mp_rcu_retired;
+
+/**
+ * Reclamation state attached to a matrix.
+ */
+typedef struct mp_rcu {
+    mp_matrix *matx;          /**< Matrix being read */
+    uint64_t epoch;           /**< Global epoch (advanced by the writer) */
+
+    mp_rcu_slot *slots;       /**< Reader announcements */
+    uint32_t nslots;
+
+    mp_rcu_retired *retired;  /**< Retire list (writer only) */
+    uint64_t nretired;
+    uint64_t cretired;
+
+    uint64_t reclaimed;       /**< Chunks returned to the pool so far */
+} mp_rcu;
+
+/**
+ * Reader handle, owned by one thread.
+ */
+typedef struct mp_reader {
+    mp_rcu *rcu;
+    mp_rcu_slot *slot;  /**< Own announcement slot */
+
+    uint64_t seq;       /**< Tree seq the cache below is valid for */
+    mp_copos offset;    /**< Last looked up offset */
+    mp_chunk *find;     /**< Its chunk (or NULL) */
+
+    uint64_t retries;   /**< Walks repeated because the writer moved links */
+} mp_reader;
+
+
+/* ============================================================================
+ *  Writer side
+ * ============================================================================
+ */
+
+/**
+ * Enable concurrent readers on matx, with room for `readers` of them
+ * (0: RCU_READERS).
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure, or if matx already has readers or
+ *            a cold tier
+ */
+int32_t
+mp_rcu_attach(mp_rcu *rcu, mp_matrix *matx, uint32_t readers);
+
+/**
+ * Return every retired chunk and detach. No reader may be registered.
+ */
+void
+mp_rcu_free(mp_rcu *rcu);
+
+/**
+ * Queue a chunk unlinked from the tree (called by mp_matrix.c).
+ */
+void
+mp_rcu_retire(mp_rcu *rcu, mp_chunk *chunk);
+
+/**
+ * Advance the epoch and return the chunks no reader can reach anymore.
+ *
+ * Returns:
+ *   Number of chunks returned to the pool
+ */
+uint64_t
+mp_rcu_reclaim(mp_rcu *rcu);
+
+
+/* ============================================================================
+ *  Reader side
+ * ============================================================================
+ */
+
+/**
+ * Register a reader of matx (from the thread that will use it).
+ *
+ * @return  0 on success
+ * @return -1 if matx has no mp_rcu attached or every slot is taken
+ */
+int32_t
+mp_reader_init(mp_reader *reader, mp_matrix *matx);
+
+/**
+ * Give the slot back.
+ */
+void
+mp_reader_free(mp_reader *reader);
+
+/**
+ * Enter a read-side section: chunks found until mp_reader_unlock()
+ * stay valid, even if the writer drops them meanwhile.
+ */
+void
+mp_reader_lock(mp_reader *reader);
+
+/**
+ * Leave the read-side section.
+ */
+void
+mp_reader_unlock(mp_reader *reader);
+
+/**
+ * Find the chunk at offset opos (inside a read-side section).
+ *
+ * Returns:
+ *   Chunk pointer or NULL if the chunk is not materialized
+ */
+mp_chunk *
+mp_reader_find(mp_reader *reader, mp_copos opos);
+
+/**
+ * Read element (x, y) in a section of its own.
+ *
+ * Elements of chunks that are not materialized read as 0.
+ */
+int64_t
+mp_reader_get(mp_reader *reader, uint64_t x, uint64_t y);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_RCU_H */
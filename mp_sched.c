@@ -0,0 +1,386 @@
+#include "mp_sched.h"
+
+#include <sched.h>
+#include <stdlib.h>
+
+
+/* ============================================================================
+ *  Chase-Lev deque
+ * ============================================================================
+ *
+ * Lê, Pop, Cohen, Zappa Nardelli: "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (PPoPP 2013), fixed capacity. The ring is
+ * never overwritten before a slot was taken: push refuses when full.
+ */
+
+#define SCHED_PACK(lo, hi) (((uint64_t) (lo) << 32) | (uint64_t) (hi))
+#define SCHED_LO(task)     ((task) >> 32)
+#define SCHED_HI(task)     ((task) & UINT32_MAX)
+
+/**
+ * Push a range at the bottom (owner only).
+ *
+ * @return  0 on success
+ * @return -1 if the deque is full
+ */
+static __inline__ int32_t
+mp_sched_push(mp_sched_deque *dq, const uint64_t task) {
+    const int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+    const int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    if (b - t >= SCHED_DEQUE) return -1;
+
+    __atomic_store_n(&dq->ring[b & (SCHED_DEQUE - 1)], task, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Take the range at the bottom (owner only).
+ *
+ * @return  1 if a range was taken
+ * @return  0 if the deque is empty
+ */
+static __inline__ int32_t
+mp_sched_take(mp_sched_deque *dq, uint64_t *task) {
+    const int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    *task = __atomic_load_n(&dq->ring[b & (SCHED_DEQUE - 1)], __ATOMIC_RELAXED);
+    if (t < b) return 1;
+
+    /* last element: race the thieves for it */
+    const int32_t won = __atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+/**
+ * Steal the range at the top (any thread).
+ *
+ * @return  1 if a range was stolen
+ * @return  0 if the deque is empty or another thread won the race
+ */
+static __inline__ int32_t
+mp_sched_steal(mp_sched_deque *dq, uint64_t *task) {
+    int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return 0;
+
+    *task = __atomic_load_n(&dq->ring[t & (SCHED_DEQUE - 1)], __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+
+/* ============================================================================
+ *  Workers
+ * ============================================================================
+ */
+
+/**
+ * Spin-wait hint.
+ */
+static __inline__ void
+mp_sched_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Run a range, splitting off upper halves for thieves first.
+ */
+static void
+mp_sched_run(mp_sched_deque *dq, const uint64_t task) {
+    mp_sched *sched = dq->sched;
+    const uint64_t lo = SCHED_LO(task);
+    uint64_t hi = SCHED_HI(task);
+
+    while (hi - lo > sched->grain) {
+        const uint64_t mid = lo + ((hi - lo) >> 1);
+        if (mp_sched_push(dq, SCHED_PACK(mid, hi)) < 0) break;
+        hi = mid;
+    }
+
+    sched->fn(sched->arg, lo, hi, dq->id);
+    __atomic_sub_fetch(&sched->remaining, hi - lo, __ATOMIC_RELEASE);
+}
+
+/**
+ * Steal from random victims, one round over all of them.
+ */
+static int32_t
+mp_sched_steal_any(const mp_sched *sched, const uint32_t self, uint64_t *seed, uint64_t *task) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+
+    const uint32_t n = sched->workers;
+    const uint32_t first = (uint32_t) (*seed % n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        const uint32_t victim = (first + i) % n;
+        if (victim != self && mp_sched_steal(&sched->deque[victim], task)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Work on the current loop until every item is processed.
+ */
+static void
+mp_sched_work(mp_sched_deque *dq) {
+    mp_sched *sched = dq->sched;
+    uint64_t seed = 0x9E3779B97F4A7C15ull * (dq->id + 1);
+    uint32_t idle = 0;
+
+    while (__atomic_load_n(&sched->remaining, __ATOMIC_ACQUIRE)) {
+        uint64_t task;
+        if (mp_sched_take(dq, &task) || mp_sched_steal_any(sched, dq->id, &seed, &task)) {
+            mp_sched_run(dq, task);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < SCHED_SPIN) {
+            mp_sched_relax();
+        } else {
+            sched_yield();
+            idle = 0;
+        }
+    }
+}
+
+/**
+ * Pin the calling thread to the n-th CPU of the process affinity mask.
+ */
+static void
+mp_sched_pin(const uint32_t n) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return;
+
+    const uint32_t count = (uint32_t) CPU_COUNT(&set);
+    if (count == 0) return;
+
+    for (uint32_t cpu = 0, k = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set) || k++ != n % count) continue;
+
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+        return;
+    }
+}
+
+/**
+ * Worker thread: sleep until a loop starts, help until it is done.
+ */
+static void *
+mp_sched_worker(void *arg) {
+    mp_sched_deque *dq = arg;
+    mp_sched *sched = dq->sched;
+    uint64_t seen = 0;
+
+    if (sched->flags & MP_SCHED_PIN) mp_sched_pin(dq->id);
+
+    pthread_mutex_lock(&sched->lock);
+    while (1) {
+        while (sched->epoch == seen && !sched->stop) pthread_cond_wait(&sched->cond, &sched->lock);
+        if (sched->stop) break;
+        seen = sched->epoch;
+        pthread_mutex_unlock(&sched->lock);
+
+        mp_sched_work(dq);
+
+        pthread_mutex_lock(&sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return NULL;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Start a scheduler.
+ */
+int32_t
+mp_sched_init(mp_sched *sched, uint32_t workers, const uint32_t flags) {
+    if (!sched) return -1;
+
+    if (workers == 0) {
+        cpu_set_t set;
+        workers = sched_getaffinity(0, sizeof(set), &set) == 0 ? (uint32_t) CPU_COUNT(&set) : 1;
+    }
+    if (workers > SCHED_MAX) workers = SCHED_MAX;
+
+    __builtin_memset(sched, 0, sizeof(*sched));
+    sched->workers = workers;
+    sched->flags = flags;
+
+    sched->deque = aligned_alloc(64, workers * sizeof(mp_sched_deque));
+    sched->threads = malloc(workers * sizeof(pthread_t));
+    if (!sched->deque || !sched->threads) goto error;
+
+    for (uint32_t i = 0; i < workers; i++) {
+        __builtin_memset(&sched->deque[i], 0, sizeof(mp_sched_deque));
+        sched->deque[i].sched = sched;
+        sched->deque[i].id = i;
+    }
+
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->cond, NULL);
+
+    for (uint32_t i = 1; i < workers; i++) {
+        if (pthread_create(&sched->threads[i], NULL, mp_sched_worker, &sched->deque[i]) == 0) continue;
+
+        sched->workers = i; /* join the ones that started */
+        mp_sched_free(sched);
+        return -1;
+    }
+    return 0;
+
+error:
+    free(sched->deque);
+    free(sched->threads);
+    sched->deque = NULL;
+    sched->threads = NULL;
+    return -1;
+}
+
+/**
+ * Stop and join the workers.
+ */
+void
+mp_sched_free(mp_sched *sched) {
+    if (!sched || !sched->deque) return;
+
+    pthread_mutex_lock(&sched->lock);
+    sched->stop = 1;
+    pthread_cond_broadcast(&sched->cond);
+    pthread_mutex_unlock(&sched->lock);
+
+    for (uint32_t i = 1; i < sched->workers; i++) pthread_join(sched->threads[i], NULL);
+
+    pthread_cond_destroy(&sched->cond);
+    pthread_mutex_destroy(&sched->lock);
+
+    free(sched->deque);
+    free(sched->threads);
+    free(sched->chunks);
+    sched->deque = NULL;
+    sched->threads = NULL;
+    sched->chunks = NULL;
+    sched->cchunks = 0;
+}
+
+/**
+ * Run fn over a growing item space and wait for completion.
+ *
+ * Also used with workers == 1: spawned ranges go through deque 0.
+ */
+void
+mp_sched_loop(mp_sched *sched, const uint64_t n, const uint64_t first, uint64_t grain,
+              const mp_sched_fn fn, void *arg) {
+    if (n == 0) return;
+
+    if (grain == 0) grain = n / ((uint64_t) sched->workers * SCHED_SPLIT);
+    if (grain == 0) grain = 1;
+
+    sched->fn = fn;
+    sched->arg = arg;
+    sched->grain = grain;
+    __atomic_store_n(&sched->remaining, n, __ATOMIC_RELAXED);
+
+    /* the release store of push publishes the loop to thieves */
+    if (first) mp_sched_push(&sched->deque[0], SCHED_PACK(0, first));
+
+    if (sched->workers > 1) {
+        pthread_mutex_lock(&sched->lock);
+        sched->epoch += 1;
+        pthread_cond_broadcast(&sched->cond);
+        pthread_mutex_unlock(&sched->lock);
+    }
+
+    mp_sched_work(&sched->deque[0]);
+}
+
+/**
+ * Make [lo, hi) of the running loop available to the workers.
+ *
+ * The range is run right here if the deque of the worker is full.
+ */
+void
+mp_sched_spawn(mp_sched *sched, const uint32_t worker, const uint64_t lo, const uint64_t hi) {
+    mp_sched_deque *dq = &sched->deque[worker];
+    const uint64_t task = SCHED_PACK(lo, hi);
+
+    if (lo < hi && mp_sched_push(dq, task) < 0) mp_sched_run(dq, task);
+}
+
+/**
+ * Run fn over [0, n) and wait for completion.
+ *
+ * Loops that fit into one range run inline without waking anybody.
+ */
+void
+mp_sched_for(mp_sched *sched, const uint64_t n, uint64_t grain, const mp_sched_fn fn, void *arg) {
+    if (n == 0) return;
+
+    if (grain == 0) grain = n / ((uint64_t) sched->workers * SCHED_SPLIT);
+    if (grain == 0) grain = 1;
+
+    if (sched->workers == 1 || n <= grain) {
+        fn(arg, 0, n, 0);
+        return;
+    }
+
+    mp_sched_loop(sched, n, n, grain, fn, arg);
+}
+
+/**
+ * Range kernel of chunk loops.
+ */
+static void
+mp_sched_chunk_range(void *arg, uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    const mp_sched *sched = arg;
+    for (; lo < hi; lo++) sched->chunk_fn(sched->chunk_arg, sched->chunks[lo], worker);
+}
+
+/**
+ * Run fn on every chunk of tree.
+ */
+int32_t
+mp_sched_for_chunks(mp_sched *sched, const mp_tree *tree, const uint64_t grain,
+                    const mp_sched_chunk_fn fn, void *arg) {
+    const uint64_t n = tree->count;
+
+    if (n > sched->cchunks) {
+        mp_chunk **chunks = realloc(sched->chunks, n * sizeof(mp_chunk *));
+        if (!chunks) return -1;
+        sched->chunks = chunks;
+        sched->cchunks = n;
+    }
+
+    mp_iter iter;
+    mp_iter_init(&iter, tree);
+    for (uint64_t i = 0; i < n; i++) sched->chunks[i] = mp_iter_next(&iter);
+
+    sched->chunk_fn = fn;
+    sched->chunk_arg = arg;
+    mp_sched_for(sched, n, grain, mp_sched_chunk_range, sched);
+    return 0;
+}
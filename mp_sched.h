@@ -0,0 +1,213 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_sched.h
+ *  Description:  Work-stealing scheduler and chunk-parallel loops.
+ *
+ *  A fixed set of workers, each with a Chase-Lev deque of index ranges.
+ *  A parallel loop starts as one range [0, n) on the deque of the
+ *  calling thread, which takes part as worker 0:
+ *
+ *      worker w:  take [lo, hi) from the bottom of its own deque
+ *                   hi - lo > grain → push [mid, hi), keep [lo, mid)
+ *                   else            → run fn(lo, hi)
+ *                 own deque empty → steal the top (largest) range of a
+ *                 random victim
+ *
+ *  Owners work depth-first on small ranges at the bottom, thieves take
+ *  the big ranges at the top, so a loop is split only as far as idle
+ *  workers demand: O(workers · log n) steals, not O(n) queue operations.
+ *
+ *  Design goals:
+ *   - No allocation per loop or per task: a task is a packed
+ *     [lo | hi] 64-bit value, deques are fixed rings
+ *   - The owner side of a deque is wait-free; only thieves CAS
+ *   - Idle workers sleep on a condition variable between loops
+ *   - Optional pinning of worker i to the i-th CPU of the process
+ *     affinity mask
+ *
+ *  Notes:
+ *   - One loop per scheduler at a time, started by one thread; kernels
+ *     must not start loops on the same scheduler
+ *   - Kernels run concurrently: they must not touch the pool or any
+ *     matrix tree (lookups update the tree's cache); take the chunks a
+ *     kernel reads from an index built beforehand and create new ones
+ *     through mp_stage.h, see mp_gemm_par() (or mp_accum.h for
+ *     scattered additions)
+ *   - The worker id passed to kernels (0 .. workers - 1) indexes
+ *     per-worker state such as partial sums of a reduction
+ *   - Chunk loops see the tree as it is: thaw a matrix with a cold
+ *     tier first (mp_cold_thaw())
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_SCHED_H
+#define QDEEP_MATRIXP_SCHED_H
+
+#include <pthread.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Deque slots per worker (a loop of 2^32 items splits 32 times) */
+#define SCHED_DEQUE 64
+
+/** Upper bound on workers */
+#define SCHED_MAX 256
+
+/** Ranges per worker a loop is split into by default */
+#define SCHED_SPLIT 8
+
+/** Failed steal rounds before an idle worker yields the CPU */
+#define SCHED_SPIN 64
+
+/** Scheduler flags */
+#define MP_SCHED_PIN 0x1 /**< Pin worker i to the i-th allowed CPU */
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Range kernel: process items [lo, hi) on worker `worker`.
+ */
+typedef void (*mp_sched_fn)(void *arg, uint64_t lo, uint64_t hi, uint32_t worker);
+
+/**
+ * Chunk kernel: process one chunk on worker `worker`.
+ */
+typedef void (*mp_sched_chunk_fn)(void *arg, mp_chunk *chunk, uint32_t worker);
+
+/**
+ * Chase-Lev deque of packed ranges (cache line aligned, one per worker).
+ */
+typedef struct mp_sched_deque {
+    int64_t top __attribute__((aligned(64)));    /**< Steal end (thieves) */
+    int64_t bottom __attribute__((aligned(64))); /**< Owner end */
+    uint64_t ring[SCHED_DEQUE];                  /**< [lo | hi] ranges */
+
+    struct mp_sched *sched;                      /**< Owning scheduler */
+    uint32_t id;                                 /**< Worker id */
+} mp_sched_deque;
+
+/**
+ * Work-stealing scheduler.
+ */
+typedef struct mp_sched {
+    uint32_t workers;       /**< Workers including the calling thread */
+    uint32_t flags;         /**< MP_SCHED_* */
+    pthread_t *threads;     /**< workers - 1 threads (worker 0 is the caller) */
+    mp_sched_deque *deque;  /**< One per worker */
+
+    pthread_mutex_t lock;   /**< Guards epoch / stop for sleeping */
+    pthread_cond_t cond;    /**< Signalled when a loop starts */
+    uint64_t epoch;         /**< Loops started so far */
+    uint8_t stop;           /**< Workers must exit */
+
+    /* --------------------------------------------------------------------
+     * Current loop (written by the caller before the first push)
+     * ------------------------------------------------------------------ */
+
+    mp_sched_fn fn;         /**< Range kernel */
+    void *arg;              /**< Kernel argument */
+    uint64_t grain;         /**< Largest range run without splitting */
+    uint64_t remaining;     /**< Items not processed yet */
+
+    /* --------------------------------------------------------------------
+     * Chunk loops
+     * ------------------------------------------------------------------ */
+
+    mp_sched_chunk_fn chunk_fn; /**< Chunk kernel */
+    void *chunk_arg;            /**< Chunk kernel argument */
+    mp_chunk **chunks;          /**< Chunks of the tree, opos order */
+    uint64_t cchunks;           /**< Capacity of chunks */
+} mp_sched;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Start a scheduler with `workers` workers (0: one per allowed CPU).
+ *
+ * The calling thread counts as worker 0, so workers - 1 threads are
+ * created.
+ *
+ * @return  0 on success
+ * @return -1 on allocation / thread failure
+ */
+int32_t
+mp_sched_init(mp_sched *sched, uint32_t workers, uint32_t flags);
+
+/**
+ * Stop and join the workers.
+ */
+void
+mp_sched_free(mp_sched *sched);
+
+/**
+ * Run fn over [0, n) in ranges of at most grain items (0: n split into
+ * SCHED_SPLIT ranges per worker) and wait for completion.
+ *
+ * Ranges are packed into 32-bit halves: n must be below 2^32.
+ */
+void
+mp_sched_for(mp_sched *sched, uint64_t n, uint64_t grain, mp_sched_fn fn, void *arg);
+
+/**
+ * Run fn over an item space that grows while the loop runs.
+ *
+ * [0, first) is ready at the start; kernels make further items ready
+ * with mp_sched_spawn(). Returns after n items were processed, so n
+ * must count every item that will ever be spawned. This is the
+ * building block of dependency-driven execution (see mp_dag.h).
+ */
+void
+mp_sched_loop(mp_sched *sched, uint64_t n, uint64_t first, uint64_t grain,
+              mp_sched_fn fn, void *arg);
+
+/**
+ * Make items [lo, hi) of the running loop ready.
+ *
+ * Only from inside a kernel, with the worker id the kernel was called
+ * with (the range goes to that worker's own deque).
+ */
+void
+mp_sched_spawn(mp_sched *sched, uint32_t worker, uint64_t lo, uint64_t hi);
+
+/**
+ * Run fn on every chunk of tree, grain chunks per task at most (0: auto).
+ *
+ * The chunk list is collected in opos order before the loop starts;
+ * neighbouring chunks tend to run on the same worker.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure
+ */
+int32_t
+mp_sched_for_chunks(mp_sched *sched, const mp_tree *tree, uint64_t grain,
+                    mp_sched_chunk_fn fn, void *arg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_SCHED_H */
@@ -0,0 +1,1192 @@
+#include "mp_server.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mp_codec.h"
+#include "mp_cold.h"
+#include "mp_stats.h"
+#include "mp_stream.h"
+#include "mp_xfer.h"
+
+
+/* ============================================================================
+ *  Connection structures
+ * ============================================================================
+ */
+
+/** Input states */
+#define IN_HDR    0 /**< Reading request header */
+#define IN_NAME   1 /**< Reading matrix name */
+#define IN_BODY   2 /**< Reading a buffered body */
+#define IN_CHUNK  3 /**< Receiving a chunk payload (mp_xfer) */
+#define IN_SHDR   4 /**< RECV_MATRIX: stream header */
+#define IN_FRAME  5 /**< RECV_MATRIX: chunk frame header */
+#define IN_SKIP   6 /**< Discarding the body of a failed request */
+#define IN_PACKED 7 /**< RECV_MATRIX: packed chunk payload */
+
+/** Output states */
+#define OUT_FLAT    0 /**< Header and flat body */
+#define OUT_FRAME   1 /**< Chunk frame header */
+#define OUT_PAYLOAD 2 /**< Chunk payload (mp_xfer) */
+#define OUT_END     3 /**< Stream terminator */
+#define OUT_PACKED  4 /**< Packed chunk payload (pbuf) */
+
+/**
+ * Queued response.
+ *
+ * A response is a flat buffer (header + optional body) followed by
+ * zero or more chunk payloads, optionally framed as a chunk stream.
+ */
+typedef struct mp_out {
+    struct mp_out *next;
+
+    uint8_t *buf;   /**< Header + flat body (owned) */
+    uint64_t blen;  /**< Bytes in buf */
+    uint64_t boff;  /**< Bytes of buf already sent */
+
+    mp_pool *pool;     /**< Owner of the chunk copies */
+    mp_chunk **chunks; /**< Copies of the chunks to send (owned array) */
+    uint64_t count;    /**< Number of chunks */
+    uint64_t idx;      /**< Current chunk */
+
+    uint8_t *pbuf;     /**< Packed payload of the current chunk (packed streams) */
+    uint64_t plen;     /**< Bytes in pbuf, 0 if the chunk goes unpacked */
+    uint64_t poff;     /**< Bytes of pbuf already sent */
+
+    uint8_t framed;    /**< Send as chunk stream frames */
+    uint8_t state;     /**< OUT_* */
+    uint8_t foff;      /**< Bytes of frame already sent */
+    uint8_t frame[STREAM_FRAME];
+} mp_out;
+
+/**
+ * Client connection or listener.
+ */
+typedef struct mp_conn {
+    struct mp_conn *next; /**< Server connection list */
+    struct mp_conn *prev;
+
+    int32_t fd;
+    uint8_t listen; /**< Listening socket */
+    uint8_t state;  /**< IN_* */
+
+    /* --------------------------------------------------------------------
+     * Input
+     * ------------------------------------------------------------------ */
+
+    mp_req req;                 /**< Current request */
+    uint8_t ibuf[PROTO_REQ];    /**< Header / frame buffer */
+    uint64_t ihave;             /**< Bytes collected in current state */
+    char name[256];             /**< Current matrix name */
+
+    uint8_t *body;    /**< Buffered request body */
+    uint64_t left;    /**< Body bytes not yet consumed */
+    int32_t status;   /**< Status of a request being skipped */
+
+    mp_xfer ix;       /**< Chunk payload receive */
+    mp_entry *stage;  /**< Matrix written by the request in flight */
+    mp_chunk *upload; /**< PUT_CHUNK payload, linked once complete */
+    const mp_chunk *unpack; /**< Target of the packed payload in body */
+    uint64_t ulen;          /**< Length of the packed payload */
+
+    /* --------------------------------------------------------------------
+     * Output
+     * ------------------------------------------------------------------ */
+
+    mp_out *ohead;
+    mp_out *otail;
+    uint32_t nout;    /**< Queued responses */
+    mp_xfer ox;       /**< Chunk payload send */
+} mp_conn;
+
+
+/* ============================================================================
+ *  Matrix table
+ * ============================================================================
+ */
+
+/**
+ * FNV-1a hash of a matrix name.
+ */
+static uint32_t
+mp_server_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name) h = (h ^ (uint8_t) *name++) * 16777619u;
+    return h % SERVER_BUCKETS;
+}
+
+/**
+ * Look up a resident matrix by name.
+ */
+static mp_entry *
+mp_server_find(mp_server *srv, const char *name) {
+    mp_entry *entry = srv->table[mp_server_hash(name)];
+    while (entry && strcmp(entry->name, name) != 0) entry = entry->next;
+    return entry;
+}
+
+/**
+ * Allocate a matrix entry that is not yet in the table.
+ */
+static mp_entry *
+mp_entry_new(mp_server *srv, const char *name) {
+    mp_entry *entry = malloc(sizeof(mp_entry));
+    if (!entry) return NULL;
+
+    mp_matrix_init(&entry->matx, srv->pool);
+    strcpy(entry->name, name);
+    entry->next = NULL;
+    entry->refs = 1;
+    return entry;
+}
+
+/**
+ * Drop a reference, freeing the matrix with the last one.
+ */
+static void
+mp_entry_unref(mp_entry *entry) {
+    if (--entry->refs) return;
+
+    mp_matrix_free(&entry->matx);
+    free(entry);
+}
+
+/**
+ * Remove a matrix from the table (the table reference is dropped).
+ */
+static void
+mp_server_unlink(mp_server *srv, const char *name) {
+    mp_entry **link = &srv->table[mp_server_hash(name)];
+
+    while (*link && strcmp((*link)->name, name) != 0) link = &(*link)->next;
+    if (!*link) return;
+
+    mp_entry *entry = *link;
+    *link = entry->next;
+    mp_entry_unref(entry);
+}
+
+/**
+ * Insert a matrix into the table, replacing an entry of the same name.
+ */
+static void
+mp_server_link(mp_server *srv, mp_entry *entry) {
+    mp_server_unlink(srv, entry->name);
+
+    mp_entry **head = &srv->table[mp_server_hash(entry->name)];
+    entry->next = *head;
+    *head = entry;
+}
+
+
+/* ============================================================================
+ *  Built-in kernels
+ * ============================================================================
+ */
+
+/**
+ * dst[i] = arg for every element (materializes all chunks).
+ */
+static int32_t
+mp_kernel_fill(mp_matrix *dst, mp_matrix *const *src, const uint32_t n, const int64_t arg) {
+    (void) src;
+    (void) n;
+
+    for (uint64_t cy = 0; (cy << CHUNK_POW) < dst->size.y; cy++) {
+        for (uint64_t cx = 0; (cx << CHUNK_POW) < dst->size.x; cx++) {
+            const mp_copos opos = {.dim = {(uint32_t) cx, (uint32_t) cy}};
+
+            mp_chunk *chunk = mp_matrix_chunk_write(dst, opos);
+            if (!chunk) return -ENOMEM;
+
+            for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+                for (uint32_t x = 0; x <= chunk->size.dim.x; x++)
+                    chunk->data[CHUNK_POS(x, y)] = arg;
+        }
+    }
+    return 0;
+}
+
+/**
+ * dst[i] *= arg.
+ */
+static int32_t
+mp_kernel_scale(mp_matrix *dst, mp_matrix *const *src, const uint32_t n, const int64_t arg) {
+    (void) src;
+    (void) n;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &dst->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (!(chunk = mp_cold_warm(dst, chunk))) return -ENOMEM;
+        mp_matrix_chunk_touch(dst, chunk);
+
+        for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+            for (uint32_t x = 0; x <= chunk->size.dim.x; x++)
+                chunk->data[CHUNK_POS(x, y)] *= arg;
+    }
+    return 0;
+}
+
+/**
+ * dst[i] += src[0][i] (matrices must have equal size).
+ */
+static int32_t
+mp_kernel_add(mp_matrix *dst, mp_matrix *const *src, const uint32_t n, const int64_t arg) {
+    (void) arg;
+    if (n != 1) return -EINVAL;
+    if (src[0]->size.x != dst->size.x || src[0]->size.y != dst->size.y) return -EINVAL;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &src[0]->tree);
+
+    for (mp_chunk *from; (from = mp_iter_next(&iter));) {
+        if (!(from = mp_cold_warm(src[0], from))) return -ENOMEM;
+
+        mp_chunk *to = mp_matrix_chunk_write(dst, from->opos);
+        if (!to) return -ENOMEM;
+
+        for (uint32_t y = 0; y <= from->size.dim.y; y++)
+            for (uint32_t x = 0; x <= from->size.dim.x; x++)
+                to->data[CHUNK_POS(x, y)] += from->data[CHUNK_POS(x, y)];
+    }
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Non-blocking byte helpers
+ * ============================================================================
+ */
+
+/**
+ * Read until *have == need.
+ *
+ * Returns:
+ *   MP_XFER_DONE / MP_XFER_AGAIN / MP_XFER_ERROR
+ */
+static int32_t
+mp_conn_fill(const int32_t fd, uint8_t *buf, uint64_t *have, const uint64_t need) {
+    while (*have < need) {
+        const int64_t ret = read(fd, buf + *have, need - *have);
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (ret == 0) return MP_XFER_ERROR; /* EOF */
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return MP_XFER_AGAIN;
+            return MP_XFER_ERROR;
+        }
+        *have += (uint64_t) ret;
+        mp_stats_io(MP_STATS_RECV, (uint64_t) ret);
+    }
+    return MP_XFER_DONE;
+}
+
+/**
+ * Write until *off == len.
+ */
+static int32_t
+mp_conn_drain(const int32_t fd, const uint8_t *buf, uint64_t *off, const uint64_t len) {
+    while (*off < len) {
+        const int64_t ret = write(fd, buf + *off, len - *off);
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret < 0 && errno == EAGAIN) return MP_XFER_AGAIN;
+            return MP_XFER_ERROR;
+        }
+        *off += (uint64_t) ret;
+        mp_stats_io(MP_STATS_SENT, (uint64_t) ret);
+    }
+    return MP_XFER_DONE;
+}
+
+
+/* ============================================================================
+ *  Output queue
+ * ============================================================================
+ */
+
+/**
+ * Queue a response with an optional flat body of blen bytes.
+ *
+ * The returned buffer (after the header) is for the caller to fill.
+ */
+static mp_out *
+mp_conn_reply(mp_conn *conn, const int32_t status, const uint64_t a,
+              const uint64_t blen, const uint64_t len) {
+    mp_out *out = calloc(1, sizeof(mp_out));
+    if (!out) return NULL;
+
+    out->buf = malloc(PROTO_RESP + blen);
+    if (!out->buf) {
+        free(out);
+        return NULL;
+    }
+
+    const mp_resp resp = {conn->req.id, status, a, len};
+    mp_resp_pack(out->buf, &resp);
+    out->blen = PROTO_RESP + blen;
+
+    if (conn->otail) conn->otail->next = out;
+    else conn->ohead = out;
+    conn->otail = out;
+    conn->nout += 1;
+    return out;
+}
+
+/**
+ * Release a response and its chunk copies.
+ */
+static void
+mp_out_free(mp_out *out) {
+    for (uint64_t i = 0; i < out->count; i++) mp_pool_ret(out->pool, out->chunks[i]);
+    free(out->chunks);
+    free(out->pbuf);
+    free(out->buf);
+    free(out);
+}
+
+/**
+ * Enter the state for the next chunk of a response.
+ */
+static void
+mp_out_next(mp_out *out) {
+    if (out->idx < out->count) {
+        const mp_chunk *chunk = out->chunks[out->idx];
+        out->state = out->framed ? OUT_FRAME : OUT_PAYLOAD;
+
+        out->plen = out->pbuf ? mp_codec_encode(chunk, out->pbuf) : 0;
+        out->poff = 0;
+
+        if (out->plen && out->plen < mp_stream_payload(chunk->size))
+            mp_stream_pack(out->frame, chunk->opos.pos,
+                           out->plen << 32 | STREAM_PACKED | chunk->size.size);
+        else {
+            out->plen = 0;
+            mp_stream_pack(out->frame, chunk->opos.pos, chunk->size.size);
+        }
+    } else {
+        out->state = OUT_END;
+        mp_stream_pack(out->frame, MP_STREAM_END, 0);
+    }
+    out->foff = 0;
+}
+
+/**
+ * Send one queued response as far as possible.
+ */
+static int32_t
+mp_conn_send(mp_conn *conn, mp_out *out) {
+    int32_t ret;
+    uint64_t off;
+
+    while (1) {
+        switch (out->state) {
+            case OUT_FLAT:
+                ret = mp_conn_drain(conn->fd, out->buf, &out->boff, out->blen);
+                if (ret != MP_XFER_DONE) return ret;
+
+                mp_out_next(out);
+                if (out->state == OUT_PAYLOAD)
+                    mp_xfer_chunk_send(&conn->ox, out->chunks[out->idx], conn->fd);
+                break;
+
+            case OUT_FRAME:
+                off = out->foff;
+                ret = mp_conn_drain(conn->fd, out->frame, &off, STREAM_FRAME);
+                out->foff = (uint8_t) off;
+                if (ret != MP_XFER_DONE) return ret;
+
+                if (out->plen) {
+                    out->state = OUT_PACKED;
+                    break;
+                }
+
+                out->state = OUT_PAYLOAD;
+                mp_xfer_chunk_send(&conn->ox, out->chunks[out->idx], conn->fd);
+                break;
+
+            case OUT_PACKED:
+                ret = mp_conn_drain(conn->fd, out->pbuf, &out->poff, out->plen);
+                if (ret != MP_XFER_DONE) return ret;
+
+                out->idx += 1;
+                mp_out_next(out);
+                if (out->state == OUT_PAYLOAD)
+                    mp_xfer_chunk_send(&conn->ox, out->chunks[out->idx], conn->fd);
+                break;
+
+            case OUT_PAYLOAD:
+                ret = mp_xfer_step(&conn->ox);
+                if (ret != MP_XFER_DONE) return ret;
+
+                out->idx += 1;
+                mp_out_next(out);
+                if (out->state == OUT_PAYLOAD)
+                    mp_xfer_chunk_send(&conn->ox, out->chunks[out->idx], conn->fd);
+                break;
+
+            default: /* OUT_END */
+                if (!out->framed) return MP_XFER_DONE;
+
+                off = out->foff;
+                ret = mp_conn_drain(conn->fd, out->frame, &off, STREAM_FRAME);
+                out->foff = (uint8_t) off;
+                return ret;
+        }
+    }
+}
+
+/**
+ * Send queued responses until the socket would block.
+ */
+static int32_t
+mp_conn_flush(mp_conn *conn) {
+    while (conn->ohead) {
+        mp_out *out = conn->ohead;
+
+        const int32_t ret = mp_conn_send(conn, out);
+        if (ret != MP_XFER_DONE) return ret;
+
+        conn->ohead = out->next;
+        if (!conn->ohead) conn->otail = NULL;
+        conn->nout -= 1;
+        mp_out_free(out);
+    }
+    return MP_XFER_DONE;
+}
+
+
+/* ============================================================================
+ *  Request execution
+ * ============================================================================
+ */
+
+/**
+ * Finish the current request with an empty response.
+ */
+static int32_t
+mp_conn_status(mp_conn *conn, const int32_t status) {
+    conn->state = IN_HDR;
+    conn->ihave = 0;
+    return mp_conn_reply(conn, status, 0, 0, 0) ? MP_XFER_DONE : MP_XFER_ERROR;
+}
+
+/**
+ * Fail the current request after discarding its remaining body.
+ */
+static int32_t
+mp_conn_fail(mp_conn *conn, const int32_t status) {
+    if (conn->left == 0) return mp_conn_status(conn, status);
+
+    conn->state = IN_SKIP;
+    conn->status = status;
+    return MP_XFER_DONE;
+}
+
+/**
+ * Copy the effective area of chunk into a pool chunk.
+ */
+static mp_chunk *
+mp_out_copy(mp_pool *pool, const mp_chunk *chunk) {
+    mp_chunk *copy = mp_pool_get(pool);
+    if (!copy) return NULL;
+
+    copy->opos = chunk->opos;
+    mp_chunk_set_size(copy, chunk->size);
+
+    const uint64_t row = (chunk->size.dim.x + 1) * sizeof(int64_t);
+    for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+        __builtin_memcpy(copy->data + CHUNK_POS(0, y), chunk->data + CHUNK_POS(0, y), row);
+    return copy;
+}
+
+/**
+ * Queue chunk payloads of a matrix.
+ *
+ * The chunks are copied here: later requests of the pipeline may modify
+ * or drop them before the response is sent.
+ */
+static int32_t
+mp_conn_chunks(mp_conn *conn, mp_entry *entry, mp_chunk **chunks,
+               const uint64_t count, const uint64_t a, const uint64_t len,
+               const uint8_t framed, const mp_msize *size, const uint8_t packed) {
+    mp_out *out = mp_conn_reply(conn, 0, a, framed ? STREAM_FRAME : 0, len);
+    if (!out) {
+        free(chunks);
+        return MP_XFER_ERROR;
+    }
+
+    if (packed) {
+        out->pbuf = malloc(CODEC_MAX);
+        if (!out->pbuf) {
+            free(chunks);
+            return MP_XFER_ERROR;
+        }
+    }
+
+    if (framed) mp_stream_pack(out->buf + PROTO_RESP, size->x, size->y);
+
+    out->pool = entry->matx.pool;
+    out->chunks = chunks;
+    out->framed = framed;
+
+    /* out->count covers the copies made, for mp_out_free() */
+    for (; out->count < count; out->count++) {
+        mp_chunk *chunk = mp_cold_warm(&entry->matx, chunks[out->count]);
+        if (!chunk || !(chunks[out->count] = mp_out_copy(out->pool, chunk))) return MP_XFER_ERROR;
+    }
+
+    conn->state = IN_HDR;
+    conn->ihave = 0;
+    return MP_XFER_DONE;
+}
+
+/**
+ * GET_CHUNK: respond with the payload of a single chunk.
+ */
+static int32_t
+mp_conn_get_chunk(mp_conn *conn, mp_entry *entry) {
+    const mp_copos opos = {.pos = conn->req.a};
+
+    mp_chunk *chunk = mp_matrix_chunk_find(&entry->matx, opos);
+    if (!chunk) return mp_conn_status(conn, -ENOENT);
+
+    mp_chunk **chunks = malloc(sizeof(mp_chunk *));
+    if (!chunks) return MP_XFER_ERROR;
+    chunks[0] = chunk;
+
+    return mp_conn_chunks(conn, entry, chunks, 1, chunk->size.size,
+                          mp_stream_payload(chunk->size), 0, NULL, 0);
+}
+
+/**
+ * SEND_MATRIX: respond with the whole matrix as a chunk stream.
+ *
+ * With MP_FLAG_PACKED chunks are encoded while they are sent, so the
+ * body length is unknown: a = MP_CODEC_FOR and len = 0.
+ */
+static int32_t
+mp_conn_send_matrix(mp_conn *conn, mp_entry *entry) {
+    const uint64_t count = entry->matx.tree.count;
+
+    mp_chunk **chunks = malloc((count ? count : 1) * sizeof(mp_chunk *));
+    if (!chunks) return MP_XFER_ERROR;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &entry->matx.tree);
+    for (uint64_t i = 0; i < count; i++) chunks[i] = mp_iter_next(&iter);
+
+    if (conn->req.flags & MP_FLAG_PACKED)
+        return mp_conn_chunks(conn, entry, chunks, count, MP_CODEC_FOR, 0, 1, &entry->matx.size, 1);
+
+    return mp_conn_chunks(conn, entry, chunks, count, 0,
+                          mp_stream_bytes(&entry->matx), 1, &entry->matx.size, 0);
+}
+
+/**
+ * GET_ELEMS / PUT_ELEMS on a buffered body.
+ */
+static int32_t
+mp_conn_elems(mp_conn *conn, mp_entry *entry) {
+    const uint64_t *in = (const uint64_t *) conn->body;
+
+    if (conn->req.op == MP_OP_PUT_ELEMS) {
+        const uint64_t n = conn->req.len / (3 * sizeof(uint64_t));
+        for (uint64_t i = 0; i < n; i++, in += 3)
+            if (mp_matrix_put(&entry->matx, in[0], in[1], (int64_t) in[2]) < 0)
+                return mp_conn_status(conn, -ERANGE);
+        return mp_conn_status(conn, 0);
+    }
+
+    const uint64_t n = conn->req.len / (2 * sizeof(uint64_t));
+    mp_out *out = mp_conn_reply(conn, 0, n, n * sizeof(int64_t), n * sizeof(int64_t));
+    if (!out) return MP_XFER_ERROR;
+
+    int64_t *values = (int64_t *) (out->buf + PROTO_RESP);
+    for (uint64_t i = 0; i < n; i++, in += 2)
+        values[i] = in[0] < entry->matx.size.x && in[1] < entry->matx.size.y
+                        ? mp_matrix_get(&entry->matx, in[0], in[1]) : 0;
+
+    conn->state = IN_HDR;
+    conn->ihave = 0;
+    return MP_XFER_DONE;
+}
+
+/**
+ * KERNEL: body is "kernel\0src\0src\0...".
+ */
+static int32_t
+mp_conn_kernel(mp_server *srv, mp_conn *conn, mp_entry *entry) {
+    const char *arg = (const char *) conn->body;
+    const char *end = arg + conn->req.len;
+
+    if (conn->req.len == 0 || end[-1] != '\0') return mp_conn_status(conn, -EINVAL);
+
+    mp_kernel fn = NULL;
+    for (uint32_t i = 0; i < srv->nkern; i++)
+        if (strcmp(srv->kern[i].name, arg) == 0) fn = srv->kern[i].fn;
+    if (!fn) return mp_conn_status(conn, -ENOSYS);
+
+    mp_matrix *src[SERVER_KERNEL_ARGS];
+    uint32_t n = 0;
+
+    for (arg += strlen(arg) + 1; arg < end; arg += strlen(arg) + 1) {
+        const mp_entry *from = mp_server_find(srv, arg);
+        if (!from) return mp_conn_status(conn, -ENOENT);
+        if (n == SERVER_KERNEL_ARGS) return mp_conn_status(conn, -E2BIG);
+        src[n++] = (mp_matrix *) &from->matx;
+    }
+
+    return mp_conn_status(conn, fn(&entry->matx, src, n, (int64_t) conn->req.b));
+}
+
+/**
+ * Execute a request whose body (if any) has been buffered.
+ */
+static int32_t
+mp_conn_exec(mp_server *srv, mp_conn *conn) {
+    mp_entry *entry = mp_server_find(srv, conn->name);
+
+    if (conn->req.op == MP_OP_CREATE) {
+        const mp_msize size = {conn->req.a, conn->req.b};
+        if (!mp_msize_valid(size)) return mp_conn_status(conn, -EINVAL);
+
+        /* always a new, empty matrix: an existing one is replaced */
+        entry = mp_entry_new(srv, conn->name);
+        if (!entry) return mp_conn_status(conn, -ENOMEM);
+
+        if (mp_matrix_set_size(&entry->matx, size) < 0) {
+            mp_entry_unref(entry);
+            return mp_conn_status(conn, -EIO);
+        }
+
+        mp_server_link(srv, entry);
+        return mp_conn_status(conn, 0);
+    }
+
+    if (!entry) return mp_conn_status(conn, -ENOENT);
+
+    switch (conn->req.op) {
+        case MP_OP_DROP:
+            mp_server_unlink(srv, conn->name);
+            return mp_conn_status(conn, 0);
+        case MP_OP_GET_CHUNK:   return mp_conn_get_chunk(conn, entry);
+        case MP_OP_SEND_MATRIX: return mp_conn_send_matrix(conn, entry);
+        case MP_OP_GET_ELEMS:
+        case MP_OP_PUT_ELEMS:   return mp_conn_elems(conn, entry);
+        case MP_OP_KERNEL:      return mp_conn_kernel(srv, conn, entry);
+        default:                return mp_conn_status(conn, -ENOSYS);
+    }
+}
+
+/**
+ * Decide how the body of a freshly parsed request is consumed.
+ */
+static int32_t
+mp_conn_begin(mp_server *srv, mp_conn *conn) {
+    const mp_req *req = &conn->req;
+    conn->left = req->len;
+
+    switch (req->op) {
+        case MP_OP_CREATE:
+        case MP_OP_DROP:
+        case MP_OP_GET_CHUNK:
+        case MP_OP_SEND_MATRIX:
+            if (req->len) return mp_conn_fail(conn, -EINVAL);
+            return mp_conn_exec(srv, conn);
+
+        case MP_OP_GET_ELEMS:
+        case MP_OP_PUT_ELEMS:
+        case MP_OP_KERNEL: {
+            const uint64_t unit = req->op == MP_OP_GET_ELEMS ? 16 : req->op == MP_OP_PUT_ELEMS ? 24 : 1;
+            if (req->len > PROTO_BODY_MAX || req->len % unit) return mp_conn_fail(conn, -EINVAL);
+
+            conn->body = malloc(req->len ? req->len : 1);
+            if (!conn->body) return mp_conn_fail(conn, -ENOMEM);
+
+            conn->state = IN_BODY;
+            conn->ihave = 0;
+            return MP_XFER_DONE;
+        }
+
+        case MP_OP_PUT_CHUNK: {
+            mp_entry *entry = mp_server_find(srv, conn->name);
+            if (!entry) return mp_conn_fail(conn, -ENOENT);
+
+            const mp_copos opos = {.pos = req->a};
+            const mp_csize size = {.size = (uint16_t) req->b};
+            if (req->b > UINT16_MAX || !mp_stream_valid(&entry->matx, opos, size) ||
+                req->len != mp_stream_payload(size))
+                return mp_conn_fail(conn, -EINVAL);
+
+            /* a private chunk: other requests never see a partial upload */
+            conn->upload = mp_pool_get(entry->matx.pool);
+            if (!conn->upload) return mp_conn_fail(conn, -ENOMEM);
+
+            conn->upload->opos = opos;
+            mp_chunk_set_size(conn->upload, size);
+
+            /* keep the matrix alive if it is dropped meanwhile */
+            conn->stage = entry;
+            entry->refs += 1;
+
+            mp_xfer_chunk_recv(&conn->ix, conn->upload, conn->fd);
+            conn->state = IN_CHUNK;
+            return MP_XFER_DONE;
+        }
+
+        case MP_OP_RECV_MATRIX:
+            if (req->len < 2 * STREAM_FRAME) return mp_conn_fail(conn, -EINVAL);
+
+            conn->stage = mp_entry_new(srv, conn->name);
+            if (!conn->stage) return mp_conn_fail(conn, -ENOMEM);
+
+            conn->state = IN_SHDR;
+            conn->ihave = 0;
+            return MP_XFER_DONE;
+
+        default:
+            return mp_conn_fail(conn, -ENOSYS);
+    }
+}
+
+/**
+ * Handle a chunk frame of a RECV_MATRIX stream.
+ */
+static int32_t
+mp_conn_frame(mp_server *srv, mp_conn *conn) {
+    uint64_t a, b;
+    mp_stream_unpack(conn->ibuf, &a, &b);
+    conn->left -= STREAM_FRAME;
+    conn->ihave = 0;
+
+    mp_matrix *matx = &conn->stage->matx;
+
+    if (a == MP_STREAM_END) {
+        if (conn->left) goto fail;
+
+        mp_server_link(srv, conn->stage);
+        conn->stage = NULL;
+        return mp_conn_status(conn, 0);
+    }
+
+    const mp_copos opos = {.pos = a};
+    const mp_csize size = {.size = (uint16_t) b};
+
+    if (b & STREAM_PACKED) {
+        const uint64_t elen = b >> 32;
+        if ((b & 0xFFFE0000ull) || !elen || elen > mp_codec_bound(size) ||
+            !mp_stream_valid(matx, opos, size) || conn->left < elen + STREAM_FRAME)
+            goto fail;
+
+        conn->unpack = mp_matrix_chunk_write(matx, opos);
+        conn->body = malloc(elen);
+        if (!conn->unpack || !conn->body) goto fail;
+
+        conn->left -= elen;
+        conn->ulen = elen;
+        conn->ihave = 0;
+        conn->state = IN_PACKED;
+        return MP_XFER_DONE;
+    }
+
+    if (b > UINT16_MAX || !mp_stream_valid(matx, opos, size) ||
+        conn->left < mp_stream_payload(size) + STREAM_FRAME)
+        goto fail;
+
+    const mp_chunk *chunk = mp_matrix_chunk_write(matx, opos);
+    if (!chunk) goto fail;
+
+    conn->left -= mp_stream_payload(size);
+    mp_xfer_chunk_recv(&conn->ix, chunk, conn->fd);
+    conn->state = IN_CHUNK;
+    return MP_XFER_DONE;
+
+fail:
+    free(conn->body);
+    conn->body = NULL;
+    mp_entry_unref(conn->stage);
+    conn->stage = NULL;
+    return mp_conn_fail(conn, -EINVAL);
+}
+
+
+/* ============================================================================
+ *  Input state machine
+ * ============================================================================
+ */
+
+/**
+ * Advance the input state machine by one state.
+ *
+ * Returns:
+ *   MP_XFER_DONE   progress was made, call again
+ *   MP_XFER_AGAIN  socket has no more data
+ *   MP_XFER_ERROR  connection must be closed
+ */
+static int32_t
+mp_conn_input(mp_server *srv, mp_conn *conn) {
+    int32_t ret;
+    uint8_t skip[4096];
+
+    switch (conn->state) {
+        case IN_HDR:
+            ret = mp_conn_fill(conn->fd, conn->ibuf, &conn->ihave, PROTO_REQ);
+            if (ret != MP_XFER_DONE) return ret;
+
+            mp_req_unpack(conn->ibuf, &conn->req);
+            conn->ihave = 0;
+            conn->state = IN_NAME;
+            return MP_XFER_DONE;
+
+        case IN_NAME:
+            ret = mp_conn_fill(conn->fd, (uint8_t *) conn->name, &conn->ihave, conn->req.nlen);
+            if (ret != MP_XFER_DONE) return ret;
+
+            conn->name[conn->req.nlen] = '\0';
+            conn->ihave = 0;
+            return mp_conn_begin(srv, conn);
+
+        case IN_BODY:
+            ret = mp_conn_fill(conn->fd, conn->body, &conn->ihave, conn->req.len);
+            if (ret != MP_XFER_DONE) return ret;
+
+            ret = mp_conn_exec(srv, conn);
+            free(conn->body);
+            conn->body = NULL;
+            return ret;
+
+        case IN_CHUNK:
+            ret = mp_xfer_step(&conn->ix);
+            if (ret != MP_XFER_DONE) return ret;
+
+            if (conn->req.op == MP_OP_PUT_CHUNK) {
+                mp_matrix_chunk_insert(&conn->stage->matx, conn->upload);
+                conn->upload = NULL;
+                mp_entry_unref(conn->stage);
+                conn->stage = NULL;
+                return mp_conn_status(conn, 0);
+            }
+
+            conn->state = IN_FRAME;
+            return MP_XFER_DONE;
+
+        case IN_PACKED:
+            ret = mp_conn_fill(conn->fd, conn->body, &conn->ihave, conn->ulen);
+            if (ret != MP_XFER_DONE) return ret;
+
+            ret = mp_codec_decode(conn->unpack, conn->body, conn->ulen);
+            free(conn->body);
+            conn->body = NULL;
+            conn->ihave = 0;
+
+            if (ret < 0) {
+                mp_entry_unref(conn->stage);
+                conn->stage = NULL;
+                return mp_conn_fail(conn, -EINVAL);
+            }
+
+            conn->state = IN_FRAME;
+            return MP_XFER_DONE;
+
+        case IN_SHDR:
+        case IN_FRAME:
+            ret = mp_conn_fill(conn->fd, conn->ibuf, &conn->ihave, STREAM_FRAME);
+            if (ret != MP_XFER_DONE) return ret;
+
+            if (conn->state == IN_FRAME) return mp_conn_frame(srv, conn);
+
+            uint64_t x, y;
+            mp_stream_unpack(conn->ibuf, &x, &y);
+
+            conn->left -= STREAM_FRAME;
+            conn->ihave = 0;
+
+            const mp_msize size = {x, y};
+            const int32_t status = !mp_msize_valid(size) ? -EINVAL
+                                 : mp_matrix_set_size(&conn->stage->matx, size) < 0 ? -EIO : 0;
+            if (status < 0) {
+                mp_entry_unref(conn->stage);
+                conn->stage = NULL;
+                return mp_conn_fail(conn, status);
+            }
+            conn->state = IN_FRAME;
+            return MP_XFER_DONE;
+
+        default: /* IN_SKIP */
+            while (conn->left > 0) {
+                const uint64_t want = conn->left > sizeof(skip) ? sizeof(skip) : conn->left;
+                const int64_t n = read(conn->fd, skip, want);
+                if (n <= 0) {
+                    if (n < 0 && errno == EINTR) continue;
+                    return n < 0 && errno == EAGAIN ? MP_XFER_AGAIN : MP_XFER_ERROR;
+                }
+                conn->left -= (uint64_t) n;
+                mp_stats_io(MP_STATS_RECV, (uint64_t) n);
+            }
+            return mp_conn_status(conn, conn->status);
+    }
+}
+
+
+/* ============================================================================
+ *  Connection lifecycle
+ * ============================================================================
+ */
+
+/**
+ * Allocate a connection and register it with epoll.
+ */
+static mp_conn *
+mp_conn_open(mp_server *srv, const int32_t fd, const uint8_t listen) {
+    mp_conn *conn = calloc(1, sizeof(mp_conn));
+    if (!conn) return NULL;
+
+    conn->fd = fd;
+    conn->listen = listen;
+    conn->state = IN_HDR;
+
+    struct epoll_event ev;
+    ev.events = listen ? EPOLLIN : EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        free(conn);
+        return NULL;
+    }
+
+    conn->next = srv->conns;
+    conn->prev = NULL;
+    if (srv->conns) srv->conns->prev = conn;
+    srv->conns = conn;
+    return conn;
+}
+
+/**
+ * Close a connection and release everything it references.
+ */
+static void
+mp_conn_close(mp_server *srv, mp_conn *conn) {
+    if (conn->prev) conn->prev->next = conn->next;
+    else srv->conns = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+
+    for (mp_out *out = conn->ohead, *next; out; out = next) {
+        next = out->next;
+        mp_out_free(out);
+    }
+
+    if (conn->upload) mp_pool_ret(conn->stage->matx.pool, conn->upload);
+    if (conn->stage) mp_entry_unref(conn->stage);
+    free(conn->body);
+
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn);
+}
+
+/**
+ * Alternate between flushing output and parsing input.
+ *
+ * Input is paused while SERVER_PIPELINE responses are queued; the
+ * next EPOLLOUT edge resumes it.
+ */
+static int32_t
+mp_conn_serve(mp_server *srv, mp_conn *conn) {
+    int32_t ret;
+
+    do {
+        if (mp_conn_flush(conn) == MP_XFER_ERROR) return -1;
+        if (conn->nout >= SERVER_PIPELINE) return 0;
+
+        ret = mp_conn_input(srv, conn);
+        if (ret == MP_XFER_ERROR) return -1;
+    } while (ret == MP_XFER_DONE);
+
+    return mp_conn_flush(conn) == MP_XFER_ERROR ? -1 : 0;
+}
+
+/**
+ * Accept all pending connections of a listener.
+ */
+static void
+mp_server_accept(mp_server *srv, const mp_conn *lst) {
+    while (1) {
+        const int32_t fd = accept4(lst->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) return; /* EAGAIN or transient error */
+
+        const int32_t one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (!mp_conn_open(srv, fd, 0)) close(fd);
+    }
+}
+
+
+/* ============================================================================
+ *  Server lifecycle
+ * ============================================================================
+ */
+
+/**
+ * Initialize a server on top of a pool and register built-in kernels.
+ */
+int32_t
+mp_server_init(mp_server *srv, mp_pool *pool) {
+    srv->pool = pool;
+    srv->stop = 0;
+    srv->stats = NULL;
+    srv->conns = NULL;
+    srv->nkern = 0;
+
+    for (uint32_t i = 0; i < SERVER_BUCKETS; i++) srv->table[i] = NULL;
+
+    srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (srv->epfd == -1) return -1;
+
+    mp_server_kernel(srv, "fill", mp_kernel_fill);
+    mp_server_kernel(srv, "scale", mp_kernel_scale);
+    mp_server_kernel(srv, "add", mp_kernel_add);
+    return 0;
+}
+
+/**
+ * Close all connections and free all resident matrices.
+ */
+void
+mp_server_free(mp_server *srv) {
+    while (srv->conns) mp_conn_close(srv, srv->conns);
+
+    for (uint32_t i = 0; i < SERVER_BUCKETS; i++) {
+        for (mp_entry *entry = srv->table[i], *next; entry; entry = next) {
+            next = entry->next;
+            mp_entry_unref(entry);
+        }
+        srv->table[i] = NULL;
+    }
+
+    close(srv->epfd);
+}
+
+/**
+ * Register a listening socket.
+ */
+static int32_t
+mp_server_listen(mp_server *srv, const int32_t fd, const struct sockaddr *addr,
+                 const socklen_t len) {
+    if (fd == -1) return -1;
+
+    if (bind(fd, addr, len) == -1 || listen(fd, SOMAXCONN) == -1 ||
+        !mp_conn_open(srv, fd, 1)) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Listen on a TCP port (all interfaces).
+ */
+int32_t
+mp_server_listen_tcp(mp_server *srv, const uint16_t port) {
+    const int32_t fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const int32_t one = 1;
+    if (fd != -1) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in6 addr = {0};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    addr.sin6_addr = in6addr_any;
+
+    return mp_server_listen(srv, fd, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+/**
+ * Listen on a Unix stream socket, replacing a stale socket file.
+ */
+int32_t
+mp_server_listen_unix(mp_server *srv, const char *path) {
+    struct sockaddr_un addr = {0};
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    const int32_t fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    return mp_server_listen(srv, fd, (struct sockaddr *) &addr, sizeof(addr));
+}
+
+/**
+ * Register a kernel callable through MP_OP_KERNEL.
+ */
+int32_t
+mp_server_kernel(mp_server *srv, const char *name, const mp_kernel fn) {
+    if (srv->nkern == SERVER_KERNELS) return -1;
+
+    srv->kern[srv->nkern].name = name;
+    srv->kern[srv->nkern].fn = fn;
+    srv->nkern += 1;
+    return 0;
+}
+
+/**
+ * Publish live statistics.
+ */
+void
+mp_server_stats(mp_server *srv, mp_stats *stats) {
+    srv->stats = stats;
+}
+
+/**
+ * Write an update of the statistics page if one is due.
+ */
+static void
+mp_server_publish(const mp_server *srv) {
+    mp_stats *st = srv->stats;
+    if (!st || !mp_stats_due(st)) return;
+
+    mp_stats_begin(st, srv->pool);
+    for (uint32_t i = 0; i < SERVER_BUCKETS; i++)
+        for (const mp_entry *entry = srv->table[i]; entry; entry = entry->next)
+            mp_stats_add(st, entry->name, &entry->matx);
+    mp_stats_end(st);
+}
+
+/**
+ * Serve requests until srv->stop is set.
+ */
+int32_t
+mp_server_run(mp_server *srv) {
+    struct epoll_event ev[256];
+
+    while (!srv->stop) {
+        const int32_t wait = srv->stats && srv->stats->ms < 1000 ? (int32_t) srv->stats->ms : 1000;
+        const int32_t n = epoll_wait(srv->epfd, ev, 256, wait);
+        mp_server_publish(srv);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        for (int32_t i = 0; i < n; i++) {
+            mp_conn *conn = ev[i].data.ptr;
+
+            if (conn->listen) {
+                mp_server_accept(srv, conn);
+                continue;
+            }
+
+            if (mp_conn_serve(srv, conn) < 0 || (ev[i].events & EPOLLERR))
+                mp_conn_close(srv, conn);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_server.h
+ *  Description:  Matrix Manipulation Protocol server.
+ *
+ *  Responsibilities:
+ *    - Hold named matrices resident in a shared mp_pool
+ *    - Serve the MMP request/response protocol (see mp_proto.h)
+ *      over TCP and Unix stream sockets
+ *    - Run registered kernels on resident matrices
+ *    - Optionally publish live statistics (see mp_stats.h)
+ *
+ *  Concurrency model:
+ *    - Single thread, edge-triggered epoll
+ *    - Every connection is an input state machine plus an output queue;
+ *      chunk payloads are moved with resumable mp_xfer transfers
+ *    - Requests are pipelined: input keeps being parsed while earlier
+ *      responses are still queued, up to SERVER_PIPELINE responses
+ *
+ *  Notes:
+ *    - Chunk payloads of GET_CHUNK / SEND_MATRIX are copied when the
+ *      response is queued: later requests of the pipeline never change
+ *      a response, at the cost of holding the copies until it is sent
+ *    - PUT_CHUNK receives into a private chunk that replaces the
+ *      resident one only once the payload is complete
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_SERVER_H
+#define QDEEP_MATRIXP_SERVER_H
+
+#include "mp_matrix.h"
+#include "mp_pool.h"
+#include "mp_proto.h"
+#include "mp_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Hash buckets of the matrix name table */
+#define SERVER_BUCKETS 256
+
+/** Maximum number of registered kernels */
+#define SERVER_KERNELS 32
+
+/** Maximum number of source operands of a kernel */
+#define SERVER_KERNEL_ARGS 8
+
+/** Queued responses per connection before input is paused */
+#define SERVER_PIPELINE 256
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Kernel callback.
+ *
+ * @param dst  Target matrix (request name).
+ * @param src  Source matrices named in the request body.
+ * @param n    Number of sources.
+ * @param arg  Request operand b.
+ *
+ * @return 0 on success, negative errno on failure
+ */
+typedef int32_t (*mp_kernel)(mp_matrix *dst, mp_matrix *const *src, uint32_t n, int64_t arg);
+
+/**
+ * Named resident matrix.
+ */
+typedef struct mp_entry {
+    struct mp_entry *next; /**< Hash chain */
+    uint32_t refs;         /**< Table reference + chunk uploads in progress */
+    mp_matrix matx;
+    char name[256];
+} mp_entry;
+
+/**
+ * Server state.
+ */
+typedef struct mp_server {
+    mp_pool *pool;  /**< Pool shared by all resident matrices */
+    int32_t epfd;   /**< epoll instance */
+    volatile int32_t stop; /**< Set to leave mp_server_run() */
+    mp_stats *stats;       /**< Live statistics page or NULL */
+
+    mp_entry *table[SERVER_BUCKETS]; /**< Name -> matrix */
+    struct mp_conn *conns;           /**< Open connections and listeners */
+
+    struct {
+        const char *name;
+        mp_kernel fn;
+    } kern[SERVER_KERNELS];
+    uint32_t nkern;
+} mp_server;
+
+
+/* ============================================================================
+ *  Lifecycle
+ * ============================================================================
+ */
+
+/**
+ * Initialize a server on top of a pool and register built-in kernels
+ * ("fill", "scale", "add").
+ *
+ * @return  0 on success
+ * @return -1 if the epoll instance could not be created
+ */
+int32_t
+mp_server_init(mp_server *srv, mp_pool *pool);
+
+/**
+ * Close all connections and free all resident matrices.
+ */
+void
+mp_server_free(mp_server *srv);
+
+/**
+ * Listen on a TCP port (all interfaces).
+ *
+ * @return  0 on success
+ * @return -1 on socket / bind / listen failure
+ */
+int32_t
+mp_server_listen_tcp(mp_server *srv, uint16_t port);
+
+/**
+ * Listen on a Unix stream socket, replacing a stale socket file.
+ *
+ * @return  0 on success
+ * @return -1 on socket / bind / listen failure
+ */
+int32_t
+mp_server_listen_unix(mp_server *srv, const char *path);
+
+/**
+ * Register a kernel callable through MP_OP_KERNEL.
+ *
+ * @return  0 on success
+ * @return -1 if the kernel table is full
+ */
+int32_t
+mp_server_kernel(mp_server *srv, const char *name, mp_kernel fn);
+
+/**
+ * Publish pool, matrix and transfer counters to stats every stats->ms
+ * from the event loop (NULL stops publishing).
+ */
+void
+mp_server_stats(mp_server *srv, mp_stats *stats);
+
+/**
+ * Serve requests until srv->stop is set.
+ *
+ * @return  0 on clean shutdown
+ * @return -1 on epoll failure
+ */
+int32_t
+mp_server_run(mp_server *srv);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_SERVER_H */
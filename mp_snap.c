@@ -0,0 +1,212 @@
+#include "mp_snap.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mp_cold.h"
+#include "mp_file.h"
+
+
+/** Source of globally unique snapshot epochs (0 = never saved) */
+static uint32_t snap_epoch;
+
+
+/* ============================================================================
+ *  Internal helpers
+ * ============================================================================
+ */
+
+/**
+ * Find the frozen index of opos.
+ *
+ * Returns:
+ *   Index, or -1 if opos was not part of the frozen set
+ */
+static int64_t
+mp_snap_find(const mp_snap *snap, const mp_copos opos) {
+    uint64_t lo = 0, hi = snap->count;
+
+    while (lo < hi) {
+        const uint64_t mid = lo + ((hi - lo) >> 1);
+        if (snap->opos[mid].pos < opos.pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < snap->count && snap->opos[lo].pos == opos.pos ? (int64_t) lo : -1;
+}
+
+/**
+ * Release the frozen set.
+ */
+static void
+mp_snap_release(mp_snap *snap) {
+    free(snap->opos);
+    free(snap->chunk);
+    free(snap->copy);
+    free(snap->state);
+
+    snap->opos = NULL;
+    snap->chunk = NULL;
+    snap->copy = NULL;
+    snap->state = NULL;
+}
+
+
+/* ============================================================================
+ *  Writer
+ * ============================================================================
+ */
+
+/**
+ * Writer thread: store every frozen chunk, from its copy or live buffer.
+ */
+static void *
+mp_snap_writer(void *arg) {
+    mp_snap *snap = arg;
+
+    for (uint64_t i = 0; i < snap->count && !snap->error; i++) {
+        pthread_mutex_lock(&snap->lock);
+        const uint8_t state = snap->state[i];
+        const uint8_t live = state == SNAP_PENDING;
+        const int64_t *data = live ? snap->chunk[i]->data :
+                              state == SNAP_COPIED ? snap->copy[i]->data : NULL;
+        if (live) snap->state[i] = SNAP_WRITING;
+        pthread_mutex_unlock(&snap->lock);
+
+        /* owner blocks on this chunk only while it is SNAP_WRITING */
+        if (data && mp_file_tile_write(snap->fd, snap->size, snap->opos[i], data) < 0)
+            snap->error = 1;
+
+        pthread_mutex_lock(&snap->lock);
+        if (live) __atomic_store_n(&snap->chunk[i]->epoch, snap->epoch, __ATOMIC_RELEASE);
+        snap->state[i] = SNAP_SAVED;
+        pthread_cond_broadcast(&snap->cond);
+        pthread_mutex_unlock(&snap->lock);
+
+        __atomic_store_n(&snap->written, i + 1, __ATOMIC_RELAXED);
+    }
+
+    if (!snap->error && fdatasync(snap->fd) == -1) snap->error = 1;
+
+    __atomic_store_n(&snap->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Freeze the current version of matx and start writing it to path.
+ */
+int32_t
+mp_snap_start(mp_snap *snap, mp_matrix *matx, const char *path) {
+    if (!snap || !matx || !path || matx->snap) return -1;
+    if (matx->cold && mp_cold_thaw(matx->cold) < 0) return -1;
+
+    snap->matx = matx;
+    snap->size = matx->size;
+    snap->count = matx->tree.count;
+    snap->written = 0;
+    snap->done = 0;
+    snap->error = 0;
+
+    snap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (snap->fd == -1) return -1;
+    if (mp_file_resize(snap->fd, snap->size) < 0) goto error;
+
+    const uint64_t n = snap->count ? snap->count : 1;
+    snap->opos = malloc(n * sizeof(mp_copos));
+    snap->chunk = malloc(n * sizeof(mp_chunk *));
+    snap->copy = calloc(n, sizeof(mp_chunk *));
+    snap->state = calloc(n, sizeof(uint8_t));
+    if (!snap->opos || !snap->chunk || !snap->copy || !snap->state) goto error;
+
+    /* ---- freeze: metadata only ---- */
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    uint64_t i = 0;
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter)); i++) {
+        snap->opos[i] = chunk->opos;
+        snap->chunk[i] = chunk;
+    }
+
+    snap->epoch = __atomic_add_fetch(&snap_epoch, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_init(&snap->lock, NULL);
+    pthread_cond_init(&snap->cond, NULL);
+
+    matx->snap = snap;
+    if (pthread_create(&snap->thread, NULL, mp_snap_writer, snap) != 0) {
+        matx->snap = NULL;
+        pthread_cond_destroy(&snap->cond);
+        pthread_mutex_destroy(&snap->lock);
+        goto error;
+    }
+    return 0;
+
+error:
+    mp_snap_release(snap);
+    close(snap->fd);
+    snap->fd = -1;
+    return -1;
+}
+
+/**
+ * Save a chunk before it is modified.
+ */
+void
+mp_snap_preserve(mp_snap *snap, mp_chunk *chunk) {
+    /* fast path: already saved in (or created during) this snapshot */
+    if (__atomic_load_n(&chunk->epoch, __ATOMIC_ACQUIRE) == snap->epoch) return;
+
+    pthread_mutex_lock(&snap->lock);
+
+    /* a finished (or failed) writer needs nothing more */
+    const int64_t i = mp_snap_done(snap) ? -1 : mp_snap_find(snap, chunk->opos);
+    if (i != -1 && snap->chunk[i] == chunk) {
+        while (snap->state[i] == SNAP_WRITING) pthread_cond_wait(&snap->cond, &snap->lock);
+
+        if (snap->state[i] == SNAP_PENDING) {
+            mp_chunk *copy = mp_pool_get(snap->matx->pool);
+
+            if (copy) {
+                __builtin_memcpy(copy->data, chunk->data, CHUNK_BYTES);
+                copy->opos = chunk->opos;
+                copy->size = chunk->size;
+                snap->copy[i] = copy;
+                snap->state[i] = SNAP_COPIED;
+            } else {
+                /* pool exhausted: write it synchronously instead */
+                if (mp_file_tile_write(snap->fd, snap->size, chunk->opos, chunk->data) < 0)
+                    snap->error = 1;
+                snap->state[i] = SNAP_SAVED;
+            }
+        }
+    }
+
+    __atomic_store_n(&chunk->epoch, snap->epoch, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&snap->lock);
+}
+
+/**
+ * Wait for the writer, detach the snapshot and release its copies.
+ */
+int32_t
+mp_snap_wait(mp_snap *snap) {
+    pthread_join(snap->thread, NULL);
+    snap->matx->snap = NULL;
+
+    for (uint64_t i = 0; i < snap->count; i++)
+        if (snap->copy[i]) mp_pool_ret(snap->matx->pool, snap->copy[i]);
+
+    pthread_cond_destroy(&snap->cond);
+    pthread_mutex_destroy(&snap->lock);
+    mp_snap_release(snap);
+
+    if (close(snap->fd) == -1) snap->error = 1;
+    snap->fd = -1;
+    return snap->error ? -1 : 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_snap.h
+ *  Description:  Background consistent snapshots of a live matrix.
+ *
+ *  mp_snap_start() freezes the chunk set of a matrix (metadata only) and
+ *  a writer thread stores the frozen version to a tiled file while the
+ *  owner keeps updating the matrix:
+ *
+ *      owner thread                         writer thread
+ *      ────────────                         ─────────────
+ *      touch(chunk)                         for each frozen chunk:
+ *        pending  → copy into pool chunk      copied  → write the copy
+ *        writing  → wait for that chunk       pending → write live data
+ *        saved    → nothing
+ *
+ *  Design goals:
+ *   - The owner never waits for more than one in-flight chunk write
+ *   - Copy-on-write only for chunks modified before they were saved,
+ *     copies come from the matrix pool
+ *   - Unmodified chunks are written straight from their live buffers
+ *   - O(1) fast path for saved chunks: a per-chunk epoch compare
+ *
+ *  Notes:
+ *   - Every modification of the matrix during a snapshot must go
+ *     through mp_matrix_chunk_write() / mp_matrix_chunk_touch(),
+ *     mp_matrix_put() or the chunk drop / insert functions
+ *   - The pool is only used by the owner thread (copies are allocated
+ *     in touch and returned in mp_snap_wait())
+ *   - The matrix must not be resized or freed during a snapshot
+ *   - One snapshot per matrix at a time
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_SNAP_H
+#define QDEEP_MATRIXP_SNAP_H
+
+#include <pthread.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/** Per-chunk snapshot states */
+#define SNAP_PENDING 0 /**< Not saved, live buffer unchanged */
+#define SNAP_COPIED  1 /**< Preserved in a copy, not written yet */
+#define SNAP_WRITING 2 /**< Live buffer is being written */
+#define SNAP_SAVED   3 /**< Written to the file */
+
+/**
+ * Snapshot in progress.
+ */
+typedef struct mp_snap {
+    mp_matrix *matx;       /**< Snapshotted matrix */
+    mp_msize size;         /**< Frozen matrix size */
+    int32_t fd;            /**< Tiled output file */
+    uint32_t epoch;        /**< Globally unique snapshot epoch */
+
+    pthread_t thread;      /**< Writer */
+    pthread_mutex_t lock;  /**< Guards state / copy */
+    pthread_cond_t cond;   /**< Signalled when a chunk leaves SNAP_WRITING */
+
+    /* --------------------------------------------------------------------
+     * Frozen chunk set (opos ascending)
+     * ------------------------------------------------------------------ */
+
+    uint64_t count;        /**< Frozen chunks */
+    mp_copos *opos;        /**< Offsets at freeze time */
+    mp_chunk **chunk;      /**< Live descriptors at freeze time */
+    mp_chunk **copy;       /**< Copy-on-write copies (NULL if none) */
+    uint8_t *state;        /**< SNAP_* per chunk */
+
+    volatile uint64_t written; /**< Chunks written so far (progress) */
+    volatile int32_t done;     /**< Writer finished */
+    volatile int32_t error;    /**< Write failure */
+} mp_snap;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Freeze the current version of matx and start writing it to path.
+ *
+ * The output is a tiled matrix file (see mp_file.h) that can be opened
+ * with mp_matrix_set_file_mode() or mp_matrix_map_file().
+ *
+ * @return  0 on success
+ * @return -1 on open / allocation / thread failure or if matx already
+ *          has a snapshot running
+ */
+int32_t
+mp_snap_start(mp_snap *snap, mp_matrix *matx, const char *path);
+
+/**
+ * Save a chunk before it is modified (called from the matrix write paths).
+ *
+ * Must be called by the owner thread.
+ */
+void
+mp_snap_preserve(mp_snap *snap, mp_chunk *chunk);
+
+/**
+ * Check whether the writer has finished (non-blocking).
+ */
+static __inline__ int32_t
+mp_snap_done(const mp_snap *snap) {
+    return __atomic_load_n(&snap->done, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Wait for the writer, detach the snapshot and release its copies.
+ *
+ * @return  0 if the snapshot was written and synced
+ * @return -1 on write failure
+ */
+int32_t
+mp_snap_wait(mp_snap *snap);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_SNAP_H */
@@ -0,0 +1,362 @@
+#include "mp_splice.h"
+#include "mp_hist.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* ============================================================================
+ *  Internal state
+ * ============================================================================
+ */
+
+/** Idle pipes, used as a stack */
+static struct {
+    pthread_mutex_t lock;
+    int32_t fd[SPLICE_POOL][2];
+    uint32_t size[SPLICE_POOL];
+    uint32_t count;
+} splice_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/** Pipe size to request; lowered when the user quota refuses it */
+static uint32_t splice_target;
+static pthread_once_t splice_once = PTHREAD_ONCE_INIT;
+
+/** Per-path counters, updated with relaxed atomics */
+static mp_splice_stat splice_stat[MP_SPLICE_PATHS];
+
+/** Step result: path refused the descriptors, try the pipe path */
+#define SPLICE_REFUSED 1
+
+
+/* ============================================================================
+ *  Helpers
+ * ============================================================================
+ */
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static uint64_t
+mp_splice_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Add one copy segment to the counters of a path.
+ */
+static void
+mp_splice_account(const uint32_t path, const uint64_t bytes,
+                  const uint64_t nsec, const uint64_t syscalls) {
+    mp_splice_stat *stat = &splice_stat[path];
+
+    __atomic_fetch_add(&stat->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->nsec, nsec, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stat->syscalls, syscalls, __ATOMIC_RELAXED);
+}
+
+/**
+ * Read the system pipe size limit once.
+ */
+static void
+mp_splice_limit(void) {
+    uint32_t max = 1u << 20; /* kernel default of pipe-max-size */
+
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "re");
+    if (f) {
+        uint32_t val;
+        if (fscanf(f, "%u", &val) == 1 && val >= SPLICE_MIN_PIPE) max = val;
+        fclose(f);
+    }
+
+    splice_target = max;
+}
+
+/**
+ * Grow a fresh pipe as far as the system and user quota allow.
+ *
+ * Unprivileged users are limited by pipe-user-pages-soft, so an EPERM
+ * halves the target; the reduced value is remembered for later pipes.
+ *
+ * Returns:
+ *   Resulting pipe capacity in bytes
+ */
+static uint32_t
+mp_splice_grow(const int32_t fd) {
+    pthread_once(&splice_once, mp_splice_limit);
+
+    uint32_t want = __atomic_load_n(&splice_target, __ATOMIC_RELAXED);
+    while (want > SPLICE_MIN_PIPE && fcntl(fd, F_SETPIPE_SZ, want) == -1) {
+        if (errno != EPERM && errno != EBUSY) break;
+        want >>= 1;
+        __atomic_store_n(&splice_target, want, __ATOMIC_RELAXED);
+    }
+
+    const int32_t size = fcntl(fd, F_GETPIPE_SZ);
+    return size > 0 ? (uint32_t) size : SPLICE_MIN_PIPE;
+}
+
+
+/* ============================================================================
+ *  Pipe pool
+ * ============================================================================
+ */
+
+/**
+ * Take a pipe from the pool (or create and grow a new one).
+ */
+uint32_t
+mp_splice_pipe_get(int32_t pipefd[2]) {
+    pthread_mutex_lock(&splice_pool.lock);
+    if (splice_pool.count > 0) {
+        const uint32_t i = --splice_pool.count;
+        pipefd[0] = splice_pool.fd[i][0];
+        pipefd[1] = splice_pool.fd[i][1];
+        const uint32_t size = splice_pool.size[i];
+        pthread_mutex_unlock(&splice_pool.lock);
+        return size;
+    }
+    pthread_mutex_unlock(&splice_pool.lock);
+
+    if (pipe2(pipefd, O_CLOEXEC) == -1) return 0;
+    return mp_splice_grow(pipefd[1]);
+}
+
+/**
+ * Return a pipe to the pool.
+ */
+void
+mp_splice_pipe_put(const int32_t pipefd[2], const uint32_t size, const uint8_t dirty) {
+    if (!dirty) {
+        pthread_mutex_lock(&splice_pool.lock);
+        if (splice_pool.count < SPLICE_POOL) {
+            const uint32_t i = splice_pool.count++;
+            splice_pool.fd[i][0] = pipefd[0];
+            splice_pool.fd[i][1] = pipefd[1];
+            splice_pool.size[i] = size;
+            pthread_mutex_unlock(&splice_pool.lock);
+            return;
+        }
+        pthread_mutex_unlock(&splice_pool.lock);
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+/**
+ * Close all pooled pipes.
+ */
+void
+mp_splice_cleanup(void) {
+    pthread_mutex_lock(&splice_pool.lock);
+    while (splice_pool.count > 0) {
+        const uint32_t i = --splice_pool.count;
+        close(splice_pool.fd[i][0]);
+        close(splice_pool.fd[i][1]);
+    }
+    pthread_mutex_unlock(&splice_pool.lock);
+}
+
+/**
+ * Snapshot the counters of a path.
+ */
+void
+mp_splice_stats(const uint32_t path, mp_splice_stat *stat) {
+    const mp_splice_stat *src = &splice_stat[path < MP_SPLICE_PATHS ? path : 0];
+
+    stat->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+    stat->nsec = __atomic_load_n(&src->nsec, __ATOMIC_RELAXED);
+    stat->calls = __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+    stat->syscalls = __atomic_load_n(&src->syscalls, __ATOMIC_RELAXED);
+}
+
+
+/* ============================================================================
+ *  Copy paths
+ * ============================================================================
+ *
+ * Each path moves as much of *remain as it can and decrements it.
+ * Offsets are advanced in place so a refused fast path can hand the
+ * rest over to the pipe path.
+ *
+ * Returns:
+ *   0               all bytes moved
+ *   SPLICE_REFUSED  the kernel does not support this path for the pair
+ *  -1               I/O error or premature EOF
+ */
+
+/**
+ * errno values meaning "this path does not apply", not "I/O failed".
+ */
+static uint8_t
+mp_splice_refused(const int32_t err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS ||
+           err == EOPNOTSUPP || err == EBADF;
+}
+
+/**
+ * file -> file via copy_file_range().
+ */
+static int32_t
+mp_splice_copy_range(const int32_t fd_f, loff_t *pos_f, const int32_t fd_t, loff_t *pos_t,
+                     uint64_t *remain, uint64_t *syscalls) {
+    while (*remain > 0) {
+        const uint64_t want = *remain > SPLICE_MAX_CALL ? SPLICE_MAX_CALL : *remain;
+        const int64_t n = copy_file_range(fd_f, *pos_f < 0 ? NULL : pos_f,
+                                          fd_t, *pos_t < 0 ? NULL : pos_t, want, 0);
+        *syscalls += 1;
+
+        if (__builtin_expect(n <= 0, 0)) {
+            if (n == 0) return -1; /* premature EOF */
+            if (errno == EINTR) continue;
+            return mp_splice_refused(errno) ? SPLICE_REFUSED : -1;
+        }
+
+        *remain -= (uint64_t) n;
+    }
+    return 0;
+}
+
+/**
+ * file -> stream via sendfile().
+ */
+static int32_t
+mp_splice_sendfile(const int32_t fd_f, loff_t *pos_f, const int32_t fd_t,
+                   uint64_t *remain, uint64_t *syscalls) {
+    while (*remain > 0) {
+        const uint64_t want = *remain > SPLICE_MAX_CALL ? SPLICE_MAX_CALL : *remain;
+        off_t pos = *pos_f;
+        const int64_t n = sendfile(fd_t, fd_f, *pos_f < 0 ? NULL : &pos, want);
+        *syscalls += 1;
+
+        if (__builtin_expect(n <= 0, 0)) {
+            if (n == 0) return -1; /* premature EOF */
+            if (errno == EINTR || errno == EAGAIN) continue;
+            return mp_splice_refused(errno) ? SPLICE_REFUSED : -1;
+        }
+
+        if (*pos_f >= 0) *pos_f = pos;
+        *remain -= (uint64_t) n;
+    }
+    return 0;
+}
+
+/**
+ * Anything -> anything via splice() through a pooled pipe.
+ *
+ * Every round fills the pipe up to its capacity (or what the source
+ * has available) and drains it completely.
+ */
+static int32_t
+mp_splice_pipe(const int32_t fd_f, loff_t *pos_f, const int32_t fd_t, loff_t *pos_t,
+               uint64_t *remain, uint64_t *syscalls) {
+    int32_t pipefd[2];
+    const uint32_t cap = mp_splice_pipe_get(pipefd);
+    if (!cap) return -1;
+
+    while (*remain > 0) {
+        const uint64_t want = *remain > cap ? cap : *remain;
+        const uint32_t flags = SPLICE_F_MOVE | (*remain > want ? SPLICE_F_MORE : 0);
+
+        /* ---- fd_f -> pipe ---- */
+        int64_t n;
+        do {
+            n = splice(fd_f, *pos_f < 0 ? NULL : pos_f, pipefd[1], NULL, want, flags);
+            *syscalls += 1;
+        } while (n == -1 && (errno == EINTR || errno == EAGAIN));
+
+        if (n <= 0) goto error;
+
+        /* ---- pipe -> fd_t ---- */
+        while (n > 0) {
+            int64_t m;
+            do {
+                m = splice(pipefd[0], NULL, fd_t, *pos_t < 0 ? NULL : pos_t, n, flags);
+                *syscalls += 1;
+            } while (m == -1 && (errno == EINTR || errno == EAGAIN));
+
+            if (m <= 0) goto error;
+
+            n -= m;
+            *remain -= (uint64_t) m;
+        }
+    }
+
+    mp_splice_pipe_put(pipefd, cap, 0);
+    return 0;
+
+error:
+    mp_splice_pipe_put(pipefd, cap, 1);
+    return -1;
+}
+
+
+/* ============================================================================
+ *  Copy
+ * ============================================================================
+ */
+
+/**
+ * Path mp_splice_copy() will try first for this descriptor pair.
+ */
+uint32_t
+mp_splice_path(const int32_t fd_f, const loff_t pos_f, const int32_t fd_t, const loff_t pos_t) {
+    (void) pos_f;
+    struct stat st_f, st_t;
+
+    if (fstat(fd_f, &st_f) == -1 || !S_ISREG(st_f.st_mode)) return MP_SPLICE_PIPE;
+    if (fstat(fd_t, &st_t) == -1) return MP_SPLICE_PIPE;
+
+    if (S_ISREG(st_t.st_mode)) return MP_SPLICE_COPY_RANGE;
+    if (pos_t < 0) return MP_SPLICE_SENDFILE;
+    return MP_SPLICE_PIPE;
+}
+
+/**
+ * Copy exactly bytes from fd_f to fd_t without user-space buffers.
+ */
+int32_t
+mp_splice_copy(const int32_t fd_f, loff_t pos_f, const int32_t fd_t, loff_t pos_t,
+               const uint64_t bytes) {
+    if (bytes == 0) return 0;
+
+    MP_HIST_BEGIN(begin);
+    uint32_t path = mp_splice_path(fd_f, pos_f, fd_t, pos_t);
+    uint64_t remain = bytes;
+
+    for (;;) {
+        const uint64_t start = mp_splice_now();
+        const uint64_t before = remain;
+        uint64_t syscalls = 0;
+        int32_t ret;
+
+        switch (path) {
+            case MP_SPLICE_COPY_RANGE:
+                ret = mp_splice_copy_range(fd_f, &pos_f, fd_t, &pos_t, &remain, &syscalls);
+                break;
+            case MP_SPLICE_SENDFILE:
+                ret = mp_splice_sendfile(fd_f, &pos_f, fd_t, &remain, &syscalls);
+                break;
+            default:
+                ret = mp_splice_pipe(fd_f, &pos_f, fd_t, &pos_t, &remain, &syscalls);
+                break;
+        }
+
+        mp_splice_account(path, before - remain, mp_splice_now() - start, syscalls);
+
+        if (ret != SPLICE_REFUSED || path == MP_SPLICE_PIPE) {
+            MP_HIST_END(begin, MP_HIST_SPLICE);
+            return ret == 0 ? 0 : -1;
+        }
+        path = MP_SPLICE_PIPE;
+    }
+}
@@ -0,0 +1,153 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_splice.h
+ *  Description:  Kernel-side copy engine for bulk matrix payloads.
+ *
+ *  Picks the cheapest in-kernel path for a descriptor pair:
+ *
+ *      file   -> file     copy_file_range()  (may reflink / server-side copy)
+ *      file   -> stream   sendfile()
+ *      other             splice() through a pipe
+ *
+ *  Responsibilities:
+ *    - Pool of reusable pipes grown with F_SETPIPE_SZ up to the
+ *      system limit (/proc/sys/fs/pipe-max-size)
+ *    - Move a full pipe (not CHUNK_BYTES) per splice() pair
+ *    - Fall back to the pipe path if a fast path is refused
+ *    - Per-path byte / time / syscall accounting for throughput reports
+ *
+ *  Notes:
+ *    - Offsets of -1 use and advance the descriptor's file position
+ *    - All functions are thread-safe
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_SPLICE_H
+#define QDEEP_MATRIXP_SPLICE_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Number of idle pipes kept for reuse */
+#define SPLICE_POOL 8
+
+/** Smallest pipe size accepted while growing (Linux default) */
+#define SPLICE_MIN_PIPE (64u << 10)
+
+/** Upper bound for a single copy_file_range() / sendfile() call */
+#define SPLICE_MAX_CALL (1u << 30)
+
+/** Copy paths */
+#define MP_SPLICE_PIPE       0
+#define MP_SPLICE_COPY_RANGE 1
+#define MP_SPLICE_SENDFILE   2
+#define MP_SPLICE_PATHS      3
+
+
+/* ============================================================================
+ *  Statistics
+ * ============================================================================
+ */
+
+/**
+ * Accumulated counters of one copy path.
+ */
+typedef struct mp_splice_stat {
+    uint64_t bytes;    /**< Bytes delivered */
+    uint64_t nsec;     /**< Wall time spent inside mp_splice_copy() */
+    uint64_t calls;    /**< mp_splice_copy() invocations */
+    uint64_t syscalls; /**< Data-moving syscalls issued */
+} mp_splice_stat;
+
+/**
+ * Snapshot the counters of a path.
+ */
+void
+mp_splice_stats(uint32_t path, mp_splice_stat *stat);
+
+/**
+ * Measured throughput of a path in bytes per second (0 if unused).
+ */
+static __inline__ double
+mp_splice_rate(uint32_t path) {
+    mp_splice_stat stat;
+    mp_splice_stats(path, &stat);
+    return stat.nsec ? (double) stat.bytes * 1e9 / (double) stat.nsec : 0.0;
+}
+
+
+/* ============================================================================
+ *  Pipe pool
+ * ============================================================================
+ */
+
+/**
+ * Take a pipe from the pool (or create and grow a new one).
+ *
+ * @param pipefd  Receives [read end, write end].
+ *
+ * @return Pipe capacity in bytes, or 0 on failure
+ */
+uint32_t
+mp_splice_pipe_get(int32_t pipefd[2]);
+
+/**
+ * Return a pipe to the pool.
+ *
+ * The pipe must be empty; pipes with leftover data (aborted transfers)
+ * must be passed with dirty set so they are closed instead.
+ */
+void
+mp_splice_pipe_put(const int32_t pipefd[2], uint32_t size, uint8_t dirty);
+
+/**
+ * Close all pooled pipes.
+ */
+void
+mp_splice_cleanup(void);
+
+
+/* ============================================================================
+ *  Copy
+ * ============================================================================
+ */
+
+/**
+ * Path mp_splice_copy() will try first for this descriptor pair.
+ */
+uint32_t
+mp_splice_path(int32_t fd_f, loff_t pos_f, int32_t fd_t, loff_t pos_t);
+
+/**
+ * Copy exactly bytes from fd_f to fd_t without user-space buffers.
+ *
+ * @param pos_f  Source offset, or -1 to use the file position.
+ * @param pos_t  Destination offset, or -1 to use the file position.
+ *
+ * @return  0 on success
+ * @return -1 on premature EOF or failure
+ */
+int32_t
+mp_splice_copy(int32_t fd_f, loff_t pos_f, int32_t fd_t, loff_t pos_t, uint64_t bytes);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_SPLICE_H */
@@ -0,0 +1,492 @@
+#include "mp_stage.h"
+
+#include <stdlib.h>
+
+
+/* ============================================================================
+ *  Producer side
+ * ============================================================================
+ */
+
+/**
+ * Index slot of a chunk offset.
+ */
+static __inline__ uint32_t
+mp_stage_hash(const mp_copos opos, const uint32_t cap) {
+    return (uint32_t) ((opos.pos * 0x9E3779B97F4A7C15ull) >> 32) & (cap - 1);
+}
+
+/**
+ * Double the hash index of a worker.
+ */
+static int32_t
+mp_stage_rehash(mp_stage_local *local) {
+    const uint32_t cap = local->cmap << 1;
+    mp_chunk **map = calloc(cap, sizeof(mp_chunk *));
+    if (!map) return -1;
+
+    for (uint32_t i = 0; i < local->cmap; i++) {
+        mp_chunk *chunk = local->map[i];
+        if (!chunk) continue;
+
+        uint32_t h = mp_stage_hash(chunk->opos, cap);
+        while (map[h]) h = (h + 1) & (cap - 1);
+        map[h] = chunk;
+    }
+
+    free(local->map);
+    local->map = map;
+    local->cmap = cap;
+    return 0;
+}
+
+/**
+ * Hand out a pool chunk, refilling the worker cache under the lock.
+ */
+static mp_chunk *
+mp_stage_alloc(mp_stage *stage, mp_stage_local *local) {
+    if (local->ncache == 0) {
+        pthread_mutex_lock(&stage->lock);
+        while (local->ncache < STAGE_BATCH) {
+            mp_chunk *chunk = mp_pool_get(stage->matx->pool);
+            if (!chunk) break;
+            local->cache[local->ncache++] = chunk;
+        }
+        pthread_mutex_unlock(&stage->lock);
+
+        if (local->ncache == 0) return NULL;
+    }
+    return local->cache[--local->ncache];
+}
+
+/**
+ * Return every staged chunk of a worker to the pool.
+ */
+static void
+mp_stage_drop(mp_stage *stage, mp_stage_local *local) {
+    for (uint32_t i = 0; i < local->cmap; i++) {
+        if (local->map[i]) mp_pool_ret(stage->matx->pool, local->map[i]);
+        local->map[i] = NULL;
+    }
+    local->nmap = 0;
+}
+
+
+/* ============================================================================
+ *  Merge
+ * ============================================================================
+ */
+
+/**
+ * Staged chunk and the worker that staged it.
+ */
+typedef struct mp_stage_entry {
+    mp_chunk *chunk;
+    uint32_t worker;
+} mp_stage_entry;
+
+/**
+ * Order by offset, then by worker.
+ */
+static int
+mp_stage_cmp(const void *a, const void *b) {
+    const mp_stage_entry *x = a, *y = b;
+    const int32_t c = mp_coffs_cmp(x->chunk->opos, y->chunk->opos);
+    return c ? c : (x->worker > y->worker) - (x->worker < y->worker);
+}
+
+/**
+ * d[0 .. n) += s[0 .. n), two lanes at a time (SSE2 baseline).
+ */
+static void
+mp_stage_add_row(int64_t *d, const int64_t *s, const uint32_t n) {
+    typedef int64_t v2 __attribute__((vector_size(16)));
+    uint32_t x = 0;
+
+    for (; x + 2 <= n; x += 2) {
+        v2 a, b;
+        __builtin_memcpy(&a, d + x, sizeof(a));
+        __builtin_memcpy(&b, s + x, sizeof(b));
+        a += b;
+        __builtin_memcpy(d + x, &a, sizeof(a));
+    }
+    for (; x < n; x++) d[x] += s[x];
+}
+
+#if defined(__x86_64__)
+/**
+ * d[0 .. n) += s[0 .. n), eight lanes at a time (AVX2).
+ */
+__attribute__((target("avx2")))
+static void
+mp_stage_add_row_avx2(int64_t *d, const int64_t *s, const uint32_t n) {
+    typedef int64_t v4 __attribute__((vector_size(32)));
+    uint32_t x = 0;
+
+    for (; x + 8 <= n; x += 8) {
+        v4 a0, a1, b0, b1;
+        __builtin_memcpy(&a0, d + x, sizeof(a0));
+        __builtin_memcpy(&a1, d + x + 4, sizeof(a1));
+        __builtin_memcpy(&b0, s + x, sizeof(b0));
+        __builtin_memcpy(&b1, s + x + 4, sizeof(b1));
+        a0 += b0;
+        a1 += b1;
+        __builtin_memcpy(d + x, &a0, sizeof(a0));
+        __builtin_memcpy(d + x + 4, &a1, sizeof(a1));
+    }
+    for (; x < n; x++) d[x] += s[x];
+}
+#endif
+
+static void (*stage_add_row)(int64_t *, const int64_t *, uint32_t) = mp_stage_add_row;
+static pthread_once_t stage_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Probe the CPU once.
+ */
+static void
+mp_stage_simd_init(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) stage_add_row = mp_stage_add_row_avx2;
+#endif
+}
+
+/**
+ * dst += src over the effective area (both have the same size).
+ */
+static void
+mp_stage_add(mp_chunk *dst, const mp_chunk *src) {
+    const uint32_t w = dst->size.dim.x + 1u;
+
+    for (uint32_t y = 0; y <= dst->size.dim.y; y++)
+        stage_add_row(dst->data + CHUNK_POS(0, y), src->data + CHUNK_POS(0, y), w);
+}
+
+/**
+ * Combine two staged chunks at the same offset; returns the survivor.
+ */
+static mp_chunk *
+mp_stage_combine(mp_stage *stage, mp_chunk *first, mp_chunk *later) {
+    if (stage->mode == MP_STAGE_ADD) {
+        mp_stage_add(first, later);
+        mp_pool_ret(stage->matx->pool, later);
+        return first;
+    }
+    mp_pool_ret(stage->matx->pool, first);
+    return later;
+}
+
+/**
+ * Link one merged chunk into a non-empty matrix.
+ */
+static void
+mp_stage_link(mp_stage *stage, mp_chunk *chunk) {
+    mp_matrix *matx = stage->matx;
+
+    if (stage->mode == MP_STAGE_ADD) {
+        mp_chunk *old = mp_matrix_chunk_find(matx, chunk->opos);
+        if (old) {
+            mp_matrix_chunk_touch(matx, old);
+            mp_stage_add(old, chunk);
+            mp_pool_ret(matx->pool, chunk);
+            return;
+        }
+    }
+    mp_matrix_chunk_insert(matx, chunk);
+}
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Prepare staging for `workers` producers into matx.
+ */
+int32_t
+mp_stage_init(mp_stage *stage, mp_matrix *matx, const uint32_t workers, const uint32_t mode) {
+    if (!stage || !matx || !workers || mode > MP_STAGE_ADD) return -1;
+
+    stage->matx = matx;
+    stage->mode = mode;
+    stage->workers = workers;
+
+    stage->local = aligned_alloc(64, workers * sizeof(mp_stage_local));
+    if (!stage->local) return -1;
+
+    for (uint32_t w = 0; w < workers; w++) {
+        mp_stage_local *local = &stage->local[w];
+        local->map = calloc(STAGE_MAP, sizeof(mp_chunk *));
+        local->nmap = 0;
+        local->cmap = STAGE_MAP;
+        local->ncache = 0;
+
+        if (!local->map) {
+            while (w--) free(stage->local[w].map);
+            free(stage->local);
+            stage->local = NULL;
+            return -1;
+        }
+    }
+
+    pthread_mutex_init(&stage->lock, NULL);
+    pthread_once(&stage_once, mp_stage_simd_init);
+    return 0;
+}
+
+/**
+ * Drop everything staged and release the staging area.
+ */
+void
+mp_stage_free(mp_stage *stage) {
+    if (!stage || !stage->local) return;
+
+    for (uint32_t w = 0; w < stage->workers; w++) {
+        mp_stage_local *local = &stage->local[w];
+        mp_stage_drop(stage, local);
+        while (local->ncache) mp_pool_ret(stage->matx->pool, local->cache[--local->ncache]);
+        free(local->map);
+    }
+
+    pthread_mutex_destroy(&stage->lock);
+    free(stage->local);
+    stage->local = NULL;
+}
+
+/**
+ * Find or stage the chunk at opos for worker.
+ */
+mp_chunk *
+mp_stage_take(mp_stage *stage, const uint32_t worker, const mp_copos opos) {
+    mp_stage_local *local = &stage->local[worker];
+
+    uint32_t h = mp_stage_hash(opos, local->cmap);
+    for (; local->map[h]; h = (h + 1) & (local->cmap - 1))
+        if (local->map[h]->opos.pos == opos.pos) return local->map[h];
+
+    if (!mp_matrix_contains(stage->matx, opos)) return NULL;
+
+    if ((local->nmap + 1) * 2 > local->cmap) {
+        if (mp_stage_rehash(local) < 0) return NULL;
+        h = mp_stage_hash(opos, local->cmap);
+        while (local->map[h]) h = (h + 1) & (local->cmap - 1);
+    }
+
+    mp_chunk *chunk = mp_stage_alloc(stage, local);
+    if (!chunk) return NULL;
+
+    chunk->opos = opos;
+    mp_chunk_set_size(chunk, mp_matrix_csize(stage->matx, opos));
+
+    const uint64_t row = (chunk->size.dim.x + 1) * sizeof(int64_t);
+    for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+        __builtin_memset(chunk->data + CHUNK_POS(0, y), 0, row);
+
+    local->map[h] = chunk;
+    local->nmap += 1;
+    return chunk;
+}
+
+/**
+ * Stage element (x, y).
+ */
+int32_t
+mp_stage_put(mp_stage *stage, const uint32_t worker, const uint64_t x, const uint64_t y,
+             const int64_t value) {
+    if (x >= stage->matx->size.x || y >= stage->matx->size.y) return -1;
+
+    mp_copos opos;
+    opos.dim.x = (uint32_t) (x >> CHUNK_POW);
+    opos.dim.y = (uint32_t) (y >> CHUNK_POW);
+
+    mp_chunk *chunk = mp_stage_take(stage, worker, opos);
+    if (!chunk) return -1;
+
+    const uint32_t idx = CHUNK_POS(x & (CHUNK_W - 1), y & (CHUNK_H - 1));
+    if (stage->mode == MP_STAGE_ADD) chunk->data[idx] += value;
+    else chunk->data[idx] = value;
+    return 0;
+}
+
+/**
+ * Collect every staged chunk, sorted by offset then worker, and empty
+ * the hash indexes.
+ *
+ * @return  0 on success (*all is NULL if nothing was staged)
+ * @return -1 on allocation failure (the staged chunks are dropped)
+ */
+static int32_t
+mp_stage_gather(mp_stage *stage, mp_stage_entry **all, uint64_t *count) {
+    uint64_t n = 0;
+    for (uint32_t w = 0; w < stage->workers; w++) n += stage->local[w].nmap;
+
+    *all = NULL;
+    *count = 0;
+    if (n == 0) return 0;
+
+    mp_stage_entry *entries = malloc(n * sizeof(mp_stage_entry));
+    if (!entries) {
+        for (uint32_t w = 0; w < stage->workers; w++) mp_stage_drop(stage, &stage->local[w]);
+        return -1;
+    }
+
+    n = 0;
+    for (uint32_t w = 0; w < stage->workers; w++) {
+        mp_stage_local *local = &stage->local[w];
+        for (uint32_t i = 0; i < local->cmap; i++) {
+            if (local->map[i]) entries[n++] = (mp_stage_entry){local->map[i], w};
+            local->map[i] = NULL;
+        }
+        local->nmap = 0;
+    }
+
+    qsort(entries, n, sizeof(mp_stage_entry), mp_stage_cmp);
+    *all = entries;
+    *count = n;
+    return 0;
+}
+
+/**
+ * Move every staged chunk into the matrix.
+ *
+ * One sort over all workers puts duplicates next to each other; the
+ * deduplicated run is then either the whole tree (empty matrix, built
+ * in O(n)) or inserted chunk by chunk.
+ */
+int32_t
+mp_stage_merge(mp_stage *stage) {
+    mp_matrix *matx = stage->matx;
+
+    mp_stage_entry *all;
+    uint64_t n;
+    if (mp_stage_gather(stage, &all, &n) < 0) return -1;
+    if (n == 0) return 0;
+
+    mp_chunk **chunks = malloc(n * sizeof(mp_chunk *));
+    if (!chunks) {
+        for (uint64_t i = 0; i < n; i++) mp_pool_ret(matx->pool, all[i].chunk);
+        free(all);
+        return -1;
+    }
+
+    uint64_t m = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        if (m && chunks[m - 1]->opos.pos == all[i].chunk->opos.pos)
+            chunks[m - 1] = mp_stage_combine(stage, chunks[m - 1], all[i].chunk);
+        else
+            chunks[m++] = all[i].chunk;
+    }
+
+    if (matx->tree.count == 0) mp_matrix_chunk_build(matx, chunks, m);
+    else for (uint64_t i = 0; i < m; i++) mp_stage_link(stage, chunks[i]);
+
+    free(all);
+    free(chunks);
+    return 0;
+}
+
+/**
+ * Pairs of one reduction level: dst[i] += src[i].
+ */
+typedef struct mp_stage_level {
+    mp_chunk **dst;
+    mp_chunk **src;
+} mp_stage_level;
+
+static void
+mp_stage_reduce(void *arg, uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    (void) worker;
+    const mp_stage_level *level = arg;
+    for (; lo < hi; lo++) mp_stage_add(level->dst[lo], level->src[lo]);
+}
+
+/**
+ * Move every staged chunk into the matrix, reducing duplicates over the
+ * workers of sched.
+ *
+ * Each offset is a group: the matrix chunk, if any, followed by the
+ * staged copies in worker order. Level s adds member i + s into member
+ * i for every i that is a multiple of 2s, across all groups at once, so
+ * a chunk staged by every worker is summed in log2(workers) parallel
+ * steps and the result lands in member 0 (the matrix chunk, or the
+ * first copy, which is then linked).
+ */
+int32_t
+mp_stage_merge_par(mp_stage *stage, mp_sched *sched) {
+    if (stage->mode != MP_STAGE_ADD || !sched || sched->workers < 2) return mp_stage_merge(stage);
+
+    mp_matrix *matx = stage->matx;
+
+    mp_stage_entry *all;
+    uint64_t n;
+    if (mp_stage_gather(stage, &all, &n) < 0) return -1;
+    if (n == 0) return 0;
+
+    /* members: n staged + at most one matrix chunk per group */
+    mp_chunk **member = malloc(2 * n * sizeof(mp_chunk *));
+    uint64_t *start = malloc((n + 1) * sizeof(uint64_t));
+    mp_chunk **fresh = malloc(n * sizeof(mp_chunk *));
+    mp_chunk **pairs = malloc(2 * n * sizeof(mp_chunk *));
+    if (!member || !start || !fresh || !pairs) {
+        for (uint64_t i = 0; i < n; i++) mp_pool_ret(matx->pool, all[i].chunk);
+        free(all);
+        free(member);
+        free(start);
+        free(fresh);
+        free(pairs);
+        return -1;
+    }
+
+    /* groups, with the matrix chunks found and touched by the owner */
+    uint64_t groups = 0, m = 0, nfresh = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        mp_chunk *chunk = all[i].chunk;
+        if (i && all[i - 1].chunk->opos.pos == chunk->opos.pos) {
+            member[m++] = chunk;
+            continue;
+        }
+
+        start[groups++] = m;
+        mp_chunk *old = matx->tree.count ? mp_matrix_chunk_find(matx, chunk->opos) : NULL;
+        if (old) {
+            mp_matrix_chunk_touch(matx, old);
+            member[m++] = old;
+        } else {
+            fresh[nfresh++] = chunk;
+        }
+        member[m++] = chunk;
+    }
+    start[groups] = m;
+
+    /* tree reduction: every member appears in at most one pair per level */
+    mp_stage_level level = {pairs, pairs + n};
+    for (uint64_t s = 1;; s <<= 1) {
+        uint64_t np = 0;
+        for (uint64_t g = 0; g < groups; g++) {
+            const uint64_t k = start[g + 1] - start[g];
+            for (uint64_t i = 0; i + s < k; i += 2 * s) {
+                level.dst[np] = member[start[g] + i];
+                level.src[np] = member[start[g] + i + s];
+                np++;
+            }
+        }
+        if (np == 0) break;
+        mp_sched_for(sched, np, 1, mp_stage_reduce, &level);
+    }
+
+    /* everything but member 0 has been added in */
+    for (uint64_t g = 0; g < groups; g++)
+        for (uint64_t i = start[g] + 1; i < start[g + 1]; i++) mp_pool_ret(matx->pool, member[i]);
+
+    if (matx->tree.count == 0) mp_matrix_chunk_build(matx, fresh, nfresh);
+    else for (uint64_t i = 0; i < nfresh; i++) mp_matrix_chunk_insert(matx, fresh[i]);
+
+    free(all);
+    free(member);
+    free(start);
+    free(fresh);
+    free(pairs);
+    return 0;
+}
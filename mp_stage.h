@@ -0,0 +1,173 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_stage.h
+ *  Description:  Concurrent chunk insertion through per-thread staging.
+ *
+ *  Parallel producers (COO assembly, GEMM output) create chunks of one
+ *  matrix from many threads. The tree and the pool are single-threaded,
+ *  so each producer stages its chunks privately and the owner merges
+ *  them in one pass at the end:
+ *
+ *      worker w:  mp_stage_take(w, opos) → chunk in w's hash index,
+ *                 taken from w's cache of pool chunks (refilled
+ *                 STAGE_BATCH at a time under the pool lock)
+ *
+ *      owner:     mp_stage_merge() → all staged chunks sorted by opos,
+ *                 duplicates combined, then linked into the matrix;
+ *                 an empty matrix gets its tree built in O(n)
+ *
+ *      owner:     mp_stage_merge_par() → same, with the duplicates of
+ *                 MP_STAGE_ADD summed in a parallel reduction tree
+ *
+ *  Chunks staged by several workers, or already in the matrix, are
+ *  combined according to the mode: MP_STAGE_ADD sums them element by
+ *  element (assembly of duplicate entries), MP_STAGE_REPLACE keeps the
+ *  one from the highest worker id (kernels that own their outputs).
+ *
+ *  Design goals:
+ *   - No shared writes on the producer path except the batched pool
+ *     refills; worker state is cache line aligned
+ *   - Staged chunks are the final chunks: merging moves pointers, it
+ *     does not copy payloads (except to combine duplicates)
+ *   - Duplicates are summed row by row with 128-bit vector adds, 256-bit
+ *     where the CPU has AVX2 (probed once)
+ *
+ *  Notes:
+ *   - Worker ids index the per-thread state: two threads must never use
+ *     the same id at the same time (mp_sched kernels pass theirs)
+ *   - The matrix, its pool and its tree must not be used by anybody
+ *     else between mp_stage_init() and mp_stage_merge()
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_STAGE_H
+#define QDEEP_MATRIXP_STAGE_H
+
+#include <pthread.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+#include "mp_sched.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Initial capacity of a worker's hash index (power of two) */
+#define STAGE_MAP 64
+
+/** Pool chunks a worker takes per refill */
+#define STAGE_BATCH 16
+
+/** Duplicate handling */
+#define MP_STAGE_REPLACE 0 /**< Highest worker id wins, the matrix chunk is replaced */
+#define MP_STAGE_ADD     1 /**< Element-wise sum */
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * State of one producer (cache line aligned).
+ */
+typedef struct mp_stage_local {
+    mp_chunk **map;                 /**< Staged chunks (open addressing) */
+    uint32_t nmap;                  /**< Used slots */
+    uint32_t cmap;                  /**< Slots (power of two) */
+
+    mp_chunk *cache[STAGE_BATCH];   /**< Pool chunks not handed out yet */
+    uint32_t ncache;
+} __attribute__((aligned(64))) mp_stage_local;
+
+/**
+ * Staging area of a matrix.
+ */
+typedef struct mp_stage {
+    mp_matrix *matx;        /**< Destination */
+    uint32_t mode;          /**< MP_STAGE_* */
+    uint32_t workers;
+
+    mp_stage_local *local;  /**< One per worker */
+    pthread_mutex_t lock;   /**< Guards matx->pool */
+} mp_stage;
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Prepare staging for `workers` producers into matx.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure or invalid mode
+ */
+int32_t
+mp_stage_init(mp_stage *stage, mp_matrix *matx, uint32_t workers, uint32_t mode);
+
+/**
+ * Drop everything staged and release the staging area.
+ */
+void
+mp_stage_free(mp_stage *stage);
+
+/**
+ * Find the chunk at opos staged by worker, staging a zeroed one (of
+ * the effective size at opos) if absent.
+ *
+ * Returns:
+ *   Chunk pointer or NULL on allocation failure / out of range offset
+ */
+mp_chunk *
+mp_stage_take(mp_stage *stage, uint32_t worker, mp_copos opos);
+
+/**
+ * Stage element (x, y): added to or stored in its chunk, per mode.
+ *
+ * @return  0 on success
+ * @return -1 on out of range position or allocation failure
+ */
+int32_t
+mp_stage_put(mp_stage *stage, uint32_t worker, uint64_t x, uint64_t y, int64_t value);
+
+/**
+ * Move every staged chunk into the matrix (owner thread, after the
+ * producers are done). The staging area is empty afterwards and can be
+ * used again.
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure (the staged chunks are dropped)
+ */
+int32_t
+mp_stage_merge(mp_stage *stage);
+
+/**
+ * mp_stage_merge() with the element-wise sums of MP_STAGE_ADD spread
+ * over the workers of sched (owner thread, outside any sched kernel).
+ * Other modes, and a single worker, fall back to mp_stage_merge().
+ *
+ * @return  0 on success
+ * @return -1 on allocation failure (the staged chunks are dropped)
+ */
+int32_t
+mp_stage_merge_par(mp_stage *stage, mp_sched *sched);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_STAGE_H */
@@ -0,0 +1,135 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_stat.c
+ *  Description:  Reader of live statistics pages (see mp_stats.h).
+ *
+ *  Usage:
+ *      mp_stat [-i ms] [-n count] name|path
+ *
+ *  Prints the page once, or every ms milliseconds (count times, or
+ *  until interrupted). A name is looked up in /dev/shm; a memfd page is
+ *  reached through /proc/<pid>/fd/<fd>.
+ *
+ *  Notes:
+ *   - The page is mapped read-only; the publisher is never waited for
+ *     nor signalled
+ *   - An update older than three publisher intervals is flagged
+ *     "stale" (publisher stopped or stuck)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mp_stats.h"
+
+
+static int
+mp_stat_usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-i ms] [-n count] name|path\n", argv0);
+    return EXIT_FAILURE;
+}
+
+/**
+ * Print a byte count with a binary unit.
+ */
+static void
+mp_stat_bytes(const char *label, const uint64_t bytes) {
+    static const char *const unit[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double value = (double) bytes;
+    uint32_t u = 0;
+
+    while (value >= 1024.0 && u < 4) {
+        value /= 1024.0;
+        u++;
+    }
+    printf("  %s %.1f %s", label, value, unit[u]);
+}
+
+/**
+ * Print one update.
+ */
+static void
+mp_stat_print(const mp_stats_data *s) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const uint64_t now = (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+    const double age = s->time && now > s->time ? (double) (now - s->time) / 1e9 : 0.0;
+
+    printf("pid %d  update %lu  age %.1f s%s\n", s->pid, s->seq / 2, age,
+           !s->time ? "  (none yet)" : age * 1000.0 > 3.0 * (double) s->interval ? "  (stale)" : "");
+
+    printf("pool      pages %lu", s->pages);
+    mp_stat_bytes("mapped", s->mapped);
+    printf("  chunks used %lu  free %lu\n", s->used, s->free);
+
+    printf("process ");
+    mp_stat_bytes("rss", s->rss);
+    printf("\n");
+
+    printf("transfer");
+    mp_stat_bytes("sent", s->sent);
+    mp_stat_bytes("at", s->send_rate);
+    printf("/s ");
+    mp_stat_bytes("recv", s->recv);
+    mp_stat_bytes("at", s->recv_rate);
+    printf("/s\n");
+
+    if (s->nmatrix)
+        printf("%-24s %12s %12s %10s %14s %8s\n", "matrix", "cols", "rows", "chunks", "finds", "hit%");
+
+    for (uint32_t i = 0; i < s->nmatrix && i < STATS_MATRICES; i++) {
+        const mp_stats_matrix *m = &s->matrix[i];
+        printf("%-24.*s %12lu %12lu %10lu %14lu %8.1f\n", STATS_NAME, m->name,
+               m->cols, m->rows, m->chunks, m->finds,
+               m->finds ? 100.0 * (double) m->hits / (double) m->finds : 0.0);
+    }
+    if (s->more) printf("(%u more matrices)\n", s->more);
+
+    fflush(stdout);
+}
+
+int
+main(const int argc, char **argv) {
+    uint32_t ms = 0;
+    uint64_t count = 0;
+    const char *path = NULL;
+
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) ms = (uint32_t) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) count = strtoull(argv[++i], NULL, 10);
+        else if (argv[i][0] != '-' && !path) path = argv[i];
+        else return mp_stat_usage(argv[0]);
+    }
+    if (!path) return mp_stat_usage(argv[0]);
+
+    const mp_stats_data *data = mp_stats_map(path);
+    if (!data) {
+        fprintf(stderr, "mp_stat: %s is not a statistics page\n", path);
+        return EXIT_FAILURE;
+    }
+
+    if (!ms) count = 1;
+    for (uint64_t n = 0; !count || n < count; n++) {
+        if (n) usleep(ms * 1000u);
+
+        mp_stats_data copy;
+        if (mp_stats_read(data, &copy) < 0) {
+            fprintf(stderr, "mp_stat: publisher stuck in an update\n");
+            continue;
+        }
+
+        if (n) printf("\n");
+        mp_stat_print(&copy);
+    }
+
+    mp_stats_unmap(data);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+#include "mp_stats.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mp_matrix.h"
+#include "mp_pool.h"
+
+
+/* ============================================================================
+ *  Internal state
+ * ============================================================================
+ */
+
+/** Bytes moved by the I/O helpers, updated with relaxed atomics */
+static uint64_t stats_io[2];
+
+
+/* ============================================================================
+ *  Helpers
+ * ============================================================================
+ */
+
+static uint64_t
+mp_stats_clock(const clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Resident set of the process in bytes, 0 if unknown.
+ */
+static uint64_t
+mp_stats_rss(const mp_stats *st) {
+    char buf[128];
+    if (st->statm < 0) return 0;
+
+    const int64_t n = pread(st->statm, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return 0;
+    buf[n] = 0;
+
+    unsigned long size, resident;
+    if (sscanf(buf, "%lu %lu", &size, &resident) != 2) return 0;
+    return (uint64_t) resident * (uint64_t) sysconf(_SC_PAGESIZE);
+}
+
+
+/* ============================================================================
+ *  Publisher API
+ * ============================================================================
+ */
+
+/**
+ * Create the shared page.
+ */
+int32_t
+mp_stats_open(mp_stats *st, const char *name) {
+    __builtin_memset(st, 0, sizeof(*st));
+    st->fd = -1;
+    st->ms = STATS_INTERVAL;
+    st->statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+
+    if (name) {
+        if (!*name || strchr(name, '/') ||
+            snprintf(st->path, sizeof(st->path), "/dev/shm/%s", name) >= (int32_t) sizeof(st->path))
+            goto error;
+        st->fd = open(st->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        st->named = 1;
+    } else {
+        st->fd = memfd_create("mp_stats", MFD_CLOEXEC);
+        snprintf(st->path, sizeof(st->path), "/proc/%d/fd/%d", (int32_t) getpid(), st->fd);
+    }
+    if (st->fd < 0) goto error;
+
+    if (ftruncate(st->fd, sizeof(mp_stats_data)) < 0) goto error;
+    st->data = mmap(NULL, sizeof(mp_stats_data), PROT_READ | PROT_WRITE, MAP_SHARED, st->fd, 0);
+    if (st->data == MAP_FAILED) goto error;
+
+    /* The page is zeroed: seq 0 is a stable, empty update */
+    st->data->version = STATS_VERSION;
+    st->data->size = sizeof(mp_stats_data);
+    st->data->pid = (int32_t) getpid();
+    __atomic_store_n(&st->data->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+
+error:
+    if (st->fd >= 0) close(st->fd);
+    if (st->fd >= 0 && st->named) unlink(st->path);
+    if (st->statm >= 0) close(st->statm);
+    st->data = NULL;
+    st->fd = -1;
+    return -1;
+}
+
+/**
+ * Unmap the page and remove it.
+ */
+void
+mp_stats_close(mp_stats *st) {
+    if (!st->data) return;
+
+    munmap(st->data, sizeof(mp_stats_data));
+    close(st->fd);
+    if (st->named) unlink(st->path);
+    if (st->statm >= 0) close(st->statm);
+    st->data = NULL;
+}
+
+/**
+ * Whether an update is due.
+ */
+uint8_t
+mp_stats_due(const mp_stats *st) {
+    return st->data && mp_stats_clock(CLOCK_MONOTONIC) - st->last >= (uint64_t) st->ms * 1000000ull;
+}
+
+/**
+ * Start an update.
+ */
+void
+mp_stats_begin(mp_stats *st, const struct mp_pool *pool) {
+    mp_stats_data *next = &st->next;
+    const uint64_t now = mp_stats_clock(CLOCK_MONOTONIC);
+    const uint64_t sent = __atomic_load_n(&stats_io[MP_STATS_SENT], __ATOMIC_RELAXED);
+    const uint64_t recv = __atomic_load_n(&stats_io[MP_STATS_RECV], __ATOMIC_RELAXED);
+
+    /* next still holds the previous update */
+    const uint64_t span = now - st->last;
+    next->send_rate = st->last && span ? (sent - next->sent) * 1000000000ull / span : 0;
+    next->recv_rate = st->last && span ? (recv - next->recv) * 1000000000ull / span : 0;
+    next->sent = sent;
+    next->recv = recv;
+    st->last = now;
+
+    next->time = mp_stats_clock(CLOCK_REALTIME);
+    next->interval = st->ms;
+    next->pages = pool ? pool->size : 0;
+    next->mapped = next->pages * PAGE_SIZE * CHUNK_BYTES;
+    next->used = pool ? pool->used : 0;
+    next->free = next->pages * PAGE_SIZE - next->used;
+    next->rss = mp_stats_rss(st);
+
+    next->nmatrix = 0;
+    next->more = 0;
+}
+
+/**
+ * Add a matrix to the update.
+ */
+void
+mp_stats_add(mp_stats *st, const char *name, const struct mp_matrix *matx) {
+    mp_stats_data *next = &st->next;
+    if (next->nmatrix == STATS_MATRICES) {
+        next->more += 1;
+        return;
+    }
+
+    mp_stats_matrix *m = &next->matrix[next->nmatrix++];
+    __builtin_memset(m->name, 0, sizeof(m->name));
+    __builtin_memcpy(m->name, name, strnlen(name, sizeof(m->name) - 1));
+
+    m->cols = matx->size.x;
+    m->rows = matx->size.y;
+    m->chunks = matx->tree.count;
+    m->finds = matx->tree.cur.finds;
+    m->hits = matx->tree.cur.hits;
+}
+
+/**
+ * Publish the update: everything after seq, inside an odd seq.
+ */
+void
+mp_stats_end(mp_stats *st) {
+    mp_stats_data *data = st->data;
+    const uint64_t off = __builtin_offsetof(mp_stats_data, time);
+    const uint64_t seq = data->seq;
+
+    __atomic_store_n(&data->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __builtin_memcpy((uint8_t *) data + off, (const uint8_t *) &st->next + off,
+                     sizeof(mp_stats_data) - off);
+
+    __atomic_store_n(&data->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Count bytes moved by an I/O helper.
+ */
+void
+mp_stats_io(const uint32_t dir, const uint64_t bytes) {
+    __atomic_fetch_add(&stats_io[dir], bytes, __ATOMIC_RELAXED);
+}
+
+
+/* ============================================================================
+ *  Reader API
+ * ============================================================================
+ */
+
+/**
+ * Map a published page read-only.
+ */
+const mp_stats_data *
+mp_stats_map(const char *path) {
+    char buf[128];
+    if (!strchr(path, '/')) {
+        if (snprintf(buf, sizeof(buf), "/dev/shm/%s", path) >= (int32_t) sizeof(buf)) return NULL;
+        path = buf;
+    }
+
+    const int32_t fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    const mp_stats_data *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t) st.st_size >= sizeof(mp_stats_data))
+        data = mmap(NULL, sizeof(mp_stats_data), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) return NULL;
+    if (__atomic_load_n(&data->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+        data->version != STATS_VERSION || data->size != sizeof(mp_stats_data)) {
+        munmap((void *) data, sizeof(mp_stats_data));
+        return NULL;
+    }
+    return data;
+}
+
+/**
+ * Release a mapping.
+ */
+void
+mp_stats_unmap(const mp_stats_data *data) {
+    if (data) munmap((void *) data, sizeof(mp_stats_data));
+}
+
+/**
+ * Copy a consistent update.
+ */
+int32_t
+mp_stats_read(const mp_stats_data *data, mp_stats_data *copy) {
+    for (uint32_t spin = 0; spin < STATS_SPIN; spin++) {
+        const uint64_t seq = __atomic_load_n(&data->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        __builtin_memcpy(copy, data, sizeof(mp_stats_data));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&data->seq, __ATOMIC_RELAXED) == seq) {
+            copy->seq = seq;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,233 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_stats.h
+ *  Description:  Live statistics in shared memory.
+ *
+ *  A service publishes its pool, matrix and transfer counters into one
+ *  shared page (mp_stats_data). Monitoring agents map the page read-only
+ *  and copy it whenever they like: no request, no socket, nothing on
+ *  the service side but the periodic update.
+ *
+ *  The page lives in /dev/shm/<name>, or in an anonymous memfd reached
+ *  through /proc/<pid>/fd/<fd>. Updates are guarded by a sequence lock:
+ *
+ *      writer:  seq odd, copy the new values, seq even
+ *      reader:  seq (even), copy, seq again; retry if it moved
+ *
+ *  The owner of the pool and matrices builds each update itself, from
+ *  the thread that modifies them:
+ *
+ *      if (mp_stats_due(&st)) {
+ *          mp_stats_begin(&st, pool);
+ *          mp_stats_add(&st, "a", &a);
+ *          mp_stats_end(&st);
+ *      }
+ *
+ *  Design goals:
+ *   - Readers never block or slow down the writer
+ *   - The update is built privately; the locked window is one copy
+ *   - Fixed layout with magic, version and size, for tools in any
+ *     language
+ *
+ *  Notes:
+ *   - Bytes sent / received count every I/O helper of the library
+ *     (chunk, stream, splice and resumable transfers) in the process
+ *   - Lookup cache counters cover the writer's cursor of each tree
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_STATS_H
+#define QDEEP_MATRIXP_STATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mp_pool;
+struct mp_matrix;
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Page identification ("MPST") and layout version */
+#define STATS_MAGIC   0x5453504du
+#define STATS_VERSION 1
+
+/** Matrices listed per update */
+#define STATS_MATRICES 32
+
+/** Matrix name length, including the terminating NUL */
+#define STATS_NAME 64
+
+/** Default update interval (ms) */
+#define STATS_INTERVAL 1000
+
+/** Reader attempts before giving up on a writer stuck mid-update */
+#define STATS_SPIN 4096
+
+/** Byte counter directions */
+#define MP_STATS_SENT 0
+#define MP_STATS_RECV 1
+
+
+/* ============================================================================
+ *  Types
+ * ============================================================================
+ */
+
+/**
+ * Counters of one matrix.
+ */
+typedef struct mp_stats_matrix {
+    char name[STATS_NAME];  /**< NUL-terminated, truncated */
+    uint64_t cols;          /**< Matrix size */
+    uint64_t rows;
+    uint64_t chunks;        /**< Chunks in the tree */
+    uint64_t finds;         /**< Tree lookups through the writer's cursor */
+    uint64_t hits;          /**< Of which answered by its cache */
+} mp_stats_matrix;
+
+/**
+ * Shared page.
+ */
+typedef struct mp_stats_data {
+    uint32_t magic;         /**< STATS_MAGIC */
+    uint32_t version;       /**< STATS_VERSION */
+    uint32_t size;          /**< sizeof(mp_stats_data) */
+    int32_t pid;            /**< Publishing process */
+    uint64_t seq;           /**< Updates * 2 (+1 while one is written) */
+
+    uint64_t time;          /**< CLOCK_REALTIME of the update (ns) */
+    uint64_t interval;      /**< Update interval of the publisher (ms) */
+
+    uint64_t pages;         /**< Pool pages mapped */
+    uint64_t mapped;        /**< Bytes mapped for them */
+    uint64_t used;          /**< Chunks handed out */
+    uint64_t free;          /**< Chunks free in the mapped pages */
+    uint64_t rss;           /**< Resident set of the process (bytes) */
+
+    uint64_t sent;          /**< Bytes sent since start */
+    uint64_t recv;          /**< Bytes received since start */
+    uint64_t send_rate;     /**< Bytes / s since the previous update */
+    uint64_t recv_rate;
+
+    uint32_t nmatrix;       /**< Entries of matrix[] in use */
+    uint32_t more;          /**< Matrices that did not fit */
+    mp_stats_matrix matrix[STATS_MATRICES];
+} mp_stats_data;
+
+/**
+ * Publisher.
+ */
+typedef struct mp_stats {
+    mp_stats_data *data;    /**< Shared page */
+    mp_stats_data next;     /**< Update being built */
+
+    int32_t fd;             /**< Page descriptor */
+    int32_t statm;          /**< /proc/self/statm, -1 if unavailable */
+    uint32_t ms;            /**< Update interval */
+    uint64_t last;          /**< Monotonic time of the last update (ns) */
+
+    char path[64];          /**< Where readers find the page */
+    uint8_t named;          /**< path is in /dev/shm, removed on close */
+} mp_stats;
+
+
+/* ============================================================================
+ *  Publisher API
+ * ============================================================================
+ */
+
+/**
+ * Create the shared page: /dev/shm/<name>, or a memfd if name is NULL.
+ * st->path tells readers where to find it.
+ *
+ * @return  0 on success
+ * @return -1 on failure
+ */
+int32_t
+mp_stats_open(mp_stats *st, const char *name);
+
+/**
+ * Unmap the page and remove it from /dev/shm.
+ */
+void
+mp_stats_close(mp_stats *st);
+
+/**
+ * Whether st->ms have passed since the last update.
+ */
+uint8_t
+mp_stats_due(const mp_stats *st);
+
+/**
+ * Start an update with the pool, process and transfer counters.
+ */
+void
+mp_stats_begin(mp_stats *st, const struct mp_pool *pool);
+
+/**
+ * Add a matrix to the update being built.
+ */
+void
+mp_stats_add(mp_stats *st, const char *name, const struct mp_matrix *matx);
+
+/**
+ * Publish the update.
+ */
+void
+mp_stats_end(mp_stats *st);
+
+/**
+ * Count bytes moved by an I/O helper (MP_STATS_SENT / MP_STATS_RECV).
+ */
+void
+mp_stats_io(uint32_t dir, uint64_t bytes);
+
+
+/* ============================================================================
+ *  Reader API
+ * ============================================================================
+ */
+
+/**
+ * Map a published page read-only. A path without '/' is looked up in
+ * /dev/shm.
+ *
+ * Returns:
+ *   Mapping, or NULL if it cannot be opened or is not a stats page of
+ *   this version
+ */
+const mp_stats_data *
+mp_stats_map(const char *path);
+
+/**
+ * Release a mapping of mp_stats_map().
+ */
+void
+mp_stats_unmap(const mp_stats_data *data);
+
+/**
+ * Copy a consistent update out of a mapped page.
+ *
+ * @return  0 on success
+ * @return -1 if no stable copy could be taken within STATS_SPIN attempts
+ */
+int32_t
+mp_stats_read(const mp_stats_data *data, mp_stats_data *copy);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_STATS_H */
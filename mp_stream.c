@@ -0,0 +1,187 @@
+#include "mp_stream.h"
+
+#include "mp_codec.h"
+#include "mp_cold.h"
+#include "mp_stats.h"
+
+
+/* ============================================================================
+ *  I/O helpers
+ * ============================================================================
+ */
+
+/**
+ * Write exactly len bytes.
+ */
+int32_t
+mp_stream_write(const int32_t fd, const uint8_t *ptr, uint64_t len) {
+    while (len > 0) {
+        const int64_t ret = write(fd, ptr, len);
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (errno == EINTR) continue; /* retry on interrupt */
+            return -1; /* EOF or real error */
+        }
+
+        mp_stats_io(MP_STATS_SENT, (uint64_t) ret);
+        ptr += ret;
+        len -= (uint64_t) ret;
+    }
+    return 0;
+}
+
+/**
+ * Read exactly len bytes.
+ */
+int32_t
+mp_stream_read(const int32_t fd, uint8_t *ptr, uint64_t len) {
+    while (len > 0) {
+        const int64_t ret = read(fd, ptr, len);
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (errno == EINTR) continue; /* retry on interrupt */
+            return -1; /* EOF or real error */
+        }
+
+        mp_stats_io(MP_STATS_RECV, (uint64_t) ret);
+        ptr += ret;
+        len -= (uint64_t) ret;
+    }
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Blocking stream transfer
+ * ============================================================================
+ */
+
+/**
+ * Total number of bytes mp_stream_send() will write for matx.
+ */
+uint64_t
+mp_stream_bytes(const mp_matrix *matx) {
+    uint64_t bytes = 2 * STREAM_FRAME;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (const mp_chunk *chunk; (chunk = mp_iter_next(&iter));)
+        bytes += STREAM_FRAME + mp_stream_payload(chunk->size);
+
+    return bytes;
+}
+
+/**
+ * Write all chunks of matx as a chunk stream.
+ */
+int32_t
+mp_stream_send(mp_matrix *matx, const int32_t fd) {
+    uint8_t frame[STREAM_FRAME];
+
+    mp_stream_pack(frame, matx->size.x, matx->size.y);
+    if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (!(chunk = mp_cold_warm(matx, chunk))) return -1;
+
+        mp_stream_pack(frame, chunk->opos.pos, chunk->size.size);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+        if (mp_chunk_send(chunk, fd) < 0) return -1;
+    }
+
+    mp_stream_pack(frame, MP_STREAM_END, 0);
+    return mp_stream_write(fd, frame, STREAM_FRAME);
+}
+
+/**
+ * Write all chunks of matx as a chunk stream with packed frames.
+ */
+int32_t
+mp_stream_send_packed(mp_matrix *matx, const int32_t fd) {
+    uint8_t frame[STREAM_FRAME];
+
+    uint8_t *buf = malloc(CODEC_MAX);
+    if (!buf) return -1;
+
+    mp_stream_pack(frame, matx->size.x, matx->size.y);
+    if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) goto error;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (!(chunk = mp_cold_warm(matx, chunk))) goto error;
+
+        const uint64_t elen = mp_codec_encode(chunk, buf);
+
+        if (elen < mp_stream_payload(chunk->size)) {
+            mp_stream_pack(frame, chunk->opos.pos, elen << 32 | STREAM_PACKED | chunk->size.size);
+            if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) goto error;
+            if (mp_stream_write(fd, buf, elen) < 0) goto error;
+        } else {
+            mp_stream_pack(frame, chunk->opos.pos, chunk->size.size);
+            if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) goto error;
+            if (mp_chunk_send(chunk, fd) < 0) goto error;
+        }
+    }
+
+    free(buf);
+    mp_stream_pack(frame, MP_STREAM_END, 0);
+    return mp_stream_write(fd, frame, STREAM_FRAME);
+
+error:
+    free(buf);
+    return -1;
+}
+
+/**
+ * Read a chunk stream into matx.
+ */
+int32_t
+mp_stream_recv(mp_matrix *matx, const int32_t fd) {
+    uint8_t frame[STREAM_FRAME];
+    uint64_t a, b;
+    uint8_t *buf = NULL; /* packed payloads, allocated on first use */
+
+    if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) return -1;
+    mp_stream_unpack(frame, &a, &b);
+
+    if (mp_matrix_set_size(matx, (mp_msize){a, b}) < 0) return -1;
+
+    while (1) {
+        if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto error;
+        mp_stream_unpack(frame, &a, &b);
+
+        if (a == MP_STREAM_END) {
+            free(buf);
+            return 0;
+        }
+
+        const mp_copos opos = {.pos = a};
+        const mp_csize size = {.size = (uint16_t) b};
+        const uint8_t packed = (b & STREAM_PACKED) != 0;
+        const uint64_t elen = b >> 32;
+
+        if ((packed ? b & 0xFFFE0000ull : b > UINT16_MAX) ||
+            !mp_stream_valid(matx, opos, size) || elen > mp_codec_bound(size))
+            goto error;
+
+        const mp_chunk *chunk = mp_matrix_chunk_write(matx, opos);
+        if (!chunk) goto error;
+
+        if (!packed) {
+            if (mp_chunk_recv(chunk, fd) < 0) goto error;
+            continue;
+        }
+
+        if (!buf) buf = malloc(CODEC_MAX);
+        if (!buf || mp_stream_read(fd, buf, elen) < 0) goto error;
+        if (mp_codec_decode(chunk, buf, elen) < 0) goto error;
+    }
+
+error:
+    free(buf);
+    return -1;
+}
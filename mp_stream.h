@@ -0,0 +1,170 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_stream.h
+ *  Description:  Chunk-stream wire format for in-memory matrices.
+ *
+ *  mp_matrix_send() / mp_matrix_recv() move the dense file payload.
+ *  Pool-resident matrices are sparse sets of chunks, so they travel
+ *  as a chunk stream instead:
+ *
+ *      [ msize header ]                         16 bytes
+ *      [ opos | csize ] [ chunk payload ]       16 bytes + payload
+ *      ...                                      (opos ascending)
+ *      [ MP_STREAM_END | 0 ]                    16 bytes
+ *
+ *  All header fields are 64-bit big-endian, payloads are the effective
+ *  chunk rows exactly as produced by mp_chunk_send().
+ *
+ *  Packed streams (mp_stream_send_packed()) may replace a chunk frame by
+ *
+ *      [ opos | elen << 32 | STREAM_PACKED | csize ] [ elen bytes ]
+ *
+ *  carrying the payload encoded with mp_codec_encode(). Receivers always
+ *  accept both kinds; senders only pack when the peer asked for it.
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_STREAM_H
+#define QDEEP_MATRIXP_STREAM_H
+
+#include <endian.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Wire format
+ * ============================================================================
+ */
+
+/** Size of the stream header and of each chunk frame header */
+#define STREAM_FRAME 16
+
+/** opos value of the terminating frame */
+#define MP_STREAM_END UINT64_MAX
+
+/** csize field flag of a packed chunk frame */
+#define STREAM_PACKED (1ull << 16)
+
+/**
+ * Pack two 64-bit values in network byte order.
+ */
+static __inline__ void
+mp_stream_pack(uint8_t *out, const uint64_t a, const uint64_t b) {
+    const uint64_t x = htobe64(a);
+    const uint64_t y = htobe64(b);
+
+    __builtin_memcpy(out + 0, &x, 8);
+    __builtin_memcpy(out + 8, &y, 8);
+}
+
+/**
+ * Unpack two 64-bit values from network byte order.
+ */
+static __inline__ void
+mp_stream_unpack(const uint8_t *in, uint64_t *a, uint64_t *b) {
+    uint64_t x, y;
+
+    __builtin_memcpy(&x, in + 0, 8);
+    __builtin_memcpy(&y, in + 8, 8);
+
+    *a = be64toh(x);
+    *b = be64toh(y);
+}
+
+/**
+ * Number of payload bytes of a chunk on the wire.
+ */
+static __inline__ uint64_t
+mp_stream_payload(const mp_csize size) {
+    return (uint64_t) mp_csize_real(size) * sizeof(int64_t);
+}
+
+/**
+ * Check that a received frame describes a valid chunk of matx.
+ */
+static __inline__ int32_t
+mp_stream_valid(const mp_matrix *matx, const mp_copos opos, const mp_csize size) {
+    return mp_matrix_contains(matx, opos) &&
+           mp_matrix_csize(matx, opos).size == size.size;
+}
+
+
+/* ============================================================================
+ *  Blocking stream transfer
+ * ============================================================================
+ */
+
+/**
+ * Write exactly len bytes (retries on EINTR and short writes).
+ *
+ * @return  0 on success
+ * @return -1 on write failure
+ */
+int32_t
+mp_stream_write(int32_t fd, const uint8_t *ptr, uint64_t len);
+
+/**
+ * Read exactly len bytes (retries on EINTR and short reads).
+ *
+ * @return  0 on success
+ * @return -1 on EOF or read failure
+ */
+int32_t
+mp_stream_read(int32_t fd, uint8_t *ptr, uint64_t len);
+
+/**
+ * Total number of bytes mp_stream_send() will write for matx.
+ */
+uint64_t
+mp_stream_bytes(const mp_matrix *matx);
+
+/**
+ * Write all chunks of matx as a chunk stream.
+ *
+ * Frozen chunks are thawed on the way.
+ *
+ * @return  0 on success
+ * @return -1 on write or allocation failure
+ */
+int32_t
+mp_stream_send(mp_matrix *matx, int32_t fd);
+
+/**
+ * Write all chunks of matx as a chunk stream with packed frames.
+ *
+ * Chunks that do not shrink are sent as plain frames.
+ *
+ * @return  0 on success
+ * @return -1 on write or allocation failure
+ */
+int32_t
+mp_stream_send_packed(mp_matrix *matx, int32_t fd);
+
+/**
+ * Read a chunk stream (plain or packed frames) into matx.
+ *
+ * The matrix is resized to the stream header; received chunks replace
+ * existing ones at the same offsets.
+ *
+ * @return  0 on success
+ * @return -1 on read failure, malformed frame or allocation failure
+ */
+int32_t
+mp_stream_recv(mp_matrix *matx, int32_t fd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_STREAM_H */
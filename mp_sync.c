@@ -0,0 +1,305 @@
+#include "mp_sync.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mp_cold.h"
+#include "mp_file.h"
+#include "mp_stream.h"
+
+
+/* ============================================================================
+ *  Internal helpers
+ * ============================================================================
+ */
+
+/**
+ * Check whether the next sync of matx has to write everything.
+ */
+static int32_t
+mp_sync_full(const mp_matrix *matx) {
+    return matx->resync || (matx->synced == 0 && matx->fd == -1);
+}
+
+/**
+ * Close the current generation after a successful sync.
+ */
+static void
+mp_sync_commit(mp_matrix *matx) {
+    matx->synced = matx->gen++;
+    matx->ndrops = 0;
+    matx->resync = 0;
+}
+
+
+/* ============================================================================
+ *  Tiled file
+ * ============================================================================
+ */
+
+/**
+ * Rewrite the whole tiled file: every chunk, holes in between.
+ *
+ * Tiles are cleared instead of truncating the file, because a mapped
+ * matrix may still read unmodified tiles from it.
+ */
+static int64_t
+mp_sync_dirty_full(mp_matrix *matx, const int32_t fd, const uint8_t fresh) {
+    const uint64_t tiles = mp_file_ncx(matx->size) * mp_file_ncy(matx->size);
+    uint64_t next = 0; /* first tile not handled yet */
+    int64_t written = 0;
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (!mp_matrix_contains(matx, chunk->opos)) continue;
+        if (!(chunk = mp_cold_warm(matx, chunk))) return -1;
+
+        const uint64_t tile = mp_file_tile(matx->size, chunk->opos);
+        if (!fresh && mp_file_tile_clear(fd, next, tile - next) < 0) return -1;
+        if (mp_file_tile_write(fd, matx->size, chunk->opos, chunk->data) < 0) return -1;
+
+        next = tile + 1;
+        written++;
+    }
+
+    if (!fresh && mp_file_tile_clear(fd, next, tiles - next) < 0) return -1;
+    return written;
+}
+
+/**
+ * Write the dirty chunks of matx to the tiled file fd and sync it.
+ */
+int64_t
+mp_matrix_sync_dirty(mp_matrix *matx, const int32_t fd) {
+    if (!matx || fd == -1) return -1;
+
+    mp_msize size;
+    const uint8_t valid = mp_file_header_read(fd, &size) == 0;
+    const uint8_t fresh = !valid || (size.x == 0 && size.y == 0);
+    int64_t written = 0;
+
+    if (!valid || size.x != matx->size.x || size.y != matx->size.y) {
+        if (fresh && ftruncate(fd, 0) == -1) return -1;
+        if (mp_file_resize(fd, matx->size) < 0) return -1;
+        written = mp_sync_dirty_full(matx, fd, fresh);
+    } else if (mp_sync_full(matx)) {
+        written = mp_sync_dirty_full(matx, fd, 0);
+    } else {
+        /* ---- drops first: a chunk re-created since is written below ---- */
+        for (uint64_t i = 0; i < matx->ndrops; i++) {
+            const mp_copos opos = matx->drops[i];
+            if (!mp_matrix_contains(matx, opos) || mp_matrix_chunk_find(matx, opos)) continue;
+            if (mp_file_tile_clear(fd, mp_file_tile(matx->size, opos), 1) < 0) return -1;
+        }
+
+        mp_iter iter;
+        mp_iter_init(&iter, &matx->tree);
+
+        for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+            if (!mp_matrix_chunk_dirty(matx, chunk) || !mp_matrix_contains(matx, chunk->opos)) continue;
+            if (!(chunk = mp_cold_warm(matx, chunk))) return -1;
+            if (mp_file_tile_write(fd, matx->size, chunk->opos, chunk->data) < 0) return -1;
+            written++;
+        }
+    }
+
+    if (written < 0 || fdatasync(fd) == -1) return -1;
+
+    mp_sync_commit(matx);
+    return written;
+}
+
+
+/* ============================================================================
+ *  Delta log
+ * ============================================================================
+ */
+
+/**
+ * Append a delta segment of the dirty chunks of matx to the log fd.
+ */
+int64_t
+mp_matrix_sync_log(mp_matrix *matx, const int32_t fd) {
+    if (!matx || fd == -1) return -1;
+
+    const uint8_t full = mp_sync_full(matx);
+    uint8_t frame[STREAM_FRAME];
+    int64_t written = 0;
+
+    mp_stream_pack(frame, matx->size.x, matx->size.y);
+    if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+
+    if (full) {
+        mp_stream_pack(frame, LOG_RESET, 0);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+    } else {
+        for (uint64_t i = 0; i < matx->ndrops; i++) {
+            mp_stream_pack(frame, matx->drops[i].pos, LOG_DROP);
+            if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+        }
+    }
+
+    mp_iter iter;
+    mp_iter_init(&iter, &matx->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        if (!full && !mp_matrix_chunk_dirty(matx, chunk)) continue;
+        if (!mp_matrix_contains(matx, chunk->opos)) continue;
+        if (!(chunk = mp_cold_warm(matx, chunk))) return -1;
+
+        mp_stream_pack(frame, chunk->opos.pos, chunk->size.size);
+        if (mp_stream_write(fd, frame, STREAM_FRAME) < 0) return -1;
+        if (mp_chunk_send(chunk, fd) < 0) return -1;
+        written++;
+    }
+
+    mp_stream_pack(frame, MP_STREAM_END, matx->gen);
+    if (mp_stream_write(fd, frame, STREAM_FRAME) < 0 || fdatasync(fd) == -1) return -1;
+
+    mp_sync_commit(matx);
+    return written;
+}
+
+/**
+ * Frame of a segment read but not applied yet.
+ */
+typedef struct mp_sync_frame {
+    mp_copos opos;   /**< LOG_RESET for the reset frame */
+    mp_chunk *chunk; /**< Payload, NULL for a drop */
+} mp_sync_frame;
+
+/**
+ * Return the payloads of staged frames to the pool.
+ */
+static void
+mp_sync_discard(mp_matrix *matx, mp_sync_frame *frames, const uint64_t n) {
+    for (uint64_t i = 0; i < n; i++)
+        if (frames[i].chunk) mp_pool_ret(matx->pool, frames[i].chunk);
+    free(frames);
+}
+
+/**
+ * Apply the staged frames of a complete segment, in log order.
+ */
+static int32_t
+mp_sync_apply(mp_matrix *matx, const mp_msize size, const mp_sync_frame *frames, const uint64_t n) {
+    if (mp_matrix_set_size(matx, size) < 0) return -1;
+
+    for (uint64_t i = 0; i < n; i++) {
+        const mp_sync_frame *f = &frames[i];
+
+        if (f->opos.pos == LOG_RESET) {
+            while (matx->tree.count) {
+                mp_iter iter;
+                mp_iter_init(&iter, &matx->tree);
+                mp_matrix_chunk_drop(matx, mp_iter_next(&iter)->opos);
+            }
+            continue;
+        }
+
+        if (!f->chunk) {
+            mp_matrix_chunk_drop(matx, f->opos);
+            continue;
+        }
+
+        /* through the write path: snapshot, Merkle, cold and mapped tiles */
+        const mp_chunk *chunk = mp_matrix_chunk_write(matx, f->opos);
+        if (!chunk) return -1;
+
+        const uint64_t row = (f->chunk->size.dim.x + 1) * sizeof(int64_t);
+        for (uint32_t y = 0; y <= f->chunk->size.dim.y; y++)
+            __builtin_memcpy(chunk->data + CHUNK_POS(0, y), f->chunk->data + CHUNK_POS(0, y), row);
+    }
+    return 0;
+}
+
+/**
+ * Read one segment whose header frame has already been read, and apply
+ * it once its END frame has been read.
+ *
+ * Frames are staged in pool chunks until then: a torn or malformed
+ * segment leaves matx untouched.
+ */
+static int32_t
+mp_sync_replay_segment(mp_matrix *matx, const int32_t fd, const uint8_t *head) {
+    uint8_t frame[STREAM_FRAME];
+    uint64_t a, b;
+
+    mp_stream_unpack(head, &a, &b);
+
+    /* the frames are checked against the size of the segment */
+    const mp_matrix shape = {.size = {a, b}};
+
+    mp_sync_frame *frames = NULL;
+    uint64_t n = 0, cap = 0;
+
+    while (1) {
+        if (mp_stream_read(fd, frame, STREAM_FRAME) < 0) goto error;
+        mp_stream_unpack(frame, &a, &b);
+
+        if (a == MP_STREAM_END) break;
+
+        if (n == cap) {
+            cap = cap ? cap << 1 : 64;
+            mp_sync_frame *grown = realloc(frames, cap * sizeof(mp_sync_frame));
+            if (!grown) goto error;
+            frames = grown;
+        }
+
+        mp_sync_frame *f = &frames[n];
+        f->opos.pos = a;
+        f->chunk = NULL;
+
+        if (a == LOG_RESET || b == LOG_DROP) {
+            n++;
+            continue;
+        }
+
+        const mp_csize size = {.size = (uint16_t) b};
+        if (b > UINT16_MAX || !mp_stream_valid(&shape, f->opos, size)) goto error;
+
+        f->chunk = mp_pool_get(matx->pool);
+        if (!f->chunk) goto error;
+        n++;
+
+        f->chunk->opos = f->opos;
+        mp_chunk_set_size(f->chunk, size);
+        if (mp_chunk_recv(f->chunk, fd) < 0) goto error;
+    }
+
+    const int32_t ret = mp_sync_apply(matx, shape.size, frames, n);
+    mp_sync_discard(matx, frames, n);
+    return ret;
+
+error:
+    mp_sync_discard(matx, frames, n);
+    return -1;
+}
+
+/**
+ * Apply all segments of the log fd to matx.
+ */
+int64_t
+mp_matrix_log_replay(mp_matrix *matx, const int32_t fd) {
+    if (!matx || fd == -1) return -1;
+
+    uint8_t head[STREAM_FRAME];
+    int64_t segments = 0;
+
+    while (1) {
+        /* clean EOF is only allowed between segments */
+        int64_t ret;
+        do ret = read(fd, head, STREAM_FRAME);
+        while (ret == -1 && errno == EINTR);
+
+        if (ret == 0) return segments;
+        if (ret < 0) return -1;
+        if (ret < STREAM_FRAME &&
+            mp_stream_read(fd, head + ret, STREAM_FRAME - (uint64_t) ret) < 0) return -1;
+
+        if (mp_sync_replay_segment(matx, fd, head) < 0) return -1;
+        segments++;
+    }
+}
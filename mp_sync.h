@@ -0,0 +1,120 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_sync.h
+ *  Description:  Incremental persistence of dirty chunks.
+ *
+ *  Every write path stamps the chunk with matx->gen (see
+ *  mp_matrix_chunk_touch()); a sync writes the chunks stamped after the
+ *  previous one and opens a new generation:
+ *
+ *      gen:     1        2        3
+ *      writes   a b      b c      -
+ *      sync        └─ a b  └─ b c
+ *
+ *  Two targets are supported:
+ *
+ *   - mp_matrix_sync_dirty(): rewrite dirty tiles of a tiled file in
+ *     place and punch holes for dropped chunks
+ *   - mp_matrix_sync_log(): append a delta segment to a log
+ *
+ *  Log segments use the chunk-stream framing of mp_stream.h:
+ *
+ *      [ msize header ]
+ *      [ LOG_RESET | 0 ]                        full segment only
+ *      [ opos | LOG_DROP ]                      per dropped chunk
+ *      [ opos | csize ] [ chunk payload ]       per dirty chunk
+ *      [ MP_STREAM_END | generation ]
+ *
+ *  Notes:
+ *   - Dirty state is relative to the backing file (chunks loaded from it
+ *     are clean) or to the last sync target. A matrix without backing
+ *     file is written completely on its first sync, as is a tiled file
+ *     whose header does not match the matrix size
+ *   - A segment is complete only once its END frame is on disk;
+ *     mp_matrix_log_replay() applies a segment only after reading its
+ *     END frame, and rejects a torn tail without applying any of it
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_SYNC_H
+#define QDEEP_MATRIXP_SYNC_H
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Log format
+ * ============================================================================
+ */
+
+/** opos value of the frame that clears the matrix before a full segment */
+#define LOG_RESET (UINT64_MAX - 1)
+
+/** csize value of a dropped chunk frame (no payload) */
+#define LOG_DROP ((uint64_t) UINT16_MAX + 1)
+
+
+/* ============================================================================
+ *  API
+ * ============================================================================
+ */
+
+/**
+ * Check whether chunk was modified since the last sync of matx.
+ */
+static __inline__ int32_t
+mp_matrix_chunk_dirty(const mp_matrix *matx, const mp_chunk *chunk) {
+    return chunk->gen > matx->synced;
+}
+
+/**
+ * Write the dirty chunks of matx to the tiled file fd and sync it.
+ *
+ * Tiles of dropped chunks become holes (zero tiles where the filesystem
+ * cannot punch). A file of a different size, or not yet in tiled
+ * format, is rewritten completely.
+ *
+ * Returns:
+ *   Number of tiles written, or -1 on I/O failure (the dirty state is
+ *   kept, so the sync can be retried)
+ */
+int64_t
+mp_matrix_sync_dirty(mp_matrix *matx, int32_t fd);
+
+/**
+ * Append a delta segment of the dirty chunks of matx to the log fd.
+ *
+ * fd should be opened with O_APPEND; the segment is fdatasync'ed.
+ *
+ * Returns:
+ *   Number of chunks written, or -1 on I/O failure
+ */
+int64_t
+mp_matrix_sync_log(mp_matrix *matx, int32_t fd);
+
+/**
+ * Apply all segments of the log fd (from its current offset) to matx.
+ *
+ * Returns:
+ *   Number of segments applied, or -1 on read failure, malformed or
+ *   torn segment, or allocation failure (segments before the failing
+ *   one stay applied)
+ */
+int64_t
+mp_matrix_log_replay(mp_matrix *matx, int32_t fd);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_SYNC_H */
@@ -0,0 +1,842 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_xbench.c
+ *  Description:  End-to-end matrix transfer benchmark.
+ *
+ *  Usage:
+ *      mp_xbench [-f csv|json] [-M max_mib] [-d dir] [-s unix|tcp|all]
+ *                [splice|rw|vmsplice|uring ...]
+ *
+ *  For every matrix size from 1 MiB up to max_mib (default 1024) in
+ *  steps of ten, every socket type and every transport, a sender process
+ *  streams a flat matrix file through a connected socket into a receiver
+ *  process, which writes it to a flat matrix file of its own:
+ *
+ *      splice     mp_matrix_send() / mp_matrix_recv() (mp_splice.h:
+ *                 sendfile() out, splice() through a pipe in)
+ *      rw         pread() + write() / read() + pwrite(), XBENCH_BUF at
+ *                 a time
+ *      vmsplice   file mapping → vmsplice() → pipe → splice() → socket,
+ *                 and socket → splice() → pipe → vmsplice() → mapping
+ *      uring      io_uring (raw system calls), XBENCH_DEPTH linked
+ *                 read → send / recv → write pairs per io_uring_enter()
+ *
+ *  All transports use the wire format of mp_matrix_send(). Each process
+ *  counts its own data-moving system calls and CPU time (getrusage);
+ *  the time of a run goes from the sender's start to the receiver's
+ *  last write. One row per run goes to stdout, as CSV or JSON:
+ *
+ *      transport, socket, bytes, ns, gb_s, syscalls_gb,
+ *      send_cpu_s_gb, recv_cpu_s_gb, pipe_bytes, sndbuf, rcvbuf
+ *
+ *  (GB = 10^9 bytes; pipe_bytes is the pipe capacity of the splice
+ *  based transports, sndbuf / rcvbuf the socket buffer sizes.)
+ *
+ *  Notes:
+ *   - Both files live in dir (default /tmp) and are unlinked right
+ *     away; a run needs twice the matrix size of free space there
+ *   - The source file is written just before, so it comes from the
+ *     page cache
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mp_matrix.h"
+#include "mp_splice.h"
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/** Buffer of the read/write and io_uring transports */
+#define XBENCH_BUF (1u << 20)
+
+/** Buffers in flight per io_uring_enter() */
+#define XBENCH_DEPTH 8
+
+/** Matrix width: sizes vary by row count, rows are 32 KiB */
+#define XBENCH_COLS 4096
+
+/** Transports */
+#define XBENCH_SPLICE   0
+#define XBENCH_RW       1
+#define XBENCH_VMSPLICE 2
+#define XBENCH_URING    3
+#define XBENCH_PATHS    4
+
+
+/* ============================================================================
+ *  Accounting
+ * ============================================================================
+ */
+
+/**
+ * What one side of a run reports.
+ */
+typedef struct mp_xbench_side {
+    uint64_t end;       /**< CLOCK_MONOTONIC when done */
+    uint64_t syscalls;  /**< Data-moving system calls */
+    uint64_t cpu;       /**< User + system time, ns */
+    uint64_t pipe;      /**< Pipe capacity used, 0 if none */
+    int32_t failed;
+} mp_xbench_side;
+
+static const char *const transports[XBENCH_PATHS] = {"splice", "rw", "vmsplice", "uring"};
+static uint8_t json;
+static uint64_t nrows;
+
+static uint64_t
+mp_xbench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t
+mp_xbench_cpu(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ((uint64_t) ru.ru_utime.tv_sec + (uint64_t) ru.ru_stime.tv_sec) * 1000000000ull +
+           ((uint64_t) ru.ru_utime.tv_usec + (uint64_t) ru.ru_stime.tv_usec) * 1000ull;
+}
+
+/**
+ * System calls issued by mp_splice_copy() so far, all paths.
+ */
+static uint64_t
+mp_xbench_splice_calls(void) {
+    uint64_t n = 0;
+    for (uint32_t path = 0; path < MP_SPLICE_PATHS; path++) {
+        mp_splice_stat stat;
+        mp_splice_stats(path, &stat);
+        n += stat.syscalls;
+    }
+    return n;
+}
+
+static uint64_t
+mp_xbench_bytes(const mp_msize size) {
+    return size.x * size.y * sizeof(int64_t);
+}
+
+
+/* ============================================================================
+ *  Wire helpers
+ * ============================================================================
+ */
+
+static int32_t
+mp_xbench_write(const int32_t fd, const uint8_t *buf, uint64_t len, uint64_t *syscalls) {
+    while (len > 0) {
+        const int64_t ret = write(fd, buf, len);
+        *syscalls += 1;
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        buf += ret;
+        len -= (uint64_t) ret;
+    }
+    return 0;
+}
+
+static int32_t
+mp_xbench_read(const int32_t fd, uint8_t *buf, uint64_t len, uint64_t *syscalls) {
+    while (len > 0) {
+        const int64_t ret = read(fd, buf, len);
+        *syscalls += 1;
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        buf += ret;
+        len -= (uint64_t) ret;
+    }
+    return 0;
+}
+
+/**
+ * Matrix size header, as mp_matrix_send() writes it (big endian x, y).
+ */
+static int32_t
+mp_xbench_put_header(const int32_t fd, const mp_msize size, uint64_t *syscalls) {
+    uint64_t hdr[2] = {htobe64(size.x), htobe64(size.y)};
+    return mp_xbench_write(fd, (const uint8_t *) hdr, sizeof(hdr), syscalls);
+}
+
+/**
+ * Read the size header and size the destination matrix accordingly.
+ */
+static int32_t
+mp_xbench_get_header(mp_matrix *dst, const int32_t fd, uint64_t *syscalls) {
+    uint64_t hdr[2];
+    if (mp_xbench_read(fd, (uint8_t *) hdr, sizeof(hdr), syscalls) < 0) return -1;
+    return mp_matrix_set_size(dst, (mp_msize){be64toh(hdr[0]), be64toh(hdr[1])});
+}
+
+
+/* ============================================================================
+ *  splice / read-write
+ * ============================================================================
+ */
+
+static int32_t
+mp_xbench_splice_send(mp_matrix *src, const int32_t fd, mp_xbench_side *side) {
+    const uint64_t before = mp_xbench_splice_calls();
+    const int32_t ret = mp_matrix_send(src, fd);
+
+    /* header write + the copy engine */
+    side->syscalls += 1 + mp_xbench_splice_calls() - before;
+    return ret;
+}
+
+static int32_t
+mp_xbench_splice_recv(mp_matrix *dst, const int32_t fd, mp_xbench_side *side) {
+    const uint64_t before = mp_xbench_splice_calls();
+    const int32_t ret = mp_matrix_recv(dst, fd);
+
+    side->syscalls += 1 + mp_xbench_splice_calls() - before;
+
+    /* the pipe the copy engine used is back in its pool */
+    int32_t pipefd[2];
+    side->pipe = mp_splice_pipe_get(pipefd);
+    if (side->pipe) mp_splice_pipe_put(pipefd, (uint32_t) side->pipe, 0);
+    return ret;
+}
+
+static int32_t
+mp_xbench_rw_send(mp_matrix *src, const int32_t fd, mp_xbench_side *side) {
+    const uint64_t total = mp_xbench_bytes(src->size);
+    uint8_t *buf = malloc(XBENCH_BUF);
+    int32_t ret = buf ? mp_xbench_put_header(fd, src->size, &side->syscalls) : -1;
+
+    for (uint64_t off = 0; ret == 0 && off < total;) {
+        const uint64_t len = total - off < XBENCH_BUF ? total - off : XBENCH_BUF;
+        const int64_t got = pread(src->fd, buf, len, (off_t) (sizeof(mp_msize) + off));
+        side->syscalls += 1;
+
+        if (got <= 0) ret = -1;
+        else ret = mp_xbench_write(fd, buf, (uint64_t) got, &side->syscalls);
+        off += got > 0 ? (uint64_t) got : 0;
+    }
+
+    free(buf);
+    return ret;
+}
+
+static int32_t
+mp_xbench_rw_recv(mp_matrix *dst, const int32_t fd, mp_xbench_side *side) {
+    uint8_t *buf = malloc(XBENCH_BUF);
+    int32_t ret = buf ? mp_xbench_get_header(dst, fd, &side->syscalls) : -1;
+    const uint64_t total = mp_xbench_bytes(dst->size);
+
+    for (uint64_t off = 0; ret == 0 && off < total;) {
+        const uint64_t len = total - off < XBENCH_BUF ? total - off : XBENCH_BUF;
+        const int64_t got = read(fd, buf, len);
+        side->syscalls += 1;
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+
+        for (int64_t done = 0; done < got;) {
+            const int64_t put = pwrite(dst->fd, buf + done, (uint64_t) (got - done),
+                                       (off_t) (sizeof(mp_msize) + off + (uint64_t) done));
+            side->syscalls += 1;
+            if (put <= 0) {
+                ret = -1;
+                break;
+            }
+            done += put;
+        }
+        off += (uint64_t) got;
+    }
+
+    free(buf);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  vmsplice
+ * ============================================================================
+ */
+
+static int32_t
+mp_xbench_vmsplice_send(mp_matrix *src, const int32_t fd, mp_xbench_side *side) {
+    const uint64_t total = mp_xbench_bytes(src->size);
+    const uint64_t len = sizeof(mp_msize) + total;
+
+    uint8_t *map = mmap(NULL, len, PROT_READ, MAP_SHARED, src->fd, 0);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, len, MADV_SEQUENTIAL);
+
+    int32_t pipefd[2];
+    const uint32_t cap = mp_splice_pipe_get(pipefd);
+    side->pipe = cap;
+
+    int32_t ret = cap ? mp_xbench_put_header(fd, src->size, &side->syscalls) : -1;
+    for (uint64_t off = 0; ret == 0 && off < total;) {
+        struct iovec iov = {map + sizeof(mp_msize) + off, total - off < cap ? total - off : cap};
+        const int64_t in = vmsplice(pipefd[1], &iov, 1, 0);
+        side->syscalls += 1;
+        if (in <= 0) {
+            ret = -1;
+            break;
+        }
+
+        for (int64_t out = 0; out < in;) {
+            const int64_t n = splice(pipefd[0], NULL, fd, NULL, (uint64_t) (in - out),
+                                     SPLICE_F_MOVE | SPLICE_F_MORE);
+            side->syscalls += 1;
+            if (n <= 0) {
+                ret = -1;
+                break;
+            }
+            out += n;
+        }
+        off += (uint64_t) in;
+    }
+
+    if (cap) mp_splice_pipe_put(pipefd, cap, ret != 0);
+    munmap(map, len);
+    return ret;
+}
+
+static int32_t
+mp_xbench_vmsplice_recv(mp_matrix *dst, const int32_t fd, mp_xbench_side *side) {
+    if (mp_xbench_get_header(dst, fd, &side->syscalls) < 0) return -1;
+
+    const uint64_t total = mp_xbench_bytes(dst->size);
+    const uint64_t len = sizeof(mp_msize) + total;
+
+    uint8_t *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, dst->fd, 0);
+    if (map == MAP_FAILED) return -1;
+
+    int32_t pipefd[2];
+    const uint32_t cap = mp_splice_pipe_get(pipefd);
+    side->pipe = cap;
+
+    int32_t ret = cap ? 0 : -1;
+    for (uint64_t off = 0; ret == 0 && off < total;) {
+        const int64_t in = splice(fd, NULL, pipefd[1], NULL, total - off < cap ? total - off : cap,
+                                  SPLICE_F_MOVE | SPLICE_F_MORE);
+        side->syscalls += 1;
+        if (in <= 0) {
+            ret = -1;
+            break;
+        }
+
+        for (int64_t out = 0; out < in;) {
+            struct iovec iov = {map + sizeof(mp_msize) + off + (uint64_t) out, (uint64_t) (in - out)};
+            const int64_t n = vmsplice(pipefd[0], &iov, 1, 0);
+            side->syscalls += 1;
+            if (n <= 0) {
+                ret = -1;
+                break;
+            }
+            out += n;
+        }
+        off += (uint64_t) in;
+    }
+
+    if (cap) mp_splice_pipe_put(pipefd, cap, ret != 0);
+    munmap(map, len);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  io_uring
+ * ============================================================================
+ */
+
+/**
+ * Submission and completion rings of an io_uring instance.
+ */
+typedef struct mp_xbench_ring {
+    int32_t fd;
+    uint32_t *sq_tail, *sq_mask, *sq_array;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq, *cq;
+    uint64_t sq_len, cq_len, sqes_len;
+} mp_xbench_ring;
+
+static void
+mp_xbench_ring_free(mp_xbench_ring *ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq && ring->cq != ring->sq) munmap(ring->cq, ring->cq_len);
+    if (ring->sq) munmap(ring->sq, ring->sq_len);
+    if (ring->fd >= 0) close(ring->fd);
+}
+
+static int32_t
+mp_xbench_ring_init(mp_xbench_ring *ring, const uint32_t entries) {
+    struct io_uring_params p;
+    __builtin_memset(&p, 0, sizeof(p));
+    __builtin_memset(ring, 0, sizeof(*ring));
+
+    ring->fd = (int32_t) syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) return -1;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq == MAP_FAILED) ring->sq = NULL;
+
+    ring->cq = p.features & IORING_FEAT_SINGLE_MMAP ? ring->sq :
+        mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq == MAP_FAILED) ring->cq = NULL;
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+
+    if (!ring->sq || !ring->cq || !ring->sqes) {
+        mp_xbench_ring_free(ring);
+        return -1;
+    }
+
+    uint8_t *sq = ring->sq, *cq = ring->cq;
+    ring->sq_tail = (uint32_t *) (sq + p.sq_off.tail);
+    ring->sq_mask = (uint32_t *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (uint32_t *) (sq + p.sq_off.array);
+    ring->cq_head = (uint32_t *) (cq + p.cq_off.head);
+    ring->cq_tail = (uint32_t *) (cq + p.cq_off.tail);
+    ring->cq_mask = (uint32_t *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * Submit sqes[0 .. n) as one linked chain and wait for all n
+ * completions: res[user_data] receives each result (-ECANCELED for the
+ * rest of a broken chain).
+ */
+static int32_t
+mp_xbench_ring_run(mp_xbench_ring *ring, const uint32_t n, int32_t *res, uint64_t *syscalls) {
+    const uint32_t tail = *ring->sq_tail;
+    for (uint32_t i = 0; i < n; i++) {
+        ring->sqes[i].flags = i + 1 < n ? IOSQE_IO_LINK : 0;
+        ring->sq_array[(tail + i) & *ring->sq_mask] = i;
+    }
+    __atomic_store_n(ring->sq_tail, tail + n, __ATOMIC_RELEASE);
+
+    uint32_t submit = n;
+    for (uint32_t done = 0; done < n;) {
+        const int64_t ret = syscall(__NR_io_uring_enter, ring->fd, submit, n - done,
+                                    IORING_ENTER_GETEVENTS, NULL, 0);
+        *syscalls += 1;
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        submit = 0;
+
+        uint32_t head = *ring->cq_head;
+        const uint32_t end = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != end; head++, done++) {
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            res[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void
+mp_xbench_sqe(struct io_uring_sqe *sqe, const uint8_t op, const int32_t fd, void *buf,
+              const uint32_t len, const uint64_t off, const uint64_t data) {
+    __builtin_memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+    sqe->user_data = data;
+
+    /* socket ops take no offset; MSG_WAITALL keeps them from coming back short */
+    if (op == IORING_OP_SEND || op == IORING_OP_RECV) sqe->msg_flags = MSG_WAITALL;
+    else sqe->off = off;
+}
+
+/**
+ * Copy total bytes with XBENCH_DEPTH linked (input → output) pairs per
+ * submission. Whatever a short or failed output leaves in a buffer is
+ * completed synchronously, so the stream stays in order.
+ */
+static int32_t
+mp_xbench_uring_copy(const uint8_t in_op, const int32_t in_fd, const uint64_t in_base,
+                     const uint8_t out_op, const int32_t out_fd, const uint64_t out_base,
+                     const uint64_t total, mp_xbench_side *side) {
+    mp_xbench_ring ring;
+    if (mp_xbench_ring_init(&ring, 2 * XBENCH_DEPTH) < 0) return -1;
+
+    uint8_t *buf = malloc((uint64_t) XBENCH_DEPTH * XBENCH_BUF);
+    int32_t res[2 * XBENCH_DEPTH];
+    uint32_t len[XBENCH_DEPTH];
+    int32_t ret = buf ? 0 : -1;
+
+    for (uint64_t off = 0; ret == 0 && off < total;) {
+        uint32_t k = 0;
+        for (uint64_t pos = off; k < XBENCH_DEPTH && pos < total; k++) {
+            len[k] = total - pos < XBENCH_BUF ? (uint32_t) (total - pos) : XBENCH_BUF;
+            uint8_t *b = buf + (uint64_t) k * XBENCH_BUF;
+
+            mp_xbench_sqe(&ring.sqes[2 * k], in_op, in_fd, b, len[k], in_base + pos, 2 * k);
+            mp_xbench_sqe(&ring.sqes[2 * k + 1], out_op, out_fd, b, len[k], out_base + pos, 2 * k + 1);
+            pos += len[k];
+        }
+
+        if (mp_xbench_ring_run(&ring, 2 * k, res, &side->syscalls) < 0) {
+            ret = -1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < k; i++) {
+            const int32_t got = res[2 * i], put = res[2 * i + 1];
+            if (got == (int32_t) len[i] && put == (int32_t) len[i]) {
+                off += len[i];
+                continue;
+            }
+
+            /* chain broken here: finish this buffer by hand, resubmit the rest */
+            if (i + 1 < k && res[2 * i + 2] != -ECANCELED) {
+                ret = -1; /* the chain went on: the stream is out of order */
+                break;
+            }
+            if (got <= 0) {
+                if (got != -EINTR && got != -EAGAIN) ret = -1;
+                break;
+            }
+            const uint32_t done = put > 0 ? (uint32_t) put : 0;
+            const uint8_t *b = buf + (uint64_t) i * XBENCH_BUF;
+            if (out_op == IORING_OP_WRITE && out_base) {
+                for (uint32_t d = done; ret == 0 && d < (uint32_t) got;) {
+                    const int64_t n = pwrite(out_fd, b + d, (uint32_t) got - d, (off_t) (out_base + off + d));
+                    side->syscalls += 1;
+                    if (n <= 0) ret = -1;
+                    else d += (uint32_t) n;
+                }
+            } else {
+                ret = mp_xbench_write(out_fd, b + done, (uint32_t) got - done, &side->syscalls);
+            }
+            off += (uint32_t) got;
+            break;
+        }
+    }
+
+    free(buf);
+    mp_xbench_ring_free(&ring);
+    return ret;
+}
+
+static int32_t
+mp_xbench_uring_send(mp_matrix *src, const int32_t fd, mp_xbench_side *side) {
+    if (mp_xbench_put_header(fd, src->size, &side->syscalls) < 0) return -1;
+
+    return mp_xbench_uring_copy(IORING_OP_READ, src->fd, sizeof(mp_msize),
+                                IORING_OP_SEND, fd, 0, mp_xbench_bytes(src->size), side);
+}
+
+static int32_t
+mp_xbench_uring_recv(mp_matrix *dst, const int32_t fd, mp_xbench_side *side) {
+    if (mp_xbench_get_header(dst, fd, &side->syscalls) < 0) return -1;
+
+    return mp_xbench_uring_copy(IORING_OP_RECV, fd, 0,
+                                IORING_OP_WRITE, dst->fd, sizeof(mp_msize), mp_xbench_bytes(dst->size), side);
+}
+
+
+/* ============================================================================
+ *  Runs
+ * ============================================================================
+ */
+
+typedef int32_t (*mp_xbench_fn)(mp_matrix *matx, int32_t fd, mp_xbench_side *side);
+
+static const mp_xbench_fn senders[XBENCH_PATHS] = {
+    mp_xbench_splice_send, mp_xbench_rw_send, mp_xbench_vmsplice_send, mp_xbench_uring_send,
+};
+
+static const mp_xbench_fn receivers[XBENCH_PATHS] = {
+    mp_xbench_splice_recv, mp_xbench_rw_recv, mp_xbench_vmsplice_recv, mp_xbench_uring_recv,
+};
+
+/**
+ * Connected stream pair: fds[0] receives, fds[1] sends.
+ */
+static int32_t
+mp_xbench_connect(const uint8_t tcp, int32_t fds[2]) {
+    if (!tcp) return socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+
+    const int32_t lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) return -1;
+
+    struct sockaddr_in addr = {0};
+    socklen_t alen = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fds[0] = fds[1] = -1;
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == 0 && listen(lfd, 1) == 0 &&
+        getsockname(lfd, (struct sockaddr *) &addr, &alen) == 0) {
+        fds[1] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fds[1] >= 0 && connect(fds[1], (struct sockaddr *) &addr, sizeof(addr)) == 0)
+            fds[0] = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+    }
+    close(lfd);
+
+    if (fds[0] < 0) {
+        if (fds[1] >= 0) close(fds[1]);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Receiver process: write the matrix from fd into a file of its own and
+ * report through the result pipe.
+ */
+static void
+mp_xbench_receiver(const uint32_t path, const char *dir, const int32_t fd, const int32_t report) {
+    mp_xbench_side side = {0};
+    char name[4096];
+
+    /* pipes pooled by the parent are shared with it: never reuse them */
+    mp_splice_cleanup();
+    snprintf(name, sizeof(name), "%s/mp_xbench.%d.dst", dir, getpid());
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix dst;
+    mp_matrix_init(&dst, &pool);
+    side.failed = mp_matrix_set_file(&dst, name) < 0;
+    unlink(name);
+
+    uint64_t unused = 0;
+    uint8_t ready = 1;
+    mp_xbench_write(report, &ready, 1, &unused);
+
+    const uint64_t cpu = mp_xbench_cpu();
+    if (!side.failed) side.failed = receivers[path](&dst, fd, &side) < 0;
+    side.end = mp_xbench_now();
+    side.cpu = mp_xbench_cpu() - cpu;
+
+    mp_xbench_write(report, (const uint8_t *) &side, sizeof(side), &unused);
+    _exit(0);
+}
+
+static void
+mp_xbench_emit(const char *transport, const char *socket, const uint64_t bytes, const uint64_t ns,
+               const mp_xbench_side *send, const mp_xbench_side *recv, const int32_t sndbuf,
+               const int32_t rcvbuf) {
+    const double gb = (double) bytes / 1e9;
+    const double gb_s = ns ? gb * 1e9 / (double) ns : 0.0;
+    const double sys_gb = (double) (send->syscalls + recv->syscalls) / gb;
+    const double scpu = (double) send->cpu / 1e9 / gb;
+    const double rcpu = (double) recv->cpu / 1e9 / gb;
+    const uint64_t pipe = send->pipe > recv->pipe ? send->pipe : recv->pipe;
+
+    if (json) {
+        printf("%s\n  {\"transport\": \"%s\", \"socket\": \"%s\", \"bytes\": %lu, \"ns\": %lu, "
+               "\"gb_s\": %.3f, \"syscalls_gb\": %.0f, \"send_cpu_s_gb\": %.4f, \"recv_cpu_s_gb\": %.4f, "
+               "\"pipe_bytes\": %lu, \"sndbuf\": %d, \"rcvbuf\": %d}",
+               nrows ? "," : "[", transport, socket, bytes, ns, gb_s, sys_gb, scpu, rcpu, pipe, sndbuf, rcvbuf);
+    } else {
+        if (!nrows) printf("transport,socket,bytes,ns,gb_s,syscalls_gb,send_cpu_s_gb,recv_cpu_s_gb,"
+                           "pipe_bytes,sndbuf,rcvbuf\n");
+        printf("%s,%s,%lu,%lu,%.3f,%.0f,%.4f,%.4f,%lu,%d,%d\n",
+               transport, socket, bytes, ns, gb_s, sys_gb, scpu, rcpu, pipe, sndbuf, rcvbuf);
+    }
+    nrows += 1;
+    fflush(stdout);
+}
+
+/**
+ * One transfer of src over a fresh connection.
+ */
+static int32_t
+mp_xbench_run(mp_matrix *src, const uint32_t path, const uint8_t tcp, const char *dir) {
+    int32_t fds[2], report[2];
+    if (mp_xbench_connect(tcp, fds) < 0) return -1;
+    if (pipe2(report, O_CLOEXEC) < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    int32_t sndbuf = 0, rcvbuf = 0;
+    socklen_t olen = sizeof(int32_t);
+    getsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, &olen);
+    olen = sizeof(int32_t);
+    getsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &rcvbuf, &olen);
+
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[1]);
+        close(report[0]);
+        mp_xbench_receiver(path, dir, fds[0], report[1]);
+    }
+    close(fds[0]);
+    close(report[1]);
+
+    mp_xbench_side send = {0}, recv = {0};
+    uint64_t unused = 0;
+    uint8_t ready;
+    int32_t ret = pid < 0 || mp_xbench_read(report[0], &ready, 1, &unused) < 0 ? -1 : 0;
+
+    if (ret == 0) {
+        const uint64_t t0 = mp_xbench_now();
+        const uint64_t cpu = mp_xbench_cpu();
+        send.failed = senders[path](src, fds[1], &send) < 0;
+        send.cpu = mp_xbench_cpu() - cpu;
+        shutdown(fds[1], SHUT_WR);
+
+        ret = mp_xbench_read(report[0], (uint8_t *) &recv, sizeof(recv), &unused);
+        if (ret == 0 && !send.failed && !recv.failed)
+            mp_xbench_emit(transports[path], tcp ? "tcp" : "unix", mp_xbench_bytes(src->size),
+                           recv.end - t0, &send, &recv, sndbuf, rcvbuf);
+        else
+            ret = -1;
+    }
+
+    close(fds[1]);
+    close(report[0]);
+    if (pid > 0) waitpid(pid, NULL, 0);
+    return ret;
+}
+
+/**
+ * Create the source matrix of about mib MiB in dir.
+ */
+static int32_t
+mp_xbench_source(mp_matrix *src, const char *dir, const uint64_t mib) {
+    char name[4096];
+    snprintf(name, sizeof(name), "%s/mp_xbench.%d.src", dir, getpid());
+
+    if (mp_matrix_set_file(src, name) < 0) return -1;
+    unlink(name);
+
+    const mp_msize size = {XBENCH_COLS, (mib << 20) / (XBENCH_COLS * sizeof(int64_t))};
+    if (mp_matrix_set_size(src, size) < 0) return -1;
+
+    /* fill it, so the payload is data and not a hole */
+    uint64_t *buf = malloc(XBENCH_BUF);
+    if (!buf) return -1;
+    for (uint64_t i = 0; i < XBENCH_BUF / sizeof(uint64_t); i++) buf[i] = i * 0x9E3779B97F4A7C15ull;
+
+    const uint64_t total = mp_xbench_bytes(size);
+    int32_t ret = 0;
+    for (uint64_t off = 0; ret == 0 && off < total; off += XBENCH_BUF) {
+        const uint64_t len = total - off < XBENCH_BUF ? total - off : XBENCH_BUF;
+        if (pwrite(src->fd, buf, len, (off_t) (sizeof(mp_msize) + off)) != (int64_t) len) ret = -1;
+    }
+    free(buf);
+    return ret;
+}
+
+
+/* ============================================================================
+ *  Main
+ * ============================================================================
+ */
+
+int
+main(const int argc, char **argv) {
+    uint64_t max_mib = 1024;
+    const char *dir = "/tmp";
+    uint8_t sockets = 1; /* bit 0: unix, bit 1: tcp */
+    uint32_t paths = 0;
+
+    for (int32_t i = 1; i < argc; i++) {
+        uint32_t known = 0;
+        for (uint32_t p = 0; p < XBENCH_PATHS; p++)
+            if (strcmp(argv[i], transports[p]) == 0) known = 1u << p;
+
+        if (known) paths |= known;
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) json = strcmp(argv[++i], "json") == 0;
+        else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) max_mib = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) dir = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            i++;
+            sockets = strcmp(argv[i], "tcp") == 0 ? 2 : strcmp(argv[i], "all") == 0 ? 3 : 1;
+        } else {
+            fprintf(stderr, "usage: %s [-f csv|json] [-M max_mib] [-d dir] [-s unix|tcp|all] "
+                            "[splice|rw|vmsplice|uring ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!paths) paths = (1u << XBENCH_PATHS) - 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int32_t failed = 0;
+    for (uint64_t mib = 1; mib <= max_mib; mib *= 10) {
+        mp_pool pool;
+        mp_pool_init(&pool);
+
+        mp_matrix src;
+        mp_matrix_init(&src, &pool);
+        if (mp_xbench_source(&src, dir, mib) < 0) {
+            fprintf(stderr, "mp_xbench: cannot create a %lu MiB matrix in %s\n", mib, dir);
+            failed = 1;
+        }
+
+        for (uint32_t path = 0; !failed && path < XBENCH_PATHS; path++) {
+            if (!(paths & (1u << path))) continue;
+            for (uint8_t tcp = 0; tcp < 2; tcp++) {
+                if (!(sockets & (1u << tcp))) continue;
+                if (mp_xbench_run(&src, path, tcp, dir) == 0) continue;
+
+                fprintf(stderr, "mp_xbench: %s over %s failed at %lu MiB\n",
+                        transports[path], tcp ? "tcp" : "unix", mib);
+                failed = 1;
+            }
+        }
+
+        if (src.fd != -1) close(src.fd);
+        src.fd = -1;
+        mp_matrix_free(&src);
+        mp_pool_free(&pool);
+        if (failed) break;
+    }
+
+    if (json && nrows) printf("\n]\n");
+    mp_splice_cleanup();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,364 @@
+#include "mp_xfer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mp_splice.h"
+#include "mp_stats.h"
+
+
+/* ============================================================================
+ *  Internal setup helpers
+ * ============================================================================
+ */
+
+/**
+ * Reset common state of a transfer.
+ */
+static void
+mp_xfer_reset(mp_xfer *xfer, const uint8_t kind) {
+    xfer->kind = kind;
+    xfer->phase = 0;
+    xfer->events = 0;
+    xfer->wait = -1;
+
+    xfer->pipe[0] = -1;
+    xfer->pipe[1] = -1;
+    xfer->cap = 0;
+    xfer->piped = 0;
+
+    xfer->matx = NULL;
+    xfer->tail = 0;
+}
+
+/**
+ * Point the strided cursor at a region.
+ */
+static void
+mp_xfer_region(mp_xfer *xfer, const int32_t fd, uint8_t *ptr,
+               const uint64_t len, const uint64_t stride, const uint64_t rows) {
+    xfer->fd = fd;
+    xfer->ptr = ptr;
+    xfer->off = 0;
+    xfer->len = len;
+    xfer->stride = stride;
+    xfer->rows = rows;
+    xfer->remain = len * rows;
+}
+
+/**
+ * Point the strided cursor at a chunk payload.
+ */
+static void
+mp_xfer_chunk(mp_xfer *xfer, const mp_chunk *chunk, const int32_t fd) {
+    constexpr uint64_t size_d = sizeof(int64_t);
+
+    mp_xfer_region(xfer, fd, (uint8_t *) chunk->data,
+                   (chunk->size.dim.x + 1) * size_d,
+                   CHUNK_W * size_d,
+                   chunk->size.dim.y + 1);
+}
+
+
+/* ============================================================================
+ *  Transfer setup
+ * ============================================================================
+ */
+
+/**
+ * Prepare a resumable receive of chunk->data from fd.
+ * Chunk size must be set before this function.
+ */
+void
+mp_xfer_chunk_recv(mp_xfer *xfer, const mp_chunk *chunk, const int32_t fd) {
+    mp_xfer_reset(xfer, MP_XFER_RECV);
+    mp_xfer_chunk(xfer, chunk, fd);
+}
+
+/**
+ * Prepare a resumable send of chunk->data to fd.
+ * Chunk size must be set before this function.
+ */
+void
+mp_xfer_chunk_send(mp_xfer *xfer, const mp_chunk *chunk, const int32_t fd) {
+    mp_xfer_reset(xfer, MP_XFER_SEND);
+    mp_xfer_chunk(xfer, chunk, fd);
+}
+
+/**
+ * Prepare a resumable splice of bytes from fd_f to fd_t.
+ *
+ * The pipe comes from the splice engine pool and is already grown
+ * to the system maximum.
+ *
+ * @return  0 on success
+ * @return -1 if no pipe could be obtained
+ */
+int32_t
+mp_xfer_splice(mp_xfer *xfer, const int32_t fd_f, const loff_t pos_f,
+               const int32_t fd_t, const loff_t pos_t, const uint64_t bytes) {
+    mp_xfer_reset(xfer, MP_XFER_SPLICE);
+
+    xfer->fd_f = fd_f;
+    xfer->fd_t = fd_t;
+    xfer->pos_f = pos_f;
+    xfer->pos_t = pos_t;
+    xfer->remain = bytes;
+
+    xfer->cap = mp_splice_pipe_get(xfer->pipe);
+    if (xfer->cap) return 0;
+
+    xfer->pipe[0] = -1;
+    xfer->pipe[1] = -1;
+    return -1;
+}
+
+/**
+ * Prepare a resumable receive of a full matrix (header + payload).
+ */
+void
+mp_xfer_matrix_recv(mp_xfer *xfer, mp_matrix *matx, const int32_t fd) {
+    mp_xfer_reset(xfer, MP_XFER_MATRIX_RECV);
+    mp_xfer_region(xfer, fd, xfer->hdr, sizeof(xfer->hdr), 0, 1);
+    xfer->matx = matx;
+}
+
+/**
+ * Prepare a resumable send of a full matrix (header + payload).
+ */
+void
+mp_xfer_matrix_send(mp_xfer *xfer, mp_matrix *matx, const int32_t fd) {
+    const uint64_t x = htobe64(matx->size.x);
+    const uint64_t y = htobe64(matx->size.y);
+
+    mp_xfer_reset(xfer, MP_XFER_MATRIX_SEND);
+
+    /* pack */
+    __builtin_memcpy(xfer->hdr + 0, &x, 8);
+    __builtin_memcpy(xfer->hdr + 8, &y, 8);
+
+    mp_xfer_region(xfer, fd, xfer->hdr, sizeof(xfer->hdr), 0, 1);
+    xfer->matx = matx;
+
+    /* payload is accounted up-front so remain is meaningful from the start */
+    xfer->tail = matx->size.x * matx->size.y * sizeof(int64_t);
+}
+
+
+/* ============================================================================
+ *  Progress engines
+ * ============================================================================
+ */
+
+/**
+ * Record what the transfer is waiting for.
+ */
+static int32_t
+mp_xfer_block(mp_xfer *xfer, const int32_t fd, const uint32_t events) {
+    xfer->wait = fd;
+    xfer->events = events;
+    return MP_XFER_AGAIN;
+}
+
+/**
+ * Advance a strided region with readv()/writev().
+ *
+ * Up to XFER_IOV rows are gathered per syscall; a partially moved
+ * row is resumed from xfer->off.
+ */
+static int32_t
+mp_xfer_step_region(mp_xfer *xfer, const uint8_t out) {
+    struct iovec iov[XFER_IOV];
+
+    while (xfer->rows > 0) {
+        uint32_t cnt = 0;
+        uint8_t *ptr = xfer->ptr;
+
+        iov[cnt].iov_base = ptr + xfer->off;
+        iov[cnt].iov_len = xfer->len - xfer->off;
+
+        for (cnt = 1; cnt < XFER_IOV && cnt < xfer->rows; cnt++) {
+            ptr += xfer->stride;
+            iov[cnt].iov_base = ptr;
+            iov[cnt].iov_len = xfer->len;
+        }
+
+        const int64_t ret = out ? writev(xfer->fd, iov, (int32_t) cnt)
+                                : readv(xfer->fd, iov, (int32_t) cnt);
+
+        /* Expected: positive bytes moved. ret <= 0 is unlikely. */
+        if (__builtin_expect(ret <= 0, 0)) {
+            if (ret == 0) return MP_XFER_ERROR; /* EOF */
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return mp_xfer_block(xfer, xfer->fd, out ? EPOLLOUT : EPOLLIN);
+            return MP_XFER_ERROR;
+        }
+
+        /* Advance cursor over fully and partially moved rows */
+        uint64_t n = (uint64_t) ret;
+        xfer->remain -= n;
+        mp_stats_io(out ? MP_STATS_SENT : MP_STATS_RECV, n);
+
+        while (n > 0) {
+            const uint64_t left = xfer->len - xfer->off;
+            if (n < left) {
+                xfer->off += n;
+                break;
+            }
+
+            n -= left;
+            xfer->off = 0;
+            xfer->ptr += xfer->stride;
+            xfer->rows--;
+        }
+    }
+
+    return MP_XFER_DONE;
+}
+
+/**
+ * Advance a splice transfer: fd_f -> pipe -> fd_t.
+ *
+ * The pipe is drained before it is refilled, so at most one pipe
+ * worth of data is in flight and xfer->remain counts delivered bytes.
+ */
+static int32_t
+mp_xfer_step_splice(mp_xfer *xfer) {
+    constexpr uint32_t flags = SPLICE_F_MORE | SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    while (xfer->remain > 0) {
+        /* ---- fd_f -> pipe ---- */
+        if (xfer->piped == 0) {
+            const uint64_t want = xfer->remain > xfer->cap ? xfer->cap : xfer->remain;
+            const int64_t n = splice(xfer->fd_f, xfer->pos_f < 0 ? NULL : &xfer->pos_f,
+                                     xfer->pipe[1], NULL, want, flags);
+
+            if (__builtin_expect(n <= 0, 0)) {
+                if (n == 0) return MP_XFER_ERROR; /* premature EOF */
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) return mp_xfer_block(xfer, xfer->fd_f, EPOLLIN);
+                return MP_XFER_ERROR;
+            }
+
+            xfer->piped = (uint64_t) n;
+        }
+
+        /* ---- pipe -> fd_t ---- */
+        const int64_t m = splice(xfer->pipe[0], NULL,
+                                 xfer->fd_t, xfer->pos_t < 0 ? NULL : &xfer->pos_t,
+                                 xfer->piped, flags);
+
+        if (__builtin_expect(m <= 0, 0)) {
+            if (m == 0) return MP_XFER_ERROR;
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return mp_xfer_block(xfer, xfer->fd_t, EPOLLOUT);
+            return MP_XFER_ERROR;
+        }
+
+        xfer->piped -= (uint64_t) m;
+        xfer->remain -= (uint64_t) m;
+
+        /* plain splices are local copies, not transfers */
+        if (xfer->kind != MP_XFER_SPLICE)
+            mp_stats_io(xfer->kind == MP_XFER_MATRIX_SEND ? MP_STATS_SENT : MP_STATS_RECV,
+                        (uint64_t) m);
+    }
+
+    return MP_XFER_DONE;
+}
+
+/**
+ * Advance a full matrix receive: header, resize, payload.
+ */
+static int32_t
+mp_xfer_step_matrix_recv(mp_xfer *xfer) {
+    if (xfer->phase == 0) {
+        if (xfer->matx->flags & MP_MATRIX_TILED) return MP_XFER_ERROR; /* dense only */
+
+        const int32_t ret = mp_xfer_step_region(xfer, 0);
+        if (ret != MP_XFER_DONE) return ret;
+
+        uint64_t x, y;
+        __builtin_memcpy(&x, xfer->hdr + 0, 8);
+        __builtin_memcpy(&y, xfer->hdr + 8, 8);
+
+        const mp_msize size = {be64toh(x), be64toh(y)};
+        if (mp_matrix_set_size(xfer->matx, size) < 0) return MP_XFER_ERROR;
+
+        const int32_t fd = xfer->fd;
+        mp_matrix *matx = xfer->matx;
+        if (mp_xfer_splice(xfer, fd, -1, matx->fd, sizeof(mp_msize),
+                           size.x * size.y * sizeof(int64_t)) < 0)
+            return MP_XFER_ERROR;
+
+        xfer->kind = MP_XFER_MATRIX_RECV;
+        xfer->matx = matx;
+        xfer->phase = 1;
+    }
+
+    return mp_xfer_step_splice(xfer);
+}
+
+/**
+ * Advance a full matrix send: header, payload.
+ */
+static int32_t
+mp_xfer_step_matrix_send(mp_xfer *xfer) {
+    if (xfer->phase == 0) {
+        if (xfer->matx->flags & MP_MATRIX_TILED) return MP_XFER_ERROR; /* dense only */
+
+        const int32_t ret = mp_xfer_step_region(xfer, 1);
+        if (ret != MP_XFER_DONE) return ret;
+
+        const int32_t fd = xfer->fd;
+        const uint64_t payload = xfer->tail;
+        mp_matrix *matx = xfer->matx;
+        if (mp_xfer_splice(xfer, matx->fd, sizeof(mp_msize), fd, -1, payload) < 0)
+            return MP_XFER_ERROR;
+
+        xfer->kind = MP_XFER_MATRIX_SEND;
+        xfer->matx = matx;
+        xfer->phase = 1;
+    }
+
+    return mp_xfer_step_splice(xfer);
+}
+
+
+/* ============================================================================
+ *  Public progress API
+ * ============================================================================
+ */
+
+/**
+ * Make as much progress as possible without blocking.
+ */
+int32_t
+mp_xfer_step(mp_xfer *xfer) {
+    xfer->events = 0;
+    xfer->wait = -1;
+
+    switch (xfer->kind) {
+        case MP_XFER_RECV:        return mp_xfer_step_region(xfer, 0);
+        case MP_XFER_SEND:        return mp_xfer_step_region(xfer, 1);
+        case MP_XFER_SPLICE:      return mp_xfer_step_splice(xfer);
+        case MP_XFER_MATRIX_RECV: return mp_xfer_step_matrix_recv(xfer);
+        case MP_XFER_MATRIX_SEND: return mp_xfer_step_matrix_send(xfer);
+        default:                  return MP_XFER_ERROR;
+    }
+}
+
+/**
+ * Release resources held by a transfer (splice pipe).
+ *
+ * A pipe still holding data of an aborted transfer is closed instead
+ * of going back to the pool.
+ */
+void
+mp_xfer_free(mp_xfer *xfer) {
+    if (xfer->pipe[0] != -1) mp_splice_pipe_put(xfer->pipe, xfer->cap, xfer->piped != 0);
+
+    xfer->pipe[0] = -1;
+    xfer->pipe[1] = -1;
+}
@@ -0,0 +1,238 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mp_xfer.h
+ *  Description:  Resumable (non-blocking) transfer state machines.
+ *
+ *  A transfer object captures everything needed to continue a partially
+ *  finished send / recv / splice after the descriptor returned EAGAIN:
+ *   - Strided row cursor for chunk payloads (chunk rows are not contiguous)
+ *   - Header buffer for matrix size exchange
+ *   - Pipe and in-flight byte count for splice() based copies
+ *
+ *  Usage with epoll:
+ *
+ *      mp_xfer_chunk_send(&x, chunk, fd);
+ *      while ((ret = mp_xfer_step(&x)) == MP_XFER_AGAIN)
+ *          wait for mp_xfer_events(&x) on mp_xfer_wait_fd(&x)
+ *
+ *  Design goals:
+ *   - No allocation on the hot path (splice pipes come from the
+ *     mp_splice.h pool, grown to the system maximum)
+ *   - Progress on every readiness notification, never block
+ *   - Batched readv()/writev() of chunk rows (one syscall per many rows)
+ *
+ *  Notes:
+ *   - Descriptors should be O_NONBLOCK; blocking ones also work,
+ *     mp_xfer_step() then simply runs until completion
+ *   - Wire format is identical to mp_chunk_send() / mp_matrix_send()
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#ifndef QDEEP_MATRIXP_XFER_H
+#define QDEEP_MATRIXP_XFER_H
+
+#include <sys/epoll.h>
+#include <sys/uio.h>
+
+#include "mp_chunk.h"
+#include "mp_matrix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* ============================================================================
+ *  Configuration
+ * ============================================================================
+ */
+
+/**
+ * Maximum number of chunk rows gathered into a single readv()/writev().
+ *
+ * 64 rows × 2 KB = 128 KB per syscall for a full chunk.
+ */
+#define XFER_IOV 64
+
+/** Transfer kinds */
+#define MP_XFER_RECV        0 /**< strided region <- fd        */
+#define MP_XFER_SEND        1 /**< strided region -> fd        */
+#define MP_XFER_SPLICE      2 /**< fd_f -> pipe -> fd_t        */
+#define MP_XFER_MATRIX_RECV 3 /**< msize header, then splice   */
+#define MP_XFER_MATRIX_SEND 4 /**< msize header, then splice   */
+
+/** mp_xfer_step() results */
+#define MP_XFER_DONE   0
+#define MP_XFER_AGAIN  1
+#define MP_XFER_ERROR (-1)
+
+
+/* ============================================================================
+ *  Transfer state
+ * ============================================================================
+ */
+
+/**
+ * Resumable transfer descriptor.
+ *
+ * A strided region is described as:
+ *   rows × len bytes, consecutive rows separated by stride bytes.
+ *
+ * A chunk is (dim.y + 1) rows of (dim.x + 1) int64 with stride CHUNK_W;
+ * a header is a single row.
+ */
+typedef struct mp_xfer {
+    uint8_t kind;    /**< MP_XFER_* kind */
+    uint8_t phase;   /**< Sub-phase for two-step kinds (header / payload) */
+    uint32_t events; /**< EPOLLIN / EPOLLOUT we are waiting for */
+    int32_t wait;    /**< Descriptor that returned EAGAIN */
+
+    /* --------------------------------------------------------------------
+     * Strided region cursor
+     * ------------------------------------------------------------------ */
+
+    int32_t fd;      /**< Stream descriptor */
+    uint8_t *ptr;    /**< Start of current row */
+    uint64_t off;    /**< Bytes already moved in current row */
+    uint64_t len;    /**< Row length (bytes) */
+    uint64_t stride; /**< Distance between row starts (bytes) */
+    uint64_t rows;   /**< Rows left, including current */
+
+    /* --------------------------------------------------------------------
+     * Splice state
+     * ------------------------------------------------------------------ */
+
+    int32_t fd_f;    /**< Splice source */
+    int32_t fd_t;    /**< Splice destination */
+    loff_t pos_f;    /**< Source file offset (-1 = stream position) */
+    loff_t pos_t;    /**< Destination file offset (-1 = stream position) */
+    int32_t pipe[2]; /**< Pooled pipe (-1 when not held) */
+    uint32_t cap;    /**< Pipe capacity, bytes moved per splice() round */
+    uint64_t piped;  /**< Bytes currently sitting in the pipe */
+
+    /* --------------------------------------------------------------------
+     * Accounting
+     * ------------------------------------------------------------------ */
+
+    uint64_t remain; /**< Bytes left in the current phase */
+    uint64_t tail;   /**< Bytes of later phases not yet in remain */
+
+    mp_matrix *matx; /**< Matrix for MATRIX_* kinds */
+    uint8_t hdr[16]; /**< Big-endian [ x | y ] header */
+} mp_xfer;
+
+
+/* ============================================================================
+ *  Transfer setup
+ * ============================================================================
+ */
+
+/**
+ * Prepare a resumable receive of chunk->data from fd.
+ * Chunk size must be set before this function.
+ */
+void
+mp_xfer_chunk_recv(mp_xfer *xfer, const mp_chunk *chunk, int32_t fd);
+
+/**
+ * Prepare a resumable send of chunk->data to fd.
+ * Chunk size must be set before this function.
+ */
+void
+mp_xfer_chunk_send(mp_xfer *xfer, const mp_chunk *chunk, int32_t fd);
+
+/**
+ * Prepare a resumable splice of bytes from fd_f to fd_t.
+ *
+ * @param pos_f  Source offset, or -1 to use/advance the file position.
+ * @param pos_t  Destination offset, or -1 to use/advance the file position.
+ *
+ * @return  0 on success
+ * @return -1 if no pipe could be obtained
+ */
+int32_t
+mp_xfer_splice(mp_xfer *xfer, int32_t fd_f, loff_t pos_f,
+               int32_t fd_t, loff_t pos_t, uint64_t bytes);
+
+/**
+ * Prepare a resumable receive of a full matrix (header + payload).
+ *
+ * The header is read first; the matrix is then resized through
+ * mp_matrix_set_size() and the payload spliced into matx->fd.
+ */
+void
+mp_xfer_matrix_recv(mp_xfer *xfer, mp_matrix *matx, int32_t fd);
+
+/**
+ * Prepare a resumable send of a full matrix (header + payload).
+ */
+void
+mp_xfer_matrix_send(mp_xfer *xfer, mp_matrix *matx, int32_t fd);
+
+
+/* ============================================================================
+ *  Progress
+ * ============================================================================
+ */
+
+/**
+ * Make as much progress as possible without blocking.
+ *
+ * Returns:
+ *   MP_XFER_DONE   transfer finished
+ *   MP_XFER_AGAIN  descriptor would block, wait for mp_xfer_events()
+ *   MP_XFER_ERROR  EOF or unrecoverable error (errno is set)
+ */
+int32_t
+mp_xfer_step(mp_xfer *xfer);
+
+/**
+ * Release resources held by a transfer (splice pipe).
+ * Safe to call on finished, failed or abandoned transfers.
+ */
+void
+mp_xfer_free(mp_xfer *xfer);
+
+
+/* ============================================================================
+ *  Inspection
+ * ============================================================================
+ */
+
+/**
+ * Bytes left until the transfer completes.
+ */
+static __inline__ uint64_t
+mp_xfer_remain(const mp_xfer *xfer) {
+    return xfer->remain + xfer->tail;
+}
+
+/**
+ * Epoll events the transfer is blocked on (EPOLLIN or EPOLLOUT).
+ */
+static __inline__ uint32_t
+mp_xfer_events(const mp_xfer *xfer) {
+    return xfer->events;
+}
+
+/**
+ * Descriptor the transfer is blocked on.
+ *
+ * For splice transfers this is either fd_f or fd_t depending on
+ * which side returned EAGAIN last.
+ */
+static __inline__ int32_t
+mp_xfer_wait_fd(const mp_xfer *xfer) {
+    return xfer->wait;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QDEEP_MATRIXP_XFER_H */
@@ -0,0 +1,142 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         mpd.c
+ *  Description:  Matrix Manipulation Protocol daemon.
+ *
+ *  Usage:
+ *      mpd [-p port] [-u socket_path] [-s stats_name]
+ *      mpd -w port
+ *
+ *  Without options the daemon listens on TCP port PROTO_PORT.
+ *  With -s it publishes live statistics in /dev/shm/<stats_name>
+ *  (read them with mp_stat, see mp_stats.h).
+ *  With -w it runs as a distributed GEMM worker (see mp_dist.h) and
+ *  serves one coordinator connection at a time.
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "mp_dist.h"
+#include "mp_server.h"
+#include "mp_stats.h"
+
+static mp_server server;
+static mp_stats stats;
+
+/**
+ * Worker mode: accept coordinators on a TCP port, one at a time.
+ */
+static int
+mpd_worker(const uint16_t port) {
+    const int32_t fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const int32_t one = 1;
+    if (fd == -1) return EXIT_FAILURE;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in6 addr = {0};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    addr.sin6_addr = in6addr_any;
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 1) == -1) {
+        perror("mpd: worker listen");
+        return EXIT_FAILURE;
+    }
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    while (!server.stop) {
+        const int32_t conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn == -1) continue;
+
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (mp_dist_worker(conn, &pool) < 0) fprintf(stderr, "mpd: coordinator session failed\n");
+        close(conn);
+    }
+
+    mp_pool_free(&pool);
+    close(fd);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * SIGINT / SIGTERM: leave the event loop after the current batch.
+ */
+static void
+mpd_stop(const int32_t sig) {
+    (void) sig;
+    server.stop = 1;
+}
+
+int
+main(const int argc, char **argv) {
+    int32_t port = -1;
+    int32_t worker = -1;
+    const char *path = NULL;
+    const char *stats_name = NULL;
+
+    for (int32_t i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) path = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) worker = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) stats_name = argv[++i];
+        else {
+            fprintf(stderr, "usage: %s [-p port] [-u socket_path] [-s stats_name] | -w port\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, mpd_stop);
+    signal(SIGTERM, mpd_stop);
+
+    if (worker != -1) return mpd_worker((uint16_t) worker);
+    if (port == -1 && !path) port = PROTO_PORT;
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    if (mp_server_init(&server, &pool) < 0) {
+        perror("mpd: epoll");
+        return EXIT_FAILURE;
+    }
+
+    if (port != -1 && mp_server_listen_tcp(&server, (uint16_t) port) < 0) {
+        perror("mpd: tcp listen");
+        return EXIT_FAILURE;
+    }
+
+    if (path && mp_server_listen_unix(&server, path) < 0) {
+        perror("mpd: unix listen");
+        return EXIT_FAILURE;
+    }
+
+    if (stats_name) {
+        if (mp_stats_open(&stats, stats_name) < 0) {
+            perror("mpd: stats");
+            return EXIT_FAILURE;
+        }
+        mp_server_stats(&server, &stats);
+    }
+
+    const int32_t ret = mp_server_run(&server);
+
+    mp_server_free(&server);
+    mp_pool_free(&pool);
+    if (path) unlink(path);
+    if (stats_name) mp_stats_close(&stats);
+
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
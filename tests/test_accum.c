@@ -0,0 +1,190 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_accum.c
+ *  Description:  Parallel accumulation against a naive reference
+ *                (mp_accum.h).
+ *
+ *  Workers of a scheduler add pseudo-random values into a matrix that
+ *  already holds data, half of them into a few chunks declared hot
+ *  (atomic adds in place), the rest into per-worker delta chunks. After
+ *  mp_accum_merge() every element must equal the same additions done
+ *  one by one into a flat array.
+ *
+ *  Two rounds reuse the context: the first declares more hot chunks
+ *  than the initial table holds (rehash) and includes border and absent
+ *  chunks, the second a different, smaller hot set.
+ *
+ *  Notes:
+ *   - Meant to run under ThreadSanitizer too (-DMP_SANITIZE=thread)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_accum.h"
+
+
+/** Matrix size: 4 x 4 chunks, clipped on the right and bottom border */
+#define TEST_COLS (4 * CHUNK_W - 30)
+#define TEST_ROWS (3 * CHUNK_H + 17)
+
+/** Additions per round */
+#define TEST_ADDS 400000
+
+#define TEST_WORKERS 4
+
+
+typedef struct test_round {
+    mp_accum *acc;
+    const mp_copos *hot;  /**< Hot chunks of the round */
+    uint32_t nhot;
+    uint32_t round;
+    uint32_t failed;      /**< mp_accum_add() errors */
+} test_round;
+
+
+/* ============================================================================
+ *  Additions
+ * ============================================================================
+ */
+
+static uint64_t
+test_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Addition i of a round: odd ones land in a hot chunk, even ones
+ * anywhere in the matrix.
+ */
+static void
+test_addition(const test_round *r, const uint64_t i, uint64_t *x, uint64_t *y, int64_t *v) {
+    const uint64_t h = test_mix(i * 0x9e3779b97f4a7c15ull + r->round);
+
+    if (i & 1) {
+        const mp_copos opos = r->hot[h % r->nhot];
+        const uint64_t x0 = (uint64_t) opos.dim.x << CHUNK_POW;
+        const uint64_t y0 = (uint64_t) opos.dim.y << CHUNK_POW;
+        const uint64_t w = TEST_COLS - x0 < CHUNK_W ? TEST_COLS - x0 : CHUNK_W;
+        const uint64_t hh = TEST_ROWS - y0 < CHUNK_H ? TEST_ROWS - y0 : CHUNK_H;
+
+        /* a small window, so workers collide on the same elements */
+        *x = x0 + (h >> 8) % (w < 16 ? w : 16);
+        *y = y0 + (h >> 20) % (hh < 16 ? hh : 16);
+    } else {
+        *x = (h >> 8) % TEST_COLS;
+        *y = (h >> 32) % TEST_ROWS;
+    }
+    *v = (int64_t) (h >> 48) - 32768;
+}
+
+static void
+test_add(void *arg, const uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    test_round *r = arg;
+
+    for (uint64_t i = lo; i < hi; i++) {
+        uint64_t x, y;
+        int64_t v;
+        test_addition(r, i, &x, &y, &v);
+        if (mp_accum_add(r->acc, worker, x, y, v) < 0) __atomic_fetch_add(&r->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+/* ============================================================================
+ *  Rounds
+ * ============================================================================
+ */
+
+static int32_t
+test_run(mp_accum *acc, mp_sched *sched, int64_t *ref, const uint32_t round,
+         const mp_copos *hot, const uint32_t nhot) {
+    test_round r = {acc, hot, nhot, round, 0};
+
+    for (uint32_t i = 0; i < nhot; i++)
+        if (mp_accum_hot(acc, hot[i]) < 0) return -1;
+
+    mp_sched_for(sched, TEST_ADDS, 0, test_add, &r);
+    if (r.failed || mp_accum_merge(acc) < 0) return -1;
+
+    for (uint64_t i = 0; i < TEST_ADDS; i++) {
+        uint64_t x, y;
+        int64_t v;
+        test_addition(&r, i, &x, &y, &v);
+        ref[y * TEST_COLS + x] += v;
+    }
+    return 0;
+}
+
+static uint64_t
+test_compare(mp_matrix *matx, const int64_t *ref) {
+    uint64_t wrong = 0;
+
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            if (mp_matrix_get(matx, x, y) != ref[y * TEST_COLS + x]) {
+                if (!wrong)
+                    fprintf(stderr, "test_accum: (%lu, %lu) is %ld, expected %ld\n",
+                            x, y, mp_matrix_get(matx, x, y), ref[y * TEST_COLS + x]);
+                wrong++;
+            }
+    return wrong;
+}
+
+int
+main(void) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix matx;
+    mp_matrix_init(&matx, &pool);
+    mp_matrix_set_size(&matx, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    int64_t *ref = calloc((uint64_t) TEST_COLS * TEST_ROWS, sizeof(int64_t));
+    mp_sched sched;
+    mp_accum acc;
+
+    if (!ref || mp_sched_init(&sched, TEST_WORKERS, 0) < 0 || mp_accum_init(&acc, &matx, &sched) < 0) {
+        fprintf(stderr, "test_accum: setup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    /* existing data in part of the matrix, hot chunks included */
+    for (uint64_t y = 0; y < TEST_ROWS; y += 3)
+        for (uint64_t x = 0; x < TEST_COLS / 2; x += 5) {
+            mp_matrix_put(&matx, x, y, (int64_t) (x * 31 + y));
+            ref[y * TEST_COLS + x] = (int64_t) (x * 31 + y);
+        }
+
+    /* round 1: ten hot chunks, more than ACCUM_HOT / 2, border ones too */
+    static const mp_copos hot1[] = {
+        {.dim = {0, 0}}, {.dim = {1, 1}}, {.dim = {2, 2}}, {.dim = {3, 3}}, {.dim = {3, 0}},
+        {.dim = {0, 3}}, {.dim = {1, 0}}, {.dim = {2, 1}}, {.dim = {3, 2}}, {.dim = {1, 3}},
+    };
+    static const mp_copos hot2[] = {{.dim = {2, 0}}, {.dim = {0, 2}}};
+
+    uint64_t wrong = 0;
+    int32_t ret = test_run(&acc, &sched, ref, 1, hot1, sizeof(hot1) / sizeof(hot1[0]));
+    if (ret == 0) wrong += test_compare(&matx, ref);
+
+    if (ret == 0) ret = test_run(&acc, &sched, ref, 2, hot2, sizeof(hot2) / sizeof(hot2[0]));
+    if (ret == 0) wrong += test_compare(&matx, ref);
+
+    printf("test_accum: 2 rounds of %u additions, %lu chunks, %s, %lu wrong elements\n",
+           TEST_ADDS, matx.tree.count, ret < 0 ? "failed" : "merged", wrong);
+
+    mp_accum_free(&acc);
+    mp_sched_free(&sched);
+    mp_matrix_free(&matx);
+    mp_pool_free(&pool);
+    free(ref);
+
+    return ret < 0 || wrong ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_codec.c
+ *  Description:  Encode / decode round trips of the chunk codec (mp_codec.h).
+ *
+ *  Every value pattern is encoded at a full, a single-element and a
+ *  clipped chunk size, then decoded into a poisoned chunk:
+ *
+ *   - the encoded size never exceeds mp_codec_bound()
+ *   - the effective rows come back unchanged
+ *   - input cut short by one byte is rejected
+ *   - small values actually shrink
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_codec.h"
+#include "mp_pool.h"
+
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+static const char *const test_kinds[] = {
+    "small", "random", "ramp", "negative", "constant", "extremes",
+};
+
+static uint64_t
+test_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int64_t
+test_value(const uint32_t kind, const uint32_t x, const uint32_t y) {
+    const uint64_t z = test_mix((uint64_t) kind << 48 | (uint64_t) y << 16 | x);
+
+    switch (kind) {
+        case 0:  return (int64_t) (z % 16);
+        case 1:  return (int64_t) z;
+        case 2:  return (int64_t) x * 1000 + y;
+        case 3:  return -(int64_t) (z % 100000);
+        case 4:  return 7;
+        default: return z & 1 ? INT64_MIN : INT64_MAX;
+    }
+}
+
+static void
+test_round(mp_chunk *src, mp_chunk *dst, uint8_t *buf, const uint32_t kind, const mp_csize size) {
+    mp_chunk_set_size(src, size);
+    mp_chunk_set_size(dst, size);
+
+    for (uint32_t y = 0; y <= size.dim.y; y++)
+        for (uint32_t x = 0; x <= size.dim.x; x++) src->data[CHUNK_POS(x, y)] = test_value(kind, x, y);
+
+    const uint64_t n = mp_codec_encode(src, buf);
+    TEST_CHECK(n <= mp_codec_bound(size), "%s %ux%u: %lu bytes exceed the bound",
+               test_kinds[kind], size.dim.x + 1, size.dim.y + 1, n);
+
+    __builtin_memset(dst->data, 0xAB, CHUNK_BYTES);
+    TEST_CHECK(mp_codec_decode(dst, buf, n) == 0, "%s %ux%u: decode failed",
+               test_kinds[kind], size.dim.x + 1, size.dim.y + 1);
+
+    uint64_t wrong = 0;
+    for (uint32_t y = 0; y <= size.dim.y; y++)
+        for (uint32_t x = 0; x <= size.dim.x; x++)
+            wrong += dst->data[CHUNK_POS(x, y)] != src->data[CHUNK_POS(x, y)];
+    TEST_CHECK(wrong == 0, "%s %ux%u: %lu wrong elements",
+               test_kinds[kind], size.dim.x + 1, size.dim.y + 1, wrong);
+
+    TEST_CHECK(n <= 1 || mp_codec_decode(dst, buf, n - 1) < 0, "%s %ux%u: truncated input accepted",
+               test_kinds[kind], size.dim.x + 1, size.dim.y + 1);
+
+    if (size.dim.x == CHUNK_W - 1 && size.dim.y == CHUNK_H - 1) {
+        printf("test_codec: %-8s %7lu bytes (%.1fx)\n", test_kinds[kind], n, (double) CHUNK_BYTES / (double) n);
+        if (kind == 0 || kind == 4)
+            TEST_CHECK(n * 4 <= CHUNK_BYTES, "%s: %lu bytes, expected at least 4x smaller", test_kinds[kind], n);
+    }
+}
+
+int
+main(void) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_chunk *src = mp_pool_get(&pool);
+    mp_chunk *dst = mp_pool_get(&pool);
+    uint8_t *buf = malloc(CODEC_MAX);
+
+    if (!src || !dst || !buf) {
+        fprintf(stderr, "test_codec: allocation failed\n");
+        return EXIT_FAILURE;
+    }
+
+    static const mp_csize sizes[] = {
+        {.dim = {CHUNK_W - 1, CHUNK_H - 1}},
+        {.dim = {0, 0}},
+        {.dim = {100, 37}},
+    };
+
+    for (uint32_t kind = 0; kind < sizeof(test_kinds) / sizeof(test_kinds[0]); kind++)
+        for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+            test_round(src, dst, buf, kind, sizes[i]);
+
+    free(buf);
+    mp_pool_ret(&pool, src);
+    mp_pool_ret(&pool, dst);
+    mp_pool_free(&pool);
+
+    printf("test_codec: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_cold.c
+ *  Description:  Passes over a frozen matrix (mp_cold.h).
+ *
+ *  Both operands are swept until every chunk is a placeholder, then
+ *  each pass runs straight on the cold tree and its result is compared
+ *  with the one computed while the matrices were warm:
+ *
+ *   - plain and packed chunk streams, read back with mp_stream_recv()
+ *   - local GEMM (mp_gemm())
+ *   - distributed GEMM on two local workers (mp_dist_local())
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mp_cold.h"
+#include "mp_dist.h"
+#include "mp_gemm.h"
+#include "mp_stream.h"
+
+
+#define TEST_SWEEPS 4096
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+static uint64_t
+test_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Fill a rows x cols matrix with small (well compressible) values.
+ */
+static int32_t
+test_fill(mp_matrix *matx, const uint64_t rows, const uint64_t cols, const uint64_t seed) {
+    if (mp_matrix_set_size(matx, (mp_msize){cols, rows}) < 0) return -1;
+
+    for (uint64_t y = 0; y < rows; y++)
+        for (uint64_t x = 0; x < cols; x++)
+            if (mp_matrix_put(matx, x, y, (int64_t) (test_mix(seed ^ (y << 32 | x)) % 17) - 8) < 0)
+                return -1;
+    return 0;
+}
+
+/**
+ * Sweep until every chunk of the matrix is frozen.
+ */
+static int32_t
+test_freeze(mp_cold *cold) {
+    for (uint32_t i = 0; i < TEST_SWEEPS && cold->count < cold->matx->tree.count; i++) {
+        mp_cold_sweep(cold);
+        usleep(1000);
+    }
+    return cold->count == cold->matx->tree.count ? 0 : -1;
+}
+
+static uint64_t
+test_compare(mp_matrix *got, mp_matrix *want) {
+    uint64_t wrong = 0;
+
+    if (got->size.x != want->size.x || got->size.y != want->size.y) return 1;
+
+    for (uint64_t y = 0; y < want->size.y; y++)
+        for (uint64_t x = 0; x < want->size.x; x++)
+            wrong += mp_matrix_get(got, x, y) != mp_matrix_get(want, x, y);
+    return wrong;
+}
+
+/**
+ * Send the frozen matrix through a file and read it back.
+ */
+static void
+test_stream(mp_cold *cold, mp_matrix *want, const int32_t packed) {
+    char path[] = "/tmp/mp_test_cold.XXXXXX";
+    const int32_t fd = mkstemp(path);
+    TEST_CHECK(fd >= 0, "mkstemp failed");
+    if (fd < 0) return;
+    unlink(path);
+
+    mp_matrix got;
+    mp_matrix_init(&got, want->pool);
+
+    int32_t ret = test_freeze(cold);
+    TEST_CHECK(ret == 0, "stream: only %lu of %lu chunks frozen", cold->count, cold->matx->tree.count);
+
+    if (ret == 0) ret = packed ? mp_stream_send_packed(cold->matx, fd) : mp_stream_send(cold->matx, fd);
+    TEST_CHECK(ret == 0, "stream: send of the frozen matrix failed (packed %d)", packed);
+
+    if (ret == 0) {
+        lseek(fd, 0, SEEK_SET);
+        ret = mp_stream_recv(&got, fd);
+        TEST_CHECK(ret == 0, "stream: recv failed (packed %d)", packed);
+    }
+
+    uint64_t wrong = ret == 0 ? test_compare(&got, want) : 0;
+    TEST_CHECK(wrong == 0, "stream: %lu wrong elements (packed %d)", wrong, packed);
+
+    printf("test_cold: stream  packed %d, %lu chunks, %lu wrong elements\n", packed, got.tree.count, wrong);
+
+    mp_matrix_free(&got);
+    close(fd);
+}
+
+/**
+ * Multiply the frozen matrices, locally or on n workers.
+ */
+static void
+test_gemm(mp_cold *ca, mp_cold *cb, mp_matrix *want, const uint32_t n) {
+    mp_matrix got;
+    mp_matrix_init(&got, want->pool);
+
+    int32_t ret = test_freeze(ca);
+    if (ret == 0) ret = test_freeze(cb);
+    TEST_CHECK(ret == 0, "gemm: operands did not freeze");
+
+    if (ret == 0) ret = n ? mp_dist_local(&got, ca->matx, cb->matx, n) : mp_gemm(&got, ca->matx, cb->matx);
+    TEST_CHECK(ret == 0, "gemm: product of the frozen matrices failed (%u workers)", n);
+
+    uint64_t wrong = ret == 0 ? test_compare(&got, want) : 0;
+    TEST_CHECK(wrong == 0, "gemm: %lu wrong elements (%u workers)", wrong, n);
+
+    printf("test_cold: gemm    %u workers, %lu chunks, %lu wrong elements\n", n, got.tree.count, wrong);
+
+    mp_matrix_free(&got);
+}
+
+int
+main(void) {
+    /* a worker that gives up must fail the job, not kill the test */
+    signal(SIGPIPE, SIG_IGN);
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix a, b, ref;
+    mp_matrix_init(&a, &pool);
+    mp_matrix_init(&b, &pool);
+    mp_matrix_init(&ref, &pool);
+
+    mp_cold ca, cb;
+    int32_t ret = test_fill(&a, 2 * CHUNK_H - 7, 3 * CHUNK_W, 1);
+    if (ret == 0) ret = test_fill(&b, 3 * CHUNK_W, 2 * CHUNK_W + 5, 2);
+    if (ret == 0) ret = mp_gemm(&ref, &a, &b);
+    if (ret == 0) ret = mp_cold_attach(&ca, &a);
+    if (ret == 0 && mp_cold_attach(&cb, &b) < 0) {
+        mp_cold_free(&ca);
+        ret = -1;
+    }
+    TEST_CHECK(ret == 0, "setup failed");
+
+    if (ret == 0) {
+        /* the warm copy of a, to compare the streams with */
+        mp_matrix want;
+        mp_matrix_init(&want, &pool);
+        TEST_CHECK(mp_matrix_set_size(&want, a.size) == 0, "setup failed");
+        for (uint64_t y = 0; y < a.size.y; y++)
+            for (uint64_t x = 0; x < a.size.x; x++) mp_matrix_put(&want, x, y, mp_matrix_get(&a, x, y));
+
+        test_stream(&ca, &want, 0);
+        test_stream(&ca, &want, 1);
+        test_gemm(&ca, &cb, &ref, 0);
+        test_gemm(&ca, &cb, &ref, 2);
+
+        mp_matrix_free(&want);
+        TEST_CHECK(mp_cold_free(&ca) == 0 && mp_cold_free(&cb) == 0, "detach failed");
+    }
+
+    mp_matrix_free(&a);
+    mp_matrix_free(&b);
+    mp_matrix_free(&ref);
+    mp_pool_free(&pool);
+
+    printf("test_cold: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
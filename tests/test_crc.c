@@ -0,0 +1,243 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_crc.c
+ *  Description:  CRC32C and checked transfer through a faulty link (mp_crc.h).
+ *
+ *  mp_crc32c() is checked against the standard check value and split
+ *  buffers. The checked transfer runs between two file-backed matrices
+ *  over two socketpairs joined by shim threads; the forward shim flips
+ *  bytes at chosen stream positions (first pass only) and counts what
+ *  crosses the link:
+ *
+ *   - clean link: nothing is re-sent
+ *   - a flipped payload byte and a flipped frame header: exactly those
+ *     two frames are re-sent, the copy is exact
+ *   - a flipped size header: the receiver gives up before resizing
+ *
+ *  The test is built with CRC_LANE_CPUS = 1, so the checksum threads
+ *  run even on a single CPU.
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mp_crc.h"
+#include "mp_stream.h"
+
+
+/** 19 frames, the last one partial */
+#define TEST_COLS 1000
+#define TEST_ROWS 600
+#define TEST_BYTES ((uint64_t) TEST_COLS * TEST_ROWS * sizeof(int64_t))
+#define TEST_FRAMES ((TEST_BYTES + CRC_FRAME - 1) / CRC_FRAME)
+
+/** Stream position of frame i (after the two header frames) */
+#define TEST_FRAME_POS(i) (2 * STREAM_FRAME + (uint64_t) (i) * (STREAM_FRAME + CRC_FRAME))
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+/**
+ * One direction of the link.
+ */
+typedef struct test_shim {
+    int32_t from, to;
+    const uint64_t *flip; /**< Stream positions to corrupt, ascending */
+    uint32_t nflip;
+    uint64_t bytes;       /**< Bytes forwarded */
+} test_shim;
+
+typedef struct test_sender {
+    mp_matrix *matx;
+    int32_t fd;
+    int64_t ret;
+} test_sender;
+
+static int64_t
+test_value(const uint64_t x, const uint64_t y) {
+    return (int64_t) (y * 100003 + x);
+}
+
+/**
+ * Read row y of the dense payload.
+ */
+static int32_t
+test_row(const mp_matrix *matx, const uint64_t y, int64_t *row) {
+    const uint64_t len = TEST_COLS * sizeof(int64_t);
+    return pread(matx->fd, row, len, (off_t) (sizeof(mp_msize) + y * len)) == (int64_t) len ? 0 : -1;
+}
+
+static void *
+test_forward(void *arg) {
+    test_shim *shim = arg;
+    uint8_t buf[64 << 10];
+    uint32_t next = 0;
+
+    while (1) {
+        const int64_t n = read(shim->from, buf, sizeof(buf));
+        if (n <= 0) break;
+
+        for (; next < shim->nflip && shim->flip[next] < shim->bytes + (uint64_t) n; next++)
+            buf[shim->flip[next] - shim->bytes] ^= 0x10;
+
+        shim->bytes += (uint64_t) n;
+        if (mp_stream_write(shim->to, buf, (uint64_t) n) < 0) break;
+    }
+
+    shutdown(shim->from, SHUT_RDWR);
+    shutdown(shim->to, SHUT_RDWR);
+    return NULL;
+}
+
+static void *
+test_send(void *arg) {
+    test_sender *s = arg;
+    s->ret = mp_matrix_send_checked(s->matx, s->fd);
+    shutdown(s->fd, SHUT_WR);
+    return NULL;
+}
+
+/**
+ * Transfer src into dst through the link, flipping bytes at flip[].
+ */
+static void
+test_link(const char *name, mp_matrix *src, mp_matrix *dst, const uint64_t *flip, const uint32_t nflip,
+          const int64_t want, const uint64_t bytes) {
+    int32_t a[2], b[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, a) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, b) < 0) {
+        TEST_CHECK(0, "%s: socketpair failed", name);
+        return;
+    }
+
+    /* start from an empty file, so frames that were never stored read as zeros */
+    TEST_CHECK(ftruncate(dst->fd, 0) == 0, "%s: cannot truncate the target", name);
+
+    /* sender a[0] <-> a[1] shims b[0] <-> b[1] receiver */
+    test_shim fwd = {a[1], b[0], flip, nflip, 0};
+    test_shim back = {b[0], a[1], NULL, 0, 0};
+    test_sender sender = {src, a[0], 0};
+
+    pthread_t tid[3];
+    pthread_create(&tid[0], NULL, test_forward, &fwd);
+    pthread_create(&tid[1], NULL, test_forward, &back);
+    pthread_create(&tid[2], NULL, test_send, &sender);
+
+    const int64_t ret = mp_matrix_recv_checked(dst, b[1]);
+    shutdown(b[1], ret < 0 ? SHUT_RDWR : SHUT_WR);
+
+    for (uint32_t i = 0; i < 3; i++) pthread_join(tid[i], NULL);
+    for (uint32_t i = 0; i < 2; i++) {
+        close(a[i]);
+        close(b[i]);
+    }
+
+    printf("test_crc: %-8s sent %ld, asked %ld, %lu bytes on the link\n", name, sender.ret, ret, fwd.bytes);
+
+    TEST_CHECK(ret == want, "%s: receiver returned %ld, expected %ld", name, ret, want);
+    if (want < 0) return;
+
+    TEST_CHECK(sender.ret == want, "%s: sender returned %ld, expected %ld", name, sender.ret, want);
+    TEST_CHECK(fwd.bytes == bytes, "%s: %lu bytes on the link, expected %lu", name, fwd.bytes, bytes);
+
+    uint64_t wrong = dst->size.x != TEST_COLS || dst->size.y != TEST_ROWS;
+    int64_t row[TEST_COLS];
+    for (uint64_t y = 0; !wrong && y < TEST_ROWS; y++) {
+        if (test_row(dst, y, row) < 0) wrong++;
+        for (uint64_t x = 0; !wrong && x < TEST_COLS; x++) wrong += row[x] != test_value(x, y);
+    }
+    TEST_CHECK(wrong == 0, "%s: %lu wrong elements", name, wrong);
+}
+
+static void
+test_checksum(void) {
+    static const char check[] = "123456789";
+    TEST_CHECK(mp_crc32c(0, check, 9) == 0xE3069283u, "CRC32C check value");
+
+    uint8_t *buf = malloc(3 * CRC_LANE * 4 + 13);
+    if (!buf) return;
+    for (uint64_t i = 0; i < 3 * CRC_LANE * 4 + 13; i++) buf[i] = (uint8_t) (i * 131 + (i >> 7));
+
+    /* odd offsets and lengths cross the lane and alignment boundaries */
+    const uint64_t len = 3 * CRC_LANE * 4 + 12;
+    const uint32_t whole = mp_crc32c(0, buf + 1, len);
+    TEST_CHECK(mp_crc32c(mp_crc32c(0, buf + 1, 7777), buf + 1 + 7777, len - 7777) == whole,
+               "CRC32C over split buffers");
+    free(buf);
+}
+
+int
+main(void) {
+    signal(SIGPIPE, SIG_IGN);
+    test_checksum();
+
+    char spath[64], dpath[64];
+    snprintf(spath, sizeof(spath), "/tmp/mp_test_crc_src.%d", getpid());
+    snprintf(dpath, sizeof(dpath), "/tmp/mp_test_crc_dst.%d", getpid());
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix src, dst;
+    mp_matrix_init(&src, &pool);
+    mp_matrix_init(&dst, &pool);
+
+    if (mp_matrix_set_file(&src, spath) < 0 || mp_matrix_set_file(&dst, dpath) < 0 ||
+        mp_matrix_set_size(&src, (mp_msize){TEST_COLS, TEST_ROWS}) < 0) {
+        fprintf(stderr, "test_crc: cannot create the matrix files\n");
+        unlink(spath);
+        unlink(dpath);
+        return EXIT_FAILURE;
+    }
+
+    /* the checked transfer moves the dense file payload */
+    int64_t row[TEST_COLS];
+    for (uint64_t y = 0; y < TEST_ROWS; y++) {
+        for (uint64_t x = 0; x < TEST_COLS; x++) row[x] = test_value(x, y);
+        const off_t off = (off_t) (sizeof(mp_msize) + y * sizeof(row));
+        TEST_CHECK(pwrite(src.fd, row, sizeof(row), off) == (int64_t) sizeof(row), "cannot write row %lu", y);
+    }
+
+    const uint64_t clean = TEST_FRAME_POS(0) + TEST_FRAMES * STREAM_FRAME + TEST_BYTES;
+    const uint64_t last = TEST_BYTES - (TEST_FRAMES - 1) * CRC_FRAME;
+
+    test_link("clean", &src, &dst, NULL, 0, 0, clean);
+
+    /* a payload byte of frame 5, the offset field of the last frame */
+    const uint64_t frames[] = {TEST_FRAME_POS(5) + STREAM_FRAME + 1000, TEST_FRAME_POS(TEST_FRAMES - 1) + 7};
+    test_link("frames", &src, &dst, frames, 2, CRC_FRAME + last,
+              clean + 2 * STREAM_FRAME + CRC_FRAME + last);
+
+    /* size.x of the header */
+    const uint64_t header[] = {6};
+    const mp_msize before = dst.size;
+    test_link("header", &src, &dst, header, 1, -1, 0);
+    TEST_CHECK(dst.size.x == before.x && dst.size.y == before.y, "header: matrix resized");
+
+    mp_matrix_free(&src);
+    mp_matrix_free(&dst);
+    close(src.fd);
+    close(dst.fd);
+    mp_pool_free(&pool);
+    unlink(spath);
+    unlink(dpath);
+
+    printf("test_crc: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
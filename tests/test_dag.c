@@ -0,0 +1,228 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_dag.c
+ *  Description:  Task graphs must compute what the serial order computes (mp_dag.h).
+ *
+ *  Two graphs, each run several times on the same mp_dag (so its arrays
+ *  are reused):
+ *
+ *   - a wavefront: cell (i, j) reads (i - 1, j) and (i, j - 1); every
+ *     task runs once and after both of its predecessors
+ *   - random tasks reading up to three and writing up to two of a few
+ *     cells, so read-after-write, write-after-read and write-after-write
+ *     all occur; the cells must end as in a serial run
+ *
+ *  Notes:
+ *   - Meant to run under ThreadSanitizer too (-DMP_SANITIZE=thread):
+ *     the cells are plain memory, ordered only by the graph
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_dag.h"
+
+
+/** Workers, more than CPUs on small machines on purpose */
+#define TEST_WORKERS 4
+
+/** Runs of each graph */
+#define TEST_RUNS 3
+
+/** Wavefront side */
+#define TEST_GRID 40
+
+/** Random graph: cells and tasks */
+#define TEST_CELLS 64
+#define TEST_TASKS 20000
+
+#define TEST_PRIME 1000000007ull
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+/**
+ * Random task: cells read and written.
+ */
+typedef struct test_op {
+    uint32_t reads[3], nreads;
+    uint32_t writes[2], nwrites;
+    uint64_t *cell;
+} test_op;
+
+typedef struct test_state {
+    uint64_t grid[TEST_GRID][TEST_GRID];  /**< Wavefront values */
+    uint32_t order[TEST_GRID][TEST_GRID]; /**< Completion stamp, 0 = not run */
+    uint32_t runs[TEST_GRID][TEST_GRID];  /**< Runs per cell */
+    uint32_t stamp;                       /**< Last completion stamp */
+    uint32_t late;                        /**< Tasks that ran before a predecessor */
+    test_op ops[TEST_TASKS];
+    uint64_t cell[TEST_CELLS];            /**< Cells of the parallel run */
+    uint64_t ref[TEST_CELLS];             /**< Cells of the serial run */
+} test_state;
+
+static uint64_t
+test_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static mp_copos
+test_key(const uint32_t i, const uint32_t j) {
+    return (mp_copos){.dim = {j, i}};
+}
+
+
+/* ============================================================================
+ *  Tasks
+ * ============================================================================
+ */
+
+static void
+test_wave(void *arg, const mp_copos key, const uint32_t worker) {
+    test_state *st = arg;
+    const uint32_t i = key.dim.y, j = key.dim.x;
+    (void) worker;
+
+    /* predecessors must have finished (and stamped) before this starts */
+    if ((i && !st->order[i - 1][j]) || (j && !st->order[i][j - 1]))
+        __atomic_fetch_add(&st->late, 1, __ATOMIC_RELAXED);
+
+    const uint64_t up = i ? st->grid[i - 1][j] : 1;
+    const uint64_t left = j ? st->grid[i][j - 1] : 1;
+    st->grid[i][j] = (up + left) % TEST_PRIME;
+    st->runs[i][j]++;
+    st->order[i][j] = __atomic_add_fetch(&st->stamp, 1, __ATOMIC_RELAXED);
+}
+
+static void
+test_apply(const test_op *op, uint64_t *cell) {
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < op->nreads; i++) sum = sum * 31 + cell[op->reads[i]];
+    for (uint32_t i = 0; i < op->nwrites; i++) cell[op->writes[i]] = cell[op->writes[i]] * 7 + sum + 1;
+}
+
+static void
+test_random(void *arg, const mp_copos key, const uint32_t worker) {
+    const test_op *op = arg;
+    (void) key;
+    (void) worker;
+    test_apply(op, op->cell);
+}
+
+
+/* ============================================================================
+ *  Graphs
+ * ============================================================================
+ */
+
+static void
+test_wavefront(test_state *st, mp_dag *dag, mp_sched *sched, const uint32_t run) {
+    __builtin_memset(st->grid, 0, sizeof(st->grid));
+    __builtin_memset(st->order, 0, sizeof(st->order));
+    __builtin_memset(st->runs, 0, sizeof(st->runs));
+    st->stamp = 0;
+    st->late = 0;
+
+    int32_t ret = 0;
+    for (uint32_t i = 0; ret == 0 && i < TEST_GRID; i++)
+        for (uint32_t j = 0; ret == 0 && j < TEST_GRID; j++) {
+            const mp_copos key = test_key(i, j);
+            mp_copos reads[2];
+            uint32_t n = 0;
+
+            if (i) reads[n++] = test_key(i - 1, j);
+            if (j) reads[n++] = test_key(i, j - 1);
+            if (mp_dag_submit(dag, test_wave, st, key, reads, n, &key, 1) < 0) ret = -1;
+        }
+    if (ret == 0) ret = mp_dag_run(dag, sched);
+    TEST_CHECK(ret == 0, "wavefront run %u: submit or run failed", run);
+
+    uint64_t want[TEST_GRID][TEST_GRID];
+    uint32_t wrong = 0, once = 0;
+    for (uint32_t i = 0; i < TEST_GRID; i++)
+        for (uint32_t j = 0; j < TEST_GRID; j++) {
+            want[i][j] = ((i ? want[i - 1][j] : 1) + (j ? want[i][j - 1] : 1)) % TEST_PRIME;
+            wrong += st->grid[i][j] != want[i][j];
+            once += st->runs[i][j] == 1;
+        }
+
+    TEST_CHECK(once == TEST_GRID * TEST_GRID, "wavefront run %u: %u of %u tasks ran once",
+               run, once, TEST_GRID * TEST_GRID);
+    TEST_CHECK(st->late == 0, "wavefront run %u: %u tasks ran before a predecessor", run, st->late);
+    TEST_CHECK(wrong == 0, "wavefront run %u: %u wrong cells", run, wrong);
+}
+
+static void
+test_graph(test_state *st, mp_dag *dag, mp_sched *sched, const uint32_t run) {
+    uint64_t rng = 99 + run;
+
+    for (uint32_t i = 0; i < TEST_CELLS; i++) st->cell[i] = st->ref[i] = i;
+
+    int32_t ret = 0;
+    for (uint32_t t = 0; ret == 0 && t < TEST_TASKS; t++) {
+        test_op *op = &st->ops[t];
+        mp_copos reads[3], writes[2];
+
+        op->cell = st->cell;
+        op->nreads = (uint32_t) (test_rand(&rng) % 4);
+        for (uint32_t i = 0; i < op->nreads; i++) op->reads[i] = (uint32_t) (test_rand(&rng) % TEST_CELLS);
+
+        op->nwrites = (uint32_t) (test_rand(&rng) % 3);
+        for (uint32_t i = 0; i < op->nwrites; i++) op->writes[i] = (uint32_t) (test_rand(&rng) % TEST_CELLS);
+        if (op->nwrites == 2 && op->writes[0] == op->writes[1]) op->nwrites = 1;
+
+        for (uint32_t i = 0; i < op->nreads; i++) reads[i] = test_key(0, op->reads[i]);
+        for (uint32_t i = 0; i < op->nwrites; i++) writes[i] = test_key(0, op->writes[i]);
+
+        if (mp_dag_submit(dag, test_random, op, test_key(0, t % TEST_CELLS), reads, op->nreads,
+                          writes, op->nwrites) < 0) ret = -1;
+        test_apply(op, st->ref);
+    }
+    if (ret == 0) ret = mp_dag_run(dag, sched);
+    TEST_CHECK(ret == 0, "random run %u: submit or run failed", run);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < TEST_CELLS; i++) wrong += st->cell[i] != st->ref[i];
+    TEST_CHECK(wrong == 0, "random run %u: %u of %u cells differ from the serial run", run, wrong, TEST_CELLS);
+}
+
+int
+main(void) {
+    test_state *st = calloc(1, sizeof(test_state));
+    mp_sched sched;
+    mp_dag dag;
+
+    if (!st || mp_sched_init(&sched, TEST_WORKERS, 0) < 0 || mp_dag_init(&dag) < 0) {
+        fprintf(stderr, "test_dag: cannot start the scheduler\n");
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t run = 0; run < TEST_RUNS; run++) {
+        test_wavefront(st, &dag, &sched, run);
+        test_graph(st, &dag, &sched, run);
+    }
+
+    printf("test_dag: %u runs of %u + %u tasks, %u failures\n",
+           TEST_RUNS, TEST_GRID * TEST_GRID, TEST_TASKS, failures);
+
+    mp_dag_free(&dag);
+    mp_sched_free(&sched);
+    free(st);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_dist.c
+ *  Description:  Distributed GEMM against the local one (mp_dist.h).
+ *
+ *  Each case multiplies two block-sparse matrices with mp_dist_local()
+ *  and with mp_gemm(); both products must be equal element by element.
+ *
+ *  The test is built with a worker cache of DIST_CACHE = 6 chunks, so
+ *  the coordinator evicts constantly:
+ *
+ *   - dense 2 x 2 blocks on one worker: a task needs 4 chunks, the
+ *     cache fills up in the middle of the second task
+ *   - 5 k blocks per output block: tasks are split into parts that fit
+ *     the cache and accumulated by the worker
+ *   - sparse, clipped matrices on a 2 x 2 worker grid
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_dist.h"
+#include "mp_gemm.h"
+
+
+typedef struct test_case {
+    const char *name;
+    uint64_t m, k, n;   /**< A is m x k, B is k x n (rows x columns) */
+    uint32_t holes;     /**< Every holes-th chunk stays absent, 0: dense */
+    uint32_t workers;
+} test_case;
+
+
+static uint64_t
+test_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Fill a rows x cols matrix with small values, leaving some chunks out.
+ */
+static int32_t
+test_fill(mp_matrix *matx, const uint64_t rows, const uint64_t cols,
+          const uint32_t holes, const uint64_t seed) {
+    if (mp_matrix_set_size(matx, (mp_msize){cols, rows}) < 0) return -1;
+
+    for (uint64_t y = 0; y < rows; y++)
+        for (uint64_t x = 0; x < cols; x++) {
+            const uint64_t block = (y >> CHUNK_POW) * 131 + (x >> CHUNK_POW);
+            if (holes && block % holes == holes - 1) continue;
+
+            const int64_t v = (int64_t) (test_mix(seed ^ (y << 32 | x)) % 17) - 8;
+            if (mp_matrix_put(matx, x, y, v) < 0) return -1;
+        }
+    return 0;
+}
+
+static uint64_t
+test_compare(mp_matrix *got, mp_matrix *want) {
+    uint64_t wrong = 0;
+
+    if (got->size.x != want->size.x || got->size.y != want->size.y) return 1;
+
+    for (uint64_t y = 0; y < want->size.y; y++)
+        for (uint64_t x = 0; x < want->size.x; x++)
+            if (mp_matrix_get(got, x, y) != mp_matrix_get(want, x, y)) {
+                if (!wrong)
+                    fprintf(stderr, "test_dist: (%lu, %lu) is %ld, expected %ld\n",
+                            x, y, mp_matrix_get(got, x, y), mp_matrix_get(want, x, y));
+                wrong++;
+            }
+    return wrong;
+}
+
+static uint32_t
+test_run(mp_pool *pool, const test_case *tc) {
+    mp_matrix a, b, c, ref;
+    mp_matrix_init(&a, pool);
+    mp_matrix_init(&b, pool);
+    mp_matrix_init(&c, pool);
+    mp_matrix_init(&ref, pool);
+
+    uint64_t wrong = 0;
+    int32_t ret = test_fill(&a, tc->m, tc->k, tc->holes, 1);
+    if (ret == 0) ret = test_fill(&b, tc->k, tc->n, tc->holes, 2);
+    if (ret == 0) ret = mp_gemm(&ref, &a, &b);
+    if (ret == 0) ret = mp_dist_local(&c, &a, &b, tc->workers);
+    if (ret == 0) wrong = test_compare(&c, &ref);
+
+    printf("test_dist: %-8s %lu x %lu x %lu, %u workers, %lu chunks, %s, %lu wrong elements\n",
+           tc->name, tc->m, tc->k, tc->n, tc->workers, c.tree.count,
+           ret < 0 ? "failed" : "done", wrong);
+
+    mp_matrix_free(&a);
+    mp_matrix_free(&b);
+    mp_matrix_free(&c);
+    mp_matrix_free(&ref);
+    return ret < 0 || wrong;
+}
+
+int
+main(void) {
+    static const test_case cases[] = {
+        {"dense", 2 * CHUNK_H, 2 * CHUNK_W, 2 * CHUNK_W, 0, 1},
+        {"split", CHUNK_H, 5 * CHUNK_W, 2 * CHUNK_W, 0, 2},
+        {"sparse", 3 * CHUNK_H - 40, 4 * CHUNK_W + 9, 3 * CHUNK_W - 3, 4, 4},
+    };
+
+    /* a worker that gives up must fail the job, not kill the test */
+    signal(SIGPIPE, SIG_IGN);
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        failed += test_run(&pool, &cases[i]);
+
+    mp_pool_free(&pool);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_file.c
+ *  Description:  Tiled files, stored and mapped (mp_file.h, mp_matrix_map_file()).
+ *
+ *  A sparse matrix is stored in the tiled format, then mapped again and
+ *  again into the same descriptor:
+ *
+ *   - every mapping reads back the stored elements, holes read as 0
+ *   - remapping, and mapping over an attached file, keeps exactly one
+ *     descriptor open (counted in /proc/self/fd)
+ *   - a failed mapping leaves no descriptor behind
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mp_file.h"
+
+
+/** 3 x 2 chunks, clipped; chunk (1, 0) stays a hole */
+#define TEST_COLS (2 * CHUNK_W + 50)
+#define TEST_ROWS (CHUNK_H + 20)
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+static int64_t
+test_value(const uint64_t x, const uint64_t y) {
+    if (x >= CHUNK_W && x < 2 * CHUNK_W && y < CHUNK_H) return 0;
+    return (int64_t) (y * 7919 + x) - 1000;
+}
+
+/**
+ * Number of open descriptors of this process.
+ */
+static int32_t
+test_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    if (!dir) return -1;
+
+    int32_t n = 0;
+    for (const struct dirent *e; (e = readdir(dir));) n += e->d_name[0] != '.';
+    closedir(dir);
+    return n - 1; /* the directory itself */
+}
+
+static uint64_t
+test_compare(mp_matrix *matx) {
+    uint64_t wrong = matx->size.x != TEST_COLS || matx->size.y != TEST_ROWS;
+
+    for (uint64_t y = 0; !wrong && y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++) wrong += mp_matrix_get(matx, x, y) != test_value(x, y);
+    return wrong;
+}
+
+int
+main(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mp_test_file.%d", getpid());
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    /* ---- store ---- */
+    mp_matrix src;
+    mp_matrix_init(&src, &pool);
+
+    int32_t ret = mp_matrix_set_file_mode(&src, path, MP_MATRIX_TILED);
+    if (ret == 0) ret = mp_matrix_set_size(&src, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    for (uint64_t y = 0; ret == 0 && y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            if (test_value(x, y)) ret = mp_matrix_put(&src, x, y, test_value(x, y));
+
+    if (ret == 0) ret = mp_file_store(&src);
+    mp_matrix_free(&src);
+    if (src.fd != -1) close(src.fd);
+
+    if (ret < 0) {
+        fprintf(stderr, "test_file: cannot store %s\n", path);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    /* ---- map, remap ---- */
+    const int32_t base = test_fds();
+    mp_matrix map;
+    mp_matrix_init(&map, &pool);
+
+    for (uint32_t i = 0; i < 3; i++) {
+        TEST_CHECK(mp_matrix_map_file(&map, path) == 0, "mapping %u failed", i);
+        TEST_CHECK(test_fds() == base + 1, "mapping %u: %d descriptors open, expected %d",
+                   i, test_fds(), base + 1);
+
+        const uint64_t wrong = test_compare(&map);
+        TEST_CHECK(wrong == 0, "mapping %u: %lu wrong elements", i, wrong);
+        printf("test_file: mapping %u, %lu tiles, %lu wrong elements\n", i, map.nmaps, wrong);
+    }
+
+    /* attached with set_file_mode() while mapped, then mapped */
+    TEST_CHECK(mp_matrix_set_file_mode(&map, path, MP_MATRIX_TILED) == 0, "set_file_mode failed");
+    TEST_CHECK(mp_matrix_map_file(&map, path) == 0 && test_fds() == base + 1,
+               "mapping over an attached file leaks its descriptor");
+
+    /* a failed mapping closes the old file and leaves none open */
+    TEST_CHECK(mp_matrix_map_file(&map, "/proc/self/status") < 0, "mapping a foreign file succeeded");
+    TEST_CHECK(map.fd == -1 && test_fds() == base, "failed mapping left %d descriptors", test_fds() - base);
+
+    mp_matrix_free(&map);
+    mp_pool_free(&pool);
+    unlink(path);
+
+    printf("test_file: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
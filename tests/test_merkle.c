@@ -0,0 +1,159 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_merkle.c
+ *  Description:  Merkle replication over a socket (mp_merkle.h).
+ *
+ *  A sparse source matrix is replicated into a sink over a socketpair,
+ *  both with attached trees, and the two drift apart between rounds:
+ *
+ *   - empty sink: every source chunk is sent
+ *   - identical matrices: nothing is sent
+ *   - chunks modified or dropped on either side: exactly those tiles
+ *   - resized source: the sink follows the new size
+ *
+ *  After every round both chunk sets, their contents and both roots are
+ *  equal.
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mp_merkle.h"
+
+
+/** 40 x 30 chunks, 60 of them present */
+#define TEST_COLS (40 * CHUNK_W - 13)
+#define TEST_ROWS (30 * CHUNK_H - 7)
+#define TEST_CHUNKS 60
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+typedef struct test_source {
+    mp_merkle *merkle;
+    int32_t fd;
+    int64_t ret;
+} test_source;
+
+static void *
+test_send(void *arg) {
+    test_source *s = arg;
+    s->ret = mp_merkle_send(s->merkle, s->fd);
+    return NULL;
+}
+
+/**
+ * Compare the chunk sets and the effective rows of every chunk.
+ */
+static uint64_t
+test_compare(mp_matrix *got, mp_matrix *want) {
+    if (got->size.x != want->size.x || got->size.y != want->size.y) return 1;
+
+    uint64_t wrong = got->tree.count != want->tree.count;
+    mp_iter iter;
+    mp_iter_init(&iter, &want->tree);
+
+    for (mp_chunk *chunk; (chunk = mp_iter_next(&iter));) {
+        const mp_chunk *other = mp_matrix_chunk_find(got, chunk->opos);
+        if (!other || other->size.size != chunk->size.size) {
+            wrong++;
+            continue;
+        }
+        for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+            for (uint32_t x = 0; x <= chunk->size.dim.x; x++)
+                wrong += other->data[CHUNK_POS(x, y)] != chunk->data[CHUNK_POS(x, y)];
+    }
+    return wrong;
+}
+
+static void
+test_round(const char *name, mp_merkle *src, mp_merkle *dst, const int64_t want) {
+    int32_t sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        TEST_CHECK(0, "%s: socketpair failed", name);
+        return;
+    }
+
+    test_source source = {src, sv[0], -1};
+    pthread_t tid;
+    pthread_create(&tid, NULL, test_send, &source);
+
+    const int64_t ret = mp_merkle_recv(dst, sv[1]);
+    if (ret < 0) shutdown(sv[1], SHUT_RDWR);
+    pthread_join(tid, NULL);
+    close(sv[0]);
+    close(sv[1]);
+
+    const uint64_t wrong = test_compare(dst->matx, src->matx);
+    printf("test_merkle: %-9s sent %ld, received %ld, %lu wrong elements\n", name, source.ret, ret, wrong);
+
+    TEST_CHECK(source.ret == want && ret == want, "%s: sent %ld, received %ld, expected %ld",
+               name, source.ret, ret, want);
+    TEST_CHECK(wrong == 0, "%s: %lu wrong elements", name, wrong);
+    TEST_CHECK(mp_merkle_update(dst) == 0 && mp_merkle_root(dst) == mp_merkle_root(src),
+               "%s: roots differ", name);
+}
+
+int
+main(void) {
+    signal(SIGPIPE, SIG_IGN);
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix a, b;
+    mp_matrix_init(&a, &pool);
+    mp_matrix_init(&b, &pool);
+    mp_matrix_set_size(&a, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    /* one element in each of TEST_CHUNKS distinct chunks */
+    for (uint64_t i = 0; i < TEST_CHUNKS; i++)
+        mp_matrix_put(&a, (i * 7 % 40) * CHUNK_W + i, (i * 11 % 30) * CHUNK_H + i, (int64_t) i + 1);
+
+    mp_merkle src, dst;
+    if (mp_merkle_attach(&src, &a) < 0 || mp_merkle_attach(&dst, &b) < 0) {
+        fprintf(stderr, "test_merkle: cannot attach the trees\n");
+        return EXIT_FAILURE;
+    }
+    TEST_CHECK(a.tree.count == TEST_CHUNKS, "%lu chunks, expected %u", a.tree.count, TEST_CHUNKS);
+
+    test_round("empty", &src, &dst, TEST_CHUNKS);
+    test_round("identical", &src, &dst, 0);
+
+    /* one chunk rewritten, one created, one dropped on the source; one created on the sink */
+    mp_matrix_put(&a, 0, 0, -1);
+    mp_matrix_put(&a, TEST_COLS - 1, TEST_ROWS - 1, -2);
+    mp_matrix_chunk_drop(&a, (mp_copos){.dim = {7, 11}});
+    mp_matrix_put(&b, 5 * CHUNK_W, 3 * CHUNK_H, -3);
+    test_round("modified", &src, &dst, 4);
+
+    mp_matrix_set_size(&a, (mp_msize){TEST_COLS + 2 * CHUNK_W, TEST_ROWS});
+    mp_matrix_put(&a, TEST_COLS + CHUNK_W, 0, -4);
+    test_round("resized", &src, &dst, 1);
+
+    mp_merkle_free(&src);
+    mp_merkle_free(&dst);
+    mp_matrix_free(&a);
+    mp_matrix_free(&b);
+    mp_pool_free(&pool);
+
+    printf("test_merkle: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_pipeline.c
+ *  Description:  Receive-and-compute over a socket (mp_pipeline.h).
+ *
+ *  A sender thread writes a chunk stream into a socketpair, plain or
+ *  with packed frames; the pipeline doubles every chunk on its workers
+ *  while receiving:
+ *
+ *   - keep = 1: the received matrix must equal 2 × the sent one
+ *   - keep = 0: the matrix stays empty, the callback still sees every
+ *     element (checked through the sum of all values)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mp_pipeline.h"
+#include "mp_stream.h"
+
+
+/** Matrix size: 3 x 2 chunks, clipped */
+#define TEST_COLS (2 * CHUNK_W + 77)
+#define TEST_ROWS (CHUNK_H + 31)
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+typedef struct test_sender {
+    mp_matrix *matx;
+    int32_t fd;
+    uint8_t packed;
+    int32_t ret;
+} test_sender;
+
+static uint64_t
+test_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Small values in the first chunk column (packed by the codec), full
+ * range values elsewhere (sent as plain frames), one chunk absent.
+ */
+static int64_t
+test_value(const uint64_t x, const uint64_t y) {
+    const uint64_t z = test_mix(y << 32 | x);
+    return x < CHUNK_W ? (int64_t) (z % 9) - 4 : (int64_t) (z >> 2);
+}
+
+static void *
+test_send(void *arg) {
+    test_sender *s = arg;
+    s->ret = s->packed ? mp_stream_send_packed(s->matx, s->fd) : mp_stream_send(s->matx, s->fd);
+    shutdown(s->fd, SHUT_WR);
+    return NULL;
+}
+
+static int32_t
+test_double(void *ctx, mp_chunk *chunk) {
+    uint64_t *sum = ctx;
+    uint64_t local = 0;
+
+    for (uint32_t y = 0; y <= chunk->size.dim.y; y++)
+        for (uint32_t x = 0; x <= chunk->size.dim.x; x++) {
+            local += (uint64_t) chunk->data[CHUNK_POS(x, y)];
+            chunk->data[CHUNK_POS(x, y)] *= 2;
+        }
+
+    __atomic_add_fetch(sum, local, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static void
+test_run(mp_matrix *src, const uint64_t want, const uint8_t packed, const uint8_t keep) {
+    int32_t sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        TEST_CHECK(0, "socketpair failed");
+        return;
+    }
+
+    mp_matrix dst;
+    mp_matrix_init(&dst, src->pool);
+
+    uint64_t sum = 0;
+    mp_pipeline pl;
+    mp_pipeline_init(&pl, test_double, &sum);
+    pl.keep = keep;
+
+    test_sender sender = {src, sv[0], packed, -1};
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, test_send, &sender) != 0) {
+        TEST_CHECK(0, "pthread_create failed");
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+
+    const int32_t ret = mp_pipeline_recv(&pl, &dst, sv[1]);
+    pthread_join(tid, NULL);
+
+    TEST_CHECK(sender.ret == 0, "send failed (packed %u)", packed);
+    TEST_CHECK(ret == 0, "mp_pipeline_recv failed (packed %u, keep %u)", packed, keep);
+    TEST_CHECK(sum == want, "callback sum %lu, expected %lu (packed %u, keep %u)", sum, want, packed, keep);
+
+    uint64_t wrong = dst.size.x != TEST_COLS || dst.size.y != TEST_ROWS ||
+                     dst.tree.count != (keep ? src->tree.count : 0);
+    for (uint64_t y = 0; keep && ret == 0 && y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            wrong += mp_matrix_get(&dst, x, y) != 2 * mp_matrix_get(src, x, y);
+    TEST_CHECK(wrong == 0, "%lu wrong elements (packed %u, keep %u)", wrong, packed, keep);
+
+    printf("test_pipeline: packed %u, keep %u, %lu chunks, %lu wrong elements\n",
+           packed, keep, dst.tree.count, wrong);
+
+    mp_matrix_free(&dst);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+int
+main(void) {
+    signal(SIGPIPE, SIG_IGN);
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix src;
+    mp_matrix_init(&src, &pool);
+    mp_matrix_set_size(&src, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    uint64_t want = 0;
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++) {
+            if (x >= 2 * CHUNK_W && y >= CHUNK_H) continue;
+            mp_matrix_put(&src, x, y, test_value(x, y));
+            want += (uint64_t) test_value(x, y);
+        }
+
+    for (uint8_t packed = 0; packed < 2; packed++)
+        for (uint8_t keep = 0; keep < 2; keep++) test_run(&src, want, packed, keep);
+
+    mp_matrix_free(&src);
+    mp_pool_free(&pool);
+
+    printf("test_pipeline: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
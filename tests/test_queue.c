@@ -0,0 +1,213 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_queue.c
+ *  Description:  MPMC test of the chunk handle queue (mp_queue.h).
+ *
+ *  Producers push disjoint runs of handles, consumers pop until the
+ *  queue is closed and drained. Every handle must come out exactly
+ *  once, and each consumer must see the handles of one producer in the
+ *  order they were pushed.
+ *
+ *  The ring is small, so it wraps many times and both sides block; the
+ *  blocking, non-blocking, single and batch calls are all mixed in.
+ *
+ *  Notes:
+ *   - Meant to run under ThreadSanitizer too (-DMP_SANITIZE=thread)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_queue.h"
+
+
+#define TEST_PRODUCERS 3
+#define TEST_CONSUMERS 3
+
+/** Handles per producer */
+#define TEST_ITEMS 100000
+
+/** Ring capacity */
+#define TEST_CAP 64
+
+/** Largest batch */
+#define TEST_BATCH 16
+
+
+typedef struct test_thread {
+    pthread_t thread;
+    uint32_t id;
+    uint32_t seed;
+
+    uint64_t handled;                 /**< Handles pushed / popped */
+    uint64_t disorder;                /**< Consumer: out of order per producer */
+    int64_t last[TEST_PRODUCERS];     /**< Consumer: last index seen per producer */
+} test_thread;
+
+static mp_queue queue;
+static mp_chunk *handles;              /**< TEST_PRODUCERS * TEST_ITEMS */
+static uint32_t *seen;                 /**< Pops per handle */
+
+
+static uint32_t
+test_rand(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+
+/* ============================================================================
+ *  Producers
+ * ============================================================================
+ */
+
+static void *
+test_produce(void *arg) {
+    test_thread *t = arg;
+    mp_chunk *batch[TEST_BATCH];
+    uint64_t next = (uint64_t) t->id * TEST_ITEMS;
+    const uint64_t end = next + TEST_ITEMS;
+
+    while (next < end) {
+        const uint32_t mode = test_rand(&t->seed) % 3;
+        uint32_t n = 1 + test_rand(&t->seed) % TEST_BATCH;
+        if (n > end - next) n = (uint32_t) (end - next);
+
+        for (uint32_t i = 0; i < n; i++) batch[i] = &handles[next + i];
+
+        uint32_t pushed = 0;
+        if (mode == 0) {
+            pushed = mp_queue_push(&queue, batch[0]) == 0;
+        } else if (mode == 1) {
+            pushed = mp_queue_push_wait(&queue, batch, n);
+        } else {
+            /* non-blocking: retry the rest in order until all are in */
+            while (pushed < n) {
+                const uint32_t k = mp_queue_push_n(&queue, batch + pushed, n - pushed);
+                if (!k) sched_yield();
+                pushed += k;
+            }
+        }
+        if (!pushed) break; /* closed: cannot happen before the join */
+
+        next += pushed;
+        t->handled += pushed;
+    }
+    return NULL;
+}
+
+
+/* ============================================================================
+ *  Consumers
+ * ============================================================================
+ */
+
+static void
+test_consume_one(test_thread *t, const mp_chunk *chunk) {
+    const uint64_t i = (uint64_t) (chunk - handles);
+    const uint32_t producer = (uint32_t) (i / TEST_ITEMS);
+
+    __atomic_fetch_add(&seen[i], 1, __ATOMIC_RELAXED);
+    if ((int64_t) i <= t->last[producer]) t->disorder++;
+    t->last[producer] = (int64_t) i;
+    t->handled++;
+}
+
+static void *
+test_consume(void *arg) {
+    test_thread *t = arg;
+    mp_chunk *batch[TEST_BATCH];
+
+    for (uint32_t p = 0; p < TEST_PRODUCERS; p++) t->last[p] = -1;
+
+    while (1) {
+        const uint32_t mode = test_rand(&t->seed) % 3;
+        uint32_t n;
+
+        if (mode == 0) {
+            batch[0] = mp_queue_pop(&queue);
+            n = batch[0] != NULL;
+        } else if (mode == 1) {
+            n = mp_queue_pop_wait(&queue, batch, 1 + test_rand(&t->seed) % TEST_BATCH);
+        } else {
+            n = mp_queue_pop_n(&queue, batch, 1 + test_rand(&t->seed) % TEST_BATCH);
+            if (!n) {
+                /* empty for now: the blocking call tells apart closed */
+                n = mp_queue_pop_wait(&queue, batch, 1);
+            }
+        }
+        if (!n) break;
+
+        for (uint32_t i = 0; i < n; i++) test_consume_one(t, batch[i]);
+    }
+    return NULL;
+}
+
+
+int
+main(void) {
+    const uint64_t total = (uint64_t) TEST_PRODUCERS * TEST_ITEMS;
+
+    handles = calloc(total, sizeof(mp_chunk));
+    seen = calloc(total, sizeof(uint32_t));
+    if (!handles || !seen || mp_queue_init(&queue, TEST_CAP) < 0) {
+        fprintf(stderr, "test_queue: allocation failed\n");
+        return EXIT_FAILURE;
+    }
+
+    test_thread producers[TEST_PRODUCERS] = {0};
+    test_thread consumers[TEST_CONSUMERS] = {0};
+
+    for (uint32_t i = 0; i < TEST_CONSUMERS; i++) {
+        consumers[i].id = i;
+        consumers[i].seed = 0x2545f491u * (i + 1);
+        if (pthread_create(&consumers[i].thread, NULL, test_consume, &consumers[i]) != 0)
+            return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < TEST_PRODUCERS; i++) {
+        producers[i].id = i;
+        producers[i].seed = 0x9e3779b9u * (i + 1);
+        if (pthread_create(&producers[i].thread, NULL, test_produce, &producers[i]) != 0)
+            return EXIT_FAILURE;
+    }
+
+    uint64_t pushed = 0, popped = 0, disorder = 0;
+    for (uint32_t i = 0; i < TEST_PRODUCERS; i++) {
+        pthread_join(producers[i].thread, NULL);
+        pushed += producers[i].handled;
+    }
+
+    /* every push has returned: closing loses nothing */
+    mp_queue_close(&queue);
+
+    for (uint32_t i = 0; i < TEST_CONSUMERS; i++) {
+        pthread_join(consumers[i].thread, NULL);
+        popped += consumers[i].handled;
+        disorder += consumers[i].disorder;
+    }
+
+    uint64_t lost = 0, duplicated = 0;
+    for (uint64_t i = 0; i < total; i++) {
+        lost += seen[i] == 0;
+        duplicated += seen[i] > 1;
+    }
+
+    printf("test_queue: %lu pushed, %lu popped, %lu lost, %lu duplicated, %lu out of order\n",
+           pushed, popped, lost, duplicated, disorder);
+
+    mp_queue_free(&queue);
+    free(handles);
+    free(seen);
+
+    return pushed != total || popped != total || lost || duplicated || disorder
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,243 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_rcu.c
+ *  Description:  Concurrent lookups against an inserting / dropping writer
+ *                (mp_rcu.h).
+ *
+ *  The matrix is a grid of chunks whose first element marks its offset.
+ *  Even grid cells are created up front and never dropped; the owner
+ *  keeps creating and dropping odd cells while readers look chunks up:
+ *
+ *   - a stable chunk must always be found, with its own marker
+ *   - a churning chunk may be missing, or found with its marker (or 0
+ *     right after creation), never with another one
+ *
+ *  Reused pool buffers of dropped chunks would show up as foreign
+ *  markers if a chunk went back to the pool within a grace period.
+ *
+ *  Notes:
+ *   - Meant to run under ThreadSanitizer too (-DMP_SANITIZE=thread);
+ *     markers are written and read atomically, the rest is plain
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_matrix.h"
+#include "mp_rcu.h"
+
+
+/** Grid of TEST_GRID x TEST_GRID chunks */
+#define TEST_GRID 12
+
+/** Reader threads */
+#define TEST_READERS 3
+
+/** Lookups per read-side section */
+#define TEST_SECTION 64
+
+/** Writer create / drop steps */
+#define TEST_STEPS 20000
+
+
+typedef struct test_reader {
+    pthread_t thread;
+    mp_matrix *matx;
+    uint32_t seed;
+
+    uint64_t lookups;
+    uint64_t missing;    /**< Stable chunks not found */
+    uint64_t mismatched; /**< Chunks found with another marker */
+    int32_t ready;       /**< -1: could not register */
+} test_reader;
+
+static uint8_t test_done;
+
+
+/* ============================================================================
+ *  Helpers
+ * ============================================================================
+ */
+
+static mp_copos
+test_opos(const uint32_t cell) {
+    return (mp_copos){.dim = {cell % TEST_GRID, cell / TEST_GRID}};
+}
+
+static uint8_t
+test_stable(const uint32_t cell) {
+    return (cell % TEST_GRID + cell / TEST_GRID) % 2 == 0;
+}
+
+static int64_t
+test_marker(const mp_copos opos) {
+    return (int64_t) opos.pos + 1;
+}
+
+static uint32_t
+test_rand(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+/**
+ * Check that a chunk found for cell is that cell's chunk.
+ */
+static uint8_t
+test_check(const mp_chunk *chunk, const uint32_t cell) {
+    const mp_copos opos = test_opos(cell);
+    const int64_t marker = __atomic_load_n(&chunk->data[0], __ATOMIC_RELAXED);
+
+    if (chunk->opos.pos != opos.pos) return 0;
+    return marker == test_marker(opos) || (marker == 0 && !test_stable(cell));
+}
+
+/**
+ * Create the chunk of a cell and mark it.
+ */
+static int32_t
+test_create(mp_matrix *matx, const uint32_t cell) {
+    const mp_copos opos = test_opos(cell);
+    const mp_chunk *chunk = mp_matrix_chunk_write(matx, opos);
+    if (!chunk) return -1;
+
+    __atomic_store_n(&chunk->data[0], test_marker(opos), __ATOMIC_RELAXED);
+    return 0;
+}
+
+
+/* ============================================================================
+ *  Reader
+ * ============================================================================
+ */
+
+static void *
+test_read(void *arg) {
+    test_reader *tr = arg;
+    mp_reader reader;
+
+    if (mp_reader_init(&reader, tr->matx) < 0) {
+        __atomic_store_n(&tr->ready, -1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    __atomic_store_n(&tr->ready, 1, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&test_done, __ATOMIC_ACQUIRE)) {
+        const mp_chunk *found[TEST_SECTION];
+        uint32_t cells[TEST_SECTION], n = 0;
+
+        mp_reader_lock(&reader);
+
+        for (uint32_t i = 0; i < TEST_SECTION; i++) {
+            const uint32_t cell = test_rand(&tr->seed) % (TEST_GRID * TEST_GRID);
+            const mp_chunk *chunk = mp_reader_find(&reader, test_opos(cell));
+            tr->lookups++;
+
+            if (!chunk) {
+                tr->missing += test_stable(cell);
+                continue;
+            }
+
+            tr->mismatched += !test_check(chunk, cell);
+            found[n] = chunk;
+            cells[n++] = cell;
+        }
+
+        /* still the same chunks at the end of the section */
+        for (uint32_t i = 0; i < n; i++) tr->mismatched += !test_check(found[i], cells[i]);
+
+        mp_reader_unlock(&reader);
+    }
+
+    mp_reader_free(&reader);
+    return NULL;
+}
+
+
+/* ============================================================================
+ *  Writer
+ * ============================================================================
+ */
+
+int
+main(void) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix matx;
+    mp_matrix_init(&matx, &pool);
+    mp_matrix_set_size(&matx, (mp_msize){TEST_GRID * CHUNK_W, TEST_GRID * CHUNK_H});
+
+    mp_rcu rcu;
+    if (mp_rcu_attach(&rcu, &matx, TEST_READERS) < 0) {
+        fprintf(stderr, "test_rcu: cannot attach readers\n");
+        return EXIT_FAILURE;
+    }
+
+    for (uint32_t cell = 0; cell < TEST_GRID * TEST_GRID; cell++)
+        if (test_stable(cell) && test_create(&matx, cell) < 0) return EXIT_FAILURE;
+
+    test_reader readers[TEST_READERS] = {0};
+    for (uint32_t i = 0; i < TEST_READERS; i++) {
+        readers[i].matx = &matx;
+        readers[i].seed = 0x9e3779b9u * (i + 1);
+        if (pthread_create(&readers[i].thread, NULL, test_read, &readers[i]) != 0) return EXIT_FAILURE;
+    }
+
+    /* readers register from their own threads before the churn starts */
+    for (uint32_t i = 0; i < TEST_READERS; i++)
+        while (!__atomic_load_n(&readers[i].ready, __ATOMIC_ACQUIRE)) sched_yield();
+
+    uint32_t seed = 12345;
+    uint64_t created = 0, dropped = 0;
+
+    for (uint32_t step = 0; step < TEST_STEPS; step++) {
+        /* the column next door has the other parity (TEST_GRID is even) */
+        uint32_t cell = test_rand(&seed) % (TEST_GRID * TEST_GRID);
+        if (test_stable(cell)) cell ^= 1;
+
+        if (mp_matrix_chunk_find(&matx, test_opos(cell))) {
+            mp_matrix_chunk_drop(&matx, test_opos(cell));
+            dropped++;
+        } else {
+            if (test_create(&matx, cell) < 0) return EXIT_FAILURE;
+            created++;
+        }
+
+        /* writes into a stable chunk, away from its marker */
+        mp_matrix_put(&matx, 1, 1, (int64_t) step);
+
+        if (step % 256 == 0) mp_rcu_reclaim(&rcu);
+    }
+
+    __atomic_store_n(&test_done, 1, __ATOMIC_RELEASE);
+
+    uint64_t lookups = 0, missing = 0, mismatched = 0;
+    uint32_t unregistered = 0;
+    for (uint32_t i = 0; i < TEST_READERS; i++) {
+        pthread_join(readers[i].thread, NULL);
+        lookups += readers[i].lookups;
+        missing += readers[i].missing;
+        mismatched += readers[i].mismatched;
+        unregistered += readers[i].ready < 0;
+    }
+
+    printf("test_rcu: %lu created, %lu dropped, %lu reclaimed, %lu lookups, "
+           "%lu missing, %lu mismatched\n",
+           created, dropped, rcu.reclaimed, lookups, missing, mismatched);
+
+    mp_rcu_free(&rcu);
+    mp_matrix_free(&matx);
+    mp_pool_free(&pool);
+
+    return missing || mismatched || unregistered || !lookups ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_sched.c
+ *  Description:  Stress test of the work-stealing deques (mp_sched.h).
+ *
+ *  Every item of a loop must run exactly once, whichever worker pops or
+ *  steals its range:
+ *
+ *   - mp_sched_for() with grain 1, so ranges are split down to single
+ *     items and thieves race the owner for the last ones
+ *   - mp_sched_loop() where each item spawns the next ones, so deques
+ *     grow and shrink while they are stolen from
+ *
+ *  Notes:
+ *   - Meant to run under ThreadSanitizer too (-DMP_SANITIZE=thread)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_sched.h"
+
+
+/** Workers, more than CPUs on small machines on purpose */
+#define TEST_WORKERS 4
+
+/** Loops per pass */
+#define TEST_LOOPS 200
+
+/** Items of the largest loop */
+#define TEST_ITEMS (1u << 16)
+
+
+typedef struct test_state {
+    uint32_t runs[TEST_ITEMS];              /**< Runs per item */
+    uint64_t items[TEST_WORKERS];           /**< Items run per worker */
+    mp_sched *sched;
+    uint64_t n;
+} test_state;
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+/* ============================================================================
+ *  Kernels
+ * ============================================================================
+ */
+
+static void
+test_count(void *arg, const uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    test_state *st = arg;
+
+    for (uint64_t i = lo; i < hi; i++) __atomic_fetch_add(&st->runs[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->items[worker], hi - lo, __ATOMIC_RELAXED);
+}
+
+/**
+ * Item i makes its children 2i + 1 and 2i + 2 ready (a binary tree).
+ */
+static void
+test_spawn(void *arg, const uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    test_state *st = arg;
+
+    for (uint64_t i = lo; i < hi; i++) {
+        const uint64_t first = 2 * i + 1;
+        const uint64_t last = first + 2 < st->n ? first + 2 : st->n;
+        if (first < last) mp_sched_spawn(st->sched, worker, first, last);
+    }
+    test_count(arg, lo, hi, worker);
+}
+
+
+/* ============================================================================
+ *  Passes
+ * ============================================================================
+ */
+
+static void
+test_reset(test_state *st, const uint64_t n) {
+    __builtin_memset(st->runs, 0, sizeof(st->runs));
+    st->n = n;
+}
+
+static void
+test_verify(const test_state *st, const char *pass, const uint32_t loop) {
+    for (uint64_t i = 0; i < st->n; i++)
+        if (st->runs[i] != 1) {
+            TEST_CHECK(0, "%s loop %u: item %lu of %lu ran %u times", pass, loop, i, st->n, st->runs[i]);
+            return;
+        }
+}
+
+int
+main(void) {
+    test_state *st = calloc(1, sizeof(test_state));
+    mp_sched sched;
+
+    if (!st || mp_sched_init(&sched, TEST_WORKERS, 0) < 0) {
+        fprintf(stderr, "test_sched: cannot start the scheduler\n");
+        return EXIT_FAILURE;
+    }
+    st->sched = &sched;
+
+    for (uint32_t loop = 0; loop < TEST_LOOPS; loop++) {
+        /* sizes from 2 items up to TEST_ITEMS, odd ones included */
+        const uint64_t n = 2 + (uint64_t) loop * (TEST_ITEMS - 2) / (TEST_LOOPS - 1) - (loop & 1);
+
+        test_reset(st, n);
+        mp_sched_for(&sched, n, 1, test_count, st);
+        test_verify(st, "for", loop);
+
+        test_reset(st, n);
+        mp_sched_loop(&sched, n, 1, 1, test_spawn, st);
+        test_verify(st, "spawn", loop);
+    }
+
+    uint32_t active = 0;
+    for (uint32_t w = 0; w < TEST_WORKERS; w++) active += st->items[w] != 0;
+
+    printf("test_sched: %u loops, %u of %u workers ran items, %u failures\n",
+           2 * TEST_LOOPS, active, TEST_WORKERS, failures);
+
+    mp_sched_free(&sched);
+    free(st);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,354 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_server.c
+ *  Description:  MMP requests against a server process (mp_server.h).
+ *
+ *  The server runs in a child process on a Unix socket; blocking
+ *  clients check:
+ *
+ *   - CREATE, PUT_ELEMS and GET_ELEMS
+ *   - RECV_MATRIX / SEND_MATRIX round trip of a chunk stream, plain and
+ *     packed
+ *   - PUT_CHUNK is atomic: while an upload stalls halfway, and after
+ *     its client disconnects, other clients still read the old chunk
+ *   - KERNEL "add" and DROP
+ *   - sizes beyond 2^32 chunks are rejected by CREATE and RECV_MATRIX
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mp_server.h"
+#include "mp_stream.h"
+
+
+/** Matrix size: 2 x 2 chunks, clipped */
+#define TEST_COLS (CHUNK_W + 100)
+#define TEST_ROWS (CHUNK_H + 60)
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+/* ============================================================================
+ *  Client
+ * ============================================================================
+ */
+
+static int32_t
+test_connect(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    __builtin_memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    const int32_t fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send a request header and name; the body (if any) follows separately.
+ */
+static int32_t
+test_send(const int32_t fd, const uint8_t op, const char *name, const uint64_t a,
+          const uint64_t b, const uint64_t len, const uint16_t flags) {
+    uint8_t hdr[PROTO_REQ];
+    const mp_req req = {.id = op, .op = op, .nlen = (uint8_t) strlen(name),
+                        .flags = flags, .a = a, .b = b, .len = len};
+    mp_req_pack(hdr, &req);
+
+    if (mp_stream_write(fd, hdr, PROTO_REQ) < 0) return -1;
+    return mp_stream_write(fd, (const uint8_t *) name, req.nlen);
+}
+
+/**
+ * Read a response header.
+ */
+static int32_t
+test_recv(const int32_t fd, mp_resp *resp) {
+    uint8_t hdr[PROTO_RESP];
+    if (mp_stream_read(fd, hdr, PROTO_RESP) < 0) return -1;
+    mp_resp_unpack(hdr, resp);
+    return 0;
+}
+
+/**
+ * Run a request with a flat body and no response body.
+ *
+ * @return the response status, or -1000 on I/O failure
+ */
+static int32_t
+test_call(const int32_t fd, const uint8_t op, const char *name, const uint64_t a,
+          const uint64_t b, const void *body, const uint64_t len) {
+    mp_resp resp;
+    if (test_send(fd, op, name, a, b, len, 0) < 0 ||
+        mp_stream_write(fd, body, len) < 0 || test_recv(fd, &resp) < 0)
+        return -1000;
+    return resp.len ? -1000 : resp.status;
+}
+
+static int64_t
+test_value(const uint64_t x, const uint64_t y) {
+    return (int64_t) (x * 7919 + y * 104729) - 5000000;
+}
+
+/**
+ * Value of (x, y) after GET_ELEMS, or INT64_MIN on failure.
+ */
+static int64_t
+test_get(const int32_t fd, const char *name, const uint64_t x, const uint64_t y) {
+    const uint64_t body[2] = {x, y};
+    mp_resp resp;
+    int64_t v;
+
+    if (test_send(fd, MP_OP_GET_ELEMS, name, 0, 0, sizeof(body), 0) < 0 ||
+        mp_stream_write(fd, (const uint8_t *) body, sizeof(body)) < 0 ||
+        test_recv(fd, &resp) < 0 || resp.status || resp.len != sizeof(v) ||
+        mp_stream_read(fd, (uint8_t *) &v, sizeof(v)) < 0)
+        return INT64_MIN;
+    return v;
+}
+
+
+/* ============================================================================
+ *  Cases
+ * ============================================================================
+ */
+
+/**
+ * CREATE a matrix and set every element through PUT_ELEMS.
+ */
+static void
+test_fill(const int32_t fd, const char *name) {
+    TEST_CHECK(test_call(fd, MP_OP_CREATE, name, TEST_COLS, TEST_ROWS, NULL, 0) == 0,
+               "CREATE %s failed", name);
+
+    uint64_t *body = malloc(TEST_COLS * 3 * sizeof(uint64_t));
+    if (!body) return;
+
+    for (uint64_t y = 0; y < TEST_ROWS; y++) {
+        for (uint64_t x = 0; x < TEST_COLS; x++) {
+            body[3 * x] = x;
+            body[3 * x + 1] = y;
+            body[3 * x + 2] = (uint64_t) test_value(x, y);
+        }
+        const int32_t st = test_call(fd, MP_OP_PUT_ELEMS, name, 0, 0, body, TEST_COLS * 3 * sizeof(uint64_t));
+        TEST_CHECK(st == 0, "PUT_ELEMS row %lu: %d", y, st);
+    }
+    free(body);
+
+    TEST_CHECK(test_get(fd, name, TEST_COLS - 1, TEST_ROWS - 1) == test_value(TEST_COLS - 1, TEST_ROWS - 1),
+               "GET_ELEMS of the last element");
+}
+
+/**
+ * RECV_MATRIX a local matrix, SEND_MATRIX it back and compare.
+ */
+static void
+test_stream(const int32_t fd, mp_pool *pool, const uint16_t flags) {
+    mp_matrix src, back;
+    mp_matrix_init(&src, pool);
+    mp_matrix_init(&back, pool);
+    mp_matrix_set_size(&src, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    /* one absent chunk, one low-entropy chunk for the codec */
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            if (x >= CHUNK_W || y < CHUNK_H)
+                mp_matrix_put(&src, x, y, x < CHUNK_W ? (int64_t) (x + y) : test_value(x, y));
+
+    mp_resp resp;
+    int32_t ret = test_send(fd, MP_OP_RECV_MATRIX, "stream", 0, 0, mp_stream_bytes(&src), 0);
+    if (ret == 0) ret = mp_stream_send(&src, fd);
+    if (ret == 0) ret = test_recv(fd, &resp);
+    TEST_CHECK(ret == 0 && resp.status == 0, "RECV_MATRIX failed");
+
+    ret = test_send(fd, MP_OP_SEND_MATRIX, "stream", 0, 0, 0, flags);
+    if (ret == 0) ret = test_recv(fd, &resp);
+    if (ret == 0 && resp.status == 0) ret = mp_stream_recv(&back, fd);
+    TEST_CHECK(ret == 0 && resp.status == 0, "SEND_MATRIX (flags %u) failed", flags);
+
+    uint64_t wrong = back.size.x != TEST_COLS || back.size.y != TEST_ROWS ||
+                     back.tree.count != src.tree.count;
+    for (uint64_t y = 0; ret == 0 && y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            wrong += mp_matrix_get(&back, x, y) != mp_matrix_get(&src, x, y);
+    TEST_CHECK(wrong == 0, "SEND_MATRIX (flags %u): %lu wrong elements", flags, wrong);
+
+    mp_matrix_free(&src);
+    mp_matrix_free(&back);
+}
+
+/**
+ * A stalled and then abandoned PUT_CHUNK never shows through.
+ */
+static void
+test_torn(const int32_t fd, const char *path, const char *name) {
+    const mp_copos opos = {.dim = {1, 0}};
+    const mp_csize size = {.dim = {TEST_COLS - CHUNK_W - 1, CHUNK_H - 1}};
+    const uint64_t len = mp_stream_payload(size);
+
+    int64_t *payload = malloc(len);
+    if (!payload) return;
+    for (uint64_t i = 0; i < len / sizeof(int64_t); i++) payload[i] = -1;
+
+    const int32_t up = test_connect(path);
+    TEST_CHECK(up >= 0, "second connection failed");
+    if (up < 0) {
+        free(payload);
+        return;
+    }
+
+    /* half of the payload, then the uploader stalls */
+    int32_t ret = test_send(up, MP_OP_PUT_CHUNK, name, opos.pos, size.size, len, 0);
+    if (ret == 0) ret = mp_stream_write(up, (const uint8_t *) payload, len / 2);
+    TEST_CHECK(ret == 0, "partial PUT_CHUNK failed");
+
+    /* give the server time to consume the half payload */
+    usleep(100000);
+    const uint64_t x = CHUNK_W + 3, y = 5;
+    TEST_CHECK(test_get(fd, name, x, y) == test_value(x, y), "stalled PUT_CHUNK is visible");
+
+    close(up);
+    TEST_CHECK(test_get(fd, name, x, y) == test_value(x, y), "abandoned PUT_CHUNK is visible");
+
+    /* a complete upload replaces the chunk */
+    ret = test_call(fd, MP_OP_PUT_CHUNK, name, opos.pos, size.size, payload, len);
+    TEST_CHECK(ret == 0 && test_get(fd, name, x, y) == -1, "complete PUT_CHUNK failed");
+    free(payload);
+}
+
+/**
+ * KERNEL "add" of a matrix to itself, then DROP.
+ */
+static void
+test_kernel(const int32_t fd, const char *name) {
+    char body[64];
+    const uint64_t len = (uint64_t) snprintf(body, sizeof(body), "add%c%s", '\0', name) + 1;
+
+    TEST_CHECK(test_call(fd, MP_OP_KERNEL, name, 0, 1, body, len) == 0, "KERNEL add failed");
+    TEST_CHECK(test_get(fd, name, 10, CHUNK_H + 1) == 2 * test_value(10, CHUNK_H + 1), "KERNEL add result");
+
+    TEST_CHECK(test_call(fd, MP_OP_DROP, name, 0, 0, NULL, 0) == 0, "DROP failed");
+    TEST_CHECK(test_call(fd, MP_OP_DROP, name, 0, 0, NULL, 0) == -ENOENT, "DROP of a dropped matrix");
+}
+
+/**
+ * CREATE and RECV_MATRIX with unaddressable sizes fail with -EINVAL.
+ */
+static void
+test_size(const int32_t fd) {
+    const uint64_t huge = (uint64_t) UINT32_MAX << CHUNK_POW;
+
+    TEST_CHECK(test_call(fd, MP_OP_CREATE, "huge", 1ull << 41, 16, NULL, 0) == -EINVAL,
+               "CREATE of 2^41 columns");
+    TEST_CHECK(test_call(fd, MP_OP_CREATE, "huge", 16, huge, NULL, 0) == -EINVAL,
+               "CREATE of 2^32 chunk rows");
+    TEST_CHECK(test_call(fd, MP_OP_CREATE, "huge", huge - 1, 16, NULL, 0) == 0,
+               "CREATE of 2^32 - 1 chunk columns");
+
+    /* a header frame that does not fit, followed by the END frame */
+    uint8_t body[2 * STREAM_FRAME];
+    mp_stream_pack(body, huge, huge);
+    mp_stream_pack(body + STREAM_FRAME, MP_STREAM_END, 0);
+    TEST_CHECK(test_call(fd, MP_OP_RECV_MATRIX, "huge", 0, 0, body, sizeof(body)) == -EINVAL,
+               "RECV_MATRIX of 2^32 chunk rows");
+
+    TEST_CHECK(test_call(fd, MP_OP_DROP, "huge", 0, 0, NULL, 0) == 0, "DROP huge failed");
+}
+
+
+/* ============================================================================
+ *  Server process
+ * ============================================================================
+ */
+
+/**
+ * Fork a server listening on path; it runs until killed.
+ */
+static pid_t
+test_serve(const char *path) {
+    int32_t ready[2];
+    if (pipe(ready) == -1) return -1;
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        close(ready[0]);
+
+        mp_pool pool;
+        mp_pool_init(&pool);
+
+        mp_server srv;
+        const uint8_t ok = mp_server_init(&srv, &pool) == 0 && mp_server_listen_unix(&srv, path) == 0;
+        if (write(ready[1], &ok, 1) != 1 || !ok) _exit(EXIT_FAILURE);
+        close(ready[1]);
+
+        _exit(mp_server_run(&srv) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    /* wait until the socket is listening */
+    uint8_t ok = 0;
+    close(ready[1]);
+    if (pid > 0 && (read(ready[0], &ok, 1) != 1 || !ok)) {
+        waitpid(pid, NULL, 0);
+        ok = 0;
+    }
+    close(ready[0]);
+    return ok ? pid : -1;
+}
+
+int
+main(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mp_test_server.%d", getpid());
+    signal(SIGPIPE, SIG_IGN);
+
+    const pid_t server = test_serve(path);
+    const int32_t fd = server > 0 ? test_connect(path) : -1;
+    if (fd < 0) {
+        fprintf(stderr, "test_server: cannot start the server\n");
+        if (server > 0) kill(server, SIGKILL);
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    mp_pool local;
+    mp_pool_init(&local);
+
+    test_fill(fd, "m");
+    test_stream(fd, &local, 0);
+    test_stream(fd, &local, MP_FLAG_PACKED);
+    test_torn(fd, path, "m");
+    test_kernel(fd, "m");
+    test_size(fd);
+    close(fd);
+
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    unlink(path);
+
+    printf("test_server: %u failures\n", failures);
+
+    mp_pool_free(&local);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_snap.c
+ *  Description:  Snapshots of a matrix modified while they are written (mp_snap.h).
+ *
+ *  Right after mp_snap_start() the owner rewrites every element, drops
+ *  one chunk and fills a hole, racing the writer thread:
+ *
+ *   - the snapshot file holds the version frozen at the start, the
+ *     hole stays a hole
+ *   - the live matrix holds the new version
+ *   - a second snapshot of the same matrix holds the new version
+ *   - a matrix runs one snapshot at a time
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mp_file.h"
+#include "mp_snap.h"
+
+
+/** 3 x 3 chunks, clipped; chunk (2, 2) starts as a hole */
+#define TEST_COLS (2 * CHUNK_W + 40)
+#define TEST_ROWS (2 * CHUNK_H + 9)
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+static int32_t
+test_hole(const uint64_t x, const uint64_t y) {
+    return x >= 2 * CHUNK_W && y >= 2 * CHUNK_H;
+}
+
+static int32_t
+test_dropped(const uint64_t x, const uint64_t y) {
+    return x < CHUNK_W && y >= CHUNK_H && y < 2 * CHUNK_H;
+}
+
+/** Version frozen by the first snapshot */
+static int64_t
+test_old(const uint64_t x, const uint64_t y) {
+    return test_hole(x, y) ? 0 : (int64_t) (y * 1000003 + x) + 1;
+}
+
+/** Version written while the first snapshot runs */
+static int64_t
+test_new(const uint64_t x, const uint64_t y) {
+    return test_dropped(x, y) ? 0 : -(int64_t) (y * 1000003 + x) - 1;
+}
+
+/**
+ * Load the snapshot file at path and count the elements that differ from value().
+ */
+static uint64_t
+test_load(mp_pool *pool, const char *path, int64_t (*value)(uint64_t, uint64_t)) {
+    mp_matrix got;
+    mp_matrix_init(&got, pool);
+
+    uint64_t wrong = 1;
+    if (mp_matrix_set_file_mode(&got, path, MP_MATRIX_TILED) == 0 && mp_file_load(&got) == 0 &&
+        got.size.x == TEST_COLS && got.size.y == TEST_ROWS) {
+        wrong = 0;
+        for (uint64_t y = 0; y < TEST_ROWS; y++)
+            for (uint64_t x = 0; x < TEST_COLS; x++) wrong += mp_matrix_get(&got, x, y) != value(x, y);
+    }
+
+    mp_matrix_free(&got);
+    if (got.fd != -1) close(got.fd);
+    return wrong;
+}
+
+int
+main(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mp_test_snap.%d", getpid());
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix matx;
+    mp_matrix_init(&matx, &pool);
+    mp_matrix_set_size(&matx, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            if (!test_hole(x, y)) mp_matrix_put(&matx, x, y, test_old(x, y));
+
+    /* ---- modified while written ---- */
+    mp_snap snap, other;
+    if (mp_snap_start(&snap, &matx, path) < 0) {
+        fprintf(stderr, "test_snap: cannot start the snapshot\n");
+        return EXIT_FAILURE;
+    }
+    TEST_CHECK(mp_snap_start(&other, &matx, path) < 0, "second snapshot started on the same matrix");
+
+    mp_matrix_chunk_drop(&matx, (mp_copos){.dim = {0, 1}});
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            if (!test_dropped(x, y)) mp_matrix_put(&matx, x, y, test_new(x, y));
+
+    const uint64_t frozen = snap.count;
+    TEST_CHECK(mp_snap_wait(&snap) == 0, "snapshot failed");
+    TEST_CHECK(snap.written == frozen && frozen == 8, "%lu of %lu chunks written, expected 8", snap.written, frozen);
+
+    uint64_t wrong = test_load(&pool, path, test_old);
+    TEST_CHECK(wrong == 0, "first snapshot: %lu wrong elements", wrong);
+    printf("test_snap: first  %lu chunks, %lu wrong elements\n", frozen, wrong);
+
+    wrong = 0;
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++) wrong += mp_matrix_get(&matx, x, y) != test_new(x, y);
+    TEST_CHECK(wrong == 0, "live matrix: %lu wrong elements", wrong);
+
+    /* ---- the new version ---- */
+    TEST_CHECK(mp_snap_start(&snap, &matx, path) == 0 && mp_snap_wait(&snap) == 0, "second snapshot failed");
+    wrong = test_load(&pool, path, test_new);
+    TEST_CHECK(wrong == 0, "second snapshot: %lu wrong elements", wrong);
+    printf("test_snap: second %lu chunks, %lu wrong elements\n", snap.count, wrong);
+
+    mp_matrix_free(&matx);
+    mp_pool_free(&pool);
+    unlink(path);
+
+    printf("test_snap: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_stage.c
+ *  Description:  Staged insertion against a naive reference (mp_stage.h).
+ *
+ *  Workers of a scheduler stage pseudo-random entries (MP_STAGE_ADD)
+ *  into a matrix that already holds data, so the same chunk is staged
+ *  by several workers and exists in the matrix too:
+ *
+ *   - round 1 merges with mp_stage_merge(), round 2 reuses the staging
+ *     area and merges with mp_stage_merge_par(); after each every
+ *     element must equal the same additions done into a flat array
+ *   - MP_STAGE_REPLACE: of a chunk staged by every worker, the one of
+ *     the highest worker id replaces the matrix chunk
+ *
+ *  Notes:
+ *   - Meant to run under ThreadSanitizer too (-DMP_SANITIZE=thread)
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mp_stage.h"
+
+
+/** Matrix size: 4 x 3 chunks, clipped on the right and bottom border */
+#define TEST_COLS (4 * CHUNK_W - 21)
+#define TEST_ROWS (3 * CHUNK_H - 40)
+
+/** Entries per round */
+#define TEST_PUTS 200000
+
+#define TEST_WORKERS 4
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+typedef struct test_round {
+    mp_stage *stage;
+    uint32_t round;
+    uint32_t failed;  /**< mp_stage_put() errors */
+} test_round;
+
+static uint64_t
+test_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Entry i of a round: anywhere in the matrix but chunk (3, 2), which
+ * stays absent.
+ */
+static void
+test_entry(const uint32_t round, const uint64_t i, uint64_t *x, uint64_t *y, int64_t *v) {
+    const uint64_t h = test_mix(i * 0x9e3779b97f4a7c15ull + round);
+
+    *x = (h >> 8) % TEST_COLS;
+    *y = (h >> 32) % TEST_ROWS;
+    if (*x >= 3 * CHUNK_W && *y >= 2 * CHUNK_H) *y -= CHUNK_H;
+    *v = (int64_t) (h >> 48) - 32768;
+}
+
+static void
+test_put(void *arg, const uint64_t lo, const uint64_t hi, const uint32_t worker) {
+    test_round *r = arg;
+
+    for (uint64_t i = lo; i < hi; i++) {
+        uint64_t x, y;
+        int64_t v;
+        test_entry(r->round, i, &x, &y, &v);
+        if (mp_stage_put(r->stage, worker, x, y, v) < 0) __atomic_fetch_add(&r->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static uint64_t
+test_compare(mp_matrix *matx, const int64_t *ref) {
+    uint64_t wrong = 0;
+
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++) wrong += mp_matrix_get(matx, x, y) != ref[y * TEST_COLS + x];
+    return wrong;
+}
+
+static void
+test_add(mp_stage *stage, mp_sched *sched, int64_t *ref, const uint32_t round) {
+    test_round r = {stage, round, 0};
+
+    mp_sched_for(sched, TEST_PUTS, 0, test_put, &r);
+    const int32_t ret = round == 1 ? mp_stage_merge(stage) : mp_stage_merge_par(stage, sched);
+    TEST_CHECK(r.failed == 0 && ret == 0, "round %u: %u puts failed, merge returned %d", round, r.failed, ret);
+
+    for (uint64_t i = 0; i < TEST_PUTS; i++) {
+        uint64_t x, y;
+        int64_t v;
+        test_entry(round, i, &x, &y, &v);
+        ref[y * TEST_COLS + x] += v;
+    }
+
+    const uint64_t wrong = test_compare(stage->matx, ref);
+    TEST_CHECK(wrong == 0, "round %u: %lu wrong elements", round, wrong);
+    TEST_CHECK(stage->matx->tree.count == 11, "round %u: %lu chunks, expected 11", round, stage->matx->tree.count);
+
+    printf("test_stage: add     round %u, %lu chunks, %lu wrong elements\n",
+           round, stage->matx->tree.count, wrong);
+}
+
+static void
+test_replace(mp_matrix *matx, int64_t *ref) {
+    mp_stage stage;
+    if (mp_stage_init(&stage, matx, TEST_WORKERS, MP_STAGE_REPLACE) < 0) {
+        TEST_CHECK(0, "replace: cannot init the staging area");
+        return;
+    }
+
+    /* every worker stages chunk (1, 1), one after the other */
+    const uint64_t x0 = CHUNK_W, y0 = CHUNK_H;
+    for (uint32_t w = 0; w < TEST_WORKERS; w++)
+        TEST_CHECK(mp_stage_put(&stage, w, x0 + w, y0 + 1, (int64_t) w + 100) == 0, "replace: put %u failed", w);
+
+    TEST_CHECK(mp_stage_merge(&stage) == 0, "replace: merge failed");
+    mp_stage_free(&stage);
+
+    /* the chunk of the last worker, all other elements zero */
+    for (uint64_t y = y0; y < y0 + CHUNK_H; y++)
+        for (uint64_t x = x0; x < x0 + CHUNK_W; x++) ref[y * TEST_COLS + x] = 0;
+    ref[(y0 + 1) * TEST_COLS + x0 + TEST_WORKERS - 1] = TEST_WORKERS - 1 + 100;
+
+    const uint64_t wrong = test_compare(matx, ref);
+    TEST_CHECK(wrong == 0, "replace: %lu wrong elements", wrong);
+    printf("test_stage: replace %lu chunks, %lu wrong elements\n", matx->tree.count, wrong);
+}
+
+int
+main(void) {
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    mp_matrix matx;
+    mp_matrix_init(&matx, &pool);
+    mp_matrix_set_size(&matx, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    int64_t *ref = calloc((uint64_t) TEST_COLS * TEST_ROWS, sizeof(int64_t));
+    mp_sched sched;
+    mp_stage stage;
+
+    if (!ref || mp_sched_init(&sched, TEST_WORKERS, 0) < 0 ||
+        mp_stage_init(&stage, &matx, sched.workers, MP_STAGE_ADD) < 0) {
+        fprintf(stderr, "test_stage: setup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    /* existing data in the left half */
+    for (uint64_t y = 0; y < TEST_ROWS; y += 3)
+        for (uint64_t x = 0; x < TEST_COLS / 2; x += 5) {
+            mp_matrix_put(&matx, x, y, (int64_t) (x * 31 + y));
+            ref[y * TEST_COLS + x] = (int64_t) (x * 31 + y);
+        }
+
+    test_add(&stage, &sched, ref, 1);
+    test_add(&stage, &sched, ref, 2);
+    mp_stage_free(&stage);
+
+    test_replace(&matx, ref);
+
+    mp_sched_free(&sched);
+    mp_matrix_free(&matx);
+    mp_pool_free(&pool);
+    free(ref);
+
+    printf("test_stage: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/**
+ * ============================================================================
+ *  Project:      QDeep / MatrixP
+ *  File:         tests/test_sync.c
+ *  Description:  Incremental syncs to a tiled file and to a delta log (mp_sync.h).
+ *
+ *  A matrix is synced, modified (chunks rewritten, dropped, created)
+ *  and synced again:
+ *
+ *   - tiled file: the first sync writes every chunk, later ones only the
+ *     dirty ones, and the file always loads back equal to the matrix
+ *   - delta log: replaying all segments into an empty matrix rebuilds
+ *     it, a resize included
+ *   - torn log: a segment without its END frame is rejected, the
+ *     segments before it stay applied
+ *
+ *  Copyright:
+ *      (c) 2025 QDeep.Net
+ * ============================================================================
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mp_file.h"
+#include "mp_stream.h"
+#include "mp_sync.h"
+
+
+/** 3 x 3 chunks, clipped; chunk (2, 2) starts as a hole */
+#define TEST_COLS (2 * CHUNK_W + 60)
+#define TEST_ROWS (2 * CHUNK_H + 11)
+
+static uint32_t failures;
+
+#define TEST_CHECK(cond, ...) do {          \
+    if (!(cond)) {                          \
+        fprintf(stderr, __VA_ARGS__);       \
+        fprintf(stderr, "\n");              \
+        failures++;                         \
+    }                                       \
+} while (0)
+
+
+static void
+test_fill(mp_matrix *matx) {
+    mp_matrix_set_size(matx, (mp_msize){TEST_COLS, TEST_ROWS});
+
+    for (uint64_t y = 0; y < TEST_ROWS; y++)
+        for (uint64_t x = 0; x < TEST_COLS; x++)
+            if (x < 2 * CHUNK_W || y < 2 * CHUNK_H) mp_matrix_put(matx, x, y, (int64_t) (y * 65537 + x) + 1);
+}
+
+/**
+ * Rewrite two chunks and drop a third one.
+ */
+static void
+test_modify(mp_matrix *matx, const int64_t value) {
+    mp_matrix_put(matx, 3, 4, value);
+    mp_matrix_put(matx, 2 * CHUNK_W + 7, CHUNK_H + 8, value);
+    mp_matrix_chunk_drop(matx, (mp_copos){.dim = {1, 1}});
+}
+
+static uint64_t
+test_compare(mp_matrix *got, mp_matrix *want) {
+    if (got->size.x != want->size.x || got->size.y != want->size.y) return 1;
+
+    uint64_t wrong = 0;
+    for (uint64_t y = 0; y < want->size.y; y++)
+        for (uint64_t x = 0; x < want->size.x; x++) wrong += mp_matrix_get(got, x, y) != mp_matrix_get(want, x, y);
+    return wrong;
+}
+
+/**
+ * Load the tiled file at path and compare it with want.
+ */
+static uint64_t
+test_load(const char *path, mp_matrix *want) {
+    mp_matrix got;
+    mp_matrix_init(&got, want->pool);
+
+    uint64_t wrong = 1;
+    if (mp_matrix_set_file_mode(&got, path, MP_MATRIX_TILED) == 0 && mp_file_load(&got) == 0)
+        wrong = test_compare(&got, want);
+
+    mp_matrix_free(&got);
+    if (got.fd != -1) close(got.fd);
+    return wrong;
+}
+
+static void
+test_tiled(mp_pool *pool, const char *path) {
+    mp_matrix matx;
+    mp_matrix_init(&matx, pool);
+    test_fill(&matx);
+
+    const int32_t fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_CHECK(fd != -1, "tiled: cannot open %s", path);
+    if (fd == -1) return;
+
+    static const char *const steps[] = {"full", "clean", "modified", "created"};
+    static const int64_t want[] = {8, 0, 2, 1};
+
+    for (uint32_t i = 0; i < 4; i++) {
+        if (i == 2) test_modify(&matx, -5);
+        if (i == 3) mp_matrix_put(&matx, TEST_COLS - 1, TEST_ROWS - 1, -6);
+
+        const int64_t written = mp_matrix_sync_dirty(&matx, fd);
+        const uint64_t wrong = test_load(path, &matx);
+        TEST_CHECK(written == want[i], "tiled %s: %ld tiles written, expected %ld", steps[i], written, want[i]);
+        TEST_CHECK(wrong == 0, "tiled %s: %lu wrong elements", steps[i], wrong);
+
+        printf("test_sync: tiled %-8s %ld tiles, %lu wrong elements\n", steps[i], written, wrong);
+    }
+
+    close(fd);
+    mp_matrix_free(&matx);
+}
+
+static void
+test_log(mp_pool *pool, const char *path) {
+    mp_matrix matx, got, torn;
+    mp_matrix_init(&matx, pool);
+    mp_matrix_init(&got, pool);
+    mp_matrix_init(&torn, pool);
+    test_fill(&matx);
+
+    const int32_t fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    TEST_CHECK(fd != -1, "log: cannot open %s", path);
+    if (fd == -1) return;
+
+    TEST_CHECK(mp_matrix_sync_log(&matx, fd) == 8, "log: first segment is not full");
+    test_modify(&matx, -7);
+    TEST_CHECK(mp_matrix_sync_log(&matx, fd) == 2, "log: second segment is not a delta");
+
+    /* the size a replay that stops before the third segment leaves */
+    const mp_msize before = matx.size;
+
+    mp_matrix_set_size(&matx, (mp_msize){TEST_COLS + CHUNK_W, TEST_ROWS});
+    mp_matrix_put(&matx, TEST_COLS + 5, 9, -8);
+    TEST_CHECK(mp_matrix_sync_log(&matx, fd) >= 1, "log: third segment failed");
+
+    lseek(fd, 0, SEEK_SET);
+    const int64_t segments = mp_matrix_log_replay(&got, fd);
+    const uint64_t wrong = test_compare(&got, &matx);
+    TEST_CHECK(segments == 3, "log: %ld segments replayed, expected 3", segments);
+    TEST_CHECK(wrong == 0, "log: %lu wrong elements", wrong);
+    printf("test_sync: log   %ld segments, %lu wrong elements\n", segments, wrong);
+
+    TEST_CHECK(ftruncate(fd, lseek(fd, 0, SEEK_END) - STREAM_FRAME / 2) == 0, "log: cannot truncate");
+    lseek(fd, 0, SEEK_SET);
+    TEST_CHECK(mp_matrix_log_replay(&torn, fd) == -1, "log: torn segment accepted");
+    TEST_CHECK(torn.size.x == before.x && torn.size.y == before.y && torn.tree.count == 7,
+               "log: segments before the torn one were not applied");
+
+    close(fd);
+    mp_matrix_free(&matx);
+    mp_matrix_free(&got);
+    mp_matrix_free(&torn);
+}
+
+int
+main(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mp_test_sync.%d", getpid());
+
+    mp_pool pool;
+    mp_pool_init(&pool);
+
+    test_tiled(&pool, path);
+    test_log(&pool, path);
+
+    mp_pool_free(&pool);
+    unlink(path);
+
+    printf("test_sync: %u failures\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}